@@ -39,6 +39,30 @@ struct AbstractDir_
     Item *listpos;
 };
 
+/* Every entry of a remote directory gets statted as it is read (see
+ * ConsiderAbstractFile), so ask the server for all of them at once */
+static void PrefetchRemoteStats(const char *dirname, const Item *list, FileCopy fc, AgentConnection *conn)
+{
+    Seq *files = SeqNew(100, free);
+    char path[CF_BUFSIZE];
+
+    for (const Item *ip = list; ip != NULL; ip = ip->next)
+    {
+        const struct dirent *dirp = (const struct dirent *) ip->name;
+
+        snprintf(path, sizeof(path), "%s/%s", dirname, dirp->d_name);
+        MapName(path);
+        SeqAppend(files, xstrdup(path));
+    }
+
+    if (SeqLength(files) > 1 && RemoteStatPrefetch(files, fc.encrypt, conn) == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Failed to stat the contents of remote directory '%s'", dirname);
+    }
+
+    SeqDestroy(files);
+}
+
 AbstractDir *AbstractDirOpen(const char *dirname, FileCopy fc, AgentConnection *conn)
 {
     AbstractDir *d = xcalloc(1, sizeof(AbstractDir));
@@ -60,6 +84,8 @@ AbstractDir *AbstractDirOpen(const char *dirname, FileCopy fc, AgentConnection *
             return NULL;
         }
         d->listpos = d->list;
+
+        PrefetchRemoteStats(dirname, d->list, fc, conn);
     }
     return d;
 }
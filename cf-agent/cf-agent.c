@@ -58,6 +58,7 @@
 #include <unix.h>
 #include <attributes.h>
 #include <communication.h>
+#include <client_code.h>
 #include <signals.h>
 #include <nfs.h>
 #include <processes_select.h>
@@ -72,6 +73,8 @@
 #include <bootstrap.h>
 #include <misc_lib.h>
 #include <buffer.h>
+#include <regex_cache.h>
+#include <profiler.h>
 
 #include <mod_common.h>
 
@@ -120,6 +123,8 @@ static int CFA_BACKGROUND_LIMIT = 1;
 
 static Item *PROCESSREFRESH;
 
+static char *PROFILE_PATH_PREFIX = NULL; /* set by --profile, empty for the default */
+
 static const char *AGENT_TYPESEQUENCE[] =
 {
     "meta",
@@ -162,6 +167,7 @@ static void KeepPromiseBundles(EvalContext *ctx, Policy *policy, GenericAgentCon
 static void KeepPromises(EvalContext *ctx, Policy *policy, GenericAgentConfig *config);
 static int NoteBundleCompliance(const Bundle *bundle, int save_pr_kept, int save_pr_repaired, int save_pr_notkept);
 static void AllClassesReport(const EvalContext *ctx);
+static void WriteProfile(void);
 static bool HasAvahiSupport(void);
 static int AutomaticBootstrap(GenericAgentConfig *config);
 
@@ -195,6 +201,8 @@ static const struct option OPTIONS[] =
     {"legacy-output", no_argument, 0, 'l'},
     {"color", optional_argument, 0, 'C'},
     {"no-extensions", no_argument, 0, 'E'},
+    {"log-modules", required_argument, 0, 'g'},
+    {"profile", optional_argument, 0, 'P'},
     {NULL, 0, 0, '\0'}
 };
 
@@ -216,6 +224,8 @@ static const char *HINTS[] =
     "Use legacy output format",
     "Enable colorized output. Possible values: 'always', 'auto', 'never'. If option is used, the default value is 'auto'",
     "Disable extension loading (used while upgrading)",
+    "Enable debug logging of specific areas of the implementation, comma separated: all, net, expand",
+    "Write the time spent in each bundle, promise and function to WORKDIR/state/cf_agent_profile.json and .folded, or to the given path prefix",
     NULL
 };
 
@@ -251,7 +261,14 @@ int main(int argc, char *argv[])
 
     ThisAgentInit();
     BeginAudit();
+    ConnectionsInit();
     KeepPromises(ctx, policy, config);
+    ConnectionsCleanup();
+
+    if (PROFILE_PATH_PREFIX)
+    {
+        WriteProfile();
+    }
 
     if (ALLCLASSESREPORT)
     {
@@ -276,6 +293,20 @@ int main(int argc, char *argv[])
         ret = 1;
     }
 
+    {
+        RegexCacheStats regex_stats = RegexCacheGetStats();
+        Log(LOG_LEVEL_VERBOSE, "Regular expression cache: %lu hits, %lu misses, %lu evictions",
+            regex_stats.hits, regex_stats.misses, regex_stats.evictions);
+    }
+
+    {
+        ConnectionStats connection_stats = ConnectionsGetStats();
+        Log(LOG_LEVEL_VERBOSE, "Server connections: %lu opened, %lu reused, "
+            "%lu requests pipelined saving %lu round trips",
+            connection_stats.opened, connection_stats.reused,
+            connection_stats.pipelined, connection_stats.round_trips_saved);
+    }
+
     EndAudit(ctx, CFA_BACKGROUND);
     EvalContextDestroy(ctx);
     GenericAgentConfigDestroy(config);
@@ -308,7 +339,7 @@ static GenericAgentConfig *CheckOpts(EvalContext *ctx, int argc, char **argv)
     char **argv_new = TranslateOldBootstrapOptionsConcatenated(argc_new, argv_tmp);
     FreeStringArray(argc_new, argv_tmp);
 
-    while ((c = getopt_long(argc_new, argv_new, "dvnKIf:D:N:VxMB:b:hlC::E", OPTIONS, NULL)) != EOF)
+    while ((c = getopt_long(argc_new, argv_new, "dvnKIf:D:N:VxMB:b:hlC::EP::", OPTIONS, NULL)) != EOF)
     {
         switch ((char) c)
         {
@@ -340,6 +371,16 @@ static GenericAgentConfig *CheckOpts(EvalContext *ctx, int argc, char **argv)
             LogSetGlobalLevel(LOG_LEVEL_DEBUG);
             break;
 
+        case 'g':
+            LogEnableModulesFromString(optarg);
+            break;
+
+        case 'P':
+            free(PROFILE_PATH_PREFIX);
+            PROFILE_PATH_PREFIX = xstrdup(optarg ? optarg : "");
+            ProfilerEnable();
+            break;
+
         case 'B':
             {
                 if (!BootstrapAllowed())
@@ -1181,6 +1222,30 @@ static void AllClassesReport(const EvalContext *ctx)
     }
 }
 
+static void WriteProfile(void)
+{
+    char path_prefix[CF_BUFSIZE + sizeof("/state/cf_agent_profile")];
+
+    if (PROFILE_PATH_PREFIX[0] == '\0')
+    {
+        snprintf(path_prefix, sizeof(path_prefix), "%s/state/cf_agent_profile", CFWORKDIR);
+        MapName(path_prefix);
+    }
+    else
+    {
+        strlcpy(path_prefix, PROFILE_PATH_PREFIX, sizeof(path_prefix));
+    }
+
+    if (ProfilerWrite(path_prefix))
+    {
+        Log(LOG_LEVEL_INFO, "Wrote profile to '%s.json' and '%s.folded'", path_prefix, path_prefix);
+    }
+
+    ProfilerReset();
+    free(PROFILE_PATH_PREFIX);
+    PROFILE_PATH_PREFIX = NULL;
+}
+
 int ScheduleAgentOperations(EvalContext *ctx, Bundle *bp)
 // NB - this function can be called recursively through "methods"
 {
@@ -1190,10 +1255,11 @@ int ScheduleAgentOperations(EvalContext *ctx, Bundle *bp)
 
     if (PROCESSREFRESH == NULL || (PROCESSREFRESH && IsRegexItemIn(ctx, PROCESSREFRESH, bp->name)))
     {
-        DeleteItemList(PROCESSTABLE);
-        PROCESSTABLE = NULL;
+        ClearProcessTable();
     }
 
+    ProfilerEnterBundle(bp);
+
     for (int pass = 1; pass < CF_DONEPASSES; pass++)
     {
         for (TypeSequence type = 0; AGENT_TYPESEQUENCE[type] != NULL; type++)
@@ -1214,6 +1280,8 @@ int ScheduleAgentOperations(EvalContext *ctx, Bundle *bp)
                 continue;
             }
 
+            ProfilerEnter(PROFILE_FRAME_PROMISE_TYPE, sp->name);
+
             for (size_t ppi = 0; ppi < SeqLength(sp->promises); ppi++)
             {
                 Promise *pp = SeqAt(sp->promises, ppi);
@@ -1224,15 +1292,19 @@ int ScheduleAgentOperations(EvalContext *ctx, Bundle *bp)
                 {
                     //NoteClassUsage(EvalContextStackFrameIteratorSoft(ctx) , false);
                     DeleteTypeContext(ctx, bp, type);
+                    ProfilerLeave();
+                    ProfilerLeave();
                     NoteBundleCompliance(bp, save_pr_kept, save_pr_repaired, save_pr_notkept);
                     return false;
                 }
             }
 
             DeleteTypeContext(ctx, bp, type);
+            ProfilerLeave();
         }
     }
 
+    ProfilerLeave();
 
     //NoteClassUsage(EvalContextStackFrameIteratorSoft(ctx) , false);
 
@@ -1520,11 +1592,6 @@ static int NewTypeContext(EvalContext *ctx, TypeSequence type)
         NewEnvironmentsContext();
         break;
 
-    case TYPE_SEQUENCE_FILES:
-
-        ConnectionsInit();
-        break;
-
     case TYPE_SEQUENCE_PROCESSES:
 
         if (!LoadProcessTable(ctx, &PROCESSTABLE))
@@ -1570,7 +1637,8 @@ static void DeleteTypeContext(EvalContext *ctx, Bundle *bp, TypeSequence type)
 
     case TYPE_SEQUENCE_FILES:
 
-        ConnectionsCleanup();
+        /* Connections stay open for the rest of the run */
+        ConnectionsFlushCache();
         break;
 
     case TYPE_SEQUENCE_PROCESSES:
@@ -1728,8 +1796,7 @@ static bool VerifyBootstrap(EvalContext *ctx)
     }
 
     // embedded failsafe.cf (bootstrap.c) contains a promise to start cf-execd (executed while running this cf-agent)
-    DeleteItemList(PROCESSTABLE);
-    PROCESSTABLE = NULL;
+    ClearProcessTable();
     LoadProcessTable(ctx, &PROCESSTABLE);
 
     if (!IsProcessNameRunning(ctx, ".*cf-execd.*"))
@@ -0,0 +1,416 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <dir_scan.h>
+
+#include <dir.h>
+#include <map.h>
+#include <string_lib.h>
+#include <logging.h>
+
+typedef enum
+{
+    DIR_SCAN_PENDING,
+    DIR_SCAN_RUNNING,
+    DIR_SCAN_DONE
+} DirScanState;
+
+typedef struct
+{
+    char *path;
+    DirScanState state;
+    bool cancelled;
+    Seq *entries;               /* NULL if path could not be read */
+    int error;
+    struct stat sb;             /* of path while it was read */
+    bool stable;                /* path named the same directory throughout */
+} DirScanJob;
+
+struct DirScanner_
+{
+    pthread_mutex_t lock;
+    pthread_cond_t job_added;
+    pthread_cond_t job_done;
+    Seq *pending;               /* of DirScanJob, taken from the end */
+    Map *jobs;                  /* path -> DirScanJob, until taken or cancelled */
+    size_t max_pending;
+    pthread_t *workers;
+    size_t n_workers;
+    size_t max_workers;
+    size_t idle;
+    bool stop;
+};
+
+static void DirScanEntryDestroy(DirScanEntry *entry)
+{
+    if (entry)
+    {
+        free(entry->name);
+        free(entry);
+    }
+}
+
+static int DirScanEntryCompare(const void *a, const void *b, ARG_UNUSED void *user_data)
+{
+    return strcmp(((const DirScanEntry *) a)->name, ((const DirScanEntry *) b)->name);
+}
+
+static void DirScanJobDestroy(DirScanJob *job)
+{
+    if (job)
+    {
+        SeqDestroy(job->entries);
+        free(job->path);
+        free(job);
+    }
+}
+
+/* The type is in the directory entry on most systems and file systems,
+ * otherwise it is looked up */
+static bool IsDirectoryEntry(const char *path, const struct dirent *dirp)
+{
+#ifdef _DIRENT_HAVE_D_TYPE
+    if (dirp->d_type != DT_UNKNOWN)
+    {
+        return dirp->d_type == DT_DIR;
+    }
+#endif
+
+    char entry_path[CF_BUFSIZE];
+    struct stat sb;
+
+    snprintf(entry_path, sizeof(entry_path), "%s%c%s", path, FILE_SEPARATOR, dirp->d_name);
+    return (lstat(entry_path, &sb) == 0) && S_ISDIR(sb.st_mode);
+}
+
+/*
+ * If #dir_sb is given it is set to the identity of #path as it was before
+ * reading, and #stable tells whether #path still named it afterwards.
+ */
+static Seq *ReadDirectory(const char *path, struct stat *dir_sb, bool *stable)
+{
+    if (dir_sb && (stat(path, dir_sb) == -1))
+    {
+        return NULL;
+    }
+
+    Dir *dirh = DirOpen(path);
+    if (dirh == NULL)
+    {
+        return NULL;
+    }
+
+    Seq *entries = SeqNew(32, DirScanEntryDestroy);
+
+    for (const struct dirent *dirp = DirRead(dirh); dirp != NULL; dirp = DirRead(dirh))
+    {
+        if ((strcmp(dirp->d_name, ".") == 0) || (strcmp(dirp->d_name, "..") == 0))
+        {
+            continue;
+        }
+
+        DirScanEntry *entry = xcalloc(1, sizeof(DirScanEntry));
+        entry->name = xstrdup(dirp->d_name);
+        entry->is_dir = IsDirectoryEntry(path, dirp);
+
+        SeqAppend(entries, entry);
+    }
+
+    int error = errno;
+    DirClose(dirh);
+
+    if (error != 0)
+    {
+        SeqDestroy(entries);
+        errno = error;
+        return NULL;
+    }
+
+    if (dir_sb)
+    {
+        struct stat after;
+        *stable = (stat(path, &after) == 0) &&
+            (after.st_dev == dir_sb->st_dev) && (after.st_ino == dir_sb->st_ino);
+    }
+
+    SeqSort(entries, DirScanEntryCompare, NULL);
+    return entries;
+}
+
+static void *DirScannerRun(void *arg)
+{
+    DirScanner *scanner = arg;
+
+    pthread_mutex_lock(&scanner->lock);
+
+    while (!scanner->stop)
+    {
+        size_t n_pending = SeqLength(scanner->pending);
+
+        if (n_pending == 0)
+        {
+            scanner->idle++;
+            pthread_cond_wait(&scanner->job_added, &scanner->lock);
+            scanner->idle--;
+            continue;
+        }
+
+        DirScanJob *job = SeqAt(scanner->pending, n_pending - 1);
+        SeqSoftRemove(scanner->pending, n_pending - 1);
+        job->state = DIR_SCAN_RUNNING;
+
+        pthread_mutex_unlock(&scanner->lock);
+        struct stat sb;
+        bool stable = false;
+        Seq *entries = ReadDirectory(job->path, &sb, &stable);
+        int error = errno;
+        pthread_mutex_lock(&scanner->lock);
+
+        job->entries = entries;
+        job->error = error;
+        job->sb = sb;
+        job->stable = stable;
+        job->state = DIR_SCAN_DONE;
+
+        if (job->cancelled)
+        {
+            MapRemove(scanner->jobs, job->path);
+        }
+
+        pthread_cond_broadcast(&scanner->job_done);
+    }
+
+    pthread_mutex_unlock(&scanner->lock);
+    return NULL;
+}
+
+DirScanner *DirScannerNew(size_t max_workers, size_t max_pending)
+{
+    DirScanner *scanner = xcalloc(1, sizeof(DirScanner));
+
+    pthread_mutex_init(&scanner->lock, NULL);
+    pthread_cond_init(&scanner->job_added, NULL);
+    pthread_cond_init(&scanner->job_done, NULL);
+    scanner->pending = SeqNew(max_pending, NULL);
+    scanner->jobs = MapNew((MapHashFn) StringHash, (MapKeyEqualFn) StringSafeEqual,
+                           NULL, (MapDestroyDataFn) DirScanJobDestroy);
+    scanner->max_pending = max_pending;
+    scanner->max_workers = max_workers;
+    scanner->workers = xcalloc(max_workers, sizeof(pthread_t));
+
+    return scanner;
+}
+
+void DirScannerDestroy(DirScanner *scanner)
+{
+    if (scanner == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&scanner->lock);
+    scanner->stop = true;
+    pthread_cond_broadcast(&scanner->job_added);
+    pthread_mutex_unlock(&scanner->lock);
+
+    for (size_t i = 0; i < scanner->n_workers; i++)
+    {
+        pthread_join(scanner->workers[i], NULL);
+    }
+
+    SeqDestroy(scanner->pending);
+    MapDestroy(scanner->jobs);
+    pthread_cond_destroy(&scanner->job_added);
+    pthread_cond_destroy(&scanner->job_done);
+    pthread_mutex_destroy(&scanner->lock);
+    free(scanner->workers);
+    free(scanner);
+}
+
+void DirScannerPrefetch(DirScanner *scanner, const char *path)
+{
+    pthread_mutex_lock(&scanner->lock);
+
+    if ((MapSize(scanner->jobs) >= scanner->max_pending) || MapHasKey(scanner->jobs, path))
+    {
+        pthread_mutex_unlock(&scanner->lock);
+        return;
+    }
+
+    DirScanJob *job = xcalloc(1, sizeof(DirScanJob));
+    job->path = xstrdup(path);
+    job->state = DIR_SCAN_PENDING;
+
+    MapInsert(scanner->jobs, job->path, job);
+    SeqAppend(scanner->pending, job);
+
+    if ((scanner->idle == 0) && (scanner->n_workers < scanner->max_workers))
+    {
+        int ret = pthread_create(&scanner->workers[scanner->n_workers], NULL, DirScannerRun, scanner);
+        if (ret == 0)
+        {
+            scanner->n_workers++;
+        }
+        else
+        {
+            errno = ret;
+            Log(LOG_LEVEL_VERBOSE, "Unable to start directory reader thread. (pthread_create: %s)",
+                GetErrorStr());
+        }
+    }
+
+    pthread_cond_signal(&scanner->job_added);
+    pthread_mutex_unlock(&scanner->lock);
+}
+
+/* Called with the lock held */
+static void DirScannerUnqueue(DirScanner *scanner, DirScanJob *job)
+{
+    for (size_t i = SeqLength(scanner->pending); i > 0; i--)
+    {
+        if (SeqAt(scanner->pending, i - 1) == job)
+        {
+            SeqSoftRemove(scanner->pending, i - 1);
+            return;
+        }
+    }
+}
+
+void DirScannerCancel(DirScanner *scanner, const char *path)
+{
+    if (scanner == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&scanner->lock);
+
+    DirScanJob *job = MapGet(scanner->jobs, path);
+    if (job)
+    {
+        switch (job->state)
+        {
+        case DIR_SCAN_PENDING:
+            DirScannerUnqueue(scanner, job);
+            MapRemove(scanner->jobs, path);
+            break;
+        case DIR_SCAN_RUNNING:
+            job->cancelled = true;
+            break;
+        case DIR_SCAN_DONE:
+            MapRemove(scanner->jobs, path);
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&scanner->lock);
+}
+
+Seq *DirScannerGet(DirScanner *scanner, const char *path)
+{
+    if (scanner == NULL)
+    {
+        return ReadDirectory(path, NULL, NULL);
+    }
+
+    pthread_mutex_lock(&scanner->lock);
+
+    DirScanJob *job = MapGet(scanner->jobs, path);
+
+    if ((job == NULL) || (job->state == DIR_SCAN_PENDING))
+    {
+        /* Not started yet: read it here rather than wait for a worker */
+        if (job)
+        {
+            DirScannerUnqueue(scanner, job);
+            MapRemove(scanner->jobs, path);
+        }
+
+        pthread_mutex_unlock(&scanner->lock);
+        return ReadDirectory(path, NULL, NULL);
+    }
+
+    job->cancelled = false;
+    while (job->state != DIR_SCAN_DONE)
+    {
+        pthread_cond_wait(&scanner->job_done, &scanner->lock);
+    }
+
+    Seq *entries = job->entries;
+    int error = job->error;
+    job->entries = NULL;
+    MapRemove(scanner->jobs, path);
+
+    pthread_mutex_unlock(&scanner->lock);
+
+    errno = error;
+    return entries;
+}
+
+Seq *DirScannerTake(DirScanner *scanner, const char *path, const struct stat *sb)
+{
+    if (scanner == NULL)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&scanner->lock);
+
+    DirScanJob *job = MapGet(scanner->jobs, path);
+
+    if ((job == NULL) || (job->state == DIR_SCAN_PENDING))
+    {
+        if (job)
+        {
+            DirScannerUnqueue(scanner, job);
+            MapRemove(scanner->jobs, path);
+        }
+
+        pthread_mutex_unlock(&scanner->lock);
+        return NULL;
+    }
+
+    job->cancelled = false;
+    while (job->state != DIR_SCAN_DONE)
+    {
+        pthread_cond_wait(&scanner->job_done, &scanner->lock);
+    }
+
+    Seq *entries = NULL;
+    if (job->stable && (job->sb.st_dev == sb->st_dev) && (job->sb.st_ino == sb->st_ino))
+    {
+        entries = job->entries;
+        job->entries = NULL;
+    }
+    else if (job->entries)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Directory '%s' changed while it was read ahead, reading it again", path);
+    }
+
+    MapRemove(scanner->jobs, path);
+
+    pthread_mutex_unlock(&scanner->lock);
+    return entries;
+}
@@ -0,0 +1,80 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_DIR_SCAN_H
+#define CFENGINE_DIR_SCAN_H
+
+#include <cf3.defs.h>
+#include <sequence.h>
+
+/*
+ * Reads directories ahead of a serial tree walk. Directories announced with
+ * DirScannerPrefetch() are listed by a bounded set of worker threads, most
+ * recently announced first, so that the walker finds them ready when it gets
+ * there. The walker takes a listing it is about to need over from the queue
+ * instead of waiting for a worker.
+ *
+ * Only names are read ahead: the walker lstat()s each entry when it gets to
+ * it, as the actions on earlier entries may have changed it.
+ *
+ * Nothing here changes the file system: promise actions stay in the walker.
+ */
+
+typedef struct DirScanner_ DirScanner;
+
+typedef struct
+{
+    char *name;
+    bool is_dir;                /* as listed, to choose what to read ahead */
+} DirScanEntry;
+
+DirScanner *DirScannerNew(size_t max_workers, size_t max_pending);
+void DirScannerDestroy(DirScanner *scanner);
+
+/*
+ * Queue #path to be read in the background, if there is room.
+ */
+void DirScannerPrefetch(DirScanner *scanner, const char *path);
+
+/*
+ * Drop a queued or finished read of #path that will not be needed.
+ */
+void DirScannerCancel(DirScanner *scanner, const char *path);
+
+/*
+ * @return The entries of #path except "." and "..", sorted by name, as a Seq
+ *         of DirScanEntry that the caller owns. NULL with errno set if #path
+ *         could not be read. #scanner may be NULL to read it right away.
+ */
+Seq *DirScannerGet(DirScanner *scanner, const char *path);
+
+/*
+ * Like DirScannerGet(), but only returns a listing read in the background,
+ * and only if #path named the directory identified by #sb all the while it
+ * was read. NULL otherwise: the caller reads the directory itself.
+ */
+Seq *DirScannerTake(DirScanner *scanner, const char *path, const struct stat *sb);
+
+#endif
@@ -935,8 +935,6 @@ static int DeletePromisedLinesMatching(EvalContext *ctx, Item **start, Item *beg
 static int ReplacePatterns(EvalContext *ctx, Item *file_start, Item *file_end, Attributes a,
                            Promise *pp, EditContext *edcontext, PromiseResult *result)
 {
-    char replace[CF_EXPANDSIZE], line_buff[CF_EXPANDSIZE];
-    char before[CF_BUFSIZE], after[CF_BUFSIZE];
     int match_len, start_off, end_off, once_only = false, retval = false;
     Item *ip;
     int notfound = true, cutoff = 1, replaced = false;
@@ -947,6 +945,10 @@ static int ReplacePatterns(EvalContext *ctx, Item *file_start, Item *file_end, A
         once_only = true;
     }
 
+    Buffer *replace = BufferNew();
+    Buffer *line = BufferNew();
+    Buffer *replaced_line = BufferNew();
+
     for (ip = file_start; ip != NULL && ip != file_end; ip = ip->next)
     {
         if (ip->name == NULL)
@@ -955,13 +957,13 @@ static int ReplacePatterns(EvalContext *ctx, Item *file_start, Item *file_end, A
         }
 
         cutoff = 1;
-        strncpy(line_buff, ip->name, CF_BUFSIZE);
+        BufferSet(line, ip->name, strlen(ip->name));
         replaced = false;
         match_len = 0;
 
-        while (BlockTextMatch(ctx, pp->promiser, line_buff, &start_off, &end_off))
+        while (BlockTextMatch(ctx, pp->promiser, BufferData(line), &start_off, &end_off))
         {
-            if (match_len == strlen(line_buff))
+            if (match_len == BufferSize(line))
             {
                 Log(LOG_LEVEL_VERBOSE, "Improper convergent expression matches defacto convergence, so accepting");
                 break;
@@ -974,24 +976,25 @@ static int ReplacePatterns(EvalContext *ctx, Item *file_start, Item *file_end, A
             }
 
             match_len = end_off - start_off;
+            BufferZero(replace);
             ExpandScalar(ctx, PromiseGetBundle(pp)->ns, PromiseGetBundle(pp)->name, a.replace.replace_value, replace);
 
-            Log(LOG_LEVEL_VERBOSE, "Verifying replacement of '%s' with '%s', cutoff %d", pp->promiser, replace,
+            Log(LOG_LEVEL_VERBOSE, "Verifying replacement of '%s' with '%s', cutoff %d", pp->promiser, BufferData(replace),
                   cutoff);
 
-            before[0] = after[0] = '\0';
-
-            // Model the partial substitution in line_buff to check convergence
-
-            strncat(before, line_buff, start_off);
-            strncat(after, line_buff + end_off, sizeof(after) - 1);
-            snprintf(line_buff, CF_EXPANDSIZE - 1, "%s%s", before, replace);
             notfound = false;
             replaced = true;
 
-            // Model the full substitution in line_buff
+            // Model the full substitution in line to check convergence
 
-            snprintf(line_buff, CF_EXPANDSIZE - 1, "%s%s%s", before, replace, after);
+            BufferZero(replaced_line);
+            BufferAppend(replaced_line, BufferData(line), start_off);
+            BufferAppend(replaced_line, BufferData(replace), BufferSize(replace));
+            BufferAppend(replaced_line, BufferData(line) + end_off, BufferSize(line) - end_off);
+
+            Buffer *swap = line;
+            line = replaced_line;
+            replaced_line = swap;
 
             if (once_only)
             {
@@ -1000,14 +1003,14 @@ static int ReplacePatterns(EvalContext *ctx, Item *file_start, Item *file_end, A
             }
         }
 
-        if (NotAnchored(pp->promiser) && BlockTextMatch(ctx, pp->promiser, line_buff, &start_off, &end_off))
+        if (NotAnchored(pp->promiser) && BlockTextMatch(ctx, pp->promiser, BufferData(line), &start_off, &end_off))
         {
             cfPS(ctx, LOG_LEVEL_ERR, PROMISE_RESULT_INTERRUPTED, pp, a,
                  "Promised replacement '%s' on line '%s' for pattern '%s' is not convergent while editing '%s'",
-                 line_buff, ip->name, pp->promiser, edcontext->filename);
+                 BufferData(line), ip->name, pp->promiser, edcontext->filename);
             *result = PromiseResultUpdate(*result, PROMISE_RESULT_INTERRUPTED);
             Log(LOG_LEVEL_ERR, "Because the regular expression '%s' still matches the replacement string '%s'",
-                  pp->promiser, line_buff);
+                  pp->promiser, BufferData(line));
             PromiseRef(LOG_LEVEL_ERR, pp);
             break;
         }
@@ -1023,14 +1026,14 @@ static int ReplacePatterns(EvalContext *ctx, Item *file_start, Item *file_end, A
         else if (replaced)
         {
             free(ip->name);
-            ip->name = xstrdup(line_buff);
+            ip->name = xstrdup(BufferData(line));
             cfPS(ctx, LOG_LEVEL_VERBOSE, PROMISE_RESULT_CHANGE, pp, a, "Replaced pattern '%s' in '%s'", pp->promiser, edcontext->filename);
             *result = PromiseResultUpdate(*result, PROMISE_RESULT_CHANGE);
             (edcontext->num_edits)++;
             retval = true;
 
             Log(LOG_LEVEL_VERBOSE, "cutoff %d, '%s'", cutoff, ip->name);
-            Log(LOG_LEVEL_VERBOSE, "cutoff %d, '%s'", cutoff, line_buff);
+            Log(LOG_LEVEL_VERBOSE, "cutoff %d, '%s'", cutoff, BufferData(line));
 
             if (once_only)
             {
@@ -1046,12 +1049,16 @@ static int ReplacePatterns(EvalContext *ctx, Item *file_start, Item *file_end, A
                 *result = PromiseResultUpdate(*result, PROMISE_RESULT_INTERRUPTED);
                 Log(LOG_LEVEL_INFO,
                       "Because the regular expression '%s' still matches the end-state replacement string '%s'",
-                      pp->promiser, line_buff);
+                      pp->promiser, BufferData(line));
                 PromiseRef(LOG_LEVEL_INFO, pp);
             }
         }
     }
 
+    BufferDestroy(&replace);
+    BufferDestroy(&line);
+    BufferDestroy(&replaced_line);
+
     if (notfound)
     {
         cfPS(ctx, LOG_LEVEL_VERBOSE, PROMISE_RESULT_NOOP, pp, a, "No pattern '%s' in '%s'", pp->promiser, edcontext->filename);
@@ -1247,6 +1254,8 @@ static int InsertFileAtLocation(EvalContext *ctx, Item **start, Item *begin_ptr,
     
     loc = location;
 
+    Buffer *expanded = BufferNew();
+
     for(;;)
     {
         if (fgets(buf, sizeof(buf), fin) == NULL)
@@ -1281,7 +1290,13 @@ static int InsertFileAtLocation(EvalContext *ctx, Item **start, Item *begin_ptr,
         
         if (a.expandvars)
         {
-            ExpandScalar(ctx, PromiseGetBundle(pp)->ns, PromiseGetBundle(pp)->name, buf, exp);
+            BufferZero(expanded);
+            ExpandScalar(ctx, PromiseGetBundle(pp)->ns, PromiseGetBundle(pp)->name, buf, expanded);
+
+            if (strlcpy(exp, BufferData(expanded), CF_EXPANDSIZE) >= CF_EXPANDSIZE)
+            {
+                Log(LOG_LEVEL_ERR, "Expansion of line '%s' from '%s' is too long, truncated", buf, pp->promiser);
+            }
         }
         else
         {
@@ -1330,6 +1345,7 @@ static int InsertFileAtLocation(EvalContext *ctx, Item **start, Item *begin_ptr,
         }
     }
     
+    BufferDestroy(&expanded);
     fclose(fin);
     return retval;
     
@@ -44,7 +44,7 @@ static const char *SKIPFILES[] =
     NULL
 };
 
-static bool ConsiderFile(const char *nodename, const char *path, struct stat *stat)
+bool ConsiderFile(const char *nodename, const char *path, struct stat *stat)
 {
     int i;
     const char *sp;
@@ -36,6 +36,12 @@ void AddFilenameToListOfSuspicious(const char *filename);
  */
 bool ConsiderLocalFile(const char *filename, const char *path);
 
+/*
+ * Same as ConsiderLocalFile, for a #filename that has been lstat'ed already.
+ * #stat is NULL if that failed, with errno telling why.
+ */
+bool ConsiderFile(const char *filename, const char *path, struct stat *stat);
+
 bool ConsiderAbstractFile(const char *nodename, const char *path, FileCopy fc, AgentConnection *conn);
 
 #endif
@@ -33,6 +33,31 @@
 #include <files_hashes.h>
 #include <misc_lib.h>
 #include <env_context.h>
+#include <map.h>
+#include <string_lib.h>
+
+/* Threads hashing the files of a directory ahead of FileHashChanged() */
+#define CF_HASH_WORKERS 4
+
+/* Digests of a file taken by PrehashFiles(), while its stat was sb */
+typedef struct
+{
+    char *path;
+    struct stat sb;
+    HashMethod type;
+    bool ok;
+    unsigned char digests[2][EVP_MAX_MD_SIZE + 1];
+} PrehashedFile;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    Seq *jobs;                  /* of PrehashedFile */
+    size_t next;
+} PrehashQueue;
+
+/* path -> PrehashedFile, until FileHashChanged() takes it */
+static Map *PREHASHED = NULL;
 
 /*
  * Key format:
@@ -63,7 +88,7 @@ static void DeleteIndexKey(char *key)
     free(key);
 }
 
-static ChecksumValue *NewHashValue(unsigned char digest[EVP_MAX_MD_SIZE + 1])
+static ChecksumValue *NewHashValue(unsigned char digest[EVP_MAX_MD_SIZE + 1], const struct stat *sb)
 {
     ChecksumValue *chk_val;
 
@@ -73,6 +98,15 @@ static ChecksumValue *NewHashValue(unsigned char digest[EVP_MAX_MD_SIZE + 1])
 
 /* memcpy(chk_val->attr_digest,attr,EVP_MAX_MD_SIZE+1); depricated */
 
+    if (sb != NULL)
+    {
+        chk_val->size = sb->st_size;
+        chk_val->mtime = sb->st_mtime;
+        chk_val->ctime = sb->st_ctime;
+        chk_val->ino = sb->st_ino;
+        chk_val->dev = sb->st_dev;
+    }
+
     return chk_val;
 }
 
@@ -81,18 +115,18 @@ static void DeleteHashValue(ChecksumValue *chk_val)
     free((char *) chk_val);
 }
 
-static int ReadHash(CF_DB *dbp, HashMethod type, const char *name, unsigned char digest[EVP_MAX_MD_SIZE + 1])
+static int ReadHash(CF_DB *dbp, HashMethod type, const char *name, ChecksumValue *chk_val)
 {
     char *key;
     int size;
-    ChecksumValue chk_val;
 
     key = NewIndexKey(type, name, &size);
 
-    if (ReadComplexKeyDB(dbp, key, size, (void *) &chk_val, sizeof(ChecksumValue)))
+    /* Records written by older versions end after the digests */
+    memset(chk_val, 0, sizeof(ChecksumValue));
+
+    if (ReadComplexKeyDB(dbp, key, size, (void *) chk_val, sizeof(ChecksumValue)))
     {
-        memset(digest, 0, EVP_MAX_MD_SIZE + 1);
-        memcpy(digest, chk_val.mess_digest, EVP_MAX_MD_SIZE + 1);
         DeleteIndexKey(key);
         return true;
     }
@@ -103,14 +137,15 @@ static int ReadHash(CF_DB *dbp, HashMethod type, const char *name, unsigned char
     }
 }
 
-static int WriteHash(CF_DB *dbp, HashMethod type, const char *name, unsigned char digest[EVP_MAX_MD_SIZE + 1])
+static int WriteHash(CF_DB *dbp, HashMethod type, const char *name, unsigned char digest[EVP_MAX_MD_SIZE + 1],
+                     const struct stat *sb)
 {
     char *key;
     ChecksumValue *value;
     int ret, keysize;
 
     key = NewIndexKey(type, name, &keysize);
-    value = NewHashValue(digest);
+    value = NewHashValue(digest, sb);
     ret = WriteComplexKeyDB(dbp, key, keysize, value, sizeof(ChecksumValue));
     DeleteIndexKey(key);
     DeleteHashValue(value);
@@ -127,33 +162,31 @@ static void DeleteHash(CF_DB *dbp, HashMethod type, const char *name)
     DeleteIndexKey(key);
 }
 
+/* Whether the file is the one the recorded digest was taken from. Any write
+   moves ctime, so only content changed within the second it was hashed in
+   could go unnoticed: such a stat is not recorded (see FileHashChanged). */
+static bool HashStatMatches(const ChecksumValue *chk_val, const struct stat *sb)
+{
+    return (chk_val->ctime != 0) &&
+        (chk_val->size == (int64_t) sb->st_size) &&
+        (chk_val->mtime == (int64_t) sb->st_mtime) &&
+        (chk_val->ctime == (int64_t) sb->st_ctime) &&
+        (chk_val->ino == (int64_t) sb->st_ino) &&
+        (chk_val->dev == (int64_t) sb->st_dev);
+}
 
-/* Returns false if filename never seen before, and adds a checksum
-   to the database. Returns true if hashes do not match and also potentially
-   updates database to the new value */
-
-int FileHashChanged(EvalContext *ctx, const char *filename, unsigned char digest[EVP_MAX_MD_SIZE + 1], HashMethod type,
-                    Attributes attr, Promise *pp, PromiseResult *result)
+static bool CheckFileHash(EvalContext *ctx, CF_DB *dbp, const char *filename, const struct stat *sb,
+                          HashMethod type, unsigned char digest[EVP_MAX_MD_SIZE + 1], bool found,
+                          const ChecksumValue *recorded, Attributes attr, Promise *pp, PromiseResult *result)
 {
-    int i, size = 21;
-    unsigned char dbdigest[EVP_MAX_MD_SIZE + 1];
-    CF_DB *dbp;
+    int i, size = FileHashSize(type);
     char buffer[EVP_MAX_MD_SIZE * 4];
 
-    size = FileHashSize(type);
-
-    if (!OpenDB(&dbp, dbid_checksums))
-    {
-        cfPS(ctx, LOG_LEVEL_ERR, PROMISE_RESULT_FAIL, pp, attr, "Unable to open the hash database!");
-        *result = PromiseResultUpdate(*result, PROMISE_RESULT_FAIL);
-        return false;
-    }
-
-    if (ReadHash(dbp, type, filename, dbdigest))
+    if (found)
     {
         for (i = 0; i < size; i++)
         {
-            if (digest[i] != dbdigest[i])
+            if (digest[i] != recorded->mess_digest[i])
             {
                 Log(LOG_LEVEL_ERR, "Hash '%s' for '%s' changed!", FileHashName(type), filename);
 
@@ -169,7 +202,7 @@ int FileHashChanged(EvalContext *ctx, const char *filename, unsigned char digest
                     *result = PromiseResultUpdate(*result, PROMISE_RESULT_CHANGE);
 
                     DeleteHash(dbp, type, filename);
-                    WriteHash(dbp, type, filename, digest);
+                    WriteHash(dbp, type, filename, digest, sb);
                 }
                 else
                 {
@@ -177,14 +210,18 @@ int FileHashChanged(EvalContext *ctx, const char *filename, unsigned char digest
                     *result = PromiseResultUpdate(*result, PROMISE_RESULT_FAIL);
                 }
 
-                CloseDB(dbp);
                 return true;
             }
         }
 
+        /* Same content, new stat (touched, copied over, restored...) */
+        if (sb != NULL && !HashStatMatches(recorded, sb))
+        {
+            WriteHash(dbp, type, filename, digest, sb);
+        }
+
         cfPS(ctx, LOG_LEVEL_VERBOSE, PROMISE_RESULT_NOOP, pp, attr, "File hash for %s is correct", filename);
         *result = PromiseResultUpdate(*result, PROMISE_RESULT_NOOP);
-        CloseDB(dbp);
         return false;
     }
     else
@@ -194,13 +231,267 @@ int FileHashChanged(EvalContext *ctx, const char *filename, unsigned char digest
              FileHashName(type));
         *result = PromiseResultUpdate(*result, PROMISE_RESULT_CHANGE);
         Log(LOG_LEVEL_DEBUG, "Storing checksum for '%s' in database '%s'", filename, HashPrintSafe(type, digest, buffer));
-        WriteHash(dbp, type, filename, digest);
+        WriteHash(dbp, type, filename, digest, sb);
 
         LogHashChange(filename, FILE_STATE_NEW, "New file found", pp);
 
+        return false;
+    }
+}
+
+static void PrehashedFileDestroy(PrehashedFile *file)
+{
+    if (file)
+    {
+        free(file->path);
+        free(file);
+    }
+}
+
+static bool SameStat(const struct stat *a, const struct stat *b)
+{
+    return (a->st_dev == b->st_dev) && (a->st_ino == b->st_ino) && (a->st_size == b->st_size) &&
+        (a->st_mtime == b->st_mtime) && (a->st_ctime == b->st_ctime);
+}
+
+static int HashTypes(HashMethod type, HashMethod types[2])
+{
+    if (type == HASH_METHOD_BEST)
+    {
+        types[0] = HASH_METHOD_MD5;
+        types[1] = HASH_METHOD_SHA1;
+        return 2;
+    }
+
+    types[0] = type;
+    return 1;
+}
+
+static void *PrehashRun(void *arg)
+{
+    PrehashQueue *queue = arg;
+
+    while (true)
+    {
+        pthread_mutex_lock(&queue->lock);
+        PrehashedFile *file = (queue->next < SeqLength(queue->jobs)) ? SeqAt(queue->jobs, queue->next++) : NULL;
+        pthread_mutex_unlock(&queue->lock);
+
+        if (file == NULL)
+        {
+            return NULL;
+        }
+
+        /* Only vouch for the digests if the file kept still meanwhile */
+        HashMethod types[2];
+        int n_types = HashTypes(file->type, types);
+        struct stat after;
+
+        file->ok = HashFileMulti(file->path, n_types, types, file->digests) &&
+            (stat(file->path, &after) != -1) && SameStat(&file->sb, &after);
+    }
+}
+
+void PrehashFiles(const Seq *files, HashMethod type, Attributes attr)
+{
+    CF_DB *dbp;
+
+    if (!OpenDB(&dbp, dbid_checksums))
+    {
+        return;
+    }
+
+    HashMethod types[2];
+    int n_types = HashTypes(type, types);
+    PrehashQueue queue = { .jobs = SeqNew(SeqLength(files), PrehashedFileDestroy) };
+
+    /* Only the files FileHashChanged() would read */
+    for (size_t i = 0; i < SeqLength(files); i++)
+    {
+        struct stat sb;
+        const char *path = SeqAt(files, i);
+
+        if ((stat(path, &sb) == -1) || !S_ISREG(sb.st_mode))
+        {
+            continue;
+        }
+
+        bool unchanged = !attr.change.rehash_always;
+        for (int j = 0; (j < n_types) && unchanged; j++)
+        {
+            ChecksumValue recorded;
+            unchanged = ReadHash(dbp, types[j], path, &recorded) && HashStatMatches(&recorded, &sb);
+        }
+
+        if (!unchanged)
+        {
+            PrehashedFile *file = xcalloc(1, sizeof(PrehashedFile));
+            file->path = xstrdup(path);
+            file->sb = sb;
+            file->type = type;
+            SeqAppend(queue.jobs, file);
+        }
+    }
+
+    CloseDB(dbp);
+
+    /* One file is hashed just as well by FileHashChanged() */
+    if (SeqLength(queue.jobs) < 2)
+    {
+        SeqDestroy(queue.jobs);
+        return;
+    }
+
+    pthread_mutex_init(&queue.lock, NULL);
+
+    pthread_t workers[CF_HASH_WORKERS];
+    size_t n_workers = 0;
+
+    for (size_t i = 1; (i < CF_HASH_WORKERS) && (i < SeqLength(queue.jobs)); i++)
+    {
+        int ret = pthread_create(&workers[n_workers], NULL, PrehashRun, &queue);
+        if (ret != 0)
+        {
+            errno = ret;
+            Log(LOG_LEVEL_VERBOSE, "Unable to start file hashing thread. (pthread_create: %s)", GetErrorStr());
+            break;
+        }
+        n_workers++;
+    }
+
+    PrehashRun(&queue);
+
+    for (size_t i = 0; i < n_workers; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+
+    pthread_mutex_destroy(&queue.lock);
+
+    if (PREHASHED == NULL)
+    {
+        PREHASHED = MapNew((MapHashFn) StringHash, (MapKeyEqualFn) StringSafeEqual,
+                           NULL, (MapDestroyDataFn) PrehashedFileDestroy);
+    }
+
+    for (size_t i = 0; i < SeqLength(queue.jobs); i++)
+    {
+        PrehashedFile *file = SeqAt(queue.jobs, i);
+        if (file->ok)
+        {
+            MapInsert(PREHASHED, file->path, file);
+        }
+        else
+        {
+            PrehashedFileDestroy(file);
+        }
+    }
+
+    SeqSoftDestroy(queue.jobs);
+}
+
+void ForgetPrehashedFiles(const Seq *files)
+{
+    if (PREHASHED == NULL)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < SeqLength(files); i++)
+    {
+        MapRemove(PREHASHED, SeqAt(files, i));
+    }
+}
+
+/* Digests PrehashFiles() took of the file while it had stat sb, if any */
+static bool TakePrehashed(const char *filename, const struct stat *sb, HashMethod type,
+                          unsigned char digests[2][EVP_MAX_MD_SIZE + 1])
+{
+    PrehashedFile *file = PREHASHED ? MapGet(PREHASHED, filename) : NULL;
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    bool ok = (sb != NULL) && (file->type == type) && SameStat(&file->sb, sb);
+    if (ok)
+    {
+        memcpy(digests, file->digests, sizeof(file->digests));
+    }
+
+    MapRemove(PREHASHED, filename);
+    return ok;
+}
+
+/* Returns false if filename never seen before, and adds a checksum
+   to the database. Returns true if hashes do not match and also potentially
+   updates database to the new value. The file is only read if its stat
+   differs from the one recorded with the hash, or with rehash => "always".
+   The best hash method checks both md5 and sha1 from one read. */
+
+int FileHashChanged(EvalContext *ctx, const char *filename, const struct stat *sb, HashMethod type,
+                    Attributes attr, Promise *pp, PromiseResult *result)
+{
+    HashMethod types[2];
+    int n_types = HashTypes(type, types);
+    ChecksumValue recorded[2];
+    bool found[2];
+    CF_DB *dbp;
+
+    if (!OpenDB(&dbp, dbid_checksums))
+    {
+        cfPS(ctx, LOG_LEVEL_ERR, PROMISE_RESULT_FAIL, pp, attr, "Unable to open the hash database!");
+        *result = PromiseResultUpdate(*result, PROMISE_RESULT_FAIL);
+        return false;
+    }
+
+    bool unchanged = (sb != NULL) && !attr.change.rehash_always;
+
+    for (int i = 0; i < n_types; i++)
+    {
+        found[i] = ReadHash(dbp, types[i], filename, &recorded[i]);
+        unchanged = unchanged && found[i] && HashStatMatches(&recorded[i], sb);
+    }
+
+    if (unchanged)
+    {
+        cfPS(ctx, LOG_LEVEL_VERBOSE, PROMISE_RESULT_NOOP, pp, attr, "File hash for %s is correct", filename);
+        *result = PromiseResultUpdate(*result, PROMISE_RESULT_NOOP);
         CloseDB(dbp);
         return false;
     }
+
+    unsigned char digests[2][EVP_MAX_MD_SIZE + 1];
+    memset(digests, 0, sizeof(digests));
+
+    bool hashed = TakePrehashed(filename, sb, type, digests) ||
+        HashFileMulti(filename, n_types, types, digests);
+
+    /* A stat taken before hashing can only vouch for the digest if the file
+       was not modified in the same second, after which a new write would not
+       move the times */
+    time_t now = time(NULL);
+    if (sb != NULL && (sb->st_ctime >= now || sb->st_mtime >= now))
+    {
+        sb = NULL;
+    }
+
+    if (!hashed)
+    {
+        sb = NULL;
+    }
+
+    bool changed = false;
+    for (int i = 0; i < n_types; i++)
+    {
+        if (CheckFileHash(ctx, dbp, filename, sb, types[i], digests[i], found[i], &recorded[i], attr, pp, result))
+        {
+            changed = true;
+        }
+    }
+
+    CloseDB(dbp);
+    return changed;
 }
 
 int CompareFileHashes(const char *file1, const char *file2, struct stat *sstat, struct stat *dstat, FileCopy fc, AgentConnection *conn)
@@ -28,7 +28,16 @@
 #ifndef CFENGINE_VERIFY_FILES_HASHES_H
 #define CFENGINE_VERIFY_FILES_HASHES_H
 
-int FileHashChanged(EvalContext *ctx, const char *filename, unsigned char digest[EVP_MAX_MD_SIZE + 1], HashMethod type, Attributes attr, Promise *pp, PromiseResult *result);
+int FileHashChanged(EvalContext *ctx, const char *filename, const struct stat *sb, HashMethod type, Attributes attr, Promise *pp, PromiseResult *result);
+
+/*
+ * Hash the regular files among #files (paths) that FileHashChanged() is
+ * about to check and would have to read, several at a time. It then takes
+ * the digests of a file whose stat has not changed since.
+ */
+void PrehashFiles(const Seq *files, HashMethod type, Attributes attr);
+/* Drop what FileHashChanged() did not take of #files */
+void ForgetPrehashedFiles(const Seq *files);
 int CompareFileHashes(const char *file1, const char *file2, struct stat *sstat, struct stat *dstat, FileCopy fc, AgentConnection *conn);
 int CompareBinaryFiles(const char *file1, const char *file2, struct stat *sstat, struct stat *dstat, FileCopy fc, AgentConnection *conn);
 
@@ -56,6 +56,8 @@
 #include <scope.h>
 #include <misc_lib.h>
 #include <abstract_dir.h>
+#include <dir_scan.h>
+#include <dbm_api.h>
 #include <verify_files_hashes.h>
 #include <audit.h>
 #include <retcode.h>
@@ -65,6 +67,10 @@
 
 #define CF_RECURSION_LIMIT 100
 
+/* Directory read-ahead for DepthSearch(): threads, and directories queued */
+#define CF_DIR_SCAN_WORKERS 8
+#define CF_DIR_SCAN_PENDING 256
+
 static Rlist *AUTO_DEFINE_LIST;
 
 Item *VSETUIDLIST;
@@ -72,6 +78,13 @@ Item *VSETUIDLIST;
 Rlist *SINGLE_COPY_LIST = NULL;
 static Rlist *SINGLE_COPY_CACHE = NULL;
 
+/* Reads directories ahead of DepthSearch(), while it runs */
+static DirScanner *DIR_SCANNER = NULL;
+
+/* Held open by DepthSearch() when it records file hashes, which are then
+ * committed once per directory rather than per file */
+static CF_DB *CHECKSUMS_DB = NULL;
+
 static bool TransformFile(EvalContext *ctx, char *file, Attributes attr, Promise *pp, PromiseResult *result);
 static PromiseResult VerifyName(EvalContext *ctx, char *path, struct stat *sb, Attributes attr, Promise *pp);
 static PromiseResult VerifyDelete(EvalContext *ctx, char *path, struct stat *sb, Attributes attr, Promise *pp);
@@ -1435,18 +1448,12 @@ bool CopyRegularFile(EvalContext *ctx, const char *source, const char *dest, str
     return true;
 }
 
-static bool TransformFile(EvalContext *ctx, char *file, Attributes attr, Promise *pp, PromiseResult *result)
+static bool RunTransformer(EvalContext *ctx, const char *file, const char *comm, Attributes attr, Promise *pp, PromiseResult *result)
 {
-    char comm[CF_EXPANDSIZE], line[CF_BUFSIZE];
+    char line[CF_BUFSIZE];
     FILE *pop = NULL;
     int transRetcode = 0;
 
-    if (attr.transformer == NULL || file == NULL)
-    {
-        return false;
-    }
-
-    ExpandScalar(ctx, PromiseGetBundle(pp)->ns, PromiseGetBundle(pp)->name, attr.transformer, comm);
     Log(LOG_LEVEL_INFO, "Transforming '%s' ", comm);
 
     if (!IsExecutable(CommandArg0(comm)))
@@ -1515,6 +1522,22 @@ static bool TransformFile(EvalContext *ctx, char *file, Attributes attr, Promise
     return true;
 }
 
+static bool TransformFile(EvalContext *ctx, char *file, Attributes attr, Promise *pp, PromiseResult *result)
+{
+    if (attr.transformer == NULL || file == NULL)
+    {
+        return false;
+    }
+
+    Buffer *comm = BufferNew();
+    ExpandScalar(ctx, PromiseGetBundle(pp)->ns, PromiseGetBundle(pp)->name, attr.transformer, comm);
+
+    bool ret = RunTransformer(ctx, file, BufferData(comm), attr, pp, result);
+
+    BufferDestroy(&comm);
+    return ret;
+}
+
 static PromiseResult VerifyName(EvalContext *ctx, char *path, struct stat *sb, Attributes attr, Promise *pp)
 {
     mode_t newperm;
@@ -2073,30 +2096,13 @@ PromiseResult VerifyFileAttributes(EvalContext *ctx, const char *file, struct st
     return result;
 }
 
-int DepthSearch(EvalContext *ctx, char *name, struct stat *sb, int rlevel, Attributes attr,
-                Promise *pp, dev_t rootdevice, PromiseResult *result)
+static int DepthSearchDir(EvalContext *ctx, char *name, struct stat *sb, int rlevel, Attributes attr,
+                          Promise *pp, dev_t rootdevice, PromiseResult *result)
 {
-    Dir *dirh;
     int goback;
-    const struct dirent *dirp;
     char path[CF_BUFSIZE];
     struct stat lsb;
 
-    if (!attr.havedepthsearch)  /* if the search is trivial, make sure that we are in the parent dir of the leaf */
-    {
-        char basedir[CF_BUFSIZE];
-
-        Log(LOG_LEVEL_DEBUG, "Direct file reference '%s', no search implied", name);
-        snprintf(basedir, sizeof(basedir), "%s", name);
-        ChopLastNode(basedir);
-        if (chdir(basedir))
-        {
-            Log(LOG_LEVEL_ERR, "Failed to chdir into '%s'", basedir);
-            return false;
-        }
-        return VerifyFileLeaf(ctx, name, sb, attr, pp, result);
-    }
-
     if (rlevel > CF_RECURSION_LIMIT)
     {
         Log(LOG_LEVEL_WARNING, "Very deep nesting of directories (>%d deep) for '%s' (Aborting files)", rlevel, name);
@@ -2110,15 +2116,88 @@ int DepthSearch(EvalContext *ctx, char *name, struct stat *sb, int rlevel, Attri
         return false;
     }
 
-    if ((dirh = DirOpen(".")) == NULL)
+    /* Only the directory we have just checked and entered may be trusted:
+     * a listing read ahead through the full path is used if that path still
+     * leads here, and its entries are looked up from here as they come */
+    Seq *entries = DirScannerTake(DIR_SCANNER, name, sb);
+    if (entries == NULL)
+    {
+        entries = DirScannerGet(NULL, ".");
+    }
+
+    if (entries == NULL)
     {
         Log(LOG_LEVEL_INFO, "Could not open existing directory '%s'. (opendir: %s)", name, GetErrorStr());
         return false;
     }
 
-    for (dirp = DirRead(dirh); dirp != NULL; dirp = DirRead(dirh))
+    /* Hash the files whose content is checked several at a time, unless
+     * the promise may select, rename or delete them first */
+    Seq *prehashed = NULL;
+    if (CHECKSUMS_DB && !DONTDO && !attr.haveselect && !attr.haverename && !attr.havedelete &&
+        (attr.transformer == NULL) &&
+        ((attr.change.report_changes == FILE_CHANGE_REPORT_CONTENT_CHANGE) ||
+         (attr.change.report_changes == FILE_CHANGE_REPORT_ALL)))
+    {
+        prehashed = SeqNew(SeqLength(entries), free);
+
+        for (size_t i = 0; i < SeqLength(entries); i++)
+        {
+            const DirScanEntry *entry = SeqAt(entries, i);
+
+            /* PrehashFiles() only takes regular files */
+            if (!entry->is_dir)
+            {
+                strcpy(path, name);
+                AddSlash(path);
+
+                if (JoinPath(path, entry->name))
+                {
+                    SeqAppend(prehashed, xstrdup(path));
+                }
+            }
+        }
+
+        PrehashFiles(prehashed, attr.change.hash, attr);
+    }
+
+    if (CHECKSUMS_DB)
+    {
+        BeginBatchDB(CHECKSUMS_DB);
+    }
+
+    bool descend = (attr.recursion.depth > 1) && (rlevel <= attr.recursion.depth);
+
+    /* Announce the subdirectories we will enter, last first, so the first
+     * one is at the top of the queue */
+    if (DIR_SCANNER && descend)
     {
-        if (!ConsiderLocalFile(dirp->d_name, name))
+        for (size_t i = SeqLength(entries); i > 0; i--)
+        {
+            const DirScanEntry *entry = SeqAt(entries, i - 1);
+
+            if (entry->is_dir)
+            {
+                strcpy(path, name);
+                AddSlash(path);
+
+                if (JoinPath(path, entry->name))
+                {
+                    DirScannerPrefetch(DIR_SCANNER, path);
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < SeqLength(entries); i++)
+    {
+        const DirScanEntry *entry = SeqAt(entries, i);
+
+        /* Looked up now, after the actions on the entries before it */
+        bool have_lsb = (lstat(entry->name, &lsb) != -1);
+        int lstat_errno = errno;
+
+        if (!ConsiderFile(entry->name, name, have_lsb ? &lsb : NULL))
         {
             continue;
         }
@@ -2126,14 +2205,14 @@ int DepthSearch(EvalContext *ctx, char *name, struct stat *sb, int rlevel, Attri
         strcpy(path, name);
         AddSlash(path);
 
-        if (!JoinPath(path, dirp->d_name))
+        if (!JoinPath(path, entry->name))
         {
-            DirClose(dirh);
-            return true;
+            break;
         }
 
-        if (lstat(dirp->d_name, &lsb) == -1)
+        if (!have_lsb)
         {
+            errno = lstat_errno;
             Log(LOG_LEVEL_VERBOSE, "Recurse was looking at '%s' when an error occurred. (lstat: %s)", path, GetErrorStr());
             continue;
         }
@@ -2163,7 +2242,7 @@ int DepthSearch(EvalContext *ctx, char *name, struct stat *sb, int rlevel, Attri
 
             /* if so, hide the difference by replacing with actual object */
 
-            if (stat(dirp->d_name, &lsb) == -1)
+            if (stat(entry->name, &lsb) == -1)
             {
                 Log(LOG_LEVEL_ERR, "Recurse was working on '%s' when this failed. (stat: %s)", path, GetErrorStr());
                 continue;
@@ -2178,15 +2257,29 @@ int DepthSearch(EvalContext *ctx, char *name, struct stat *sb, int rlevel, Attri
 
         if (S_ISDIR(lsb.st_mode))
         {
-            if (SkipDirLinks(ctx, path, dirp->d_name, attr.recursion))
+            if (SkipDirLinks(ctx, path, entry->name, attr.recursion))
             {
+                DirScannerCancel(DIR_SCANNER, path);
                 continue;
             }
 
-            if ((attr.recursion.depth > 1) && (rlevel <= attr.recursion.depth))
+            if (descend)
             {
                 Log(LOG_LEVEL_VERBOSE, "Entering '%s', level %d", path, rlevel);
-                goback = DepthSearch(ctx, path, &lsb, rlevel + 1, attr, pp, rootdevice, result);
+
+                /* Subdirectories commit their own hashes */
+                if (CHECKSUMS_DB)
+                {
+                    CommitBatchDB(CHECKSUMS_DB);
+                }
+
+                goback = DepthSearchDir(ctx, path, &lsb, rlevel + 1, attr, pp, rootdevice, result);
+
+                if (CHECKSUMS_DB)
+                {
+                    BeginBatchDB(CHECKSUMS_DB);
+                }
+
                 if (!PopDirState(goback, name, sb, attr.recursion))
                 {
                     FatalError(ctx, "Not safe to continue");
@@ -2197,10 +2290,90 @@ int DepthSearch(EvalContext *ctx, char *name, struct stat *sb, int rlevel, Attri
         VerifyFileLeaf(ctx, path, &lsb, attr, pp, result);
     }
 
-    DirClose(dirh);
+    /* Drop the listings read ahead for subdirectories that were skipped */
+    if (DIR_SCANNER && descend)
+    {
+        for (size_t i = 0; i < SeqLength(entries); i++)
+        {
+            const DirScanEntry *entry = SeqAt(entries, i);
+
+            strcpy(path, name);
+            AddSlash(path);
+
+            if (entry->is_dir && JoinPath(path, entry->name))
+            {
+                DirScannerCancel(DIR_SCANNER, path);
+            }
+        }
+    }
+
+    if (CHECKSUMS_DB)
+    {
+        CommitBatchDB(CHECKSUMS_DB);
+    }
+
+    if (prehashed)
+    {
+        ForgetPrehashedFiles(prehashed);
+        SeqDestroy(prehashed);
+    }
+
+    SeqDestroy(entries);
     return true;
 }
 
+int DepthSearch(EvalContext *ctx, char *name, struct stat *sb, int rlevel, Attributes attr,
+                Promise *pp, dev_t rootdevice, PromiseResult *result)
+{
+    if (!attr.havedepthsearch)  /* if the search is trivial, make sure that we are in the parent dir of the leaf */
+    {
+        char basedir[CF_BUFSIZE];
+
+        Log(LOG_LEVEL_DEBUG, "Direct file reference '%s', no search implied", name);
+        snprintf(basedir, sizeof(basedir), "%s", name);
+        ChopLastNode(basedir);
+        if (chdir(basedir))
+        {
+            Log(LOG_LEVEL_ERR, "Failed to chdir into '%s'", basedir);
+            return false;
+        }
+        return VerifyFileLeaf(ctx, name, sb, attr, pp, result);
+    }
+
+    /* Readers work on full paths while the walk changes directory, so only
+     * absolute trees are read ahead */
+    bool read_ahead = (DIR_SCANNER == NULL) && (attr.recursion.depth > 1) && IsAbsoluteFileName(name);
+
+    if (read_ahead)
+    {
+        DIR_SCANNER = DirScannerNew(CF_DIR_SCAN_WORKERS, CF_DIR_SCAN_PENDING);
+    }
+
+    bool batch_hashes = (CHECKSUMS_DB == NULL) && attr.havechange;
+
+    if (batch_hashes && !OpenDB(&CHECKSUMS_DB, dbid_checksums))
+    {
+        CHECKSUMS_DB = NULL;
+        batch_hashes = false;
+    }
+
+    int ret = DepthSearchDir(ctx, name, sb, rlevel, attr, pp, rootdevice, result);
+
+    if (batch_hashes)
+    {
+        CloseDB(CHECKSUMS_DB);
+        CHECKSUMS_DB = NULL;
+    }
+
+    if (read_ahead)
+    {
+        DirScannerDestroy(DIR_SCANNER);
+        DIR_SCANNER = NULL;
+    }
+
+    return ret;
+}
+
 static int PushDirState(EvalContext *ctx, char *name, struct stat *sb)
 {
     if (chdir(name) == -1)
@@ -2611,45 +2784,23 @@ PromiseResult ScheduleLinkChildrenOperation(EvalContext *ctx, char *destination,
 
 static PromiseResult VerifyFileIntegrity(EvalContext *ctx, const char *file, Attributes attr, Promise *pp)
 {
-    unsigned char digest1[EVP_MAX_MD_SIZE + 1];
-    unsigned char digest2[EVP_MAX_MD_SIZE + 1];
-    int changed = false, one, two;
+    struct stat sb;
+    int changed = false;
 
     if ((attr.change.report_changes != FILE_CHANGE_REPORT_CONTENT_CHANGE) && (attr.change.report_changes != FILE_CHANGE_REPORT_ALL))
     {
         return PROMISE_RESULT_NOOP;
     }
 
-    memset(digest1, 0, EVP_MAX_MD_SIZE + 1);
-    memset(digest2, 0, EVP_MAX_MD_SIZE + 1);
-
     PromiseResult result = PROMISE_RESULT_NOOP;
-    if (attr.change.hash == HASH_METHOD_BEST)
+    if (!DONTDO)
     {
-        if (!DONTDO)
-        {
-            HashFile(file, digest1, HASH_METHOD_MD5);
-            HashFile(file, digest2, HASH_METHOD_SHA1);
+        /* Taken before hashing, so that a change while hashing shows next time */
+        bool have_stat = (stat(file, &sb) != -1);
 
-            one = FileHashChanged(ctx, file, digest1, HASH_METHOD_MD5, attr, pp, &result);
-            two = FileHashChanged(ctx, file, digest2, HASH_METHOD_SHA1, attr, pp, &result);
-
-            if (one || two)
-            {
-                changed = true;
-            }
-        }
-    }
-    else
-    {
-        if (!DONTDO)
+        if (FileHashChanged(ctx, file, have_stat ? &sb : NULL, attr.change.hash, attr, pp, &result))
         {
-            HashFile(file, digest1, attr.change.hash);
-
-            if (FileHashChanged(ctx, file, digest1, attr.change.hash, attr, pp, &result))
-            {
-                changed = true;
-            }
+            changed = true;
         }
     }
 
@@ -70,21 +70,36 @@ PromiseResult VerifyMethod(EvalContext *ctx, char *attrname, Attributes a, Promi
 
     if (a.havebundle)
     {
+        const char *unexpanded_name = NULL;
+
         if ((vp = ConstraintGetRvalValue(ctx, attrname, pp, RVAL_TYPE_FNCALL)))
         {
             fp = (FnCall *) vp;
-            ExpandScalar(ctx, PromiseGetBundle(pp)->ns, PromiseGetBundle(pp)->name, fp->name, method_name);
+            unexpanded_name = fp->name;
             args = fp->args;
         }
         else if ((vp = ConstraintGetRvalValue(ctx, attrname, pp, RVAL_TYPE_SCALAR)))
         {
-            ExpandScalar(ctx, PromiseGetBundle(pp)->ns, PromiseGetBundle(pp)->name, (char *) vp, method_name);
+            unexpanded_name = (char *) vp;
             args = NULL;
         }
         else
         {
             return PROMISE_RESULT_NOOP;
         }
+
+        Buffer *expanded = BufferNew();
+        ExpandScalar(ctx, PromiseGetBundle(pp)->ns, PromiseGetBundle(pp)->name, unexpanded_name, expanded);
+
+        /* A cut-off name would call another bundle, or none */
+        if (strlcpy(method_name, BufferData(expanded), sizeof(method_name)) >= sizeof(method_name))
+        {
+            cfPS(ctx, LOG_LEVEL_ERR, PROMISE_RESULT_FAIL, pp, a,
+                 "The bundle name of method '%s' is too long once expanded", pp->promiser);
+            BufferDestroy(&expanded);
+            return PROMISE_RESULT_FAIL;
+        }
+        BufferDestroy(&expanded);
     }
 
     GetLockName(lockname, "method", pp->promiser, args);
@@ -29,6 +29,7 @@
 #include <dir.h>
 #include <files_names.h>
 #include <files_interfaces.h>
+#include <file_lib.h>
 #include <vars.h>
 #include <conversion.h>
 #include <expand.h>
@@ -65,8 +66,8 @@ static char *GetDefaultArch(const char *command);
 static int ExecPackageCommand(EvalContext *ctx, char *command, int verify, int setCmdClasses, Attributes a, Promise *pp, PromiseResult *result);
 
 static int PrependPatchItem(EvalContext *ctx, PackageItem ** list, char *item, PackageItem * chklist, const char *default_arch, Attributes a, Promise *pp);
-static int PrependMultiLinePackageItem(EvalContext *ctx, PackageItem ** list, char *item, int reset, const char *default_arch, Attributes a, Promise *pp);
-static int PrependListPackageItem(EvalContext *ctx, PackageItem ** list, char *item, const char *default_arch, Attributes a, Promise *pp);
+static int PrependMultiLinePackageItem(EvalContext *ctx, PackageItem ** list, char *item, int reset, const char *default_arch, Attributes a);
+static int PrependListPackageItem(EvalContext *ctx, PackageItem ** list, char *item, const char *default_arch, Attributes a);
 
 static PackageManager *NewPackageManager(PackageManager **lists, char *mgr, PackageAction pa, PackageActionPolicy x);
 static void DeletePackageManagers(PackageManager *newlist);
@@ -438,11 +439,11 @@ static bool PackageListInstalledFromCommand(EvalContext *ctx, PackageItem **inst
         {
             if (FullTextMatch(ctx, a.packages.package_multiline_start, buf))
             {
-                PrependMultiLinePackageItem(ctx, installed_list, buf, reset, default_arch, a, pp);
+                PrependMultiLinePackageItem(ctx, installed_list, buf, reset, default_arch, a);
             }
             else
             {
-                PrependMultiLinePackageItem(ctx, installed_list, buf, update, default_arch, a, pp);
+                PrependMultiLinePackageItem(ctx, installed_list, buf, update, default_arch, a);
             }
         }
         else
@@ -452,7 +453,7 @@ static bool PackageListInstalledFromCommand(EvalContext *ctx, PackageItem **inst
                 continue;
             }
             
-            if (!PrependListPackageItem(ctx, installed_list, buf, default_arch, a, pp))
+            if (!PrependListPackageItem(ctx, installed_list, buf, default_arch, a))
             {
                 Log(LOG_LEVEL_VERBOSE, "Package line '%s' did not match one of the package_list_(name|version|arch)_regex patterns", buf);
                 continue;
@@ -463,7 +464,7 @@ static bool PackageListInstalledFromCommand(EvalContext *ctx, PackageItem **inst
     
     if (a.packages.package_multiline_start)
     {
-        PrependMultiLinePackageItem(ctx, installed_list, buf, reset, default_arch, a, pp);
+        PrependMultiLinePackageItem(ctx, installed_list, buf, reset, default_arch, a);
     }
     
     return cf_pclose(fin) == 0;
@@ -498,92 +499,378 @@ static void ReportSoftware(PackageManager *list)
     fclose(fout);
 }
 
-static PackageItem *GetCachedPackageList(EvalContext *ctx, PackageManager *manager, const char *default_arch, Attributes a, Promise *pp)
+/** Package inventory **/
+
+/*
+ * WORKDIR/state/software_packages.inventory keeps the installed package list
+ * of each package manager, so that later runs load it instead of running the
+ * list command again. All integers are in host byte order:
+ *
+ *   magic, format version,
+ *   per package manager: list command, list time, package database mtime,
+ *                        package count, then the name, version and arch of
+ *                        each package in pack_list order
+ *
+ * Strings are a 32 bit length and the bytes without terminator. The CSV
+ * written by ReportSoftware() is kept for reporting, but no longer read.
+ */
+
+#define INVENTORY_MAGIC "CFPKGINV"
+#define INVENTORY_FORMAT 1
+
+typedef struct
+{
+    char *data;
+    size_t size;
+    size_t pos;
+    bool error;
+} InventoryDecoder;
+
+typedef struct
+{
+    size_t start;
+    const char *manager;
+    uint32_t manager_len;
+    uint64_t list_time;
+    uint64_t database_mtime;
+    uint32_t count;
+    size_t packages;
+    size_t end;
+} InventoryRecord;
+
+static const char *DecodeInventoryBytes(InventoryDecoder *dec, size_t len)
+{
+    if (dec->error || (len > dec->size - dec->pos))
+    {
+        dec->error = true;
+        return NULL;
+    }
+
+    const char *bytes = dec->data + dec->pos;
+    dec->pos += len;
+    return bytes;
+}
+
+static uint32_t DecodeInventoryU32(InventoryDecoder *dec)
+{
+    uint32_t value = 0;
+    const char *bytes = DecodeInventoryBytes(dec, sizeof(value));
+    if (bytes)
+    {
+        memcpy(&value, bytes, sizeof(value));
+    }
+    return value;
+}
+
+static uint64_t DecodeInventoryU64(InventoryDecoder *dec)
+{
+    uint64_t value = 0;
+    const char *bytes = DecodeInventoryBytes(dec, sizeof(value));
+    if (bytes)
+    {
+        memcpy(&value, bytes, sizeof(value));
+    }
+    return value;
+}
+
+static char *DecodeInventoryString(InventoryDecoder *dec)
+{
+    uint32_t len = DecodeInventoryU32(dec);
+    const char *bytes = DecodeInventoryBytes(dec, len);
+    return bytes ? xstrndup(bytes, len) : NULL;
+}
+
+static bool OpenSoftwareInventory(const char *path, InventoryDecoder *dec)
 {
-    PackageItem *list = NULL;
-    char name[CF_MAXVARSIZE], version[CF_MAXVARSIZE], arch[CF_MAXVARSIZE], mgr[CF_MAXVARSIZE], line[CF_BUFSIZE];
-    char thismanager[CF_MAXVARSIZE];
-    FILE *fin;
-    time_t horizon = 24 * 60, now = time(NULL);
     struct stat sb;
+    int fd = open(path, O_RDONLY | O_BINARY);
 
-    GetSoftwareCacheFilename(name);
+    if (fd == -1)
+    {
+        return false;
+    }
 
-    if (stat(name, &sb) == -1)
+    *dec = (InventoryDecoder) { 0 };
+
+    if ((fstat(fd, &sb) == -1) || (sb.st_size < (off_t) (strlen(INVENTORY_MAGIC) + sizeof(uint32_t))))
     {
-        return NULL;
+        close(fd);
+        return false;
+    }
+
+    dec->size = sb.st_size;
+    dec->data = xmalloc(dec->size);
+
+    bool ok = (FullRead(fd, dec->data, dec->size) == (int) dec->size);
+    close(fd);
+
+    if (ok)
+    {
+        const char *magic = DecodeInventoryBytes(dec, strlen(INVENTORY_MAGIC));
+        ok = (memcmp(magic, INVENTORY_MAGIC, strlen(INVENTORY_MAGIC)) == 0) &&
+             (DecodeInventoryU32(dec) == INVENTORY_FORMAT);
+    }
+
+    if (!ok)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Ignoring unreadable package inventory '%s'", path);
+        free(dec->data);
     }
 
+    return ok;
+}
+
+static bool NextInventoryRecord(InventoryDecoder *dec, InventoryRecord *rec)
+{
+    if (dec->error || (dec->pos == dec->size))
+    {
+        return false;
+    }
+
+    rec->start = dec->pos;
+    rec->manager_len = DecodeInventoryU32(dec);
+    rec->manager = DecodeInventoryBytes(dec, rec->manager_len);
+    rec->list_time = DecodeInventoryU64(dec);
+    rec->database_mtime = DecodeInventoryU64(dec);
+    rec->count = DecodeInventoryU32(dec);
+    rec->packages = dec->pos;
+
+    for (uint64_t i = 0; (i < 3 * (uint64_t) rec->count) && !dec->error; i++)
+    {
+        DecodeInventoryBytes(dec, DecodeInventoryU32(dec));
+    }
+
+    rec->end = dec->pos;
+    return !dec->error;
+}
+
+static bool InventoryRecordIsFresh(const InventoryRecord *rec, Attributes a)
+{
+    if (a.packages.package_list_database)
+    {
+        struct stat sb;
+
+        if (stat(a.packages.package_list_database, &sb) == -1)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Cannot stat package database '%s', not using the cached package list. (stat: %s)",
+                a.packages.package_list_database, GetErrorStr());
+            return false;
+        }
+
+        if ((uint64_t) sb.st_mtime != rec->database_mtime)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Package database '%s' has changed since the package list was cached",
+                a.packages.package_list_database);
+            return false;
+        }
+
+        Log(LOG_LEVEL_VERBOSE, "Package database '%s' is unchanged since the package list was cached",
+            a.packages.package_list_database);
+        return true;
+    }
+
+    time_t horizon = 24 * 60;
+
     if (a.packages.package_list_update_ifelapsed != CF_NOINT)
     {
         horizon = a.packages.package_list_update_ifelapsed;
     }
 
-    if (now - sb.st_mtime < horizon * 60)
+    if (time(NULL) - (time_t) rec->list_time < horizon * 60)
     {
-        Log(LOG_LEVEL_VERBOSE,
-            "Cache file '%s' exists and is sufficiently fresh according to (package_list_update_ifelapsed)", name);
+        Log(LOG_LEVEL_VERBOSE, "Cached package list is sufficiently fresh according to (package_list_update_ifelapsed)");
+        return true;
     }
-    else
+
+    Log(LOG_LEVEL_VERBOSE, "Cached package list is out of date (package_list_update_ifelapsed)");
+    return false;
+}
+
+static time_t PackageDatabaseMtime(Attributes a)
+{
+    struct stat sb;
+
+    if (a.packages.package_list_database && (stat(a.packages.package_list_database, &sb) != -1))
     {
-        Log(LOG_LEVEL_VERBOSE, "Cache file '%s' exists, but it is out of date (package_list_update_ifelapsed)", name);
-        return NULL;
+        return sb.st_mtime;
     }
 
-    if ((fin = fopen(name, "r")) == NULL)
+    return 0;
+}
+
+bool LoadSoftwareInventory(PackageManager *manager, const char *default_arch, Attributes a)
+{
+    char name[CF_MAXVARSIZE];
+    InventoryDecoder dec;
+    InventoryRecord rec;
+    bool found = false;
+
+    GetSoftwareInventoryFilename(name);
+
+    if (!OpenSoftwareInventory(name, &dec))
     {
-        Log(LOG_LEVEL_INFO, "Cannot open the source log '%s' - you need to run a package discovery promise to create it in cf-agent. (fopen: %s)",
-              name, GetErrorStr());
-        return NULL;
+        return false;
     }
 
-/* Max 2016 entries - at least a week */
-
-    snprintf(thismanager, CF_MAXVARSIZE - 1, "%s", ReadLastNode(CommandArg0(manager->manager)));
+    while (NextInventoryRecord(&dec, &rec))
+    {
+        if ((rec.manager_len == strlen(manager->manager)) &&
+            (memcmp(rec.manager, manager->manager, rec.manager_len) == 0))
+        {
+            found = InventoryRecordIsFresh(&rec, a);
+            break;
+        }
+    }
 
-    int linenumber = 0;
-    for(;;)
+    if (found)
     {
-        if (fgets(line, sizeof(line), fin) == NULL)
+        PackageItem **tail = &(manager->pack_list);
+
+        dec.pos = rec.packages;
+        for (uint32_t i = 0; i < rec.count; i++)
         {
-            if (ferror(fin))
+            PackageItem *pi = xcalloc(1, sizeof(PackageItem));
+            pi->name = DecodeInventoryString(&dec);
+            pi->version = DecodeInventoryString(&dec);
+            pi->arch = DecodeInventoryString(&dec);
+
+            /* Entries listed before the package method could tell the
+             * architecture take the one it detects now */
+            if (strcmp(pi->arch, "default") == 0)
             {
-                UnexpectedError("Failed to read line %d from stream '%s'", linenumber+1, name);
-                break;
+                free(pi->arch);
+                pi->arch = xstrdup(default_arch);
             }
-            else /* feof */
+
+            *tail = pi;
+            tail = &(pi->next);
+        }
+
+        manager->list_time = rec.list_time;
+        manager->database_mtime = rec.database_mtime;
+    }
+
+    free(dec.data);
+    return found;
+}
+
+static void WriteInventoryString(FILE *fout, const char *str)
+{
+    uint32_t len = strlen(str);
+    fwrite(&len, sizeof(len), 1, fout);
+    fwrite(str, 1, len, fout);
+}
+
+static bool IsListedManager(PackageManager *list, const InventoryRecord *rec)
+{
+    for (PackageManager *mp = list; mp != NULL; mp = mp->next)
+    {
+        if ((mp->list_time != 0) && (rec->manager_len == strlen(mp->manager)) &&
+            (memcmp(rec->manager, mp->manager, rec->manager_len) == 0))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void WriteSoftwareInventory(PackageManager *list)
+{
+    char name[CF_MAXVARSIZE], new_name[CF_BUFSIZE];
+    InventoryDecoder dec;
+    FILE *fout;
+
+    GetSoftwareInventoryFilename(name);
+    snprintf(new_name, sizeof(new_name), "%s.new", name);
+
+    if ((fout = fopen(new_name, "wb")) == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Cannot open the package inventory '%s'. (fopen: %s)", new_name, GetErrorStr());
+        return;
+    }
+
+    uint32_t format = INVENTORY_FORMAT;
+    fwrite(INVENTORY_MAGIC, 1, strlen(INVENTORY_MAGIC), fout);
+    fwrite(&format, sizeof(format), 1, fout);
+
+    /* Keep the lists of package managers not used in this run */
+    if (OpenSoftwareInventory(name, &dec))
+    {
+        InventoryRecord rec;
+
+        while (NextInventoryRecord(&dec, &rec))
+        {
+            if (!IsListedManager(list, &rec))
             {
-                break;
+                fwrite(dec.data + rec.start, 1, rec.end - rec.start, fout);
             }
         }
-        ++linenumber;
-        int scancount = sscanf(line, "%250[^,],%250[^,],%250[^,],%250[^\n]", name, version, arch, mgr);
-        if (scancount != 4)
+
+        free(dec.data);
+    }
+
+    for (PackageManager *mp = list; mp != NULL; mp = mp->next)
+    {
+        if (mp->list_time == 0)
         {
-            Log(LOG_LEVEL_VERBOSE, "Could only read %d values from line %d in '%s'", scancount, linenumber, name);
+            continue;
         }
 
-        /*
-         * Transition to explicit default architecture, if package manager
-         * supports it.
-         *
-         * If old cache contains entries with 'default' architecture, and
-         * package method is updated to detect this architecture, on next
-         * execution update this architecture to the real one.
-         */
-        if (!strcmp(arch, "default"))
+        uint64_t list_time = mp->list_time, database_mtime = mp->database_mtime;
+        uint32_t count = 0;
+
+        for (PackageItem *pi = mp->pack_list; pi != NULL; pi = pi->next)
         {
-            strlcpy(arch, default_arch, CF_MAXVARSIZE);
+            count++;
         }
 
-        if (strcmp(thismanager, mgr) == 0)
+        WriteInventoryString(fout, mp->manager);
+        fwrite(&list_time, sizeof(list_time), 1, fout);
+        fwrite(&database_mtime, sizeof(database_mtime), 1, fout);
+        fwrite(&count, sizeof(count), 1, fout);
+
+        for (PackageItem *pi = mp->pack_list; pi != NULL; pi = pi->next)
         {
-            PrependPackageItem(ctx, &list, name, version, arch, pp);
+            WriteInventoryString(fout, pi->name);
+            WriteInventoryString(fout, pi->version);
+            WriteInventoryString(fout, pi->arch);
         }
     }
 
-    fclose(fin);
-    return list;
+    bool failed = ferror(fout);
+
+    if ((fclose(fout) != 0) || failed || (rename(new_name, name) == -1))
+    {
+        Log(LOG_LEVEL_ERR, "Cannot write the package inventory '%s'. (%s)", name, GetErrorStr());
+        unlink(new_name);
+    }
+}
+
+static const Seq *InstalledPackagesNamed(PackageManager *manager, const char *name)
+/* The items of pack_list whose name ComparePackages() would match, in list order */
+{
+    if (manager->pack_index == NULL)
+    {
+        manager->pack_index = MapNew((MapHashFn) StringHash, (MapKeyEqualFn) StringSafeEqual,
+                                     free, (MapDestroyDataFn) SeqDestroy);
+
+        for (PackageItem *pi = manager->pack_list; pi != NULL; pi = pi->next)
+        {
+            const char *key = CanonifyChar(pi->name, ',');
+            Seq *items = MapGet(manager->pack_index, key);
+
+            if (items == NULL)
+            {
+                items = SeqNew(1, NULL);
+                MapInsert(manager->pack_index, xstrdup(key), items);
+            }
+
+            SeqAppend(items, pi);
+        }
+    }
+
+    return MapGet(manager->pack_index, CanonifyChar(name, ','));
 }
 
 static int VerifyInstalledPackages(EvalContext *ctx, PackageManager **all_mgrs, const char *default_arch,
@@ -598,20 +885,21 @@ static int VerifyInstalledPackages(EvalContext *ctx, PackageManager **all_mgrs,
         return false;
     }
 
-    if (manager->pack_list != NULL)
+    if (manager->list_time != 0)
     {
         Log(LOG_LEVEL_VERBOSE, "Already have a package list for this manager");
         return true;
     }
 
-    manager->pack_list = GetCachedPackageList(ctx, manager, default_arch, a, pp);
-
-    if (manager->pack_list != NULL)
+    if (LoadSoftwareInventory(manager, default_arch, a))
     {
         Log(LOG_LEVEL_VERBOSE, "Already have a (cached) package list for this manager ");
         return true;
     }
 
+    /* Before listing, so that a change made meanwhile invalidates the list */
+    time_t database_mtime = PackageDatabaseMtime(a);
+
 #ifdef __MINGW32__
 
     if (strcmp(a.packages.package_list_command, PACKAGE_LIST_COMMAND_WINAPI) == 0)
@@ -644,7 +932,11 @@ static int VerifyInstalledPackages(EvalContext *ctx, PackageManager **all_mgrs,
     
 #endif /* !__MINGW32__ */
 
+    manager->list_time = time(NULL);
+    manager->database_mtime = database_mtime;
+
     ReportSoftware(INSTALLED_PACKAGE_LISTS);
+    WriteSoftwareInventory(INSTALLED_PACKAGE_LISTS);
 
 /* Now get available updates */
 
@@ -823,8 +1115,12 @@ static int IsNewerThanInstalled(EvalContext *ctx, const char *n, const char *v,
 
     Log(LOG_LEVEL_VERBOSE, "Looking for an installed package older than (%s,%s,%s) [name,version,arch]", n, v, a);
 
-    for (pi = mp->pack_list; pi != NULL; pi = pi->next)
+    const Seq *named = InstalledPackagesNamed(mp, n);
+
+    for (size_t i = 0; (named != NULL) && (i < SeqLength(named)); i++)
     {
+        pi = SeqAt(named, i);
+
         if ((strcmp(n, pi->name) == 0) && (((strcmp(a, "*") == 0)) || (strcmp(a, pi->arch) == 0)))
         {
             Log(LOG_LEVEL_VERBOSE, "Found installed package (%s,%s,%s) [name,version,arch]", pi->name, pi->version, pi->arch);
@@ -921,6 +1217,19 @@ static PromiseResult AddPatchToSchedule(EvalContext *ctx, const Attributes *a, c
     }
 }
 
+static void ExpandPackageConvention(EvalContext *ctx, const char *scope, const char *convention, char *dest, size_t dest_size)
+{
+    Buffer *expanded = BufferNew();
+    ExpandScalar(ctx, NULL, scope, convention, expanded);
+
+    if (strlcpy(dest, BufferData(expanded), dest_size) >= dest_size)
+    {
+        Log(LOG_LEVEL_ERR, "Expansion of package convention '%s' is too long, truncated to '%s'", convention, dest);
+    }
+
+    BufferDestroy(&expanded);
+}
+
 static PromiseResult SchedulePackageOp(EvalContext *ctx, const char *name, const char *version, const char *arch, int installed, int matched,
                                        int no_version_specified, Attributes a, Promise *pp)
 {
@@ -956,12 +1265,12 @@ static PromiseResult SchedulePackageOp(EvalContext *ctx, const char *name, const
 
         if ((a.packages.package_delete_convention) && (a.packages.package_policy == PACKAGE_ACTION_DELETE))
         {
-            ExpandScalar(ctx, NULL, "cf_pack_context", a.packages.package_delete_convention, reference);
+            ExpandPackageConvention(ctx, "cf_pack_context", a.packages.package_delete_convention, reference, sizeof(reference));
             strlcpy(id, reference, CF_EXPANDSIZE);
         }
         else if (a.packages.package_name_convention)
         {
-            ExpandScalar(ctx, NULL, "cf_pack_context", a.packages.package_name_convention, reference);
+            ExpandPackageConvention(ctx, "cf_pack_context", a.packages.package_name_convention, reference, sizeof(reference));
             strlcpy(id, reference, CF_EXPANDSIZE);
         }
         else
@@ -1031,7 +1340,7 @@ static PromiseResult SchedulePackageOp(EvalContext *ctx, const char *name, const
                     VarRef *ref_arch = VarRefParseFromScope("arch", "cf_pack_context_anyver");
                     EvalContextVariablePut(ctx, ref_arch, arch, DATA_TYPE_STRING);
 
-                    ExpandScalar(ctx, NULL, "cf_pack_context_anyver", a.packages.package_name_convention, refAnyVer);
+                    ExpandPackageConvention(ctx, "cf_pack_context_anyver", a.packages.package_name_convention, refAnyVer, sizeof(refAnyVer));
 
                     EvalContextVariableRemove(ctx, ref_name);
                     VarRefDestroy(ref_name);
@@ -1173,7 +1482,7 @@ static PromiseResult SchedulePackageOp(EvalContext *ctx, const char *name, const
                 VarRef *ref_arch = VarRefParseFromScope("arch", "cf_pack_context_anyver");
                 EvalContextVariablePut(ctx, ref_arch, arch, DATA_TYPE_STRING);
 
-                ExpandScalar(ctx, NULL, "cf_pack_context_anyver", a.packages.package_name_convention, refAnyVer);
+                ExpandPackageConvention(ctx, "cf_pack_context_anyver", a.packages.package_name_convention, refAnyVer, sizeof(refAnyVer));
 
                 EvalContextVariableRemove(ctx, ref_name);
                 VarRefDestroy(ref_name);
@@ -1251,7 +1560,7 @@ static PromiseResult SchedulePackageOp(EvalContext *ctx, const char *name, const
                     VarRef *ref_arch = VarRefParseFromScope("arch", "cf_pack_context");
                     EvalContextVariablePut(ctx, ref_arch, inst_arch, DATA_TYPE_STRING);
 
-                    ExpandScalar(ctx, NULL, "cf_pack_context", a.packages.package_delete_convention, reference2);
+                    ExpandPackageConvention(ctx, "cf_pack_context", a.packages.package_delete_convention, reference2, sizeof(reference2));
                     id_del = reference2;
 
                     EvalContextVariableRemove(ctx, ref_name);
@@ -1458,8 +1767,11 @@ static VersionCmpResult PackageMatch(EvalContext *ctx,
 
     Log(LOG_LEVEL_VERBOSE, "Looking for %s (%s,%s,%s) [name,version,arch] in package manager %s", mode, n, v, a, mp->manager);
 
-    for (pi = mp->pack_list; pi != NULL; pi = pi->next)
+    const Seq *named = InstalledPackagesNamed(mp, n);
+
+    for (size_t i = 0; (named != NULL) && (i < SeqLength(named)); i++)
     {
+        pi = SeqAt(named, i);
         VersionCmpResult res = ComparePackages(ctx, n, v, a, pi, attr, pp, mode, result);
 
         if (res != VERCMP_NO_MATCH)
@@ -1765,6 +2077,13 @@ static void InvalidateSoftwareCache(void)
             Log(LOG_LEVEL_ERR, "Cannot mark software cache as invalid. (utimes: %s)", GetErrorStr());
         }
     }
+
+    GetSoftwareInventoryFilename(name);
+
+    if ((unlink(name) == -1) && (errno != ENOENT))
+    {
+        Log(LOG_LEVEL_ERR, "Cannot remove the package inventory '%s'. (unlink: %s)", name, GetErrorStr());
+    }
 }
 
 static int ExecuteSchedule(EvalContext *ctx, PackageManager *schedule, PackageAction action, PromiseResult *result)
@@ -2318,6 +2637,7 @@ static void DeletePackageManagers(PackageManager *newlist)
     {
         next = np->next;
         DeletePackageItems(np->pack_list);
+        MapDestroy(np->pack_index);
         free((char *) np);
     }
 }
@@ -2498,9 +2818,10 @@ int PrependPackageItem(EvalContext *ctx, PackageItem ** list, const char *name,
     pi->arch = xstrdup(arch);
     *list = pi;
 
-/* Finally we need these for later schedule exec, once this iteration context has gone */
+/* Finally we need these for later schedule exec, once this iteration context has gone.
+   Installed package lists are never executed, so they pass no promise to copy. */
 
-    pi->pp = DeRefCopyPromise(ctx, pp);
+    pi->pp = pp ? DeRefCopyPromise(ctx, pp) : NULL;
     return true;
 }
 
@@ -2565,7 +2886,7 @@ static int PrependPatchItem(EvalContext *ctx, PackageItem ** list, char *item, P
 }
 
 static int PrependMultiLinePackageItem(EvalContext *ctx, PackageItem ** list, char *item, int reset, const char *default_arch,
-                                       Attributes a, Promise *pp)
+                                       Attributes a)
 {
     static char name[CF_MAXVARSIZE];
     static char arch[CF_MAXVARSIZE];
@@ -2582,7 +2903,7 @@ static int PrependMultiLinePackageItem(EvalContext *ctx, PackageItem ** list, ch
         if ((strcmp(name, "") != 0) || (strcmp(version, "") != 0))
         {
             Log(LOG_LEVEL_DEBUG, "Extracted package name '%s', version '%s', arch '%s'", name, version, arch);
-            PrependPackageItem(ctx, list, name, version, arch, pp);
+            PrependPackageItem(ctx, list, name, version, arch, NULL);
         }
 
         strcpy(name, "CF_NOMATCH");
@@ -2614,7 +2935,7 @@ static int PrependMultiLinePackageItem(EvalContext *ctx, PackageItem ** list, ch
     return false;
 }
 
-static int PrependListPackageItem(EvalContext *ctx, PackageItem ** list, char *item, const char *default_arch, Attributes a, Promise *pp)
+static int PrependListPackageItem(EvalContext *ctx, PackageItem ** list, char *item, const char *default_arch, Attributes a)
 {
     char name[CF_MAXVARSIZE];
     char arch[CF_MAXVARSIZE];
@@ -2644,7 +2965,7 @@ static int PrependListPackageItem(EvalContext *ctx, PackageItem ** list, char *i
 
     Log(LOG_LEVEL_DEBUG, "Package line '%s', name '%s', version '%s', arch '%s'", item, name, version, arch);
 
-    return PrependPackageItem(ctx, list, name, version, arch, pp);
+    return PrependPackageItem(ctx, list, name, version, arch, NULL);
 }
 
 static char *GetDefaultArch(const char *command)
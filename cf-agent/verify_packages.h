@@ -41,6 +41,8 @@ VersionCmpResult ComparePackages(EvalContext *ctx,
                                  Promise *pp,
                                  const char *mode,
                                  PromiseResult *result);
+void WriteSoftwareInventory(PackageManager *list);
+bool LoadSoftwareInventory(PackageManager *manager, const char *default_arch, Attributes a);
 
 
 #endif
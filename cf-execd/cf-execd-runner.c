@@ -40,6 +40,7 @@
 #include <bootstrap.h>
 #include <files_hashes.h>
 #include <item_lib.h>
+#include <exec-output.h>
 
 #include <cf-windows-functions.h>
 
@@ -49,7 +50,10 @@ static const int INF_LINES = -2;
 
 /*******************************************************************/
 
-static int CompareResult(const char *filename, const char *prev_file);
+static bool OutputDigestFile(char *digest_file);
+static bool OutputChanged(ExecOutput *output);
+static void StoreOutputDigest(const char *digest);
+static void ReplacePreviousOutput(const char *filename);
 static void MailResult(const ExecConfig *config, const char *file);
 static int Dialogue(int sd, const char *s);
 
@@ -219,37 +223,19 @@ void LocalExec(const ExecConfig *config)
 
 /* What if no more processes? Could sacrifice and exec() - but we need a sentinel */
 
-    FILE *fp = fopen(filename, "w");
-    if (!fp)
-    {
-        Log(LOG_LEVEL_ERR, "Couldn't open '%s' - aborting exec. (fopen: %s)", filename, GetErrorStr());
-        return;
-    }
-
-#if !defined(__MINGW32__)
-/*
- * Don't inherit this file descriptor on fork/exec
- */
-
-    if (fileno(fp) != -1)
-    {
-        fcntl(fileno(fp), F_SETFD, FD_CLOEXEC);
-    }
-#endif
-
     Log(LOG_LEVEL_VERBOSE, "Command => %s", cmd);
 
     FILE *pp = cf_popen_sh(esc_command, "r");
     if (!pp)
     {
         Log(LOG_LEVEL_ERR, "Couldn't open pipe to command '%s'. (cf_popen: %s)", cmd, GetErrorStr());
-        fclose(fp);
         return;
     }
 
     Log(LOG_LEVEL_VERBOSE, "Command is executing...%s", esc_command);
 
-    int count = 0;
+    ExecOutput *output = ExecOutputNew(filename, EXEC_OUTPUT_BUFFER_MAX);
+    bool failed = false;
     for (;;)
     {
         if(!IsReadReady(fileno(pp), (config->agent_expireafter * SECONDS_PER_MINUTE)))
@@ -259,8 +245,8 @@ void LocalExec(const ExecConfig *config)
                      config->agent_expireafter);
 
             Log(LOG_LEVEL_ERR, "%s", errmsg);
-            fprintf(fp, "%s\n", errmsg);
-            count++;
+            ExecOutputAppendLine(output, errmsg);
+            failed = true;
 
             pid_t pid_agent;
 
@@ -287,6 +273,7 @@ void LocalExec(const ExecConfig *config)
         {
             Log(LOG_LEVEL_ERR, "Unable to read output from command '%s'. (cfread: %s)", cmd, GetErrorStr());
             cf_pclose(pp);
+            ExecOutputClose(output, false);
             return;
         }
 
@@ -309,8 +296,7 @@ void LocalExec(const ExecConfig *config)
 
             ReplaceStr(line, line_escaped, sizeof(line_escaped), "%", "%%");
 
-            fprintf(fp, "%s\n", line_escaped);
-            count++;
+            ExecOutputAppendLine(output, line_escaped);
 
             /* If we can't send mail, log to syslog */
 
@@ -330,122 +316,118 @@ void LocalExec(const ExecConfig *config)
         }
     }
 
-    cf_pclose(pp);
-    Log(LOG_LEVEL_DEBUG, "Closing fp");
-    fclose(fp);
+    if (cf_pclose(pp) != 0)
+    {
+        failed = true;
+    }
 
     Log(LOG_LEVEL_VERBOSE, "Command is complete");
 
-    if (count)
+    if (ExecOutputLines(output) == 0)
+    {
+        Log(LOG_LEVEL_VERBOSE, "No output");
+        ExecOutputClose(output, false);
+        return;
+    }
+
+    /* Only output that changed, or that a failed run left, is kept */
+    bool changed = OutputChanged(output);
+    if (!changed && !failed)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Previous output is the same as current so do not mail it");
+        ExecOutputClose(output, false);
+        return;
+    }
+
+    /* The digest is only stored once the output it stands for is on disk,
+       so that output failing to be written is still mailed next time */
+    char *digest = changed ? xstrdup(ExecOutputDigest(output)) : NULL;
+
+    if (!ExecOutputClose(output, true))
     {
+        free(digest);
+        return;
+    }
+
+    if (changed)
+    {
+        StoreOutputDigest(digest);
+        free(digest);
+
+        ReplacePreviousOutput(filename);
+
         Log(LOG_LEVEL_VERBOSE, "Mailing result");
         MailResult(config, filename);
     }
     else
     {
-        Log(LOG_LEVEL_VERBOSE, "No output");
-        unlink(filename);
+        Log(LOG_LEVEL_VERBOSE, "Agent run failed, keeping its output in '%s'", filename);
     }
 }
 
-static int CompareResult(const char *filename, const char *prev_file)
+static bool OutputDigestFile(char *digest_file)
 {
-    Log(LOG_LEVEL_VERBOSE, "Comparing files  %s with %s", prev_file, filename);
-
-    int rtn = 0;
-
-    FILE *old_fp = fopen(prev_file, "r");
-    FILE *new_fp = fopen(filename, "r");
-    if (old_fp && new_fp)
+    if (snprintf(digest_file, CF_BUFSIZE, "%s/state/previous_output_digest", CFWORKDIR) >= CF_BUFSIZE)
     {
-        const char *errptr;
-        int erroffset;
-        pcre_extra *regex_extra = NULL;
-        // Match timestamps and remove them. Not Y21K safe! :-)
-        pcre *regex = pcre_compile(LOGGING_TIMESTAMP_REGEX, PCRE_MULTILINE, &errptr, &erroffset, NULL);
-        if (!regex)
-        {
-            UnexpectedError("Compiling regular expression failed");
-            rtn = 1;
-        }
-        else
-        {
-            regex_extra = pcre_study(regex, 0, &errptr);
-        }
-
-        while (regex)
-        {
-            char old_line[CF_BUFSIZE];
-            char new_line[CF_BUFSIZE];
-            char *old_msg = old_line;
-            char *new_msg = new_line;
-            if (CfReadLine(old_line, sizeof(old_line), old_fp) <= 0)
-            {
-                old_msg = NULL;
-            }
-            if (CfReadLine(new_line, sizeof(new_line), new_fp) <= 0)
-            {
-                new_msg = NULL;
-            }
-            if (!old_msg || !new_msg)
-            {
-                if (old_msg != new_msg)
-                {
-                    rtn = 1;
-                }
-                break;
-            }
+        Log(LOG_LEVEL_ERR, "Path to the output digest file is too long");
+        return false;
+    }
+    MapName(digest_file);
+    return true;
+}
 
-            char *index;
-            if (pcre_exec(regex, regex_extra, old_msg, strlen(old_msg), 0, 0, NULL, 0) >= 0)
-            {
-                index = strstr(old_msg, ": ");
-                if (index != NULL)
-                {
-                    old_msg = index + 2;
-                }
-            }
-            if (pcre_exec(regex, regex_extra, new_msg, strlen(new_msg), 0, 0, NULL, 0) >= 0)
-            {
-                index = strstr(new_msg, ": ");
-                if (index != NULL)
-                {
-                    new_msg = index + 2;
-                }
-            }
+/* Compares the digest of the output with the one stored for the previous run */
+static bool OutputChanged(ExecOutput *output)
+{
+    char digest_file[CF_BUFSIZE];
+    if (!OutputDigestFile(digest_file))
+    {
+        return true;
+    }
 
-            if (strcmp(old_msg, new_msg) != 0)
-            {
-                rtn = 1;
-                break;
-            }
-        }
+    Log(LOG_LEVEL_VERBOSE, "Comparing output digest %s with the previous one", ExecOutputDigest(output));
 
-        if (regex_extra)
-        {
-            free(regex_extra);
-        }
-        free(regex);
-    }
-    else
+    if (!ThreadLock(cft_count))
     {
-        /* no previous file */
-        rtn = 1;
+        Log(LOG_LEVEL_ERR, "Severe lock error when mailing in exec");
+        return true;
     }
 
-    if (old_fp)
+    bool changed = ExecOutputDigestChanged(output, digest_file);
+
+    ThreadUnlock(cft_count);
+    return changed;
+}
+
+static void StoreOutputDigest(const char *digest)
+{
+    char digest_file[CF_BUFSIZE];
+    if (!OutputDigestFile(digest_file))
     {
-        fclose(old_fp);
+        return;
     }
-    if (new_fp)
+
+    if (!ThreadLock(cft_count))
     {
-        fclose(new_fp);
+        Log(LOG_LEVEL_ERR, "Severe lock error when mailing in exec");
+        return;
     }
 
+    ExecOutputStoreDigest(digest, digest_file);
+
+    ThreadUnlock(cft_count);
+}
+
+static void ReplacePreviousOutput(const char *filename)
+{
+    char prev_file[CF_BUFSIZE];
+    snprintf(prev_file, CF_BUFSIZE - 1, "%s/outputs/previous", CFWORKDIR);
+    MapName(prev_file);
+
     if (!ThreadLock(cft_count))
     {
         Log(LOG_LEVEL_ERR, "Severe lock error when mailing in exec");
-        return 1;
+        return;
     }
 
 /* replace old file with new*/
@@ -455,11 +437,9 @@ static int CompareResult(const char *filename, const char *prev_file)
     if (!LinkOrCopy(filename, prev_file, true))
     {
         Log(LOG_LEVEL_INFO, "Could not symlink or copy '%s' to '%s'", filename, prev_file);
-        rtn = 1;
     }
 
     ThreadUnlock(cft_count);
-    return rtn;
 }
 
 static void MailResult(const ExecConfig *config, const char *file)
@@ -484,18 +464,6 @@ static void MailResult(const ExecConfig *config, const char *file)
         }
     }
 
-    {
-        char prev_file[CF_BUFSIZE];
-        snprintf(prev_file, CF_BUFSIZE - 1, "%s/outputs/previous", CFWORKDIR);
-        MapName(prev_file);
-
-        if (CompareResult(file, prev_file) == 0)
-        {
-            Log(LOG_LEVEL_VERBOSE, "Previous output is the same as current so do not mail it");
-            return;
-        }
-    }
-
     if ((strlen(config->mail_server) == 0) || (strlen(config->mail_to_address) == 0))
     {
         /* Syslog should have done this */
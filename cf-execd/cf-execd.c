@@ -51,6 +51,7 @@
 #include <cf-windows-functions.h>
 
 #include <cf-execd.h>
+#include <exec-schedule.h>
 
 #define CF_EXEC_IFELAPSED 0
 #define CF_EXEC_EXPIREAFTER 1
@@ -65,12 +66,14 @@ static pthread_attr_t threads_attrs;
 
 static GenericAgentConfig *CheckOpts(EvalContext *ctx, int argc, char **argv);
 void ThisAgentInit(void);
-static bool ScheduleRun(EvalContext *ctx, Policy **policy, GenericAgentConfig *config, ExecConfig *exec_config);
+static bool ScheduleRun(EvalContext *ctx, Policy **policy, GenericAgentConfig *config, ExecConfig *exec_config,
+                        ExecWatch *watch, time_t *last_run);
 #ifndef __MINGW32__
 static void Apoptosis(EvalContext *ctx);
 #endif
 
 static bool LocalExecInThread(const ExecConfig *config);
+static void Splay(const ExecConfig *config);
 
 /*******************************************************************/
 /* Command line options                                            */
@@ -374,6 +377,7 @@ void StartServer(EvalContext *ctx, Policy *policy, GenericAgentConfig *config, E
 #endif /* !__MINGW32__ */
 
     WritePID("cf-execd.pid");
+    MakeSignalPipe();
     signal(SIGINT, HandleSignalsForDaemon);
     signal(SIGTERM, HandleSignalsForDaemon);
     signal(SIGHUP, SIG_IGN);
@@ -390,28 +394,47 @@ void StartServer(EvalContext *ctx, Policy *policy, GenericAgentConfig *config, E
     }
     else
     {
+        ExecWatch *watch = ExecWatchNew();
+        ExecWatchReset(watch, config->input_file, policy);
+
+        /* The minute the executor starts in is never a run */
+        time_t last_run = time(NULL);
+        last_run -= last_run % SECONDS_PER_MINUTE;
+
         while (!IsPendingTermination())
         {
-            if (ScheduleRun(ctx, &policy, config, exec_config))
+            if (ScheduleRun(ctx, &policy, config, exec_config, watch, &last_run))
             {
-                Log(LOG_LEVEL_VERBOSE, "Sleeping for splaytime %d seconds", exec_config->splay_time);
-                sleep(exec_config->splay_time);
-
                 if (!LocalExecInThread(exec_config))
                 {
                     Log(LOG_LEVEL_INFO, "Unable to run agent in thread, falling back to blocking execution");
+                    Splay(exec_config);
                     LocalExec(exec_config);
                 }
             }
         }
+
+        ExecWatchDestroy(watch);
     }
 }
 
 /*****************************************************************************/
 
+/* The splay delays each run in its own thread, so that the scheduler keeps
+ * watching for new policy meanwhile */
+static void Splay(const ExecConfig *config)
+{
+    if (config->splay_time > 0)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Sleeping for splaytime %d seconds", config->splay_time);
+        sleep(config->splay_time);
+    }
+}
+
 static void *LocalExecThread(void *param)
 {
     ExecConfig *config = (ExecConfig *)param;
+    Splay(config);
     LocalExec(config);
     ExecConfigDestroy(config);
 
@@ -477,7 +500,7 @@ static void Apoptosis(EvalContext *ctx)
         }
     }
 
-    DeleteItemList(PROCESSTABLE);
+    ClearProcessTable();
 
     Log(LOG_LEVEL_VERBOSE, "Pruning complete");
 }
@@ -513,89 +536,136 @@ static Reload CheckNewPromises(GenericAgentConfig *config, const Policy *existin
     return RELOAD_ENVIRONMENT;
 }
 
-static bool ScheduleRun(EvalContext *ctx, Policy **policy, GenericAgentConfig *config, ExecConfig *exec_config)
+static void ReloadPolicy(EvalContext *ctx, Policy **policy, GenericAgentConfig *config, ExecConfig *exec_config)
 {
-    Log(LOG_LEVEL_VERBOSE, "Sleeping for pulse time %d seconds...", CFPULSETIME);
-    sleep(CFPULSETIME);         /* 1 Minute resolution is enough */
-
     /*
      * FIXME: this logic duplicates the one from cf-serverd.c. Unify ASAP.
      */
 
-    if (CheckNewPromises(config, *policy) == RELOAD_FULL)
+    Log(LOG_LEVEL_INFO, "Re-reading promise file '%s'", config->input_file);
+
+    EvalContextClear(ctx);
+
+    DeleteItemList(IPADDRESSES);
+    IPADDRESSES = NULL;
+
+    strcpy(VDOMAIN, "undefined.domain");
+
+    PolicyDestroy(*policy);
+    *policy = NULL;
+
     {
-        /* Full reload */
+        char *existing_policy_server = ReadPolicyServerFile(GetWorkDir());
+        SetPolicyServer(ctx, existing_policy_server);
+        free(existing_policy_server);
+    }
 
-        Log(LOG_LEVEL_INFO, "Re-reading promise file '%s'", config->input_file);
+    EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_SYS, "policy_hub", POLICY_SERVER, DATA_TYPE_STRING);
 
-        EvalContextClear(ctx);
+    GetNameInfo3(ctx, AGENT_TYPE_EXECUTOR);
+    GetHostnameInfo(ctx);
+    GetInterfacesInfo(ctx);
+    Get3Environment(ctx, AGENT_TYPE_EXECUTOR);
+    BuiltinClasses(ctx);
+    OSClasses(ctx);
 
-        DeleteItemList(IPADDRESSES);
-        IPADDRESSES = NULL;
+    EvalContextClassPutHard(ctx, CF_AGENTTYPES[AGENT_TYPE_EXECUTOR]);
 
-        strcpy(VDOMAIN, "undefined.domain");
+    time_t t = SetReferenceTime();
+    UpdateTimeClasses(ctx, t);
 
-        PolicyDestroy(*policy);
-        *policy = NULL;
+    GenericAgentConfigSetBundleSequence(config, NULL);
 
-        {
-            char *existing_policy_server = ReadPolicyServerFile(GetWorkDir());
-            SetPolicyServer(ctx, existing_policy_server);
-            free(existing_policy_server);
-        }
+    *policy = GenericAgentLoadPolicy(ctx, config);
+    ExecConfigUpdate(ctx, *policy, exec_config);
 
-        EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_SYS, "policy_hub", POLICY_SERVER, DATA_TYPE_STRING);
+    SetFacility(exec_config->log_facility);
+}
 
-        GetNameInfo3(ctx, AGENT_TYPE_EXECUTOR);
-        GetInterfacesInfo(ctx);
-        Get3Environment(ctx, AGENT_TYPE_EXECUTOR);
-        BuiltinClasses(ctx);
-        OSClasses(ctx);
+static void ReloadEnvironment(EvalContext *ctx)
+{
+    EvalContextClear(ctx);
 
-        EvalContextClassPutHard(ctx, CF_AGENTTYPES[AGENT_TYPE_EXECUTOR]);
+    DeleteItemList(IPADDRESSES);
+    IPADDRESSES = NULL;
 
-        time_t t = SetReferenceTime();
-        UpdateTimeClasses(ctx, t);
+    GetInterfacesInfo(ctx);
+    Get3Environment(ctx, AGENT_TYPE_EXECUTOR);
+    BuiltinClasses(ctx);
+    OSClasses(ctx);
 
-        GenericAgentConfigSetBundleSequence(config, NULL);
+    time_t t = SetReferenceTime();
+    UpdateTimeClasses(ctx, t);
+}
 
-        *policy = GenericAgentLoadPolicy(ctx, config);
-        ExecConfigUpdate(ctx, *policy, exec_config);
+/*
+ * Sleeps until the next minute the schedule classes are due in, or until the
+ * inputs change, rather than waking up every minute to check. Without inotify
+ * the inputs are still checked every CFPULSETIME seconds.
+ */
+static bool ScheduleRun(EvalContext *ctx, Policy **policy, GenericAgentConfig *config, ExecConfig *exec_config,
+                        ExecWatch *watch, time_t *last_run)
+{
+    time_t now = time(NULL);
+    time_t next = ExecScheduleNextRun(ctx, exec_config->schedule, MAX(now, *last_run + SECONDS_PER_MINUTE));
 
-        SetFacility(exec_config->log_facility);
+    time_t timeout = EXEC_SCHEDULE_HORIZON * SECONDS_PER_MINUTE;
+    if (next != 0)
+    {
+        timeout = MAX(next - now, 0);
+        Log(LOG_LEVEL_VERBOSE, "Next run is due at %s", ctime(&next));
     }
     else
     {
-        /* Environment reload */
+        Log(LOG_LEVEL_VERBOSE, "No run is due in the next %d minutes", EXEC_SCHEDULE_HORIZON);
+    }
 
-        EvalContextClear(ctx);
+    if (!ExecWatchIsActive(watch))
+    {
+        timeout = MIN(timeout, CFPULSETIME);
+    }
 
-        DeleteItemList(IPADDRESSES);
-        IPADDRESSES = NULL;
+    Log(LOG_LEVEL_VERBOSE, "Sleeping for %jd seconds...", (intmax_t) timeout);
+    ExecWake wake = ExecWatchWait(watch, timeout);
+    if (wake == EXEC_WAKE_SIGNAL)
+    {
+        return false;
+    }
 
-        GetInterfacesInfo(ctx);
-        Get3Environment(ctx, AGENT_TYPE_EXECUTOR);
-        BuiltinClasses(ctx);
-        OSClasses(ctx);
+    now = time(NULL);
+    bool due = (next != 0) && (now >= next);
 
-        time_t t = SetReferenceTime();
-        UpdateTimeClasses(ctx, t);
+    Reload reload = RELOAD_ENVIRONMENT;
+    if (due || (wake == EXEC_WAKE_INPUTS) || !ExecWatchIsActive(watch))
+    {
+        reload = CheckNewPromises(config, *policy);
     }
 
+    if (reload == RELOAD_FULL)
     {
-        StringSetIterator it = StringSetIteratorInit(exec_config->schedule);
-        const char *time_context = NULL;
-        while ((time_context = StringSetIteratorNext(&it)))
-        {
-            if (IsDefinedClass(ctx, time_context, NULL))
-            {
-                Log(LOG_LEVEL_VERBOSE, "Waking up the agent at %s ~ %s", ctime(&CFSTARTTIME), time_context);
-                return true;
-            }
-        }
+        ReloadPolicy(ctx, policy, config, exec_config);
+        ExecWatchReset(watch, config->input_file, *policy);
+    }
+    else if (due || (next == 0 && wake == EXEC_WAKE_TIMEOUT))
+    {
+        /* Classes other than time ones may have changed since */
+        ReloadEnvironment(ctx);
+    }
+
+    if (!due)
+    {
+        return false;
+    }
+
+    *last_run = now - (now % SECONDS_PER_MINUTE);
+
+    const char *time_context = ExecScheduleMatch(ctx, exec_config->schedule);
+    if (time_context)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Waking up the agent at %s ~ %s", ctime(&CFSTARTTIME), time_context);
+        return true;
     }
 
     Log(LOG_LEVEL_VERBOSE, "Nothing to do at %s", ctime(&CFSTARTTIME));
     return false;
 }
-
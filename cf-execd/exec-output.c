@@ -0,0 +1,248 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <exec-output.h>
+
+#include <alloc.h>
+#include <writer.h>
+#include <files_hashes.h>
+#include <assert.h>
+
+struct ExecOutput_
+{
+    char *filename;
+    size_t buffer_max;
+    Writer *buffer;             /* NULL once spilled */
+    FILE *spill;
+    bool write_error;
+
+    size_t lines;
+    EVP_MD_CTX context;
+    char *digest;
+};
+
+ExecOutput *ExecOutputNew(const char *filename, size_t buffer_max)
+{
+    ExecOutput *output = xcalloc(1, sizeof(ExecOutput));
+    output->filename = xstrdup(filename);
+    output->buffer_max = buffer_max;
+    output->buffer = StringWriter();
+
+    EVP_DigestInit(&output->context, EVP_get_digestbyname(FileHashName(CF_DEFAULT_DIGEST)));
+    return output;
+}
+
+static FILE *OpenOutputFile(const char *filename)
+{
+    FILE *fp = fopen(filename, "w");
+    if (!fp)
+    {
+        Log(LOG_LEVEL_ERR, "Couldn't open '%s' for the agent output. (fopen: %s)", filename, GetErrorStr());
+        return NULL;
+    }
+
+#if !defined(__MINGW32__)
+    /* Don't inherit this file descriptor on fork/exec */
+    fcntl(fileno(fp), F_SETFD, FD_CLOEXEC);
+#endif
+
+    return fp;
+}
+
+static void Spill(ExecOutput *output)
+{
+    output->spill = OpenOutputFile(output->filename);
+    if (!output->spill)
+    {
+        /* Keep buffering, there is nowhere better to put it */
+        output->buffer_max = SIZE_MAX;
+        return;
+    }
+
+    Log(LOG_LEVEL_VERBOSE, "Agent output exceeds %zu bytes, writing it to '%s'",
+        output->buffer_max, output->filename);
+
+    size_t len = StringWriterLength(output->buffer);
+    if (fwrite(StringWriterData(output->buffer), 1, len, output->spill) != len)
+    {
+        output->write_error = true;
+    }
+
+    WriterClose(output->buffer);
+    output->buffer = NULL;
+}
+
+bool ExecOutputClose(ExecOutput *output, bool keep)
+{
+    bool ok = !output->write_error;
+
+    if (output->buffer)
+    {
+        if (keep)
+        {
+            FILE *fp = OpenOutputFile(output->filename);
+            size_t len = StringWriterLength(output->buffer);
+            ok = fp && (fwrite(StringWriterData(output->buffer), 1, len, fp) == len);
+            if (fp && fclose(fp) != 0)
+            {
+                ok = false;
+            }
+        }
+        WriterClose(output->buffer);
+    }
+    else
+    {
+        if (fclose(output->spill) != 0)
+        {
+            ok = false;
+        }
+        if (!keep)
+        {
+            unlink(output->filename);
+        }
+    }
+
+    if (!output->digest)
+    {
+        unsigned char digest[EVP_MAX_MD_SIZE + 1];
+        EVP_DigestFinal(&output->context, digest, NULL);
+    }
+
+    if (keep && !ok)
+    {
+        Log(LOG_LEVEL_ERR, "Couldn't write the agent output to '%s'. (fwrite: %s)", output->filename, GetErrorStr());
+    }
+
+    free(output->digest);
+    free(output->filename);
+    free(output);
+    return ok;
+}
+
+const char *ExecOutputStripTimestamp(const char *line)
+{
+    /* Each digit is the highest allowed in its place */
+    static const char pattern[] = "99-19-39T29:59:59";
+
+    if (line[0] != '2' || line[1] != '0')
+    {
+        return line;
+    }
+
+    for (size_t i = 0; i < sizeof(pattern) - 1; i++)
+    {
+        char c = line[i + 2];
+        if (isdigit((int) pattern[i]) ? (c < '0' || c > pattern[i]) : (c != pattern[i]))
+        {
+            return line;
+        }
+    }
+
+    const char *msg = strstr(line, ": ");
+    return msg ? msg + 2 : line;
+}
+
+void ExecOutputAppendLine(ExecOutput *output, const char *line)
+{
+    assert(output->digest == NULL);
+
+    size_t len = strlen(line);
+
+    if (output->buffer && StringWriterLength(output->buffer) + len + 1 > output->buffer_max)
+    {
+        Spill(output);
+    }
+
+    if (output->buffer)
+    {
+        WriterWriteLen(output->buffer, line, len);
+        WriterWriteChar(output->buffer, '\n');
+    }
+    else if (fwrite(line, 1, len, output->spill) != len || fputc('\n', output->spill) == EOF)
+    {
+        output->write_error = true;
+    }
+
+    const char *msg = ExecOutputStripTimestamp(line);
+    EVP_DigestUpdate(&output->context, msg, len - (msg - line));
+    EVP_DigestUpdate(&output->context, "\n", 1);
+    output->lines++;
+}
+
+size_t ExecOutputLines(const ExecOutput *output)
+{
+    return output->lines;
+}
+
+const char *ExecOutputDigest(ExecOutput *output)
+{
+    if (!output->digest)
+    {
+        unsigned char digest[EVP_MAX_MD_SIZE + 1] = { 0 };
+        char buffer[EVP_MAX_MD_SIZE * 4];
+
+        EVP_DigestFinal(&output->context, digest, NULL);
+        output->digest = xstrdup(HashPrintSafe(CF_DEFAULT_DIGEST, digest, buffer));
+    }
+
+    return output->digest;
+}
+
+bool ExecOutputDigestChanged(ExecOutput *output, const char *digest_file)
+{
+    const char *digest = ExecOutputDigest(output);
+
+    char previous[EVP_MAX_MD_SIZE * 4] = "";
+    FILE *fp = fopen(digest_file, "r");
+    if (fp)
+    {
+        if (!fgets(previous, sizeof(previous), fp))
+        {
+            previous[0] = '\0';
+        }
+        fclose(fp);
+    }
+
+    return strcmp(previous, digest) != 0;
+}
+
+bool ExecOutputStoreDigest(const char *digest, const char *digest_file)
+{
+    FILE *fp = fopen(digest_file, "w");
+    if (!fp)
+    {
+        Log(LOG_LEVEL_ERR, "Couldn't store the digest of the agent output in '%s'. (fopen: %s)", digest_file, GetErrorStr());
+        return false;
+    }
+
+    fputs(digest, fp);
+    if (fclose(fp) != 0)
+    {
+        Log(LOG_LEVEL_ERR, "Couldn't store the digest of the agent output in '%s'. (fclose: %s)", digest_file, GetErrorStr());
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,82 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_EXEC_OUTPUT_H
+#define CFENGINE_EXEC_OUTPUT_H
+
+#include <cf3.defs.h>
+
+/* Output kept in memory before it is spilled to its file */
+#define EXEC_OUTPUT_BUFFER_MAX (1024 * 1024)
+
+typedef struct ExecOutput_ ExecOutput;
+
+/**
+ * @brief Captures the output of an agent run, digesting it as it arrives so
+ *        that it can be told apart from the previous run's without reading
+ *        either back. Timestamps at the start of lines are left out of the
+ *        digest. The output is kept in memory, up to buffer_max bytes, and
+ *        only reaches filename if it is kept once the run is over.
+ */
+ExecOutput *ExecOutputNew(const char *filename, size_t buffer_max);
+
+/**
+ * @brief Frees output, writing it to its file if keep is true and removing
+ *        what was spilled there otherwise.
+ * @return False if the output could not be written.
+ */
+bool ExecOutputClose(ExecOutput *output, bool keep);
+
+void ExecOutputAppendLine(ExecOutput *output, const char *line);
+size_t ExecOutputLines(const ExecOutput *output);
+
+/**
+ * @brief The printable digest of the output so far. No more lines may be
+ *        appended after it is taken.
+ */
+const char *ExecOutputDigest(ExecOutput *output);
+
+/**
+ * @brief Compares the digest of output with the one stored in digest_file.
+ *        Nothing is stored; see ExecOutputStoreDigest().
+ * @return True if the output differs from the one last stored, or if there
+ *         is none.
+ */
+bool ExecOutputDigestChanged(ExecOutput *output, const char *digest_file);
+
+/**
+ * @brief Stores digest in digest_file, for later ExecOutputDigestChanged()
+ *        calls to compare against. Not thread safe.
+ * @return False if the digest could not be written.
+ */
+bool ExecOutputStoreDigest(const char *digest, const char *digest_file);
+
+/**
+ * @brief Skips a log timestamp (LOGGING_TIMESTAMP_REGEX) at the start of
+ *        line, up to and including the ": " after it.
+ */
+const char *ExecOutputStripTimestamp(const char *line);
+
+#endif
@@ -0,0 +1,283 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <exec-schedule.h>
+
+#include <alloc.h>
+#include <env_context.h>
+#include <time_classes.h>
+#include <policy.h>
+#include <files_names.h>
+#include <signals.h>
+
+#ifdef HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
+
+/* Seconds the inputs must be quiet before a change is reported, and the most
+ * an ongoing stream of changes may delay it */
+#define EXEC_WATCH_SETTLE 1
+#define EXEC_WATCH_SETTLE_MAX 30
+
+struct ExecWatch_
+{
+    int fd;
+    StringSet *dirs;
+};
+
+const char *ExecScheduleMatch(const EvalContext *ctx, const StringSet *schedule)
+{
+    StringSetIterator it = StringSetIteratorInit((StringSet *) schedule);
+    const char *time_context = NULL;
+    while ((time_context = StringSetIteratorNext(&it)))
+    {
+        if (IsDefinedClass(ctx, time_context, NULL))
+        {
+            return time_context;
+        }
+    }
+
+    return NULL;
+}
+
+time_t ExecScheduleNextRun(EvalContext *ctx, const StringSet *schedule, time_t from)
+{
+    time_t minute = from - (from % SECONDS_PER_MINUTE);
+    time_t next = 0;
+
+    for (int i = 0; i < EXEC_SCHEDULE_HORIZON; i++, minute += SECONDS_PER_MINUTE)
+    {
+        UpdateTimeClasses(ctx, minute);
+        if (ExecScheduleMatch(ctx, schedule) != NULL)
+        {
+            next = minute;
+            break;
+        }
+    }
+
+    UpdateTimeClasses(ctx, CFSTARTTIME);
+    return next;
+}
+
+/*****************************************************************************/
+
+static int WatchInit(void)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Unable to watch the inputs for changes. (inotify_init1: %s)", GetErrorStr());
+    }
+    return fd;
+#else
+    return -1;
+#endif
+}
+
+ExecWatch *ExecWatchNew(void)
+{
+    ExecWatch *watch = xmalloc(sizeof(ExecWatch));
+    watch->fd = WatchInit();
+    watch->dirs = StringSetNew();
+    return watch;
+}
+
+void ExecWatchDestroy(ExecWatch *watch)
+{
+    if (watch)
+    {
+        if (watch->fd != -1)
+        {
+            close(watch->fd);
+        }
+        StringSetDestroy(watch->dirs);
+        free(watch);
+    }
+}
+
+bool ExecWatchAddDirectory(ExecWatch *watch, const char *dir)
+{
+    if (watch->fd == -1)
+    {
+        return false;
+    }
+
+    if (StringSetContains(watch->dirs, (char *) dir))
+    {
+        return true;
+    }
+
+#ifdef HAVE_SYS_INOTIFY_H
+    uint32_t mask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_ONLYDIR;
+    if (inotify_add_watch(watch->fd, dir, mask) == -1)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Unable to watch '%s' for changes. (inotify_add_watch: %s)", dir, GetErrorStr());
+        return false;
+    }
+#endif
+
+    Log(LOG_LEVEL_DEBUG, "Watching '%s' for changes", dir);
+    StringSetAdd(watch->dirs, xstrdup(dir));
+    return true;
+}
+
+static void WatchFileDirectory(ExecWatch *watch, const char *file)
+{
+    char dir[CF_BUFSIZE];
+    strlcpy(dir, file, sizeof(dir));
+    if (ChopLastNode(dir))
+    {
+        ExecWatchAddDirectory(watch, dir);
+    }
+}
+
+void ExecWatchReset(ExecWatch *watch, const char *input_file, const Policy *policy)
+{
+    /* A fresh instance is the simplest way to drop the old watches */
+    if (watch->fd != -1)
+    {
+        close(watch->fd);
+        watch->fd = WatchInit();
+    }
+    StringSetClear(watch->dirs);
+
+    char inputs_dir[CF_BUFSIZE];
+    if (snprintf(inputs_dir, sizeof(inputs_dir), "%s/inputs", CFWORKDIR) >= (int) sizeof(inputs_dir))
+    {
+        Log(LOG_LEVEL_ERR, "Path to the inputs directory is too long, not watching it");
+    }
+    else
+    {
+        MapName(inputs_dir);
+        ExecWatchAddDirectory(watch, inputs_dir);
+    }
+
+    if (input_file)
+    {
+        WatchFileDirectory(watch, input_file);
+    }
+
+    if (policy)
+    {
+        StringSet *files = PolicySourceFiles(policy);
+        StringSetIterator it = StringSetIteratorInit(files);
+        const char *file = NULL;
+        while ((file = StringSetIteratorNext(&it)))
+        {
+            WatchFileDirectory(watch, file);
+        }
+        StringSetDestroy(files);
+    }
+}
+
+bool ExecWatchIsActive(const ExecWatch *watch)
+{
+    return watch->fd != -1;
+}
+
+/* Reads all pending events, returning whether there were any */
+static bool WatchDrain(int fd)
+{
+    bool any = false;
+    char buf[4096];
+
+    while (read(fd, buf, sizeof(buf)) > 0)
+    {
+        any = true;
+    }
+
+    return any;
+}
+
+static int WatchSelect(int signal_pipe, int fd, time_t timeout, bool *signalled)
+{
+    fd_set rset;
+    FD_ZERO(&rset);
+    int max_fd = -1;
+
+    if (signal_pipe >= 0)
+    {
+        FD_SET(signal_pipe, &rset);
+        max_fd = signal_pipe;
+    }
+    if (fd >= 0)
+    {
+        FD_SET(fd, &rset);
+        max_fd = MAX(max_fd, fd);
+    }
+
+    struct timeval tv = { .tv_sec = timeout, .tv_usec = 0 };
+    int ret = select(max_fd + 1, &rset, NULL, NULL, &tv);
+
+    *signalled = (ret == -1 && errno == EINTR);
+    if (ret > 0 && signal_pipe >= 0 && FD_ISSET(signal_pipe, &rset))
+    {
+        // Empty the signal pipe. We don't need the values.
+        unsigned char sig;
+        while (recv(signal_pipe, &sig, 1, 0) > 0) {}
+        *signalled = true;
+    }
+
+    return ret;
+}
+
+ExecWake ExecWatchWait(ExecWatch *watch, time_t timeout)
+{
+    int signal_pipe = GetSignalPipe();
+    bool signalled;
+
+    int ret = WatchSelect(signal_pipe, watch->fd, MAX(timeout, 0), &signalled);
+    if (signalled)
+    {
+        return EXEC_WAKE_SIGNAL;
+    }
+    if (ret == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Unable to wait for the next run. (select: %s)", GetErrorStr());
+        sleep(MIN(timeout, CFPULSETIME));
+        return EXEC_WAKE_TIMEOUT;
+    }
+    if (ret == 0 || !WatchDrain(watch->fd))
+    {
+        return EXEC_WAKE_TIMEOUT;
+    }
+
+    time_t start = time(NULL);
+    while (time(NULL) - start < EXEC_WATCH_SETTLE_MAX)
+    {
+        if (WatchSelect(signal_pipe, watch->fd, EXEC_WATCH_SETTLE, &signalled) <= 0 || signalled)
+        {
+            break;
+        }
+        if (!WatchDrain(watch->fd))
+        {
+            break;
+        }
+    }
+
+    Log(LOG_LEVEL_VERBOSE, "Changes detected in the inputs");
+    return EXEC_WAKE_INPUTS;
+}
@@ -0,0 +1,89 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_EXEC_SCHEDULE_H
+#define CFENGINE_EXEC_SCHEDULE_H
+
+#include <cf3.defs.h>
+#include <set.h>
+
+/* How far ahead, in minutes, the schedule is searched for the next run */
+#define EXEC_SCHEDULE_HORIZON 60
+
+typedef enum
+{
+    EXEC_WAKE_TIMEOUT,
+    EXEC_WAKE_INPUTS,
+    EXEC_WAKE_SIGNAL
+} ExecWake;
+
+typedef struct ExecWatch_ ExecWatch;
+
+/**
+ * @brief Returns the first schedule class defined at the current time
+ *        classes of ctx, or NULL if none is.
+ */
+const char *ExecScheduleMatch(const EvalContext *ctx, const StringSet *schedule);
+
+/**
+ * @brief Finds the start of the first minute, from the one containing from
+ *        up to EXEC_SCHEDULE_HORIZON minutes ahead, whose time classes define
+ *        one of the schedule classes. Other classes are taken as they are in
+ *        ctx, whose time classes are set for the current time again on return.
+ * @return The start of that minute, or 0 if there is none within the horizon.
+ */
+time_t ExecScheduleNextRun(EvalContext *ctx, const StringSet *schedule, time_t from);
+
+/**
+ * @brief Watches the directories holding the inputs, so that the executor can
+ *        sleep until a run is due and still pick up new policy as soon as it
+ *        lands. Without inotify there is nothing to watch, and ExecWatchWait()
+ *        only times out or returns on signals.
+ */
+ExecWatch *ExecWatchNew(void);
+void ExecWatchDestroy(ExecWatch *watch);
+
+/**
+ * @brief Watches dir, if it is not watched yet.
+ */
+bool ExecWatchAddDirectory(ExecWatch *watch, const char *dir);
+
+/**
+ * @brief Replaces the watched directories with the inputs directory and the
+ *        directories of the input file and of every file of policy.
+ */
+void ExecWatchReset(ExecWatch *watch, const char *input_file, const Policy *policy);
+
+bool ExecWatchIsActive(const ExecWatch *watch);
+
+/**
+ * @brief Waits up to timeout seconds for a signal or a change in the watched
+ *        directories. Changes are only reported once the directories have
+ *        been quiet for a second, so that a policy update being copied in is
+ *        read as a whole.
+ */
+ExecWake ExecWatchWait(ExecWatch *watch, time_t timeout);
+
+#endif
@@ -1135,6 +1135,7 @@ static void GatherPromisedMeasures(EvalContext *ctx, const Policy *policy)
 
     EvalContextClear(ctx);
     GetNameInfo3(ctx, AGENT_TYPE_MONITOR);
+    GetHostnameInfo(ctx);
     GetInterfacesInfo(ctx);
     Get3Environment(ctx, AGENT_TYPE_MONITOR);
     OSClasses(ctx);
@@ -42,6 +42,7 @@
 #include <policy.h>
 #include <audit.h>
 #include <man.h>
+#include <fanout.h>
 
 typedef enum
 {
@@ -62,12 +63,13 @@ static void ThisAgentInit(void);
 static GenericAgentConfig *CheckOpts(EvalContext *ctx, int argc, char **argv);
 
 static void KeepControlPromises(EvalContext *ctx, Policy *policy);
-static int HailServer(EvalContext *ctx, char *host);
+static int HailServer(EvalContext *ctx, char *host, FanoutHost *fanout_host, Writer *out);
+static bool HailHost(FanoutHost *host, const char *name, Writer *out, void *param);
 static int ParseHostname(char *hostname, char *new_hostname);
 static void SendClassData(AgentConnection *conn);
-static void HailExec(EvalContext *ctx, AgentConnection *conn, char *peer, char *recvbuffer, char *sendbuffer);
-static FILE *NewStream(char *name);
-static void DeleteStream(FILE *fp);
+static bool HailExec(AgentConnection *conn, char *peer, char *recvbuffer, char *sendbuffer, Writer *out);
+static Writer *NewStream(char *name, Writer *out);
+static void DeleteStream(Writer *stream, Writer *out);
 
 /*******************************************************************/
 /* Command line options                                            */
@@ -104,6 +106,7 @@ static const struct option OPTIONS[] =
     {"timeout", required_argument, 0, 't'},
     {"legacy-output", no_argument, 0, 'l'},
     {"color", optional_argument, 0, 'C'},
+    {"host-timeout", required_argument, 0, 'T'},
     {NULL, 0, 0, '\0'}
 };
 
@@ -126,6 +129,7 @@ static const char *HINTS[] =
     "Connection timeout, seconds",
     "Use legacy output format",
     "Enable colorized output. Possible values: 'always', 'auto', 'never'. If option is used, the default value is 'auto'",
+    "Seconds each host may take when hailing in parallel, no limit by default",
     NULL
 };
 
@@ -136,6 +140,7 @@ int OUTPUT_TO_FILE = false;
 char OUTPUT_DIRECTORY[CF_BUFSIZE];
 int BACKGROUND = false;
 int MAXCHILD = 50;
+int HOST_TIMEOUT = 0;
 char REMOTE_AGENT_OPTIONS[CF_MAXVARSIZE];
 Attributes RUNATTR = { {0} };
 
@@ -147,13 +152,6 @@ char DEFINECLASSES[CF_MAXVARSIZE];
 
 int main(int argc, char *argv[])
 {
-    Rlist *rp;
-#if !defined(__MINGW32__)
-    int count = 0;
-    int status;
-    int pid;
-#endif
-
     EvalContext *ctx = EvalContextNew();
 
     GenericAgentConfig *config = CheckOpts(ctx, argc, argv);
@@ -174,62 +172,23 @@ int main(int argc, char *argv[])
 /* HvB */
     if (HOSTLIST)
     {
-        rp = HOSTLIST;
+        Writer *out = FileWriter(stdout);
 
-        while (rp != NULL)
+        if (BACKGROUND)     /* parallel */
         {
-
-#ifdef __MINGW32__
-            if (BACKGROUND)
-            {
-                Log(LOG_LEVEL_VERBOSE,
-                      "Windows does not support starting processes in the background - starting in foreground");
-                BACKGROUND = false;
-            }
-#else
-            if (BACKGROUND)     /* parallel */
-            {
-                if (count <= MAXCHILD)
-                {
-                    if (fork() == 0)    /* child process */
-                    {
-                        HailServer(ctx, RlistScalarValue(rp));
-                        exit(0);
-                    }
-                    else        /* parent process */
-                    {
-                        rp = rp->next;
-                        count++;
-                    }
-                }
-                else
-                {
-                    pid = wait(&status);
-                    Log(LOG_LEVEL_DEBUG, "child = %d, child number = %d", pid, count);
-                    count--;
-                }
-            }
-            else                /* serial */
-#endif /* __MINGW32__ */
+            FanoutSummary summary = FanoutRun(HOSTLIST, MAXCHILD, HOST_TIMEOUT, HailHost, ctx, stdout);
+            FanoutSummaryWrite(&summary, out);
+        }
+        else                /* serial */
+        {
+            for (Rlist *rp = HOSTLIST; rp != NULL; rp = rp->next)
             {
-                HailServer(ctx, RlistScalarValue(rp));
-                rp = rp->next;
+                HailServer(ctx, RlistScalarValue(rp), NULL, out);
             }
-        }                       /* end while */
-    }                           /* end if HOSTLIST */
-
-#ifndef __MINGW32__
-    if (BACKGROUND)
-    {
-        Log(LOG_LEVEL_NOTICE, "Waiting for child processes to finish");
-        while (count > 1)
-        {
-            pid = wait(&status);
-            Log(LOG_LEVEL_VERBOSE, "Child %d ended, number %d", pid, count);
-            count--;
         }
-    }
-#endif
+
+        FileWriterDetach(out);
+    }                           /* end if HOSTLIST */
 
     GenericAgentConfigDestroy(config);
 
@@ -248,7 +207,7 @@ static GenericAgentConfig *CheckOpts(EvalContext *ctx, int argc, char **argv)
     DEFINECLASSES[0] = '\0';
     SENDCLASSES[0] = '\0';
 
-    while ((c = getopt_long(argc, argv, "t:q:db:vnKhIif:D:VSxo:s:MH:lC::", OPTIONS, &optindex)) != EOF)
+    while ((c = getopt_long(argc, argv, "t:q:db:vnKhIif:D:VSxo:s:MH:lC::T:", OPTIONS, &optindex)) != EOF)
     {
         switch ((char) c)
         {
@@ -327,6 +286,10 @@ static GenericAgentConfig *CheckOpts(EvalContext *ctx, int argc, char **argv)
             CONNTIMEOUT = atoi(optarg);
             break;
 
+        case 'T':
+            HOST_TIMEOUT = atoi(optarg);
+            break;
+
         case 'V':
             {
                 Writer *w = FileWriter(stdout);
@@ -402,7 +365,14 @@ static void ThisAgentInit(void)
 
 /********************************************************************/
 
-static int HailServer(EvalContext *ctx, char *host)
+static bool HailHost(FanoutHost *host, const char *name, Writer *out, void *param)
+{
+    return HailServer(param, (char *) name, host, out);
+}
+
+/********************************************************************/
+
+static int HailServer(EvalContext *ctx, char *host, FanoutHost *fanout_host, Writer *out)
 {
     AgentConnection *conn;
     char sendbuffer[CF_BUFSIZE], recvbuffer[CF_BUFSIZE], peer[CF_MAXVARSIZE],
@@ -425,7 +395,9 @@ static int HailServer(EvalContext *ctx, char *host)
     Address2Hostkey(ipaddr, digest);
     GetCurrentUserName(user, CF_SMALLBUF);
 
-    if (INTERACTIVE)
+    /* Parallel hails run on worker threads, which must not prompt on stdin:
+     * main() refuses to combine background and interactive mode */
+    if (INTERACTIVE && !BACKGROUND)
     {
         Log(LOG_LEVEL_VERBOSE, "Using interactive key trust...");
 
@@ -476,24 +448,6 @@ static int HailServer(EvalContext *ctx, char *host)
 
 /* Continue */
 
-#ifdef __MINGW32__
-
-    if (LEGACY_OUTPUT)
-    {
-        Log(LOG_LEVEL_INFO, "...........................................................................");
-        Log(LOG_LEVEL_INFO, " * Hailing %s : %u, with options \"%s\" (serial)", peer, fc.portnumber,
-              REMOTE_AGENT_OPTIONS);
-        Log(LOG_LEVEL_INFO, "...........................................................................");
-    }
-    else
-    {
-        Log(LOG_LEVEL_INFO, "Hailing '%s' : %u, with options '%s' (serial)", peer, fc.portnumber,
-            REMOTE_AGENT_OPTIONS);
-    }
-
-
-#else /* !__MINGW32__ */
-
     if (BACKGROUND)
     {
         Log(LOG_LEVEL_INFO, "Hailing '%s' : %u, with options '%s' (parallel)", peer, fc.portnumber,
@@ -515,8 +469,6 @@ static int HailServer(EvalContext *ctx, char *host)
         }
     }
 
-#endif /* !__MINGW32__ */
-
     fc.servers = RlistFromSplitString(peer, '*');
 
     if (fc.servers == NULL || strcmp(RlistScalarValue(fc.servers), "localhost") == 0)
@@ -526,8 +478,9 @@ static int HailServer(EvalContext *ctx, char *host)
     }
     else
     {
+        /* Connections of parallel hails are not cached, they are not shared */
         int err = 0;
-        conn = NewServerConnection(fc, false, &err);
+        conn = NewServerConnection(fc, BACKGROUND, &err);
 
         if (conn == NULL)
         {
@@ -539,11 +492,14 @@ static int HailServer(EvalContext *ctx, char *host)
 
 /* Check trust interaction*/
 
-    HailExec(ctx, conn, peer, recvbuffer, sendbuffer);
+    FanoutHostSetSocket(fanout_host, conn->conn_info.sd);
+    bool ok = HailExec(conn, peer, recvbuffer, sendbuffer, out);
+    FanoutHostSetSocket(fanout_host, -1);
 
+    DisconnectServer(conn);
     RlistDestroy(fc.servers);
 
-    return true;
+    return ok;
 }
 
 /********************************************************************/
@@ -724,11 +680,16 @@ static void SendClassData(AgentConnection *conn)
 
 /********************************************************************/
 
-static void HailExec(EvalContext *ctx, AgentConnection *conn, char *peer, char *recvbuffer, char *sendbuffer)
+/*
+ * @return false if the request could not be sent, or the connection failed
+ *         or was closed before the remote run was over
+ */
+static bool HailExec(AgentConnection *conn, char *peer, char *recvbuffer, char *sendbuffer, Writer *out)
 {
-    FILE *fp = stdout;
+    Writer *stream;
     char *sp;
     int n_read;
+    bool ok = false;
 
     if (strlen(DEFINECLASSES))
     {
@@ -742,11 +703,10 @@ static void HailExec(EvalContext *ctx, AgentConnection *conn, char *peer, char *
     if (SendTransaction(&conn->conn_info, sendbuffer, 0, CF_DONE) == -1)
     {
         Log(LOG_LEVEL_ERR, "Transmission rejected. (send: %s)", GetErrorStr());
-        DisconnectServer(conn);
-        return;
+        return false;
     }
 
-    fp = NewStream(peer);
+    stream = NewStream(peer, out);
     SendClassData(conn);
 
     while (true)
@@ -755,11 +715,13 @@ static void HailExec(EvalContext *ctx, AgentConnection *conn, char *peer, char *
 
         if ((n_read = ReceiveTransaction(&conn->conn_info, recvbuffer, NULL)) == -1)
         {
-            return;
+            Log(LOG_LEVEL_ERR, "Lost connection to '%s' while hailing. (receive: %s)", peer, GetErrorStr());
+            break;
         }
 
         if (n_read == 0)
         {
+            Log(LOG_LEVEL_ERR, "Connection to '%s' closed before the remote run ended", peer);
             break;
         }
 
@@ -770,33 +732,34 @@ static void HailExec(EvalContext *ctx, AgentConnection *conn, char *peer, char *
 
         if ((sp = strstr(recvbuffer, CFD_TERMINATOR)) != NULL)
         {
+            ok = true;
             break;
         }
 
         if ((sp = strstr(recvbuffer, "BAD:")) != NULL)
         {
-            fprintf(fp, "%s> !! %s\n", VPREFIX, recvbuffer + 4);
+            WriterWriteF(stream, "%s> !! %s\n", VPREFIX, recvbuffer + 4);
             continue;
         }
 
         if (strstr(recvbuffer, "too soon"))
         {
-            fprintf(fp, "%s> !! %s\n", VPREFIX, recvbuffer);
+            WriterWriteF(stream, "%s> !! %s\n", VPREFIX, recvbuffer);
             continue;
         }
 
-        fprintf(fp, "%s> -> %s", VPREFIX, recvbuffer);
+        WriterWriteF(stream, "%s> -> %s", VPREFIX, recvbuffer);
     }
 
-    DeleteStream(fp);
-    DisconnectServer(conn);
+    DeleteStream(stream, out);
+    return ok;
 }
 
 /********************************************************************/
 /* Level                                                            */
 /********************************************************************/
 
-static FILE *NewStream(char *name)
+static Writer *NewStream(char *name, Writer *out)
 {
     FILE *fp;
     char filename[CF_BUFSIZE];
@@ -812,28 +775,26 @@ static FILE *NewStream(char *name)
 
     if (OUTPUT_TO_FILE)
     {
-        printf("Opening file...%s\n", filename);
+        WriterWriteF(out, "Opening file...%s\n", filename);
 
         if ((fp = fopen(filename, "w")) == NULL)
         {
             Log(LOG_LEVEL_ERR, "Unable to open file '%s'", filename);
-            fp = stdout;
+            return out;
         }
-    }
-    else
-    {
-        fp = stdout;
+
+        return FileWriter(fp);
     }
 
-    return fp;
+    return out;
 }
 
 /********************************************************************/
 
-static void DeleteStream(FILE *fp)
+static void DeleteStream(Writer *stream, Writer *out)
 {
-    if (fp != stdout)
+    if (stream != out)
     {
-        fclose(fp);
+        WriterClose(stream);
     }
 }
@@ -0,0 +1,303 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <fanout.h>
+
+#include <rlist.h>
+#include <alloc.h>
+#include <logging.h>
+
+/* Worker threads only hail, like the connection threads of cf-serverd */
+#define FANOUT_THREAD_STACK_SIZE (1024 * 1024)
+
+typedef struct Fanout_ Fanout;
+
+struct FanoutHost_
+{
+    Fanout *fanout;
+    const char *name;
+    int sd;                     /* -1 when not connected */
+    double started;
+    double latency;
+    bool running;
+    bool succeeded;
+    bool timed_out;
+};
+
+struct Fanout_
+{
+    FanoutHost *hosts;
+    size_t num_hosts;
+    size_t next;                /* host for the next free worker */
+    size_t done;
+    int timeout;
+    FanoutHailFn hail;
+    void *param;
+    FILE *out;
+    pthread_mutex_t lock;
+    pthread_cond_t host_done;
+    pthread_mutex_t out_lock;
+};
+
+static double FanoutClockMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+void FanoutHostSetSocket(FanoutHost *host, int sd)
+{
+    if (host == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&host->fanout->lock);
+
+    host->sd = sd;
+    if ((sd >= 0) && host->timed_out)
+    {
+        shutdown(sd, SHUT_RDWR);
+    }
+
+    pthread_mutex_unlock(&host->fanout->lock);
+}
+
+static void *FanoutWorker(void *arg)
+{
+    Fanout *fanout = arg;
+
+    while (true)
+    {
+        pthread_mutex_lock(&fanout->lock);
+        if (fanout->next == fanout->num_hosts)
+        {
+            pthread_mutex_unlock(&fanout->lock);
+            break;
+        }
+
+        FanoutHost *host = &fanout->hosts[fanout->next++];
+        host->started = FanoutClockMs();
+        host->running = true;
+        pthread_mutex_unlock(&fanout->lock);
+
+        Writer *out = StringWriter();
+        bool succeeded = fanout->hail(host, host->name, out, fanout->param);
+
+        pthread_mutex_lock(&fanout->out_lock);
+        fwrite(StringWriterData(out), 1, StringWriterLength(out), fanout->out);
+        fflush(fanout->out);
+        pthread_mutex_unlock(&fanout->out_lock);
+
+        WriterClose(out);
+
+        pthread_mutex_lock(&fanout->lock);
+        host->latency = FanoutClockMs() - host->started;
+        host->running = false;
+        host->succeeded = succeeded;
+        if ((fanout->timeout > 0) && (host->latency >= fanout->timeout * 1000.0))
+        {
+            host->timed_out = true;
+        }
+        fanout->done++;
+        pthread_cond_signal(&fanout->host_done);
+        pthread_mutex_unlock(&fanout->lock);
+    }
+
+    return NULL;
+}
+
+/* Shut the connections of hosts past the timeout down, called locked */
+static void FanoutExpire(Fanout *fanout)
+{
+    double now = FanoutClockMs();
+
+    for (size_t i = 0; i < fanout->next; i++)
+    {
+        FanoutHost *host = &fanout->hosts[i];
+
+        if (host->running && !host->timed_out && (now - host->started >= fanout->timeout * 1000.0))
+        {
+            Log(LOG_LEVEL_INFO, "Host '%s' did not finish within %d seconds", host->name, fanout->timeout);
+            host->timed_out = true;
+
+            if (host->sd >= 0)
+            {
+                shutdown(host->sd, SHUT_RDWR);
+            }
+        }
+    }
+}
+
+static int CompareLatencies(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/* Nearest rank */
+static double Percentile(const double *sorted, size_t n, size_t p)
+{
+    if (n == 0)
+    {
+        return 0;
+    }
+
+    size_t rank = (p * n + 99) / 100;
+    return sorted[(rank > 0) ? rank - 1 : 0];
+}
+
+static FanoutSummary FanoutSummarize(const Fanout *fanout)
+{
+    FanoutSummary summary = { .hosts = fanout->num_hosts };
+    double *latencies = xcalloc(fanout->num_hosts + 1, sizeof(double));
+
+    for (size_t i = 0; i < fanout->num_hosts; i++)
+    {
+        const FanoutHost *host = &fanout->hosts[i];
+
+        if (host->timed_out)
+        {
+            summary.timed_out++;
+        }
+        else if (host->succeeded)
+        {
+            summary.succeeded++;
+        }
+        else
+        {
+            summary.failed++;
+        }
+
+        latencies[i] = host->latency;
+    }
+
+    qsort(latencies, fanout->num_hosts, sizeof(double), CompareLatencies);
+
+    summary.latency_p50 = Percentile(latencies, fanout->num_hosts, 50);
+    summary.latency_p90 = Percentile(latencies, fanout->num_hosts, 90);
+    summary.latency_p99 = Percentile(latencies, fanout->num_hosts, 99);
+    summary.latency_max = Percentile(latencies, fanout->num_hosts, 100);
+
+    free(latencies);
+    return summary;
+}
+
+FanoutSummary FanoutRun(const Rlist *hosts, size_t concurrency, int timeout,
+                        FanoutHailFn hail, void *param, FILE *out)
+{
+    Fanout fanout = {
+        .num_hosts = RlistLen(hosts),
+        .timeout = timeout,
+        .hail = hail,
+        .param = param,
+        .out = out,
+    };
+
+    pthread_mutex_init(&fanout.lock, NULL);
+    pthread_cond_init(&fanout.host_done, NULL);
+    pthread_mutex_init(&fanout.out_lock, NULL);
+
+    fanout.hosts = xcalloc(fanout.num_hosts + 1, sizeof(FanoutHost));
+
+    size_t i = 0;
+    for (const Rlist *rp = hosts; rp != NULL; rp = rp->next, i++)
+    {
+        fanout.hosts[i].fanout = &fanout;
+        fanout.hosts[i].name = RlistScalarValue(rp);
+        fanout.hosts[i].sd = -1;
+    }
+
+    size_t num_workers = MIN(MAX(concurrency, 1), fanout.num_hosts);
+    pthread_t *workers = xcalloc(num_workers + 1, sizeof(pthread_t));
+    size_t started = 0;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, FANOUT_THREAD_STACK_SIZE);
+
+    for (; started < num_workers; started++)
+    {
+        int ret = pthread_create(&workers[started], &attr, FanoutWorker, &fanout);
+        if (ret != 0)
+        {
+            Log(LOG_LEVEL_WARNING, "Could only start %zu of %zu workers to hail hosts. (pthread_create: %s)",
+                started, num_workers, GetErrorStrFromCode(ret));
+            break;
+        }
+    }
+
+    pthread_attr_destroy(&attr);
+
+    if (started == 0)
+    {
+        FanoutWorker(&fanout);
+    }
+
+    Log(LOG_LEVEL_VERBOSE, "Hailing %zu hosts, %zu at a time", fanout.num_hosts, MAX(started, 1));
+
+    pthread_mutex_lock(&fanout.lock);
+    while (fanout.done < fanout.num_hosts)
+    {
+        if (timeout > 0)
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += 1;
+
+            pthread_cond_timedwait(&fanout.host_done, &fanout.lock, &ts);
+            FanoutExpire(&fanout);
+        }
+        else
+        {
+            pthread_cond_wait(&fanout.host_done, &fanout.lock);
+        }
+    }
+    pthread_mutex_unlock(&fanout.lock);
+
+    for (size_t j = 0; j < started; j++)
+    {
+        pthread_join(workers[j], NULL);
+    }
+
+    FanoutSummary summary = FanoutSummarize(&fanout);
+
+    free(workers);
+    free(fanout.hosts);
+    pthread_mutex_destroy(&fanout.out_lock);
+    pthread_cond_destroy(&fanout.host_done);
+    pthread_mutex_destroy(&fanout.lock);
+
+    return summary;
+}
+
+void FanoutSummaryWrite(const FanoutSummary *summary, Writer *w)
+{
+    WriterWriteF(w, "Hailed %zu hosts: %zu succeeded, %zu failed, %zu timed out\n",
+                 summary->hosts, summary->succeeded, summary->failed, summary->timed_out);
+    WriterWriteF(w, "Latency: p50 %.0f ms, p90 %.0f ms, p99 %.0f ms, max %.0f ms\n",
+                 summary->latency_p50, summary->latency_p90, summary->latency_p99, summary->latency_max);
+}
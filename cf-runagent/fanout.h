@@ -0,0 +1,79 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_FANOUT_H
+#define CFENGINE_FANOUT_H
+
+#include <cf3.defs.h>
+#include <writer.h>
+
+/*
+ * Hails many hosts from one process: a pool of worker threads, as many as
+ * the concurrency limit, takes the hosts in turn. The output of each host is
+ * collected while it runs and printed in one piece when it is done, so that
+ * hosts do not interleave. Hosts running past the timeout have their
+ * connection shut down.
+ */
+
+typedef struct FanoutHost_ FanoutHost;
+
+/**
+ * @brief Hail one host, called from a worker thread
+ * @param out Output of the host, printed when the host is done
+ * @return false if the host could not be hailed
+ */
+typedef bool (*FanoutHailFn)(FanoutHost *host, const char *name, Writer *out, void *param);
+
+/**
+ * @brief Latencies are in milliseconds, from taking the host to being done
+ */
+typedef struct
+{
+    size_t hosts;
+    size_t succeeded;
+    size_t failed;
+    size_t timed_out;
+    double latency_p50;
+    double latency_p90;
+    double latency_p99;
+    double latency_max;
+} FanoutSummary;
+
+/**
+ * @param concurrency Hosts hailed at the same time
+ * @param timeout Seconds a host may take, 0 for no limit
+ */
+FanoutSummary FanoutRun(const Rlist *hosts, size_t concurrency, int timeout,
+                        FanoutHailFn hail, void *param, FILE *out);
+
+/**
+ * @brief The socket to shut down if the host times out, -1 once it is closed
+ * @note host may be NULL, when hailing outside FanoutRun()
+ */
+void FanoutHostSetSocket(FanoutHost *host, int sd);
+
+void FanoutSummaryWrite(const FanoutSummary *summary, Writer *w);
+
+#endif
@@ -27,6 +27,7 @@
 
 #include <client_code.h>
 #include <server_transform.h>
+#include <server_access.h>
 #include <bootstrap.h>
 #include <scope.h>
 #include <signals.h>
@@ -41,8 +42,11 @@
 #include <known_dirs.h>
 #include <sysinfo.h>
 #include <time_classes.h>
+#include <atexit.h>
 
 static const size_t QUEUESIZE = 50;
+static const time_t STATS_REPORT_INTERVAL = 3600;
+static const size_t SYSLOG_QUEUE_SIZE = 4096;
 int NO_FORK = false;
 
 /*******************************************************************/
@@ -74,6 +78,7 @@ static const struct option OPTIONS[] =
     {"generate-avahi-conf", no_argument, 0, 'A'},
     {"legacy-output", no_argument, 0, 'l'},
     {"color", optional_argument, 0, 'C'},
+    {"log-modules", required_argument, 0, 'g'},
     {NULL, 0, 0, '\0'}
 };
 
@@ -94,9 +99,13 @@ static const char *HINTS[] =
     "Generates avahi configuration file to enable policy server to be discovered in the network",
     "Use legacy output format",
     "Enable colorized output. Possible values: 'always', 'auto', 'never'. If option is used, the default value is 'auto'",
+    "Enable debug logging of specific areas of the implementation, comma separated: all, net, expand",
     NULL
 };
 
+static void AcceptPendingConnections(EvalContext *ctx, int sd);
+static void LogConnectionStats(LogLevel level);
+
 /*******************************************************************/
 
 static void KeepHardClasses(EvalContext *ctx)
@@ -161,6 +170,10 @@ GenericAgentConfig *CheckOpts(int argc, char **argv)
             IGNORELOCK = true;
             break;
 
+        case 'g':
+            LogEnableModulesFromString(optarg);
+            break;
+
         case 'D':
             config->heap_soft = StringSetFromString(optarg, ',');
             break;
@@ -279,11 +292,9 @@ void StartServer(EvalContext *ctx, Policy **policy, GenericAgentConfig *config)
     int ret_val;
     CfLock thislock;
     time_t last_collect = 0;
+    time_t last_stats_report = time(NULL);
     extern int COLLECT_WINDOW;
 
-    struct sockaddr_storage cin;
-    socklen_t addrlen = sizeof(cin);
-
     MakeSignalPipe();
 
     signal(SIGINT, HandleSignalsForDaemon);
@@ -348,15 +359,31 @@ void StartServer(EvalContext *ctx, Policy **policy, GenericAgentConfig *config)
 
     WritePID("cf-serverd.pid");
 
+    /* Worker threads log every request, they should not wait for syslog */
+    LoggingEnableAsyncSystemLog(SYSLOG_QUEUE_SIZE);
+    RegisterAtExitFunction(&LoggingFlushAsyncSystemLog);
+
 /* Andrew Stribblehill <ads@debian.org> -- close sd on exec */
 #ifndef __MINGW32__
     fcntl(sd, F_SETFD, FD_CLOEXEC);
+
+    if (sd != -1)
+    {
+        fcntl(sd, F_SETFL, fcntl(sd, F_GETFL, 0) | O_NONBLOCK);
+    }
 #endif
 
     while (!IsPendingTermination())
     {
         time_t now = time(NULL);
 
+        /* Checked first, as the branches below may start over */
+        if (now - last_stats_report > STATS_REPORT_INTERVAL)
+        {
+            LogConnectionStats(LOG_LEVEL_VERBOSE);
+            last_stats_report = now;
+        }
+
         /* Note that this loop logic is single threaded, but ACTIVE_THREADS
            might still change in threads pertaining to service handling */
 
@@ -397,6 +424,7 @@ void StartServer(EvalContext *ctx, Policy **policy, GenericAgentConfig *config)
 
             int max_fd = (sd > signal_pipe) ? (sd + 1) : (signal_pipe + 1);
             ret_val = select(max_fd, &rset, NULL, NULL, &timeout);
+            int select_errno = errno;
 
             // Empty the signal pipe. We don't need the values.
             unsigned char buf;
@@ -404,6 +432,7 @@ void StartServer(EvalContext *ctx, Policy **policy, GenericAgentConfig *config)
 
             if (ret_val == -1)      /* Error received from call to select */
             {
+                errno = select_errno;
                 if (errno == EINTR)
                 {
                     continue;
@@ -421,24 +450,75 @@ void StartServer(EvalContext *ctx, Policy **policy, GenericAgentConfig *config)
 
             if (FD_ISSET(sd, &rset))
             {
-                Log(LOG_LEVEL_VERBOSE, "Accepting a connection");
+                AcceptPendingConnections(ctx, sd);
+            }
+        }
+    }
 
-                int sd_accepted = accept(sd, (struct sockaddr *) &cin, &addrlen);
-                if (sd_accepted != -1)
-                {
-                    /* Just convert IP address to string, no DNS lookup. */
-                    char ipaddr[CF_MAX_IP_LEN] = "";
-                    getnameinfo((struct sockaddr *) &cin, addrlen,
-                                ipaddr, sizeof(ipaddr),
-                                NULL, 0, NI_NUMERICHOST);
+    LogConnectionStats(LOG_LEVEL_INFO);
+    PolicyDestroy(server_cfengine_policy);
+}
 
-                    ServerEntryPoint(ctx, sd_accepted, ipaddr);
-                }
+/**
+ * @brief Accept every connection waiting in the listen backlog.
+ *
+ * The listening socket is non-blocking, so a burst of agents arriving in the
+ * same splay window is drained in one wakeup instead of one select() round
+ * per client. Admission and dispatch to the worker pool happen in
+ * ServerEntryPoint().
+ */
+static void AcceptPendingConnections(EvalContext *ctx, int sd)
+{
+    for (;;)
+    {
+        struct sockaddr_storage cin;
+        socklen_t addrlen = sizeof(cin);
+
+        int sd_accepted = accept(sd, (struct sockaddr *) &cin, &addrlen);
+        if (sd_accepted == -1)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                Log(LOG_LEVEL_ERR, "accept failed. (accept: %s)", GetErrorStr());
             }
+            return;
+        }
+
+        Log(LOG_LEVEL_VERBOSE, "Accepting a connection");
+
+#ifndef __MINGW32__
+        /* BSD derived systems let accepted sockets inherit O_NONBLOCK, the
+         * session code expects blocking I/O. */
+        int flags = fcntl(sd_accepted, F_GETFL, 0);
+        if (flags != -1 && (flags & O_NONBLOCK))
+        {
+            fcntl(sd_accepted, F_SETFL, flags & ~O_NONBLOCK);
         }
+#endif
+
+        /* Just convert IP address to string, no DNS lookup. */
+        char ipaddr[CF_MAX_IP_LEN] = "";
+        getnameinfo((struct sockaddr *) &cin, addrlen,
+                    ipaddr, sizeof(ipaddr),
+                    NULL, 0, NI_NUMERICHOST);
+
+        ServerEntryPoint(ctx, sd_accepted, ipaddr);
+
+#ifdef __MINGW32__
+        /* Listening socket is blocking here, don't wait for another client. */
+        return;
+#endif
     }
+}
 
-    PolicyDestroy(server_cfengine_policy);
+static void LogConnectionStats(LogLevel level)
+{
+    ServerConnectionStats stats = ServerGetConnectionStats();
+
+    Log(level, "Connections accepted: %lu, served: %lu, rejected as too busy: %lu"
+        " (worker threads: %zu, idle: %zu)",
+        stats.accepted, stats.served, stats.rejected,
+        stats.workers, stats.idle_workers);
 }
 
 /*********************************************************************/
@@ -577,6 +657,9 @@ void CheckFileChanges(EvalContext *ctx, Policy **policy, GenericAgentConfig *con
             DeleteItemList(SV.nonattackerlist);
             DeleteItemList(SV.multiconnlist);
 
+            PathAclDestroy(SV.path_acl);
+            SV.path_acl = NULL;
+
             DeleteAuthList(SV.admit);
             DeleteAuthList(SV.deny);
 
@@ -619,6 +702,7 @@ void CheckFileChanges(EvalContext *ctx, Policy **policy, GenericAgentConfig *con
             }
 
             GetNameInfo3(ctx, AGENT_TYPE_SERVER);
+            GetHostnameInfo(ctx);
             GetInterfacesInfo(ctx);
             Get3Environment(ctx, AGENT_TYPE_SERVER);
             BuiltinClasses(ctx);
@@ -37,10 +37,12 @@
 #include <tls_generic.h>              /* TLSVerifyPeer */
 #include <rlist.h>
 #include <misc_lib.h>
+#include <sequence.h>
 #include <cf-serverd-enterprise-stubs.h>
 #include <audit.h>
 #include <tls_server.h>
 #include <server_common.h>
+#include <server_access.h>
 
 #include <cf-windows-functions.h>
 
@@ -70,7 +72,9 @@ char CFRUNCOMMAND[CF_BUFSIZE] = { 0 };
 
 
 static void SpawnConnection(EvalContext *ctx, int sd_reply, char *ipaddr);
-static void *HandleConnection(ServerConnectionState *conn);
+static bool WorkerPoolSubmit(ServerConnectionState *conn);
+static void *WorkerPoolRun(void *arg);
+static void HandleConnection(ServerConnectionState *conn);
 static int BusyWithClassicConnection(EvalContext *ctx, ServerConnectionState *conn);
 static int VerifyConnection(ServerConnectionState *conn, char buf[CF_BUFSIZE]);
 static int CheckStoreKey(ServerConnectionState *conn, RSA *key);
@@ -84,6 +88,23 @@ static int AuthenticationDialogue(ServerConnectionState *conn, char *recvbuffer,
 
 static int TRIES = 0;
 
+/* Protected by cft_server_children, like ACTIVE_THREADS. */
+static ServerConnectionStats STATS = { 0 };
+static time_t LAST_PROGRESS = 0;
+
+/* Connections admitted by SpawnConnection() and waiting for a worker. */
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    Seq *queue;                 /* of ServerConnectionState */
+    size_t workers;
+    size_t idle;
+} WORKER_POOL = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
 /*******************************************************************/
 
 
@@ -285,9 +306,7 @@ void PurgeOldConnections(Item **list, time_t now)
 static void SpawnConnection(EvalContext *ctx, int sd_accepted, char *ipaddr)
 {
     ServerConnectionState *conn;
-    int ret;
-    pthread_t tid;
-    pthread_attr_t threadattrs;
+    char output[CF_BUFSIZE];
 
     if ((conn = NewConn(ctx, sd_accepted)) == NULL)
     {
@@ -298,106 +317,201 @@ static void SpawnConnection(EvalContext *ctx, int sd_accepted, char *ipaddr)
 
     Log(LOG_LEVEL_VERBOSE, "New connection...(from %s, sd %d)",
         conn->ipaddr, sd_accepted);
-    Log(LOG_LEVEL_VERBOSE, "Spawning new thread...");
 
-    ret = pthread_attr_init(&threadattrs);
+    /* Admission control: ACTIVE_THREADS counts both the sessions being
+     * served and the ones waiting for a free worker. */
+    if (!ThreadLock(cft_server_children))
+    {
+        DeleteConn(conn);
+        return;
+    }
+
+    if (ACTIVE_THREADS >= CFD_MAXPROCESSES)
+    {
+        STATS.rejected++;
+
+        /* When to say we're hung / apoptosis threshold: being saturated is
+         * fine as long as sessions keep completing, give up only when none
+         * has made progress for as long as a session may block on a read. */
+        if (TRIES++ > MAXTRIES &&
+            time(NULL) - LAST_PROGRESS > CONNTIMEOUT * 20)
+        {
+            Log(LOG_LEVEL_ERR, "Server seems to be paralyzed. DOS attack? Committing apoptosis...");
+            FatalError(conn->ctx, "Terminating");
+        }
+
+        ThreadUnlock(cft_server_children);
+
+        Log(LOG_LEVEL_ERR, "Too many connections (>=%d) -- increase server maxconnections?", CFD_MAXPROCESSES);
+        snprintf(output, CF_BUFSIZE, "BAD: Server is currently too busy -- increase maxconnections or splaytime?");
+        SendTransaction(&conn->conn_info, output, 0, CF_DONE);
+        DeleteConn(conn);
+        return;
+    }
+
+    if (ACTIVE_THREADS++ == 0)
+    {
+        LAST_PROGRESS = time(NULL);
+    }
+    STATS.accepted++;
+    ThreadUnlock(cft_server_children);
+
+    if (!WorkerPoolSubmit(conn))
+    {
+        Log(LOG_LEVEL_WARNING, "Thread is being handled from main loop!");
+        HandleConnection(conn);
+    }
+}
+
+/*********************************************************************/
+
+/**
+ * @brief Start one more pool worker. Called with WORKER_POOL.lock held.
+ */
+static bool WorkerPoolGrow(void)
+{
+    pthread_t tid;
+    pthread_attr_t threadattrs;
+
+    int ret = pthread_attr_init(&threadattrs);
     if (ret != 0)
     {
         Log(LOG_LEVEL_ERR,
-            "SpawnConnection: Unable to initialize thread attributes (%s)",
+            "WorkerPoolGrow: Unable to initialize thread attributes (%s)",
             GetErrorStr());
-        goto err2;
+        return false;
     }
     ret = pthread_attr_setdetachstate(&threadattrs, PTHREAD_CREATE_DETACHED);
     if (ret != 0)
     {
         Log(LOG_LEVEL_ERR,
-            "SpawnConnection: Unable to set thread to detached state (%s).",
+            "WorkerPoolGrow: Unable to set thread to detached state (%s).",
             GetErrorStr());
-        goto err1;
+        pthread_attr_destroy(&threadattrs);
+        return false;
     }
     ret = pthread_attr_setstacksize(&threadattrs, 1024 * 1024);
     if (ret != 0)
     {
         Log(LOG_LEVEL_WARNING,
-            "SpawnConnection: Unable to set thread stack size (%s).",
+            "WorkerPoolGrow: Unable to set thread stack size (%s).",
             GetErrorStr());
         /* Continue with default thread stack size. */
     }
 
-    ret = pthread_create(&tid, &threadattrs,
-                         (void *(*)(void *)) HandleConnection, conn);
+    ret = pthread_create(&tid, &threadattrs, WorkerPoolRun, NULL);
+    pthread_attr_destroy(&threadattrs);
     if (ret != 0)
     {
         errno = ret;
         Log(LOG_LEVEL_ERR,
             "Unable to spawn worker thread. (pthread_create: %s)",
             GetErrorStr());
-        goto err1;
+        return false;
     }
 
-  err1:
-    pthread_attr_destroy(&threadattrs);
-  err2:
-    if (ret != 0)
+    WORKER_POOL.workers++;
+    Log(LOG_LEVEL_VERBOSE, "Started server worker thread %zu", WORKER_POOL.workers);
+    return true;
+}
+
+/**
+ * @brief Queue an admitted connection for the worker pool.
+ *
+ * Workers are long-lived: they are started on demand, never more than
+ * maxconnections of them, and then block waiting for the next connection
+ * instead of exiting, so a burst of agents does not cost one thread
+ * creation (and one fresh 1 MB stack) per client.
+ *
+ * @return false if no worker could be started, the caller then has to
+ *         handle the connection itself.
+ */
+static bool WorkerPoolSubmit(ServerConnectionState *conn)
+{
+    pthread_mutex_lock(&WORKER_POOL.lock);
+
+    if (WORKER_POOL.queue == NULL)
     {
-        Log(LOG_LEVEL_WARNING, "Thread is being handled from main loop!");
-        HandleConnection(conn);
+        WORKER_POOL.queue = SeqNew(CFD_MAXPROCESSES, NULL);
     }
-}
 
-/*********************************************************************/
+    /* Idle workers only stop counting as idle once they get the lock back,
+     * so those already claimed by queued connections are not free */
+    if (SeqLength(WORKER_POOL.queue) >= WORKER_POOL.idle &&
+        WORKER_POOL.workers < (size_t) CFD_MAXPROCESSES &&
+        !WorkerPoolGrow() && WORKER_POOL.workers == 0)
+    {
+        pthread_mutex_unlock(&WORKER_POOL.lock);
+        return false;
+    }
 
-void DisableSendDelays(int sockfd)
-{
-    int yes = 1;
+    SeqAppend(WORKER_POOL.queue, conn);
+    pthread_cond_signal(&WORKER_POOL.cond);
 
-    if (setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, (void *) &yes, sizeof(yes)) == -1)
+    pthread_mutex_unlock(&WORKER_POOL.lock);
+    return true;
+}
+
+static void *WorkerPoolRun(ARG_UNUSED void *arg)
+{
+    for (;;)
     {
-        Log(LOG_LEVEL_INFO, "Unable to disable Nagle algorithm, expect performance problems. (setsockopt(TCP_NODELAY): %s)", GetErrorStr());
+        pthread_mutex_lock(&WORKER_POOL.lock);
+
+        WORKER_POOL.idle++;
+        while (SeqLength(WORKER_POOL.queue) == 0)
+        {
+            pthread_cond_wait(&WORKER_POOL.cond, &WORKER_POOL.lock);
+        }
+        WORKER_POOL.idle--;
+
+        ServerConnectionState *conn = SeqAt(WORKER_POOL.queue, 0);
+        SeqSoftRemove(WORKER_POOL.queue, 0);
+
+        pthread_mutex_unlock(&WORKER_POOL.lock);
+
+        HandleConnection(conn);
     }
+
+    return NULL;
 }
 
 /*********************************************************************/
 
-static void *HandleConnection(ServerConnectionState *conn)
+ServerConnectionStats ServerGetConnectionStats(void)
 {
-    int ret;
-    char output[CF_BUFSIZE];
+    ServerConnectionStats stats = { 0 };
 
-    if (!ThreadLock(cft_server_children))
+    if (ThreadLock(cft_server_children))
     {
-        DeleteConn(conn);
-        return NULL;
+        stats = STATS;
+        ThreadUnlock(cft_server_children);
     }
 
-    ACTIVE_THREADS++;
+    pthread_mutex_lock(&WORKER_POOL.lock);
+    stats.workers = WORKER_POOL.workers;
+    stats.idle_workers = WORKER_POOL.idle;
+    pthread_mutex_unlock(&WORKER_POOL.lock);
 
-    if (ACTIVE_THREADS >= CFD_MAXPROCESSES)
-    {
-        ACTIVE_THREADS--;
+    return stats;
+}
 
-        if (TRIES++ > MAXTRIES) /* When to say we're hung / apoptosis threshold */
-        {
-            Log(LOG_LEVEL_ERR, "Server seems to be paralyzed. DOS attack? Committing apoptosis...");
-            FatalError(conn->ctx, "Terminating");
-        }
+/*********************************************************************/
 
-        if (!ThreadUnlock(cft_server_children))
-        {
-        }
+void DisableSendDelays(int sockfd)
+{
+    int yes = 1;
 
-        Log(LOG_LEVEL_ERR, "Too many threads (>=%d) -- increase server maxconnections?", CFD_MAXPROCESSES);
-        snprintf(output, CF_BUFSIZE, "BAD: Server is currently too busy -- increase maxconnections or splaytime?");
-        SendTransaction(&conn->conn_info, output, 0, CF_DONE);
-        DeleteConn(conn);
-        return NULL;
-    }
-    else
+    if (setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, (void *) &yes, sizeof(yes)) == -1)
     {
-        ThreadUnlock(cft_server_children);
+        Log(LOG_LEVEL_INFO, "Unable to disable Nagle algorithm, expect performance problems. (setsockopt(TCP_NODELAY): %s)", GetErrorStr());
     }
+}
+
+/*********************************************************************/
 
+static void ServeConnection(ServerConnectionState *conn)
+{
     TRIES = 0;                  /* As long as there is activity, we're not stuck */
 
     DisableSendDelays(conn->conn_info.sd);
@@ -408,11 +522,10 @@ static void *HandleConnection(ServerConnectionState *conn)
     SetReceiveTimeout(conn->conn_info.sd, &tv);
 
     /* Decide the protocol used. */
-    ret = ServerTLSPeek(&conn->conn_info);
+    int ret = ServerTLSPeek(&conn->conn_info);
     if (ret == -1)
     {
-        DeleteConn(conn);
-        return NULL;
+        return;
     }
 
     switch (conn->conn_info.type)
@@ -431,8 +544,7 @@ static void *HandleConnection(ServerConnectionState *conn)
         ret = ServerTLSSessionEstablish(conn);
         if (ret == -1)
         {
-            DeleteConn(conn);
-            return NULL;
+            return;
         }
 
         while (BusyWithNewProtocol(conn->ctx, conn))
@@ -446,23 +558,23 @@ static void *HandleConnection(ServerConnectionState *conn)
                         conn->conn_info.type);
     }
 
-    Log(LOG_LEVEL_INFO, "Connection from %s is closed, terminating thread",
-        conn->ipaddr);
-
-    if (!ThreadLock(cft_server_children))
-    {
-        DeleteConn(conn);
-        return NULL;
-    }
+    Log(LOG_LEVEL_INFO, "Connection from %s is closed", conn->ipaddr);
+}
 
-    ACTIVE_THREADS--;
+static void HandleConnection(ServerConnectionState *conn)
+{
+    ServeConnection(conn);
 
-    if (!ThreadUnlock(cft_server_children))
+    if (ThreadLock(cft_server_children))
     {
+        ACTIVE_THREADS--;
+        STATS.served++;
+        TRIES = 0;
+        LAST_PROGRESS = time(NULL);
+        ThreadUnlock(cft_server_children);
     }
 
     DeleteConn(conn);
-    return NULL;
 }
 
 /*********************************************************************/
@@ -1709,6 +1821,7 @@ static void DeleteConn(ServerConnectionState *conn)
     cf_closesocket(conn->conn_info.sd);
 
     free(conn->session_key);
+    AccessCacheDestroy(conn->access_cache);
 
     if (conn->conn_info.remote_key != NULL)
     {
@@ -37,6 +37,8 @@
 //*******************************************************************
 
 typedef struct Auth_ Auth;
+typedef struct PathAcl_ PathAcl;                 /* server_access.h */
+typedef struct AccessCache_ AccessCache;
 
 struct Auth_
 {
@@ -69,6 +71,8 @@ typedef struct
     Auth *deny;
     Auth *denytop;
 
+    PathAcl *path_acl;                 /* admit and deny, compiled */
+
     Auth *varadmit;
     Auth *varadmittop;
 
@@ -107,6 +111,7 @@ struct ServerConnectionState_
     int maproot;
     unsigned char *session_key;
     char encryption_type;
+    AccessCache *access_cache;
 };
 
 typedef struct
@@ -118,11 +123,27 @@ typedef struct
     char *replyfile;
 } ServerFileGetState;
 
+/**
+ * @brief Connection counters, for sizing maxconnections on busy hubs.
+ * @member accepted Connections admitted and handed to the worker pool
+ * @member served Admitted connections that have been closed
+ * @member rejected Connections refused because maxconnections was reached
+ */
+typedef struct
+{
+    unsigned long accepted;
+    unsigned long served;
+    unsigned long rejected;
+    size_t workers;
+    size_t idle_workers;
+} ServerConnectionStats;
+
 
 void KeepPromises(EvalContext *ctx, Policy *policy, GenericAgentConfig *config);
 void ServerEntryPoint(EvalContext *ctx, int sd_reply, char *ipaddr);
 void DeleteAuthList(Auth *ap);
 void PurgeOldConnections(Item **list, time_t now);
+ServerConnectionStats ServerGetConnectionStats(void);
 
 
 AgentConnection *ExtractCallBackChannel(ServerConnectionState *conn);
@@ -0,0 +1,429 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <server_access.h>
+
+#include <item_lib.h>                                      /* IsMatchItemIn */
+#include <matching.h>                                      /* IsRegexItemIn */
+#include <conversion.h>                                    /* MapAddress */
+#include <files_names.h>
+#include <map.h>
+#include <string_lib.h>
+
+#define ACL_NO_RULE ((size_t) -1)
+
+/* Directories remembered per connection, before starting over */
+#define ACCESS_CACHE_MAX 4096
+
+typedef struct AclNode_ AclNode;
+
+struct AclNode_
+{
+    char c;
+    size_t rule;                /* lowest admit rule whose path ends here */
+    AclNode **children;         /* sorted by c */
+    size_t num_children;
+};
+
+struct PathAcl_
+{
+    unsigned long generation;
+    const Auth **rules;
+    char **paths;               /* rule paths after MapName() */
+    size_t num_rules;
+    size_t root_rule;           /* lowest rule for "/", which covers everything */
+    AclNode *root;
+    const Auth *deny;
+};
+
+typedef struct
+{
+    bool hosts_checked;
+    bool access;
+    bool maproot;
+} AclRuleState;
+
+/* The rules that may cover the files of a directory, in the order given */
+typedef struct
+{
+    size_t count;
+    size_t rules[];
+} AclCandidates;
+
+struct AccessCache_
+{
+    unsigned long generation;
+    AclRuleState *rules;
+    int denied;                 /* -1 until checked */
+    Map *candidates;            /* resolved directory -> AclCandidates */
+};
+
+static unsigned long PATH_ACL_GENERATIONS = 0;
+
+/*******************************************************************/
+
+static AclNode *AclNodeNew(char c)
+{
+    AclNode *node = xcalloc(1, sizeof(AclNode));
+    node->c = c;
+    node->rule = ACL_NO_RULE;
+    return node;
+}
+
+static void AclNodeDestroy(AclNode *node)
+{
+    for (size_t i = 0; i < node->num_children; i++)
+    {
+        AclNodeDestroy(node->children[i]);
+    }
+    free(node->children);
+    free(node);
+}
+
+/* Index of the child for c, or where it would be inserted */
+static size_t AclNodeSearch(const AclNode *node, char c)
+{
+    size_t low = 0, high = node->num_children;
+
+    while (low < high)
+    {
+        size_t mid = (low + high) / 2;
+        if (node->children[mid]->c < c)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+static const AclNode *AclNodeFind(const AclNode *node, char c)
+{
+    size_t i = AclNodeSearch(node, c);
+    return (i < node->num_children && node->children[i]->c == c) ? node->children[i] : NULL;
+}
+
+static AclNode *AclNodeAdd(AclNode *node, char c)
+{
+    size_t i = AclNodeSearch(node, c);
+    if (i < node->num_children && node->children[i]->c == c)
+    {
+        return node->children[i];
+    }
+
+    node->children = xrealloc(node->children, (node->num_children + 1) * sizeof(AclNode *));
+    memmove(node->children + i + 1, node->children + i, (node->num_children - i) * sizeof(AclNode *));
+    node->num_children++;
+
+    node->children[i] = AclNodeNew(c);
+    return node->children[i];
+}
+
+/*******************************************************************/
+
+PathAcl *PathAclCompile(const Auth *admit, const Auth *deny)
+{
+    PathAcl *acl = xcalloc(1, sizeof(PathAcl));
+
+    acl->generation = ++PATH_ACL_GENERATIONS;
+    acl->root_rule = ACL_NO_RULE;
+    acl->root = AclNodeNew('\0');
+    acl->deny = deny;
+
+    for (const Auth *ap = admit; ap != NULL; ap = ap->next)
+    {
+        acl->num_rules++;
+    }
+
+    acl->rules = xcalloc(acl->num_rules, sizeof(Auth *));
+    acl->paths = xcalloc(acl->num_rules, sizeof(char *));
+
+    size_t i = 0;
+    for (const Auth *ap = admit; ap != NULL; ap = ap->next, i++)
+    {
+        acl->rules[i] = ap;
+        acl->paths[i] = MapName(xstrdup(ap->path));
+
+        if (strcmp(acl->paths[i], "/") == 0)
+        {
+            if (acl->root_rule == ACL_NO_RULE)
+            {
+                acl->root_rule = i;
+            }
+            continue;
+        }
+
+        AclNode *node = acl->root;
+        for (const char *c = acl->paths[i]; *c != '\0'; c++)
+        {
+            node = AclNodeAdd(node, *c);
+        }
+
+        /* Of two rules for the same path, the first one always wins */
+        if (node->rule == ACL_NO_RULE)
+        {
+            node->rule = i;
+        }
+    }
+
+    Log(LOG_LEVEL_VERBOSE, "Compiled %zu admit rules for file access", acl->num_rules);
+    return acl;
+}
+
+void PathAclDestroy(PathAcl *acl)
+{
+    if (acl != NULL)
+    {
+        for (size_t i = 0; i < acl->num_rules; i++)
+        {
+            free(acl->paths[i]);
+        }
+        free(acl->paths);
+        free(acl->rules);
+        AclNodeDestroy(acl->root);
+        free(acl);
+    }
+}
+
+/*
+ * The rules whose path is the path itself or one of its parent directories,
+ * in the order they were given. Returns how many were stored in rules, which
+ * must have room for strlen(path) + 1 of them.
+ */
+static size_t PathAclCandidates(const PathAcl *acl, const char *path, size_t *rules)
+{
+    size_t count = 0;
+
+    if (acl->root_rule != ACL_NO_RULE)
+    {
+        rules[count++] = acl->root_rule;
+    }
+
+    const AclNode *node = acl->root;
+    for (const char *c = path; (*c != '\0') && (node != NULL); c++)
+    {
+        node = AclNodeFind(node, *c);
+
+        if ((node != NULL) && (node->rule != ACL_NO_RULE) && ((c[1] == '\0') || (c[1] == FILE_SEPARATOR)))
+        {
+            rules[count++] = node->rule;
+        }
+    }
+
+    for (size_t i = 1; i < count; i++)
+    {
+        size_t rule = rules[i], j = i;
+        for (; (j > 0) && (rules[j - 1] > rule); j--)
+        {
+            rules[j] = rules[j - 1];
+        }
+        rules[j] = rule;
+    }
+
+    return count;
+}
+
+/* Whether some rule path goes on below dir, which ends with a separator */
+static bool PathAclHasRulesBelow(const PathAcl *acl, const char *dir)
+{
+    const AclNode *node = acl->root;
+    for (const char *c = dir; (*c != '\0') && (node != NULL); c++)
+    {
+        node = AclNodeFind(node, *c);
+    }
+
+    return (node != NULL) && (node->num_children > 0);
+}
+
+/*******************************************************************/
+
+AccessCache *AccessCacheNew(void)
+{
+    AccessCache *cache = xcalloc(1, sizeof(AccessCache));
+
+    cache->denied = -1;
+    cache->candidates = MapNew((MapHashFn) StringHash, (MapKeyEqualFn) StringSafeEqual, free, free);
+
+    return cache;
+}
+
+void AccessCacheDestroy(AccessCache *cache)
+{
+    if (cache != NULL)
+    {
+        free(cache->rules);
+        MapDestroy(cache->candidates);
+        free(cache);
+    }
+}
+
+/* Forget what was learnt about the rules of another policy */
+static void AccessCacheSync(AccessCache *cache, const PathAcl *acl)
+{
+    if (cache->generation != acl->generation)
+    {
+        free(cache->rules);
+        cache->rules = xcalloc(acl->num_rules, sizeof(AclRuleState));
+        cache->denied = -1;
+        MapClear(cache->candidates);
+        cache->generation = acl->generation;
+    }
+}
+
+/*
+ * Rule paths are checked on every request, as they were before they were
+ * compiled, since they may come and go while the connection lasts.
+ */
+static bool PathAclRuleExists(const PathAcl *acl, size_t rule)
+{
+    struct stat statbuf;
+
+    if (stat(acl->paths[rule], &statbuf) == -1)
+    {
+        Log(LOG_LEVEL_INFO,
+            "Warning cannot stat file object %s in admit/grant, or access list refers to dangling link",
+            acl->paths[rule]);
+        return false;
+    }
+
+    return true;
+}
+
+static AclCandidates *AclCandidatesNew(const PathAcl *acl, const char *path)
+{
+    AclCandidates *candidates = xmalloc(sizeof(AclCandidates) + (strlen(path) + 1) * sizeof(size_t));
+    candidates->count = PathAclCandidates(acl, path, candidates->rules);
+    return candidates;
+}
+
+AccessDecision AccessCacheDecide(AccessCache *cache, const PathAcl *acl, EvalContext *ctx,
+                                 const char *path, const char *ipaddr, const char *hostname)
+{
+    AccessCacheSync(cache, acl);
+
+    /*
+     * Every file in a directory is covered by the same rules, unless some
+     * rule names a path below the directory. The directory is the one path
+     * was just resolved to, never one remembered from an earlier request.
+     */
+    char dir[CF_BUFSIZE] = "";
+    const char *sep = strrchr(path, FILE_SEPARATOR);
+
+    if ((sep != NULL) && (sep[1] != '\0') && (sep - path + 1 < sizeof(dir)))
+    {
+        memcpy(dir, path, sep - path + 1);
+        dir[sep - path + 1] = '\0';
+
+        if (PathAclHasRulesBelow(acl, dir))
+        {
+            dir[0] = '\0';
+        }
+    }
+
+    AclCandidates *candidates = (dir[0] != '\0') ? MapGet(cache->candidates, dir) : NULL;
+    AclCandidates *uncached = NULL;
+
+    if (candidates == NULL)
+    {
+        candidates = AclCandidatesNew(acl, path);
+
+        if (dir[0] != '\0')
+        {
+            if (MapSize(cache->candidates) >= ACCESS_CACHE_MAX)
+            {
+                MapClear(cache->candidates);
+            }
+
+            MapInsert(cache->candidates, xstrdup(dir), candidates);
+        }
+        else
+        {
+            uncached = candidates;
+        }
+    }
+
+    size_t rule = ACL_NO_RULE;
+    for (size_t i = 0; i < candidates->count; i++)
+    {
+        if (PathAclRuleExists(acl, candidates->rules[i]))
+        {
+            rule = candidates->rules[i];
+            break;
+        }
+    }
+
+    free(uncached);
+
+    AccessDecision decision = { NULL, NULL, false, false };
+
+    if (rule == ACL_NO_RULE)
+    {
+        return decision;
+    }
+
+    AclRuleState *state = &cache->rules[rule];
+    const Auth *ap = acl->rules[rule];
+
+    if (!state->hosts_checked)
+    {
+        state->maproot = IsMatchItemIn(ctx, ap->maproot, MapAddress(ipaddr)) ||
+            IsRegexItemIn(ctx, ap->maproot, (char *) hostname);
+        state->access = IsMatchItemIn(ctx, ap->accesslist, MapAddress(ipaddr)) ||
+            IsRegexItemIn(ctx, ap->accesslist, (char *) hostname);
+        state->hosts_checked = true;
+    }
+
+    decision.rule = ap;
+    decision.rule_path = acl->paths[rule];
+    decision.access = state->access;
+    decision.maproot = state->maproot;
+    return decision;
+}
+
+bool AccessCacheDenied(AccessCache *cache, const PathAcl *acl, EvalContext *ctx, const char *hostname)
+{
+    AccessCacheSync(cache, acl);
+
+    /* Deny rules apply to whatever the admit rules grant, whatever their path */
+    if (cache->denied == -1)
+    {
+        cache->denied = false;
+
+        for (const Auth *ap = acl->deny; ap != NULL; ap = ap->next)
+        {
+            if (IsRegexItemIn(ctx, ap->accesslist, (char *) hostname))
+            {
+                cache->denied = true;
+                break;
+            }
+        }
+    }
+
+    return cache->denied;
+}
@@ -0,0 +1,82 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_SERVER_ACCESS_H
+#define CFENGINE_SERVER_ACCESS_H
+
+#include <cf3.defs.h>
+#include <server.h>                                    /* Auth, PathAcl */
+
+/*
+ * The admit rules for file paths, compiled when the policy is loaded into a
+ * trie over the rule paths, so that the rules covering a request are found
+ * by walking the request once instead of comparing it with every rule.
+ *
+ * What a connection learns about the rules is kept in its AccessCache:
+ * whether the host is in each rule's access and maproot lists, whether it is
+ * denied, and which rules may cover each resolved directory it has asked
+ * for, so that the siblings of a file cost a single lookup. Requested paths
+ * are resolved, and rule paths checked, afresh on every request.
+ */
+
+/**
+ * @brief The admit rule covering a path, and what it grants the host
+ * @member rule The first admit rule that covers the path and exists, or NULL
+ * @member rule_path Its path after MapName()
+ * @member access Whether the host is in the rule's access list
+ * @member maproot Whether the host is in the rule's maproot list
+ */
+typedef struct
+{
+    const Auth *rule;
+    const char *rule_path;
+    bool access;
+    bool maproot;
+} AccessDecision;
+
+/**
+ * @brief Compile the admit rules, in order, and keep the deny rules
+ * @note Both lists must outlive the compiled result
+ */
+PathAcl *PathAclCompile(const Auth *admit, const Auth *deny);
+void PathAclDestroy(PathAcl *acl);
+
+AccessCache *AccessCacheNew(void);
+void AccessCacheDestroy(AccessCache *cache);
+
+/**
+ * @brief Find the admit rule covering a resolved path, like the first rule
+ *        in SV.admit whose path is the path itself, a parent directory of it
+ *        or "/", skipping rules whose path does not exist
+ */
+AccessDecision AccessCacheDecide(AccessCache *cache, const PathAcl *acl, EvalContext *ctx,
+                                 const char *path, const char *ipaddr, const char *hostname);
+
+/**
+ * @brief Whether a deny rule lists the host
+ */
+bool AccessCacheDenied(AccessCache *cache, const PathAcl *acl, EvalContext *ctx, const char *hostname);
+
+#endif
@@ -27,6 +27,7 @@ static const int CF_NOSIZE = -1;
 
 
 #include <server_common.h>
+#include <server_access.h>
 
 #include <item_lib.h>
 #include <string_lib.h>                                    /* ToLower */
@@ -42,6 +43,7 @@ static const int CF_NOSIZE = -1;
 #include <classic.h>                  /* SendSocketStream */
 #include <net.h>                      /* SendTransaction,ReceiveTransaction */
 #include <tls_generic.h>              /* TLSSend */
+#include <file_lib.h>                 /* FullRead */
 #include <rlist.h>
 #include <cf-serverd-enterprise-stubs.h>
 
@@ -136,20 +138,28 @@ bool ResolveFilename(const char *req_path, char *res_path)
     return true;
 }
 
+/*
+ * The admit rules are compiled into SV.path_acl when the policy is loaded,
+ * and what this connection has already learnt about them is remembered in
+ * conn->access_cache, see server_access.h.
+ */
 int AccessControl(EvalContext *ctx, const char *req_path, ServerConnectionState *conn, int encrypt)
 {
-    Auth *ap;
     int access = false;
     char transrequest[CF_BUFSIZE];
     struct stat statbuf;
     char translated_req_path[CF_BUFSIZE];
-    char transpath[CF_BUFSIZE];
 
 /*
  * /var/cfengine -> $workdir translation.
  */
     TranslatePath(translated_req_path, req_path);
 
+    if (conn->access_cache == NULL)
+    {
+        conn->access_cache = AccessCacheNew();
+    }
+
     if (ResolveFilename(translated_req_path, transrequest))
     {
         Log(LOG_LEVEL_VERBOSE, "Filename %s is resolved to %s", translated_req_path, transrequest);
@@ -158,6 +168,7 @@ int AccessControl(EvalContext *ctx, const char *req_path, ServerConnectionState
     {
         Log(LOG_LEVEL_INFO, "Couldn't resolve (realpath: %s) filename: %s",
             GetErrorStr(), translated_req_path);
+        return false;
     }
 
     if (lstat(transrequest, &statbuf) == -1)
@@ -169,7 +180,7 @@ int AccessControl(EvalContext *ctx, const char *req_path, ServerConnectionState
 
     Log(LOG_LEVEL_DEBUG, "AccessControl, match (%s,%s) encrypt request = %d", transrequest, conn->hostname, encrypt);
 
-    if (SV.admit == NULL)
+    if ((SV.admit == NULL) || (SV.path_acl == NULL))
     {
         Log(LOG_LEVEL_INFO, "cf-serverd access list is empty, no files are visible");
         return false;
@@ -177,82 +188,37 @@ int AccessControl(EvalContext *ctx, const char *req_path, ServerConnectionState
 
     conn->maproot = false;
 
-    for (ap = SV.admit; ap != NULL; ap = ap->next)
-    {
-        int res = false;
-
-        Log(LOG_LEVEL_DEBUG, "Examining rule in access list (%s,%s)", transrequest, ap->path);
+    AccessDecision decision = AccessCacheDecide(conn->access_cache, SV.path_acl, ctx, transrequest,
+                                                conn->ipaddr, conn->hostname);
 
-        strncpy(transpath, ap->path, CF_BUFSIZE - 1);
-        MapName(transpath);
-
-        if ((strlen(transrequest) > strlen(transpath)) && (strncmp(transpath, transrequest, strlen(transpath)) == 0)
-            && (transrequest[strlen(transpath)] == FILE_SEPARATOR))
-        {
-            res = true;         /* Substring means must be a / to link, else just a substring og filename */
-        }
-
-        /* Exact match means single file to admit */
-
-        if (strcmp(transpath, transrequest) == 0)
-        {
-            res = true;
-        }
+    if (decision.rule != NULL)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Found a matching rule in access list (%s in %s)", transrequest, decision.rule_path);
 
-        if (strcmp(transpath, "/") == 0)
+        if ((!encrypt) && (decision.rule->encrypt == true))
         {
-            res = true;
+            Log(LOG_LEVEL_ERR, "File %s requires encrypt connection...will not serve", decision.rule_path);
+            access = false;
         }
-
-        if (res)
+        else
         {
-            Log(LOG_LEVEL_VERBOSE, "Found a matching rule in access list (%s in %s)", transrequest, transpath);
-
-            if (stat(transpath, &statbuf) == -1)
+            if (decision.maproot)
             {
-                Log(LOG_LEVEL_INFO,
-                      "Warning cannot stat file object %s in admit/grant, or access list refers to dangling link\n",
-                      transpath);
-                continue;
+                conn->maproot = true;
+                Log(LOG_LEVEL_VERBOSE, "Mapping root privileges to access non-root files");
             }
 
-            if ((!encrypt) && (ap->encrypt == true))
-            {
-                Log(LOG_LEVEL_ERR, "File %s requires encrypt connection...will not serve", transpath);
-                access = false;
-            }
-            else
+            if (decision.access)
             {
-                Log(LOG_LEVEL_DEBUG, "Checking whether to map root privileges..");
-
-                if ((IsMatchItemIn(ctx, ap->maproot, MapAddress(conn->ipaddr))) ||
-                    (IsRegexItemIn(ctx, ap->maproot, conn->hostname)))
-                {
-                    conn->maproot = true;
-                    Log(LOG_LEVEL_VERBOSE, "Mapping root privileges to access non-root files");
-                }
-
-                if ((IsMatchItemIn(ctx, ap->accesslist, MapAddress(conn->ipaddr)))
-                    || (IsRegexItemIn(ctx, ap->accesslist, conn->hostname)))
-                {
-                    access = true;
-                    Log(LOG_LEVEL_DEBUG, "Access privileges - match found");
-                }
+                access = true;
+                Log(LOG_LEVEL_DEBUG, "Access privileges - match found");
             }
-            break;
         }
-    }
 
-    if (strncmp(transpath, transrequest, strlen(transpath)) == 0)
-    {
-        for (ap = SV.deny; ap != NULL; ap = ap->next)
+        if (access && AccessCacheDenied(conn->access_cache, SV.path_acl, ctx, conn->hostname))
         {
-            if (IsRegexItemIn(ctx, ap->accesslist, conn->hostname))
-            {
-                access = false;
-                Log(LOG_LEVEL_INFO, "Host %s explicitly denied access to %s", conn->hostname, transrequest);
-                break;
-            }
+            access = false;
+            Log(LOG_LEVEL_INFO, "Host %s explicitly denied access to %s", conn->hostname, transrequest);
         }
     }
 
@@ -993,6 +959,140 @@ static void FailedTransfer(ConnectionInfo *connection)
     }
 }
 
+/*
+ * Plaintext classic transfers have no framing: the client takes the file as a
+ * raw byte stream and only looks for error strings at block boundaries. So
+ * the file can be handed to the kernel in spans of whole blocks, checking
+ * between spans that it is not changing at source.
+ */
+static void CfGetFileStream(ConnectionInfo *conn_info, int fd, const char *filename, struct stat *sb, int blocksize)
+{
+    char sendbuffer[CF_BUFSIZE];
+    off_t span = blocksize * 32;
+    off_t total = 0;
+
+    if (sb->st_size > 10485760L) /* File larger than 10 MB, checks every 512kB */
+    {
+        span = blocksize * 256;
+    }
+
+    while (total < sb->st_size)
+    {
+        off_t savedlen = sb->st_size;
+        off_t tosend = MIN(span, savedlen - total);
+        off_t sent = SendSocketFile(conn_info->sd, fd, total, tosend);
+
+        if (sent == -1)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Send failed in GetFile. (send: %s)", GetErrorStr());
+            return;
+        }
+
+        total += sent;
+
+        if (sent < tosend)
+        {
+            Log(LOG_LEVEL_VERBOSE, "File '%s' shrank while sending it, after %jd bytes",
+                filename, (intmax_t) total);
+            return;
+        }
+
+        if (total == savedlen)
+        {
+            return;
+        }
+
+        /* check the file is not changing at source */
+
+        if (stat(filename, sb))
+        {
+            Log(LOG_LEVEL_ERR, "Cannot stat file '%s'. (stat: %s)",
+                filename, GetErrorStr());
+            return;
+        }
+
+        if (sb->st_size != savedlen)
+        {
+            memset(sendbuffer, 0, blocksize);
+            snprintf(sendbuffer, CF_BUFSIZE, "%s%s: %s", CF_CHANGEDSTR1, CF_CHANGEDSTR2, filename);
+
+            if (SendSocketStream(conn_info->sd, sendbuffer, blocksize) == -1)
+            {
+                Log(LOG_LEVEL_VERBOSE, "Send failed in GetFile. (send: %s)", GetErrorStr());
+            }
+
+            Log(LOG_LEVEL_DEBUG, "Aborting transfer after %" PRIdMAX ": file is changing rapidly at source.", (intmax_t)total);
+            return;
+        }
+    }
+}
+
+/*
+ * From protocol version 2 on, the file goes in frames of up to
+ * GET_FRAME_SIZE bytes, all but the last one marked CF_MORE. A transfer
+ * that cannot be completed ends with a CF_FAILED frame carrying the reason,
+ * so the client never mistakes an error message for file contents.
+ */
+#define GET_FRAME_SIZE (256 * 1024)
+
+static void SendGetFailure(ConnectionInfo *conn_info, const char *reason)
+{
+    if (SendTransaction(conn_info, reason, 0, CF_FAILED) == -1)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Send failed in GetFile. (send: %s)", GetErrorStr());
+    }
+}
+
+static void CfGetFileFramed(ConnectionInfo *conn_info, int fd, const char *filename, struct stat *sb)
+{
+    char changed[CF_BUFSIZE];
+    snprintf(changed, sizeof(changed), "%s%s: %s", CF_CHANGEDSTR1, CF_CHANGEDSTR2, filename);
+
+    off_t savedlen = sb->st_size;
+    off_t total = 0;
+
+    if (savedlen == 0)
+    {
+        SendTransaction(conn_info, "", 0, CF_DONE);
+        return;
+    }
+
+    char *buffer = xmalloc(MIN(savedlen, GET_FRAME_SIZE));
+
+    while (total < savedlen)
+    {
+        int tosend = MIN(savedlen - total, GET_FRAME_SIZE);
+        int n_read = FullRead(fd, buffer, tosend);
+
+        if (n_read == -1)
+        {
+            Log(LOG_LEVEL_ERR, "Read failed in GetFile. (read: %s)", GetErrorStr());
+            SendGetFailure(conn_info, CF_FAILEDSTR);
+            break;
+        }
+
+        /* check the file is not changing at source */
+
+        if (n_read < tosend || stat(filename, sb) == -1 || sb->st_size != savedlen)
+        {
+            Log(LOG_LEVEL_DEBUG, "Aborting transfer after %jd: file is changing rapidly at source.",
+                (intmax_t) total);
+            SendGetFailure(conn_info, changed);
+            break;
+        }
+
+        total += n_read;
+
+        if (SendTransaction(conn_info, buffer, n_read, (total == savedlen) ? CF_DONE : CF_MORE) == -1)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Send failed in GetFile. (send: %s)", GetErrorStr());
+            break;
+        }
+    }
+
+    free(buffer);
+}
+
 void CfGetFile(ServerFileGetState *args)
 {
     int fd;
@@ -1013,8 +1113,17 @@ void CfGetFile(ServerFileGetState *args)
 
     if (!TransferRights(filename, args, &sb))
     {
-        RefuseAccess(args->connect, args->buf_size, "");
         snprintf(sendbuffer, CF_BUFSIZE, "%s", CF_FAILEDSTR);
+        if (conn_info->protocol_version >= 2)
+        {
+            /* A single CF_FAILED frame is all the client reads in reply */
+            Log(LOG_LEVEL_INFO, "REFUSAL to (user=%s,ip=%s) of request: GET '%s'",
+                args->connect->username, args->connect->ipaddr, filename);
+            SendGetFailure(conn_info, sendbuffer);
+            return;
+        }
+
+        RefuseAccess(args->connect, args->buf_size, "");
         if (conn_info->type == CF_PROTOCOL_CLASSIC)
         {
             SendSocketStream(conn_info->sd, sendbuffer, args->buf_size);
@@ -1033,7 +1142,11 @@ void CfGetFile(ServerFileGetState *args)
         Log(LOG_LEVEL_ERR, "Open error of file '%s'. (open: %s)",
             filename, GetErrorStr());
         snprintf(sendbuffer, CF_BUFSIZE, "%s", CF_FAILEDSTR);
-        if (conn_info->type == CF_PROTOCOL_CLASSIC)
+        if (conn_info->protocol_version >= 2)
+        {
+            SendGetFailure(conn_info, sendbuffer);
+        }
+        else if (conn_info->type == CF_PROTOCOL_CLASSIC)
         {
             SendSocketStream(conn_info->sd, sendbuffer, args->buf_size);
         }
@@ -1042,6 +1155,16 @@ void CfGetFile(ServerFileGetState *args)
             TLSSend(conn_info->ssl, sendbuffer, args->buf_size);
         }
     }
+    else if (conn_info->protocol_version >= 2)
+    {
+        CfGetFileFramed(conn_info, fd, filename, &sb);
+        close(fd);
+    }
+    else if (conn_info->type == CF_PROTOCOL_CLASSIC)
+    {
+        CfGetFileStream(conn_info, fd, filename, &sb, blocksize);
+        close(fd);
+    }
     else
     {
         int div = 3;
@@ -1560,6 +1683,45 @@ void ReplyServerContext(ServerConnectionState *conn, int encrypted, Item *classe
     }
 }
 
+/*
+ * From protocol version 2 on, the listing is packed the same way, names
+ * separated by '\0' and ending with CFD_TERMINATOR, but goes in one frame
+ * unless it is larger than CF_NET_FRAME_MAX.
+ */
+static void CfOpenDirectoryFramed(ConnectionInfo *conn_info, Dir *dirh)
+{
+    size_t size = CF_BUFSIZE;
+    char *buffer = xmalloc(size);
+    size_t offset = 0;
+    const size_t reserved = strlen(CFD_TERMINATOR) + 2;
+
+    for (const struct dirent *dirp = DirRead(dirh); dirp != NULL; dirp = DirRead(dirh))
+    {
+        size_t len = strlen(dirp->d_name) + 1;
+
+        if (offset + len + reserved > CF_NET_FRAME_MAX)
+        {
+            buffer[offset] = '\0';
+            SendTransaction(conn_info, buffer, offset + 1, CF_MORE);
+            offset = 0;
+        }
+
+        if (offset + len + reserved > size)
+        {
+            size = MIN(MAX(size * 2, offset + len + reserved), CF_NET_FRAME_MAX);
+            buffer = xrealloc(buffer, size);
+        }
+
+        memcpy(buffer + offset, dirp->d_name, len);
+        offset += len;
+    }
+
+    memcpy(buffer + offset, CFD_TERMINATOR, reserved - 1);
+    buffer[offset + reserved - 1] = '\0';
+    SendTransaction(conn_info, buffer, offset + reserved, CF_DONE);
+    free(buffer);
+}
+
 int CfOpenDirectory(ServerConnectionState *conn, char *sendbuffer, char *oldDirname)
 {
     Dir *dirh;
@@ -1584,6 +1746,13 @@ int CfOpenDirectory(ServerConnectionState *conn, char *sendbuffer, char *oldDirn
         return -1;
     }
 
+    if (conn->conn_info.protocol_version >= 2)
+    {
+        CfOpenDirectoryFramed(&conn->conn_info, dirh);
+        DirClose(dirh);
+        return 0;
+    }
+
 /* Pack names for transmission */
 
     memset(sendbuffer, 0, CF_BUFSIZE);
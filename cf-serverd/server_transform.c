@@ -25,6 +25,7 @@
 #include <server_transform.h>
 
 #include <server.h>
+#include <server_access.h>
 
 #include <misc_lib.h>
 #include <env_context.h>
@@ -130,6 +131,9 @@ void KeepPromises(EvalContext *ctx, Policy *policy, GenericAgentConfig *config)
     KeepContextBundles(ctx, policy);
     KeepControlPromises(ctx, policy, config);
     KeepPromiseBundles(ctx, policy);
+
+    PathAclDestroy(SV.path_acl);
+    SV.path_acl = PathAclCompile(SV.admit, SV.deny);
 }
 
 /*******************************************************************/
@@ -221,7 +221,7 @@ int ServerTLSPeek(ConnectionInfo *conn_info)
     {
         Log(LOG_LEVEL_VERBOSE,
             "Peeked nothing important in TCP stream, considering the protocol as TLS");
-        LogRaw(LOG_LEVEL_DEBUG, "Peeked data: ", buf, sizeof(buf));
+        LogRaw(LOG_MOD_NET, LOG_LEVEL_DEBUG, "Peeked data: ", buf, sizeof(buf));
         conn_info->type = CF_PROTOCOL_TLS;
     }
 
@@ -270,8 +270,8 @@ int ServerNegotiateProtocol(const ConnectionInfo *conn_info)
         return -1;
     }
 
-    /* For now we support only one version, so just check they match... */
-    if (version_received == SERVER_PROTOCOL_VERSION)
+    /* Older clients ask for the version they support */
+    if (version_received >= 1 && version_received <= SERVER_PROTOCOL_VERSION)
     {
         char s[] = "OK\n";
         TLSSend(conn_info->ssl, s, sizeof(s)-1);
@@ -417,6 +417,7 @@ int ServerTLSSessionEstablish(ServerConnectionState *conn)
     {
         return -1;
     }
+    conn->conn_info.protocol_version = ret;
 
     /* Receive IDENTITY USER=asdf plain string. */
     ret = ServerIdentifyClient(&conn->conn_info, conn->username,
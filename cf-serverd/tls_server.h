@@ -34,8 +34,8 @@
 #include <server.h>                                /* ServerConnectionState */
 
 
-/* The only protocol we support inside TLS, for now... */
-#define SERVER_PROTOCOL_VERSION 1
+/* The highest protocol version we support inside TLS */
+#define SERVER_PROTOCOL_VERSION CFNET_PROTOCOL_VERSION
 
 
 bool ServerTLSInitialize();
@@ -28,6 +28,7 @@
 
 
 #include <platform.h>
+#include <map.h>
 #include <openssl/ssl.h>
 
 
@@ -42,6 +43,7 @@
 #define CF_MAX_IP_LEN 64        /* numerical ip length */
 #define CF_DONE 't'
 #define CF_MORE 'm'
+#define CF_FAILED 'f'           /* Protocol version 2 on: aborts a GET */
 /* ************************************************ */
 
 
@@ -52,8 +54,13 @@
 #define CF_INBAND_OFFSET 8
 
 
-/* The only protocol we support inside TLS, for now... */
-#define CFNET_PROTOCOL_VERSION 1
+/* The highest protocol version we support inside TLS. Version 2 replaces the
+   ASCII transaction header with a binary one, see net.c, and allows
+   transactions of up to CF_NET_FRAME_MAX bytes where both ends expect them. */
+#define CFNET_PROTOCOL_VERSION 2
+
+#define CF_NET_FRAME_HEADER_SIZE 5
+#define CF_NET_FRAME_MAX (8 * 1024 * 1024)
 
 
 /* TODO Shouldn't this be in libutils? */
@@ -113,6 +120,7 @@ typedef enum
 typedef struct
 {
     ProtocolVersion type;
+    int protocol_version;             /* Negotiated inside TLS, 0 otherwise */
     int sd;                           /* Socket descriptor */
     SSL *ssl;                         /* OpenSSL struct for TLS connections */
     RSA *remote_key;
@@ -135,6 +143,7 @@ typedef struct
     short error;
     char *this_server;
     Stat *cache;             /* Cache for network connection (SYNCH result) */
+    Map *cache_index;        /* The cache entries by file name */
 } AgentConnection;
 
 
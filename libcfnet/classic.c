@@ -29,6 +29,12 @@
 #include <logging.h>
 #include <misc_lib.h>
 
+#ifdef HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+#endif
+
+#define SEND_FILE_BUFSIZE (64 * 1024)
+
 static bool LastRecvTimedOut(void)
 {
 #ifndef __MINGW32__
@@ -93,6 +99,40 @@ int RecvSocketStream(int sd, char buffer[CF_BUFSIZE], int toget)
     return already;
 }
 
+/**
+ * Like RecvSocketStream, but returns as soon as some data has arrived, so that
+ * large buffers can be filled with whatever the socket has.
+ *
+ * @return 0 if socket is closed.
+ */
+int RecvSocketStreamPartial(int sd, char *buffer, int toget)
+{
+    for (;;)
+    {
+        int got = recv(sd, buffer, toget, 0);
+
+        if ((got == -1) && (errno == EINTR))
+        {
+            continue;
+        }
+
+        if ((got == -1) && (LastRecvTimedOut()))
+        {
+            Log(LOG_LEVEL_ERR, "Timeout - remote end did not respond with the expected amount of data (expecting=%d). (recv: %s)",
+                toget, GetErrorStr());
+            return -1;
+        }
+
+        if (got == -1)
+        {
+            Log(LOG_LEVEL_ERR, "Couldn't receive. (recv: %s)", GetErrorStr());
+            return -1;
+        }
+
+        return got;
+    }
+}
+
 /*************************************************************************/
 
 int SendSocketStream(int sd, char buffer[CF_BUFSIZE], int tosend)
@@ -120,3 +160,94 @@ int SendSocketStream(int sd, char buffer[CF_BUFSIZE], int tosend)
 
     return already;
 }
+
+/*************************************************************************/
+
+static off_t SendSocketFileCopy(int sd, int fd, off_t offset, off_t tosend)
+{
+    char buffer[SEND_FILE_BUFSIZE];
+    off_t already = 0;
+
+    if (lseek(fd, offset, SEEK_SET) == (off_t) -1)
+    {
+        Log(LOG_LEVEL_ERR, "Couldn't seek in file. (lseek: %s)", GetErrorStr());
+        return -1;
+    }
+
+    while (already < tosend)
+    {
+        ssize_t n_read = read(fd, buffer, MIN(sizeof(buffer), tosend - already));
+
+        if ((n_read == -1) && (errno == EINTR))
+        {
+            continue;
+        }
+
+        if (n_read == -1)
+        {
+            Log(LOG_LEVEL_ERR, "Couldn't read file. (read: %s)", GetErrorStr());
+            return -1;
+        }
+
+        if (n_read == 0)
+        {
+            break;
+        }
+
+        if (SendSocketStream(sd, buffer, n_read) == -1)
+        {
+            return -1;
+        }
+
+        already += n_read;
+    }
+
+    return already;
+}
+
+/**
+ * Send #tosend bytes of file #fd, starting at #offset, with sendfile() where
+ * the kernel supports it and read()/send() otherwise.
+ *
+ * @return bytes sent, less than #tosend if the file ended early, -1 on error.
+ */
+off_t SendSocketFile(int sd, int fd, off_t offset, off_t tosend)
+{
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+    off_t already = 0;
+
+    while (already < tosend)
+    {
+        off_t pos = offset + already;
+        ssize_t sent = sendfile(sd, fd, &pos, tosend - already);
+
+        if ((sent == -1) && (errno == EINTR))
+        {
+            continue;
+        }
+
+        if ((sent == -1) && (already == 0) && ((errno == EINVAL) || (errno == ENOSYS)))
+        {
+            /* File system or socket type that sendfile() cannot handle */
+            return SendSocketFileCopy(sd, fd, offset, tosend);
+        }
+
+        if (sent == -1)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Couldn't send. (sendfile: %s)", GetErrorStr());
+            return -1;
+        }
+
+        if (sent == 0)
+        {
+            break;
+        }
+
+        already += sent;
+    }
+
+    return already;
+#else
+    return SendSocketFileCopy(sd, fd, offset, tosend);
+#endif
+}
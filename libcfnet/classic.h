@@ -25,8 +25,11 @@
 #ifndef CLASSIC_H
 #define CLASSIC_H
 
+#include <platform.h>
 
 int RecvSocketStream(int sd, char *buffer, int toget);
+int RecvSocketStreamPartial(int sd, char *buffer, int toget);
 int SendSocketStream(int sd, char *buffer, int tosend);
+off_t SendSocketFile(int sd, int fd, off_t offset, off_t tosend);
 
 #endif // CLASSIC_H
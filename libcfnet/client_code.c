@@ -59,13 +59,20 @@ typedef struct
 
 #define RECVTIMEOUT 30 /* seconds */
 
+#define CF_NET_STREAM_BUFSIZE (64 * 1024) /* plaintext GET read size */
+
+#define CF_STAT_PIPELINE_DEPTH 32 /* SYNCH STAT requests sent before reading replies */
+
 #define CF_COULD_NOT_CONNECT -2
 
 /* With this lock we ensure we read the list head atomically, but we don't
  * guarantee anything about the queue's contents. It should be OK since we
- * never remove elements from the queue, only prepend to the head.*/
+ * never remove elements from the queue while promises are being kept, only
+ * prepend to the head.*/
 static pthread_mutex_t cft_serverlist = PTHREAD_ERRORCHECK_MUTEX_INITIALIZER_NP;
 
+static ConnectionStats CONNECTION_STATS;
+
 static void NewClientCache(Stat *data, AgentConnection *conn);
 static void CacheServerConnection(AgentConnection *conn, const char *server);
 static void MarkServerOffline(const char *server);
@@ -200,6 +207,10 @@ AgentConnection *NewServerConnection(FileCopy fc, bool background, int *err)
                 /* If background connection was requested, then don't cache it
                  * in SERVERLIST since it will be closed right afterwards. */
                 conn = ServerConnection(servername, fc, err);
+                if (conn != NULL)
+                {
+                    CONNECTION_STATS.opened++;
+                }
                 return conn;
             }
         }
@@ -208,6 +219,7 @@ AgentConnection *NewServerConnection(FileCopy fc, bool background, int *err)
             conn = GetIdleConnectionToServer(servername);
             if (conn != NULL)
             {
+                CONNECTION_STATS.reused++;
                 *err = 0;
                 return conn;
             }
@@ -216,6 +228,7 @@ AgentConnection *NewServerConnection(FileCopy fc, bool background, int *err)
             conn = ServerConnection(servername, fc, err);
             if (conn != NULL)
             {
+                CONNECTION_STATS.opened++;
                 CacheServerConnection(conn, servername);
                 return conn;
             }
@@ -289,6 +302,7 @@ int TLSConnect(ConnectionInfo *conn_info, bool trust_server,
     {
         return -1;
     }
+    conn_info->protocol_version = ret;
 
     /* We continue by sending identification data. */
     ret = TLSClientSendIdentity(conn_info, username);
@@ -445,41 +459,11 @@ void DisconnectServer(AgentConnection *conn)
 
 /*********************************************************************/
 
-int cf_remote_stat(char *file, struct stat *buf, char *stattype, bool encrypt, AgentConnection *conn)
-/* If a link, this reads readlink and sends it back in the same
-   package. It then caches the value for each copy command */
+static int SendStatRequest(const char *file, time_t tloc, bool encrypt, AgentConnection *conn)
 {
     char sendbuffer[CF_BUFSIZE];
-    char recvbuffer[CF_BUFSIZE];
     char in[CF_BUFSIZE], out[CF_BUFSIZE];
-    int ret, tosend, cipherlen;
-    time_t tloc;
-
-    memset(recvbuffer, 0, CF_BUFSIZE);
-
-    if (strlen(file) > CF_BUFSIZE - 30)
-    {
-        Log(LOG_LEVEL_ERR, "Filename too long");
-        return -1;
-    }
-
-    ret = CacheStat(file, buf, stattype, conn);
-
-    if (ret != 1)
-    {
-        return ret;
-    }
-
-    if ((tloc = time((time_t *) NULL)) == -1)
-    {
-        Log(LOG_LEVEL_ERR, "Couldn't read system clock");
-    }
-
-    sendbuffer[0] = '\0';
-
-    /* We encrypt only for CLASSIC protocol. The TLS protocol is always over
-     * encrypted layer, so it does not support encrypted (S*) commands. */
-    encrypt = encrypt && (conn->conn_info.type == CF_PROTOCOL_CLASSIC);
+    int tosend, cipherlen;
 
     if (encrypt)
     {
@@ -508,7 +492,27 @@ int cf_remote_stat(char *file, struct stat *buf, char *stattype, bool encrypt, A
         return -1;
     }
 
-    if (ReceiveTransaction(&conn->conn_info, recvbuffer, NULL) == -1)
+    return 0;
+}
+
+/*********************************************************************/
+
+/**
+ * Reads the reply to one SYNCH STAT request. A stat is two transactions, the
+ * attributes and the link target, a refusal is one: either way the
+ * connection is left ready for the reply to the next request.
+ *
+ * @return 1 and cfst filled in, 0 if the server refused, -1 on transmission error
+ */
+static int ReceiveStatReply(const char *file, Stat *cfst, AgentConnection *conn)
+{
+    char recvbuffer[CF_BUFSIZE];
+    char linkbuffer[CF_BUFSIZE];
+
+    memset(recvbuffer, 0, CF_BUFSIZE);
+
+    /* A closed connection is a transmission error too, not a refusal */
+    if (ReceiveTransaction(&conn->conn_info, recvbuffer, NULL) <= 0)
     {
         return -1;
     }
@@ -516,137 +520,254 @@ int cf_remote_stat(char *file, struct stat *buf, char *stattype, bool encrypt, A
     if (strstr(recvbuffer, "unsynchronized"))
     {
         Log(LOG_LEVEL_ERR, "Clocks differ too much to do copy by date (security) '%s'", recvbuffer + 4);
-        return -1;
+        return 0;
     }
 
     if (BadProtoReply(recvbuffer))
     {
         Log(LOG_LEVEL_VERBOSE, "Server returned error '%s'", recvbuffer + 4);
         errno = EPERM;
+        return 0;
+    }
+
+    if (!OKProtoReply(recvbuffer))
+    {
+        Log(LOG_LEVEL_ERR, "Transmission refused or failed statting '%s', got '%s'", file, recvbuffer);
+        errno = EPERM;
+        return 0;
+    }
+
+    memset(linkbuffer, 0, CF_BUFSIZE);
+
+    if (ReceiveTransaction(&conn->conn_info, linkbuffer, NULL) <= 0)
+    {
         return -1;
     }
 
-    if (OKProtoReply(recvbuffer))
+    // use intmax_t here to provide enough space for large values coming over the protocol
+    intmax_t d1, d2, d3, d4, d5, d6, d7, d8, d9, d10, d11, d12 = 0, d13 = 0;
+    int ret = sscanf(recvbuffer, "OK: "
+           "%1" PRIdMAX     // 01 cfst.cf_type
+           " %5" PRIdMAX    // 02 cfst.cf_mode
+           " %14" PRIdMAX   // 03 cfst.cf_lmode
+           " %14" PRIdMAX   // 04 cfst.cf_uid
+           " %14" PRIdMAX   // 05 cfst.cf_gid
+           " %18" PRIdMAX   // 06 cfst.cf_size
+           " %14" PRIdMAX   // 07 cfst.cf_atime
+           " %14" PRIdMAX   // 08 cfst.cf_mtime
+           " %14" PRIdMAX   // 09 cfst.cf_ctime
+           " %1" PRIdMAX    // 10 cfst.cf_makeholes
+           " %14" PRIdMAX   // 11 cfst.cf_ino
+           " %14" PRIdMAX   // 12 cfst.cf_nlink
+           " %18" PRIdMAX,  // 13 cfst.cf_dev
+           &d1, &d2, &d3, &d4, &d5, &d6, &d7, &d8, &d9, &d10, &d11, &d12, &d13);
+
+    if (ret < 13)
+    {
+        Log(LOG_LEVEL_ERR, "Cannot read SYNCH reply from '%s', only %d/13 items parsed", conn->remoteip, ret );
+        return 0;
+    }
+
+    memset(cfst, 0, sizeof(Stat));
+
+    cfst->cf_type = (FileType) d1;
+    cfst->cf_mode = (mode_t) d2;
+    cfst->cf_lmode = (mode_t) d3;
+    cfst->cf_uid = (uid_t) d4;
+    cfst->cf_gid = (gid_t) d5;
+    cfst->cf_size = (off_t) d6;
+    cfst->cf_atime = (time_t) d7;
+    cfst->cf_mtime = (time_t) d8;
+    cfst->cf_ctime = (time_t) d9;
+    cfst->cf_makeholes = (char) d10;
+    cfst->cf_ino = d11;
+    cfst->cf_nlink = d12;
+    cfst->cf_dev = (dev_t)d13;
+
+    /* Use %?d here to avoid memory overflow attacks */
+
+    if (strlen(linkbuffer) > 3)
     {
-        Stat cfst;
+        cfst->cf_readlink = xstrdup(linkbuffer + 3);
+    }
+    else
+    {
+        cfst->cf_readlink = NULL;
+    }
 
-        // use intmax_t here to provide enough space for large values coming over the protocol
-        intmax_t d1, d2, d3, d4, d5, d6, d7, d8, d9, d10, d11, d12 = 0, d13 = 0;
-        ret = sscanf(recvbuffer, "OK: "
-               "%1" PRIdMAX     // 01 cfst.cf_type
-               " %5" PRIdMAX    // 02 cfst.cf_mode
-               " %14" PRIdMAX   // 03 cfst.cf_lmode
-               " %14" PRIdMAX   // 04 cfst.cf_uid
-               " %14" PRIdMAX   // 05 cfst.cf_gid
-               " %18" PRIdMAX   // 06 cfst.cf_size
-               " %14" PRIdMAX   // 07 cfst.cf_atime
-               " %14" PRIdMAX   // 08 cfst.cf_mtime
-               " %14" PRIdMAX   // 09 cfst.cf_ctime
-               " %1" PRIdMAX    // 10 cfst.cf_makeholes
-               " %14" PRIdMAX   // 11 cfst.cf_ino
-               " %14" PRIdMAX   // 12 cfst.cf_nlink
-               " %18" PRIdMAX,  // 13 cfst.cf_dev
-               &d1, &d2, &d3, &d4, &d5, &d6, &d7, &d8, &d9, &d10, &d11, &d12, &d13);
+    switch (cfst->cf_type)
+    {
+    case FILE_TYPE_REGULAR:
+        cfst->cf_mode |= (mode_t) S_IFREG;
+        break;
+    case FILE_TYPE_DIR:
+        cfst->cf_mode |= (mode_t) S_IFDIR;
+        break;
+    case FILE_TYPE_CHAR_:
+        cfst->cf_mode |= (mode_t) S_IFCHR;
+        break;
+    case FILE_TYPE_FIFO:
+        cfst->cf_mode |= (mode_t) S_IFIFO;
+        break;
+    case FILE_TYPE_SOCK:
+        cfst->cf_mode |= (mode_t) S_IFSOCK;
+        break;
+    case FILE_TYPE_BLOCK:
+        cfst->cf_mode |= (mode_t) S_IFBLK;
+        break;
+    case FILE_TYPE_LINK:
+        cfst->cf_mode |= (mode_t) S_IFLNK;
+        break;
+    }
 
-        if (ret < 13)
-        {
-            Log(LOG_LEVEL_ERR, "Cannot read SYNCH reply from '%s', only %d/13 items parsed", conn->remoteip, ret );
-            return -1;
-        }
+    if (cfst->cf_lmode != 0)
+    {
+        cfst->cf_lmode |= (mode_t) S_IFLNK;
+    }
 
-        cfst.cf_type = (FileType) d1;
-        cfst.cf_mode = (mode_t) d2;
-        cfst.cf_lmode = (mode_t) d3;
-        cfst.cf_uid = (uid_t) d4;
-        cfst.cf_gid = (gid_t) d5;
-        cfst.cf_size = (off_t) d6;
-        cfst.cf_atime = (time_t) d7;
-        cfst.cf_mtime = (time_t) d8;
-        cfst.cf_ctime = (time_t) d9;
-        cfst.cf_makeholes = (char) d10;
-        cfst.cf_ino = d11;
-        cfst.cf_nlink = d12;
-        cfst.cf_dev = (dev_t)d13;
+    cfst->cf_filename = xstrdup(file);
+    cfst->cf_server = xstrdup(conn->this_server);
+    cfst->cf_failed = false;
 
-        /* Use %?d here to avoid memory overflow attacks */
+    return 1;
+}
 
-        memset(recvbuffer, 0, CF_BUFSIZE);
+/*********************************************************************/
 
-        if (ReceiveTransaction(&conn->conn_info, recvbuffer, NULL) == -1)
-        {
-            return -1;
-        }
+int cf_remote_stat(char *file, struct stat *buf, char *stattype, bool encrypt, AgentConnection *conn)
+/* If a link, this reads readlink and sends it back in the same
+   package. It then caches the value for each copy command */
+{
+    time_t tloc;
+    int ret;
 
-        if (strlen(recvbuffer) > 3)
-        {
-            cfst.cf_readlink = xstrdup(recvbuffer + 3);
-        }
-        else
-        {
-            cfst.cf_readlink = NULL;
-        }
+    if (strlen(file) > CF_BUFSIZE - 30)
+    {
+        Log(LOG_LEVEL_ERR, "Filename too long");
+        return -1;
+    }
 
-        switch (cfst.cf_type)
-        {
-        case FILE_TYPE_REGULAR:
-            cfst.cf_mode |= (mode_t) S_IFREG;
-            break;
-        case FILE_TYPE_DIR:
-            cfst.cf_mode |= (mode_t) S_IFDIR;
-            break;
-        case FILE_TYPE_CHAR_:
-            cfst.cf_mode |= (mode_t) S_IFCHR;
-            break;
-        case FILE_TYPE_FIFO:
-            cfst.cf_mode |= (mode_t) S_IFIFO;
-            break;
-        case FILE_TYPE_SOCK:
-            cfst.cf_mode |= (mode_t) S_IFSOCK;
-            break;
-        case FILE_TYPE_BLOCK:
-            cfst.cf_mode |= (mode_t) S_IFBLK;
-            break;
-        case FILE_TYPE_LINK:
-            cfst.cf_mode |= (mode_t) S_IFLNK;
-            break;
-        }
+    ret = CacheStat(file, buf, stattype, conn);
 
-        cfst.cf_filename = xstrdup(file);
-        cfst.cf_server = xstrdup(conn->this_server);
-        cfst.cf_failed = false;
+    if (ret != 1)
+    {
+        return ret;
+    }
 
-        if (cfst.cf_lmode != 0)
-        {
-            cfst.cf_lmode |= (mode_t) S_IFLNK;
-        }
+    if ((tloc = time((time_t *) NULL)) == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Couldn't read system clock");
+    }
+
+    /* We encrypt only for CLASSIC protocol. The TLS protocol is always over
+     * encrypted layer, so it does not support encrypted (S*) commands. */
+    encrypt = encrypt && (conn->conn_info.type == CF_PROTOCOL_CLASSIC);
+
+    if (SendStatRequest(file, tloc, encrypt, conn) == -1)
+    {
+        return -1;
+    }
+
+    Stat cfst;
+    if (ReceiveStatReply(file, &cfst, conn) != 1)
+    {
+        return -1;
+    }
+
+    NewClientCache(&cfst, conn);
+
+    return CacheStat(file, buf, stattype, conn);
+}
+
+/*********************************************************************/
+
+/* Replies still due on the connection can't be told apart from the ones to
+ * the next request, so it must not be used again */
+static void AbandonConnection(AgentConnection *conn)
+{
+    Log(LOG_LEVEL_VERBOSE, "Pipelined stat to '%s' failed, closing the connection",
+        conn->this_server);
+
+    if (conn->conn_info.sd >= 0)
+    {
+        cf_closesocket(conn->conn_info.sd);
+        conn->conn_info.sd = SOCKET_INVALID;
+    }
+}
 
-        NewClientCache(&cfst, conn);
+int RemoteStatPrefetch(const Seq *files, bool encrypt, AgentConnection *conn)
+{
+    const char *pending[CF_STAT_PIPELINE_DEPTH];
+    size_t length = SeqLength(files);
+    int cached = 0;
+    time_t tloc;
 
-        if ((cfst.cf_lmode != 0) && (strcmp(stattype, "link") == 0))
+    if ((tloc = time((time_t *) NULL)) == -1)
+    {
+        Log(LOG_LEVEL_ERR, "Couldn't read system clock");
+    }
+
+    encrypt = encrypt && (conn->conn_info.type == CF_PROTOCOL_CLASSIC);
+
+    for (size_t i = 0; i < length; )
+    {
+        size_t n_pending = 0;
+
+        /* Send a window of requests for the files not seen yet... */
+        for (; i < length && n_pending < CF_STAT_PIPELINE_DEPTH; i++)
         {
-            buf->st_mode = cfst.cf_lmode;
+            const char *file = SeqAt(files, i);
+
+            if (strlen(file) > CF_BUFSIZE - 30 ||
+                ClientCacheLookup(conn, conn->this_server, file) != NULL)
+            {
+                continue;
+            }
+
+            if (SendStatRequest(file, tloc, encrypt, conn) == -1)
+            {
+                AbandonConnection(conn);
+                return -1;
+            }
+
+            pending[n_pending++] = file;
         }
-        else
+
+        /* ...then collect the replies, which come back in the same order */
+        for (size_t j = 0; j < n_pending; j++)
         {
-            buf->st_mode = cfst.cf_mode;
-        }
+            Stat cfst;
 
-        buf->st_uid = cfst.cf_uid;
-        buf->st_gid = cfst.cf_gid;
-        buf->st_size = cfst.cf_size;
-        buf->st_mtime = cfst.cf_mtime;
-        buf->st_ctime = cfst.cf_ctime;
-        buf->st_atime = cfst.cf_atime;
-        buf->st_ino = cfst.cf_ino;
-        buf->st_dev = cfst.cf_dev;
-        buf->st_nlink = cfst.cf_nlink;
+            switch (ReceiveStatReply(pending[j], &cfst, conn))
+            {
+            case 1:
+                NewClientCache(&cfst, conn);
+                cached++;
+                break;
+
+            case 0:
+                /* Remember the refusal so that cf_remote_stat() doesn't ask again */
+                memset(&cfst, 0, sizeof(cfst));
+                cfst.cf_filename = xstrdup(pending[j]);
+                cfst.cf_server = xstrdup(conn->this_server);
+                cfst.cf_failed = true;
+                NewClientCache(&cfst, conn);
+                break;
+
+            default:
+                AbandonConnection(conn);
+                return -1;
+            }
+        }
 
-        return 0;
+        if (n_pending > 1)
+        {
+            CONNECTION_STATS.pipelined += n_pending;
+            CONNECTION_STATS.round_trips_saved += n_pending - 1;
+        }
     }
 
-    Log(LOG_LEVEL_ERR, "Transmission refused or failed statting '%s', got '%s'", file, recvbuffer);
-    errno = EPERM;
-    return -1;
+    return cached;
 }
 
 /*********************************************************************/
@@ -654,7 +775,9 @@ int cf_remote_stat(char *file, struct stat *buf, char *stattype, bool encrypt, A
 Item *RemoteDirList(const char *dirname, bool encrypt, AgentConnection *conn)
 {
     char sendbuffer[CF_BUFSIZE];
-    char recvbuffer[CF_BUFSIZE];
+    char *recvbuffer = NULL;
+    size_t recvbuffer_size = 0;
+    char status;
     char in[CF_BUFSIZE];
     char out[CF_BUFSIZE];
     int n, cipherlen = 0, tosend;
@@ -697,10 +820,12 @@ Item *RemoteDirList(const char *dirname, bool encrypt, AgentConnection *conn)
         return NULL;
     }
 
+    /* Since protocol version 2 the listing usually comes in one frame */
     while (true)
     {
-        if ((n = ReceiveTransaction(&conn->conn_info, recvbuffer, NULL)) == -1)
+        if ((n = ReceiveLargeTransaction(&conn->conn_info, &recvbuffer, &recvbuffer_size, &status)) == -1)
         {
+            free(recvbuffer);
             return NULL;
         }
 
@@ -718,12 +843,14 @@ Item *RemoteDirList(const char *dirname, bool encrypt, AgentConnection *conn)
         if (FailedProtoReply(recvbuffer))
         {
             Log(LOG_LEVEL_INFO, "Network access to '%s:%s' denied", conn->this_server, dirname);
+            free(recvbuffer);
             return NULL;
         }
 
         if (BadProtoReply(recvbuffer))
         {
             Log(LOG_LEVEL_INFO, "%s", recvbuffer + 4);
+            free(recvbuffer);
             return NULL;
         }
 
@@ -733,6 +860,7 @@ Item *RemoteDirList(const char *dirname, bool encrypt, AgentConnection *conn)
 
             if (strncmp(sp, CFD_TERMINATOR, strlen(CFD_TERMINATOR)) == 0)       /* End transmission */
             {
+                free(recvbuffer);
                 return ret;
             }
 
@@ -757,6 +885,7 @@ Item *RemoteDirList(const char *dirname, bool encrypt, AgentConnection *conn)
         }
     }
 
+    free(recvbuffer);
     return ret;
 }
 
@@ -767,16 +896,28 @@ static void NewClientCache(Stat *data, AgentConnection *conn)
     Stat *sp = xmemdup(data, sizeof(Stat));
     sp->next = conn->cache;
     conn->cache = sp;
+
+    if (conn->cache_index == NULL)
+    {
+        conn->cache_index = MapNew((MapHashFn) StringHash, (MapKeyEqualFn) StringSafeEqual, NULL, NULL);
+    }
+
+    /* Newest entry wins, as it would searching the list */
+    MapInsert(conn->cache_index, sp->cf_filename, sp);
 }
 
 const Stat *ClientCacheLookup(AgentConnection *conn, const char *server_name, const char *file_name)
 {
-    for (const Stat *sp = conn->cache; sp != NULL; sp = sp->next)
+    if (conn->cache_index == NULL)
     {
-        if (strcmp(server_name, sp->cf_server) == 0 && strcmp(file_name, sp->cf_filename) == 0)
-        {
-            return sp;
-        }
+        return NULL;
+    }
+
+    const Stat *sp = MapGet(conn->cache_index, file_name);
+
+    if (sp != NULL && strcmp(server_name, sp->cf_server) == 0)
+    {
+        return sp;
     }
 
     return NULL;
@@ -998,6 +1139,186 @@ int EncryptCopyRegularFileNet(const char *source, const char *dest, off_t size,
     return true;
 }
 
+/*
+ * Receive a plaintext classic GET into dd. The server sends the file as a raw
+ * byte stream, and when it refuses or the file changes it sends a whole block
+ * holding an error string instead. Those can only start at block boundaries,
+ * so everything in between is read in large chunks.
+ */
+static bool RecvFileStream(AgentConnection *conn, const char *source, const char *dest,
+                           int dd, off_t size, int blocksize)
+{
+    char cfchangedstr[265];
+    snprintf(cfchangedstr, 255, "%s%s", CF_CHANGEDSTR1, CF_CHANGEDSTR2);
+
+    /* How much of a block is needed to tell file data from an error string */
+    const int lookahead = MAX(strlen(cfchangedstr), CF_INBAND_OFFSET + strlen("BAD: "));
+
+    int sd = conn->conn_info.sd;
+    char *buf = xmalloc(CF_NET_STREAM_BUFSIZE + lookahead + 1);
+    off_t n_read_total = 0;
+
+    while (n_read_total < size)
+    {
+        int n_read = RecvSocketStreamPartial(sd, buf, MIN(CF_NET_STREAM_BUFSIZE, size - n_read_total));
+
+        if (n_read <= 0)
+        {
+            Log(LOG_LEVEL_ERR, "Error in client-server stream (has %s:%s shrunk?)", conn->this_server, source);
+            free(buf);
+            return false;
+        }
+
+        off_t end = n_read_total + n_read;
+        off_t block = ((n_read_total + blocksize - 1) / blocksize) * blocksize;
+        off_t last_block = ((end - 1) / blocksize) * blocksize;
+
+        /* Complete the start of the last block, if it has been cut short */
+        if (last_block >= block && MIN(last_block + lookahead, size) > end)
+        {
+            int missing = MIN(last_block + lookahead, size) - end;
+
+            if (RecvSocketStream(sd, buf + n_read, missing) != missing)
+            {
+                Log(LOG_LEVEL_ERR, "Error in client-server stream (has %s:%s shrunk?)", conn->this_server, source);
+                free(buf);
+                return false;
+            }
+
+            n_read += missing;
+            end += missing;
+        }
+
+        buf[n_read] = '\0';
+
+        for (; block < end; block += blocksize)
+        {
+            const char *msg = buf + (block - n_read_total);
+            const char *reason = NULL;
+            int value = -1;
+
+            sscanf(msg, "t %d", &value);
+
+            if ((block == 0) && (strncmp(msg, CF_FAILEDSTR, strlen(CF_FAILEDSTR)) == 0))
+            {
+                reason = "Network access to '%s:%s' denied";
+            }
+            else if (strncmp(msg, cfchangedstr, strlen(cfchangedstr)) == 0)
+            {
+                reason = "Source '%s:%s' changed while copying";
+            }
+            else if ((value > 0) && (strncmp(msg + CF_INBAND_OFFSET, "BAD: ", 5) == 0))
+            {
+                /* Check for mismatch between encryption here and on server */
+                reason = "Network access to cleartext '%s:%s' denied";
+            }
+
+            if (reason)
+            {
+                Log(LOG_LEVEL_INFO, reason, conn->this_server, source);
+
+                /* Consume the rest of the message to stay in step with the server */
+                int rest = blocksize - (end - block);
+                if (rest > 0)
+                {
+                    RecvSocketStream(sd, buf, rest);
+                }
+
+                free(buf);
+                return false;
+            }
+        }
+
+        if (!FSWrite(dest, dd, buf, n_read))
+        {
+            Log(LOG_LEVEL_ERR, "Local disk write failed copying '%s:%s' to '%s'. (FSWrite: %s)",
+                conn->this_server, source, dest, GetErrorStr());
+            conn->error = true;
+            free(buf);
+            FlushFileStream(sd, size - end);
+            return false;
+        }
+
+        n_read_total = end;
+    }
+
+    free(buf);
+    return true;
+}
+
+/*
+ * Receive a GET from protocol version 2 on: the file comes in frames, the
+ * last one marked CF_DONE, or cut short by a CF_FAILED frame saying why.
+ */
+static bool RecvFileFrames(AgentConnection *conn, const char *source, const char *dest,
+                           int dd, off_t size)
+{
+    char *buf = NULL;
+    size_t buf_size = 0;
+    char status = CF_MORE;
+    off_t n_read_total = 0;
+    bool ok = true;
+
+    while (status == CF_MORE)
+    {
+        int n_read = ReceiveLargeTransaction(&conn->conn_info, &buf, &buf_size, &status);
+
+        /* Only an empty file is sent as an empty frame */
+        if (n_read == -1 || (n_read == 0 && status != CF_DONE))
+        {
+            Log(LOG_LEVEL_ERR, "Error in client-server stream (has %s:%s shrunk?)", conn->this_server, source);
+            free(buf);
+            return false;
+        }
+
+        if (status == CF_FAILED)
+        {
+            if (strncmp(buf, CF_FAILEDSTR, strlen(CF_FAILEDSTR)) == 0)
+            {
+                Log(LOG_LEVEL_INFO, "Network access to '%s:%s' denied", conn->this_server, source);
+            }
+            else if (strncmp(buf, CF_CHANGEDSTR1, strlen(CF_CHANGEDSTR1)) == 0)
+            {
+                Log(LOG_LEVEL_INFO, "Source '%s:%s' changed while copying", conn->this_server, source);
+            }
+            else
+            {
+                Log(LOG_LEVEL_INFO, "Copying '%s:%s' failed: %s", conn->this_server, source, buf);
+            }
+            free(buf);
+            return false;
+        }
+
+        if (n_read_total + n_read > size)
+        {
+            Log(LOG_LEVEL_ERR, "Received more than the %jd bytes expected of '%s:%s' (has it grown?)",
+                (intmax_t) size, conn->this_server, source);
+            ok = false;
+        }
+
+        /* After an error, keep reading to stay in step with the server */
+        if (ok && !FSWrite(dest, dd, buf, n_read))
+        {
+            Log(LOG_LEVEL_ERR, "Local disk write failed copying '%s:%s' to '%s'. (FSWrite: %s)",
+                conn->this_server, source, dest, GetErrorStr());
+            conn->error = true;
+            ok = false;
+        }
+
+        n_read_total += n_read;
+    }
+
+    free(buf);
+
+    if (ok && n_read_total != size)
+    {
+        Log(LOG_LEVEL_ERR, "Error in client-server stream (has %s:%s shrunk?)", conn->this_server, source);
+        return false;
+    }
+
+    return ok;
+}
+
 int CopyRegularFileNet(const char *source, const char *dest, off_t size, bool encrypt, AgentConnection *conn)
 {
     int dd, buf_size, n_read = 0, toget, towrite;
@@ -1051,12 +1372,36 @@ int CopyRegularFileNet(const char *source, const char *dest, off_t size, bool en
         return false;
     }
 
-    buf = xmalloc(CF_BUFSIZE + sizeof(int));    /* Note CF_BUFSIZE not buf_size !! */
-    n_read_total = 0;
-
     Log(LOG_LEVEL_VERBOSE, "Copying remote file '%s:%s', expecting %jd bytes",
           conn->this_server, source, (intmax_t)size);
 
+    if (conn->conn_info.protocol_version >= 2)
+    {
+        if (!RecvFileFrames(conn, source, dest, dd, size))
+        {
+            unlink(dest);
+            close(dd);
+            return false;
+        }
+
+        n_read_total = size;
+        done = true;
+    }
+    else if (conn->conn_info.type == CF_PROTOCOL_CLASSIC)
+    {
+        if (!RecvFileStream(conn, source, dest, dd, size, buf_size))
+        {
+            unlink(dest);
+            close(dd);
+            return false;
+        }
+
+        n_read_total = size;
+        done = true;
+    }
+
+    buf = xmalloc(CF_BUFSIZE + sizeof(int));    /* Note CF_BUFSIZE not buf_size !! */
+
     while (!done)
     {
         if ((size - n_read_total) >= buf_size)
@@ -1360,6 +1705,20 @@ static bool ServerOffline(const char *server)
     return false;
 }
 
+/* An idle connection has nothing to read: data, or end of file, means the
+ * server has timed it out or is shutting it down */
+static bool ConnectionStillOpen(const AgentConnection *conn)
+{
+#if defined(MSG_PEEK) && defined(MSG_DONTWAIT)
+    char c;
+    ssize_t ret = recv(conn->conn_info.sd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+
+    return ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+#else
+    return conn->conn_info.sd >= 0;
+#endif
+}
+
 static AgentConnection *GetIdleConnectionToServer(const char *server)
 {
     char ipaddr[CF_MAX_IP_LEN];
@@ -1405,6 +1764,16 @@ static AgentConnection *GetIdleConnectionToServer(const char *server)
                     " connection to '%s' is marked as offline...",
                     ipaddr);
             }
+            else if (svp->conn->conn_info.sd > 0 && !ConnectionStillOpen(svp->conn))
+            {
+                /* The server hung up while the connection sat idle in the
+                 * pool, it is dropped by ConnectionsFlushCache() */
+                Log(LOG_LEVEL_VERBOSE, "GetIdleConnectionToServer:"
+                    " connection to '%s' was closed by the server...",
+                    ipaddr);
+                cf_closesocket(svp->conn->conn_info.sd);
+                svp->conn->conn_info.sd = SOCKET_INVALID;
+            }
             else if (svp->conn->conn_info.sd > 0)
             {
                 Log(LOG_LEVEL_VERBOSE, "GetIdleConnectionToServer:"
@@ -1515,6 +1884,11 @@ static void CacheServerConnection(AgentConnection *conn, const char *server)
     svp->busy = true;
     svp->conn = conn;
 
+#ifndef __MINGW32__
+    /* The connection outlives the files promises, keep it from the commands */
+    fcntl(conn->conn_info.sd, F_SETFD, FD_CLOEXEC);
+#endif
+
     ThreadLock(&cft_serverlist);
     SeqAppend(GetGlobalServerList(), svp);
     ThreadUnlock(&cft_serverlist);
@@ -1524,42 +1898,39 @@ static void CacheServerConnection(AgentConnection *conn, const char *server)
 
 static int CacheStat(const char *file, struct stat *statbuf, const char *stattype, AgentConnection *conn)
 {
-    Stat *sp;
+    const Stat *sp = ClientCacheLookup(conn, conn->this_server, file);
 
-    for (sp = conn->cache; sp != NULL; sp = sp->next)
+    if (sp == NULL)
     {
-        if ((strcmp(conn->this_server, sp->cf_server) == 0) && (strcmp(file, sp->cf_filename) == 0))
-        {
-            if (sp->cf_failed)  /* cached failure from cfopendir */
-            {
-                errno = EPERM;
-                return -1;
-            }
-
-            if ((strcmp(stattype, "link") == 0) && (sp->cf_lmode != 0))
-            {
-                statbuf->st_mode = sp->cf_lmode;
-            }
-            else
-            {
-                statbuf->st_mode = sp->cf_mode;
-            }
+        return 1;
+    }
 
-            statbuf->st_uid = sp->cf_uid;
-            statbuf->st_gid = sp->cf_gid;
-            statbuf->st_size = sp->cf_size;
-            statbuf->st_atime = sp->cf_atime;
-            statbuf->st_mtime = sp->cf_mtime;
-            statbuf->st_ctime = sp->cf_ctime;
-            statbuf->st_ino = sp->cf_ino;
-            statbuf->st_dev = sp->cf_dev;
-            statbuf->st_nlink = sp->cf_nlink;
+    if (sp->cf_failed)  /* cached failure from cfopendir */
+    {
+        errno = EPERM;
+        return -1;
+    }
 
-            return 0;
-        }
+    if ((strcmp(stattype, "link") == 0) && (sp->cf_lmode != 0))
+    {
+        statbuf->st_mode = sp->cf_lmode;
+    }
+    else
+    {
+        statbuf->st_mode = sp->cf_mode;
     }
 
-    return 1;
+    statbuf->st_uid = sp->cf_uid;
+    statbuf->st_gid = sp->cf_gid;
+    statbuf->st_size = sp->cf_size;
+    statbuf->st_atime = sp->cf_atime;
+    statbuf->st_mtime = sp->cf_mtime;
+    statbuf->st_ctime = sp->cf_ctime;
+    statbuf->st_ino = sp->cf_ino;
+    statbuf->st_dev = sp->cf_dev;
+    statbuf->st_nlink = sp->cf_nlink;
+
+    return 0;
 }
 
 /*********************************************************************/
@@ -1615,6 +1986,37 @@ void ConnectionsCleanup(void)
 
 /*********************************************************************/
 
+/* No locking taking place in here either */
+void ConnectionsFlushCache(void)
+{
+    Seq *srvlist_tmp = GetGlobalServerList();
+
+    for (size_t i = 0; i < SeqLength(srvlist_tmp); )
+    {
+        ServerItem *svp = SeqAt(srvlist_tmp, i);
+
+        /* Offline marks and connections the server closed go, so that the
+         * next files promises try again */
+        if (svp->conn->conn_info.sd < 0)
+        {
+            DisconnectServer(svp->conn);
+            free(svp->server);
+            SeqRemove(srvlist_tmp, i);
+            continue;
+        }
+
+        DeleteClientCache(svp->conn);
+        i++;
+    }
+}
+
+ConnectionStats ConnectionsGetStats(void)
+{
+    return CONNECTION_STATS;
+}
+
+/*********************************************************************/
+
 #if !defined(__MINGW32__)
 
 #if defined(__hpux) && defined(__GNUC__)
@@ -31,6 +31,15 @@
 /* TODO: Remove dependency on libpromises */
 #include <attributes.h>
 #include <item_lib.h>
+#include <sequence.h>
+
+typedef struct
+{
+    unsigned long opened;            /* connections established */
+    unsigned long reused;            /* idle connections handed out again */
+    unsigned long pipelined;         /* requests sent in batches */
+    unsigned long round_trips_saved; /* replies not waited for one by one */
+} ConnectionStats;
 
 bool cfnet_init(void);
 void DetermineCfenginePort(void);
@@ -46,10 +55,22 @@ int ServerConnect(AgentConnection *conn, const char *host, FileCopy fc);
 
 Item *RemoteDirList(const char *dirname, bool encrypt, AgentConnection *conn);
 
+/**
+  @brief Stat remote files ahead of cf_remote_stat(), which then answers from
+         the connection's cache. Requests go out in batches, each batch costs
+         one round trip to the server instead of one per file.
+  @param files Paths on the server, files already in the cache are skipped.
+  @return Number of files statted, -1 if the connection failed. Replies may
+          then be left unread, so the connection is closed.
+  */
+int RemoteStatPrefetch(const Seq *files, bool encrypt, AgentConnection *conn);
+
 const Stat *ClientCacheLookup(AgentConnection *conn, const char *server_name, const char *file_name);
 
 /* Mark connection as free */
 void ServerNotBusy(AgentConnection *conn);
 
+ConnectionStats ConnectionsGetStats(void);
+
 
 #endif
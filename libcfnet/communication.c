@@ -46,7 +46,7 @@ AgentConnection *NewAgentConn(const char *server_name)
     return conn;
 };
 
-void DeleteAgentConn(AgentConnection *conn)
+void DeleteClientCache(AgentConnection *conn)
 {
     Stat *sp = conn->cache;
 
@@ -54,9 +54,25 @@ void DeleteAgentConn(AgentConnection *conn)
     {
         Stat *sps = sp;
         sp = sp->next;
+        free(sps->cf_filename);
+        free(sps->cf_server);
+        free(sps->cf_readlink);
         free(sps);
     }
 
+    conn->cache = NULL;
+
+    if (conn->cache_index != NULL)
+    {
+        MapDestroy(conn->cache_index);
+        conn->cache_index = NULL;
+    }
+}
+
+void DeleteAgentConn(AgentConnection *conn)
+{
+    DeleteClientCache(conn);
+
     if (conn->conn_info.remote_key != NULL)
     {
         RSA_free(conn->conn_info.remote_key);
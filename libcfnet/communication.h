@@ -30,6 +30,8 @@
 
 AgentConnection *NewAgentConn(const char *server_name);
 void DeleteAgentConn(AgentConnection *ap);
+/* Forget the SYNCH results collected on the connection */
+void DeleteClientCache(AgentConnection *conn);
 int IsIPV6Address(char *name);
 int IsIPV4Address(char *name);
 int Hostname2IPString(char *dst, const char *hostname, size_t dst_size);
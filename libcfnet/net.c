@@ -28,6 +28,182 @@
 
 #include <logging.h>
 #include <misc_lib.h>
+#include <alloc.h>
+
+/*
+ * A transaction is a header followed by the data. The classic header is
+ * CF_INBAND_OFFSET bytes of ASCII, "<status> <length>", and the data at most
+ * CF_BUFSIZE - CF_INBAND_OFFSET bytes. From protocol version 2 on, the
+ * header is CF_NET_FRAME_HEADER_SIZE bytes: the status, then the length as a
+ * 32 bit big-endian integer. The data may then be up to CF_NET_FRAME_MAX
+ * bytes, as long as the receiver uses ReceiveLargeTransaction().
+ */
+
+/* The header is sent along with the start of the data, up to the size of a
+   TLS record; the rest of the data is sent from where it is */
+#define FRAME_FIRST_WRITE 16384
+
+/*************************************************************************/
+
+void EncodeFrameHeader(char header[CF_NET_FRAME_HEADER_SIZE], char status, uint32_t len)
+{
+    header[0] = status;
+    header[1] = (len >> 24) & 0xff;
+    header[2] = (len >> 16) & 0xff;
+    header[3] = (len >> 8) & 0xff;
+    header[4] = len & 0xff;
+}
+
+bool DecodeFrameHeader(const char header[CF_NET_FRAME_HEADER_SIZE], char *status, uint32_t *len)
+{
+    const unsigned char *h = (const unsigned char *) header;
+
+    *status = header[0];
+    *len = ((uint32_t) h[1] << 24) | ((uint32_t) h[2] << 16) |
+           ((uint32_t) h[3] << 8) | (uint32_t) h[4];
+
+    return *len <= CF_NET_FRAME_MAX;
+}
+
+/**
+ * @return len, or -1 if not all of it could be sent
+ */
+static int SendAll(const ConnectionInfo *conn_info, const char *buffer, int len)
+{
+    int ret;
+
+    switch(conn_info->type)
+    {
+    case CF_PROTOCOL_CLASSIC:
+        ret = SendSocketStream(conn_info->sd, (char *) buffer, len);
+        break;
+    case CF_PROTOCOL_TLS:
+        ret = TLSSend(conn_info->ssl, buffer, len);
+        break;
+    default:
+        UnexpectedError("SendTransaction: ProtocolVersion %d!",
+                        conn_info->type);
+        ret = -1;
+    }
+
+    return (ret == len) ? len : -1;
+}
+
+/**
+ * @return len, 0 if the connection was closed before anything was received,
+ *         or -1 on error
+ */
+static int ReceiveAll(const ConnectionInfo *conn_info, char *buffer, int len)
+{
+    int already = 0;
+
+    while (already < len)
+    {
+        int got;
+
+        switch(conn_info->type)
+        {
+        case CF_PROTOCOL_CLASSIC:
+            got = RecvSocketStreamPartial(conn_info->sd, buffer + already, len - already);
+            break;
+        case CF_PROTOCOL_TLS:
+            got = TLSRecv(conn_info->ssl, buffer + already, len - already);
+            break;
+        default:
+            UnexpectedError("ReceiveTransaction: ProtocolVersion %d!",
+                            conn_info->type);
+            got = -1;
+        }
+
+        if (got == -1 || (got == 0 && already > 0))
+        {
+            return -1;
+        }
+        if (got == 0)
+        {
+            return 0;
+        }
+
+        already += got;
+    }
+
+    return already;
+}
+
+static int SendFrame(const ConnectionInfo *conn_info, const char *buffer, int len, char status)
+{
+    if (len > CF_NET_FRAME_MAX)
+    {
+        Log(LOG_LEVEL_ERR, "SendTransaction: len (%d) > %d",
+            len, CF_NET_FRAME_MAX);
+        return -1;
+    }
+
+    char work[FRAME_FIRST_WRITE];
+    int first = MIN(len, FRAME_FIRST_WRITE - CF_NET_FRAME_HEADER_SIZE);
+
+    EncodeFrameHeader(work, status, len);
+    memcpy(work + CF_NET_FRAME_HEADER_SIZE, buffer, first);
+
+    LogDebug(LOG_MOD_NET, "SendTransaction status:'%c' len:%d", status, len);
+    LogRaw(LOG_MOD_NET, LOG_LEVEL_DEBUG, "SendTransaction data: ", (char *) buffer, len);
+
+    if (SendAll(conn_info, work, CF_NET_FRAME_HEADER_SIZE + first) == -1)
+    {
+        return -1;
+    }
+
+    if (len > first && SendAll(conn_info, buffer + first, len - first) == -1)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @return 1 if a header was received, 0 if the connection was closed,
+ *         -1 on error
+ */
+static int ReceiveFrameHeader(const ConnectionInfo *conn_info, char *status, uint32_t *len)
+{
+    char header[CF_NET_FRAME_HEADER_SIZE];
+
+    int ret = ReceiveAll(conn_info, header, sizeof(header));
+    if (ret <= 0)
+    {
+        return ret;
+    }
+
+    LogRaw(LOG_MOD_NET, LOG_LEVEL_DEBUG, "ReceiveTransaction header: ",
+           header, sizeof(header));
+
+    if (!DecodeFrameHeader(header, status, len))
+    {
+        Log(LOG_LEVEL_ERR,
+            "ReceiveTransaction: Bad packet -- too long (len=%u)", *len);
+        return -1;
+    }
+
+    return 1;
+}
+
+/**
+ * Receives the data of a frame into a buffer of at least len + 1 bytes, and
+ * terminates it.
+ */
+static int ReceiveFrameData(const ConnectionInfo *conn_info, char *buffer, uint32_t len)
+{
+    if (len > 0 && ReceiveAll(conn_info, buffer, len) != (int) len)
+    {
+        return -1;
+    }
+
+    buffer[len] = '\0';
+    LogRaw(LOG_MOD_NET, LOG_LEVEL_DEBUG, "ReceiveTransaction data: ", buffer, len);
+
+    return len;
+}
 
 /*************************************************************************/
 
@@ -45,6 +221,11 @@ int SendTransaction(const ConnectionInfo *conn_info, const char *buffer, int len
         len = strlen(buffer);
     }
 
+    if (conn_info->protocol_version >= 2)
+    {
+        return SendFrame(conn_info, buffer, len, status);
+    }
+
     if (len > CF_BUFSIZE - CF_INBAND_OFFSET)
     {
         Log(LOG_LEVEL_ERR, "SendTransaction: len (%d) > %d - %d",
@@ -56,8 +237,8 @@ int SendTransaction(const ConnectionInfo *conn_info, const char *buffer, int len
 
     memcpy(work + CF_INBAND_OFFSET, buffer, len);
 
-    Log(LOG_LEVEL_DEBUG, "SendTransaction header:'%s'", work);
-    LogRaw(LOG_LEVEL_DEBUG, "SendTransaction data: ",
+    LogDebug(LOG_MOD_NET, "SendTransaction header:'%s'", work);
+    LogRaw(LOG_MOD_NET, LOG_LEVEL_DEBUG, "SendTransaction data: ",
            work + CF_INBAND_OFFSET, len);
 
     switch(conn_info->type)
@@ -90,6 +271,29 @@ int ReceiveTransaction(const ConnectionInfo *conn_info, char *buffer, int *more)
     unsigned int len = 0;
     int ret;
 
+    if (conn_info->protocol_version >= 2)
+    {
+        ret = ReceiveFrameHeader(conn_info, &status, &len);
+        if (ret <= 0)
+        {
+            return ret;
+        }
+
+        if (len > CF_BUFSIZE - CF_INBAND_OFFSET)
+        {
+            Log(LOG_LEVEL_ERR,
+                "ReceiveTransaction: Bad packet -- too long (len=%d)", len);
+            return -1;
+        }
+
+        if (more != NULL)
+        {
+            *more = (status == CF_MORE);
+        }
+
+        return ReceiveFrameData(conn_info, buffer, len);
+    }
+
     /* Get control channel. */
     switch(conn_info->type)
     {
@@ -107,7 +311,7 @@ int ReceiveTransaction(const ConnectionInfo *conn_info, char *buffer, int *more)
     if (ret == -1 || ret == 0)
         return ret;
 
-    LogRaw(LOG_LEVEL_DEBUG, "ReceiveTransaction header: ",
+    LogRaw(LOG_MOD_NET, LOG_LEVEL_DEBUG, "ReceiveTransaction header: ",
            proto, CF_INBAND_OFFSET);
 
     ret = sscanf(proto, "%c %u", &status, &len);
@@ -148,11 +352,54 @@ int ReceiveTransaction(const ConnectionInfo *conn_info, char *buffer, int *more)
         ret = -1;
     }
 
-    LogRaw(LOG_LEVEL_DEBUG, "ReceiveTransaction data: ", buffer, ret);
+    LogRaw(LOG_MOD_NET, LOG_LEVEL_DEBUG, "ReceiveTransaction data: ", buffer, ret);
 
     return ret;
 }
 
+/**
+ * Like ReceiveTransaction(), for transactions that may be larger than
+ * CF_BUFSIZE. *buffer is grown as needed, so that it can be reused for a
+ * series of transactions, and the data is '\0'-terminated.
+ *
+ * @param status is set to CF_MORE or CF_DONE
+ */
+int ReceiveLargeTransaction(const ConnectionInfo *conn_info, char **buffer, size_t *buffer_size, char *status)
+{
+    if (*buffer_size < CF_BUFSIZE)
+    {
+        *buffer_size = CF_BUFSIZE;
+        *buffer = xrealloc(*buffer, *buffer_size);
+    }
+
+    if (conn_info->protocol_version < 2)
+    {
+        int more = false;
+        int ret = ReceiveTransaction(conn_info, *buffer, &more);
+        if (ret >= 0)
+        {
+            (*buffer)[ret] = '\0';
+        }
+        *status = more ? CF_MORE : CF_DONE;
+        return ret;
+    }
+
+    uint32_t len = 0;
+    int ret = ReceiveFrameHeader(conn_info, status, &len);
+    if (ret <= 0)
+    {
+        return ret;
+    }
+
+    if (len + 1 > *buffer_size)
+    {
+        *buffer_size = len + 1;
+        *buffer = xrealloc(*buffer, *buffer_size);
+    }
+
+    return ReceiveFrameData(conn_info, *buffer, len);
+}
+
 /*************************************************************************/
 
 /*
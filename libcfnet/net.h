@@ -31,8 +31,12 @@
 #include <cfnet.h>
 
 
+void EncodeFrameHeader(char header[CF_NET_FRAME_HEADER_SIZE], char status, uint32_t len);
+bool DecodeFrameHeader(const char header[CF_NET_FRAME_HEADER_SIZE], char *status, uint32_t *len);
+
 int SendTransaction(const ConnectionInfo *conn_info, const char *buffer, int len, char status);
 int ReceiveTransaction(const ConnectionInfo *conn_info, char *buffer, int *more);
+int ReceiveLargeTransaction(const ConnectionInfo *conn_info, char **buffer, size_t *buffer_size, char *status);
 
 int SetReceiveTimeout(int sd, const struct timeval *timeout);
 
@@ -199,11 +199,21 @@ int TLSClientNegotiateProtocol(const ConnectionInfo *conn_info)
     /* Receive CFE_v%d ... */
     ret = TLSRecvLine(conn_info->ssl, input, sizeof(input));
 
+    /* The server advertises the highest version it supports, older servers
+     * only accept that one: use it if we support it too. */
+    int version = CFNET_PROTOCOL_VERSION;
+    int version_received = 0;
+    if (ret > 0 && sscanf(input, "CFE_v%d", &version_received) == 1 &&
+        version_received > 0 && version_received < version)
+    {
+        version = version_received;
+    }
+
     /* Send "CFE_v%d cf-agent version". */
     char version_string[128];
     int len = snprintf(version_string, sizeof(version_string),
                        "CFE_v%d %s %s\n",
-                       CFNET_PROTOCOL_VERSION, "cf-agent", VERSION);
+                       version, "cf-agent", VERSION);
 
     ret = TLSSend(conn_info->ssl, version_string, len);
     if (ret != len)
@@ -215,7 +225,7 @@ int TLSClientNegotiateProtocol(const ConnectionInfo *conn_info)
     /* Receive OK */
     ret = TLSRecvLine(conn_info->ssl, input, sizeof(input));
     if (strncmp(input, "OK", strlen("OK")) == 0)
-        return 1;
+        return version;
     return 0;
 }
 
@@ -0,0 +1,142 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <discovery_probe.h>
+
+#include <alloc.h>
+#include <logging.h>
+
+struct DiscoveryProbe_
+{
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+    char *name;
+    void *(*probe)(void *arg);
+    void *arg;
+    void (*destroy_result)(void *result);
+    void *result;
+    bool done;
+    bool abandoned;             /* The waiter gave up, the thread frees the probe */
+};
+
+static void DiscoveryProbeDestroy(DiscoveryProbe *probe)
+{
+    pthread_cond_destroy(&probe->finished);
+    pthread_mutex_destroy(&probe->lock);
+    free(probe->name);
+    free(probe);
+}
+
+static void *DiscoveryProbeRun(void *arg)
+{
+    DiscoveryProbe *probe = arg;
+    void *result = probe->probe(probe->arg);
+
+    pthread_mutex_lock(&probe->lock);
+    if (probe->abandoned)
+    {
+        pthread_mutex_unlock(&probe->lock);
+        Log(LOG_LEVEL_DEBUG, "Discovery probe '%s' finished after it was given up on", probe->name);
+
+        if (probe->destroy_result && result)
+        {
+            probe->destroy_result(result);
+        }
+        DiscoveryProbeDestroy(probe);
+        return NULL;
+    }
+
+    probe->result = result;
+    probe->done = true;
+    pthread_cond_signal(&probe->finished);
+    pthread_mutex_unlock(&probe->lock);
+    return NULL;
+}
+
+DiscoveryProbe *DiscoveryProbeStart(const char *name, void *(*probe)(void *arg), void *arg,
+                                    void (*destroy_result)(void *result))
+{
+    DiscoveryProbe *p = xcalloc(1, sizeof(DiscoveryProbe));
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->finished, NULL);
+    p->name = xstrdup(name);
+    p->probe = probe;
+    p->arg = arg;
+    p->destroy_result = destroy_result;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    pthread_t tid;
+    int ret = pthread_create(&tid, &attr, DiscoveryProbeRun, p);
+    pthread_attr_destroy(&attr);
+
+    if (ret != 0)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Running discovery probe '%s' in the foreground. (pthread_create: %s)",
+            name, GetErrorStr());
+        p->result = probe(arg);
+        p->done = true;
+    }
+
+    return p;
+}
+
+void *DiscoveryProbeWait(DiscoveryProbe *probe, long timeout_ms)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&probe->lock);
+    while (!probe->done)
+    {
+        if (pthread_cond_timedwait(&probe->finished, &probe->lock, &deadline) == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+
+    if (!probe->done)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Discovery probe '%s' did not finish within %ld ms, giving up on it",
+            probe->name, timeout_ms);
+        probe->abandoned = true;
+        pthread_mutex_unlock(&probe->lock);
+        return NULL;
+    }
+
+    void *result = probe->result;
+    pthread_mutex_unlock(&probe->lock);
+    DiscoveryProbeDestroy(probe);
+    return result;
+}
@@ -0,0 +1,58 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_DISCOVERY_PROBE_H
+#define CFENGINE_DISCOVERY_PROBE_H
+
+#include <cf3.defs.h>
+
+/*
+ * Context discovery steps that block on something outside the host, like
+ * DNS, are started in a thread of their own so that the agent can discover
+ * the rest meanwhile. Probes must not touch the EvalContext: the result is
+ * handed back to the thread that waits for it, which applies it. A probe
+ * that does not finish in time is left behind and cleans up after itself.
+ */
+
+typedef struct DiscoveryProbe_ DiscoveryProbe;
+
+/**
+ * @brief Run probe(arg) in the background
+ * @param name Used in log messages
+ * @param arg Owned by the probe from now on, it may be returned as the result
+ * @param destroy_result Frees a result nobody waited for, may be NULL
+ * @note If no thread can be created the probe is run before returning
+ */
+DiscoveryProbe *DiscoveryProbeStart(const char *name, void *(*probe)(void *arg), void *arg,
+                                    void (*destroy_result)(void *result));
+
+/**
+ * @brief Wait for the result of a probe and release it
+ * @param timeout_ms How long to wait at most, counted from now
+ * @return The result, or NULL if the probe did not finish in time
+ */
+void *DiscoveryProbeWait(DiscoveryProbe *probe, long timeout_ms);
+
+#endif
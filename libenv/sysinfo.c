@@ -40,6 +40,9 @@
 #include <audit.h>
 #include <pipes.h>
 #include <known_dirs.h>
+#include <discovery_probe.h>
+#include <json.h>
+#include <writer.h>
 
 #include <cf-windows-functions.h>
 
@@ -106,6 +109,10 @@ static time_t GetBootTimeFromUptimeCommand(time_t); // Last resort
 
 /*****************************************************/
 
+#define HOSTNAME_LOOKUP_TIMEOUT 10  /* seconds, two tries of a default resolver */
+#define OS_FACTS_CACHE "os_facts.json"
+#define OS_FACTS_CACHE_TTL SECONDS_PER_HOUR
+
 void CalculateDomainName(const char *nodename, const char *dnsname, char *fqname, char *uqname, char *domain);
 
 #ifdef __linux__
@@ -265,16 +272,13 @@ void CalculateDomainName(const char *nodename, const char *dnsname, char *fqname
 
 /*******************************************************************/
 
-void DetectDomainName(EvalContext *ctx, const char *orig_nodename)
+/* Name the resolver gives for our hostname, "" if none */
+static void LookupDnsName(char *dnsname)
 {
-    char nodename[CF_BUFSIZE];
-
-    strcpy(nodename, orig_nodename);
-    ToLowerStrInplace(nodename);
-
-    char dnsname[CF_BUFSIZE] = "";
     char fqn[CF_BUFSIZE];
 
+    dnsname[0] = '\0';
+
     if (gethostname(fqn, sizeof(fqn)) != -1)
     {
         struct hostent *hp;
@@ -285,7 +289,10 @@ void DetectDomainName(EvalContext *ctx, const char *orig_nodename)
             ToLowerStrInplace(dnsname);
         }
     }
+}
 
+static void SetDomainName(EvalContext *ctx, const char *nodename, const char *dnsname)
+{
     CalculateDomainName(nodename, dnsname, VFQNAME, VUQNAME, VDOMAIN);
 
 /*
@@ -316,6 +323,159 @@ void DetectDomainName(EvalContext *ctx, const char *orig_nodename)
     EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_SYS, "domain", VDOMAIN, DATA_TYPE_STRING);
 }
 
+void DetectDomainName(EvalContext *ctx, const char *orig_nodename)
+{
+    char nodename[CF_BUFSIZE];
+
+    strcpy(nodename, orig_nodename);
+    ToLowerStrInplace(nodename);
+
+    char dnsname[CF_BUFSIZE];
+    LookupDnsName(dnsname);
+
+    SetDomainName(ctx, nodename, dnsname);
+}
+
+/*******************************************************************/
+
+/* DNS part of the host name discovery, run as a DiscoveryProbe */
+
+typedef struct
+{
+    char nodename[CF_BUFSIZE];
+    char dnsname[CF_BUFSIZE];
+    char ipaddress[CF_MAX_IP_LEN];  /* Of the fully qualified name, "" if not resolved */
+    Seq *aliases;
+} HostnameLookup;
+
+static DiscoveryProbe *HOSTNAME_LOOKUP = NULL;
+
+/* gethostbyname() is not reentrant: a lookup that was given up on may still
+ * be running, and no other may start until it is over */
+static pthread_mutex_t HOSTNAME_LOOKUP_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static bool HOSTNAME_LOOKUP_RUNNING = false;
+
+static void HostnameLookupDestroy(void *lookup)
+{
+    if (lookup)
+    {
+        SeqDestroy(((HostnameLookup *) lookup)->aliases);
+        free(lookup);
+    }
+}
+
+static void *LookupHostname(void *arg)
+{
+    HostnameLookup *lookup = arg;
+    char fqname[CF_BUFSIZE], uqname[CF_BUFSIZE], domain[CF_BUFSIZE];
+
+    LookupDnsName(lookup->dnsname);
+    CalculateDomainName(lookup->nodename, lookup->dnsname, fqname, uqname, domain);
+
+    struct hostent *hp = gethostbyname(fqname);
+
+    if (hp != NULL)
+    {
+        inet_ntop(AF_INET, hp->h_addr, lookup->ipaddress, sizeof(lookup->ipaddress));
+
+        for (int i = 0; hp->h_aliases[i] != NULL; i++)
+        {
+            SeqAppend(lookup->aliases, xstrdup(hp->h_aliases[i]));
+        }
+    }
+
+    return lookup;
+}
+
+static void *RunHostnameLookup(void *arg)
+{
+    void *lookup = LookupHostname(arg);
+
+    pthread_mutex_lock(&HOSTNAME_LOOKUP_LOCK);
+    HOSTNAME_LOOKUP_RUNNING = false;
+    pthread_mutex_unlock(&HOSTNAME_LOOKUP_LOCK);
+
+    return lookup;
+}
+
+/* Marks a lookup as running, if none is */
+static bool ClaimHostnameLookup(void)
+{
+    pthread_mutex_lock(&HOSTNAME_LOOKUP_LOCK);
+    bool claimed = !HOSTNAME_LOOKUP_RUNNING;
+    HOSTNAME_LOOKUP_RUNNING = true;
+    pthread_mutex_unlock(&HOSTNAME_LOOKUP_LOCK);
+
+    if (!claimed)
+    {
+        Log(LOG_LEVEL_VERBOSE, "An earlier host name lookup has not finished yet, not starting another");
+    }
+    return claimed;
+}
+
+static HostnameLookup *HostnameLookupNew(const char *nodename)
+{
+    HostnameLookup *lookup = xcalloc(1, sizeof(HostnameLookup));
+
+    strlcpy(lookup->nodename, nodename, sizeof(lookup->nodename));
+    ToLowerStrInplace(lookup->nodename);
+    lookup->aliases = SeqNew(4, free);
+
+    return lookup;
+}
+
+void GetHostnameInfo(EvalContext *ctx)
+{
+    HostnameLookup *lookup;
+
+    if (HOSTNAME_LOOKUP)
+    {
+        lookup = DiscoveryProbeWait(HOSTNAME_LOOKUP, HOSTNAME_LOOKUP_TIMEOUT * 1000);
+        HOSTNAME_LOOKUP = NULL;
+
+        if (lookup == NULL)
+        {
+            Log(LOG_LEVEL_INFO, "Host name lookup did not finish within %d seconds, using the node name '%s'",
+                HOSTNAME_LOOKUP_TIMEOUT, VSYSNAME.nodename);
+        }
+    }
+    else if (ClaimHostnameLookup())
+    {
+        lookup = RunHostnameLookup(HostnameLookupNew(VSYSNAME.nodename));
+    }
+    else
+    {
+        lookup = NULL;
+        Log(LOG_LEVEL_INFO, "Host name lookup is still busy, using the node name '%s'", VSYSNAME.nodename);
+    }
+
+    char nodename[CF_BUFSIZE];
+    strlcpy(nodename, VSYSNAME.nodename, sizeof(nodename));
+    ToLowerStrInplace(nodename);
+
+    SetDomainName(ctx, nodename, lookup ? lookup->dnsname : "");
+
+/* IP address from nameserver */
+
+    if (lookup == NULL || lookup->ipaddress[0] == '\0')
+    {
+        Log(LOG_LEVEL_VERBOSE, "Hostname lookup failed on node name '%s'", VSYSNAME.nodename);
+    }
+    else
+    {
+        Log(LOG_LEVEL_VERBOSE, "Address given by nameserver: %s", lookup->ipaddress);
+        strcpy(VIPADDRESS, lookup->ipaddress);
+
+        for (size_t i = 0; i < SeqLength(lookup->aliases); i++)
+        {
+            Log(LOG_LEVEL_DEBUG, "Adding alias '%s'", (char *) SeqAt(lookup->aliases, i));
+            EvalContextClassPutHard(ctx, SeqAt(lookup->aliases, i));
+        }
+    }
+
+    HostnameLookupDestroy(lookup);
+}
+
 /*******************************************************************/
 
 void DiscoverVersion(EvalContext *ctx)
@@ -354,8 +514,6 @@ void GetNameInfo3(EvalContext *ctx, AgentType agent_type)
     int i, found = false;
     char *sp, workbuf[CF_BUFSIZE];
     time_t tloc;
-    struct hostent *hp;
-    struct sockaddr_in cin;
     unsigned char digest[EVP_MAX_MD_SIZE + 1];
 
 #ifdef _AIX
@@ -412,7 +570,12 @@ void GetNameInfo3(EvalContext *ctx, AgentType agent_type)
     }
 #endif
 
-    DetectDomainName(ctx, VSYSNAME.nodename);
+    /* Resolved meanwhile, picked up by GetHostnameInfo() */
+    if (HOSTNAME_LOOKUP == NULL && ClaimHostnameLookup())
+    {
+        HOSTNAME_LOOKUP = DiscoveryProbeStart("hostname", RunHostnameLookup, HostnameLookupNew(VSYSNAME.nodename),
+                                              HostnameLookupDestroy);
+    }
 
     if ((tloc = time((time_t *) NULL)) == -1)
     {
@@ -726,27 +889,6 @@ void GetNameInfo3(EvalContext *ctx, AgentType agent_type)
     EvalContextClassPutHard(ctx, workbuf);
     Log(LOG_LEVEL_VERBOSE, "GNU autoconf class from compile time: %s", workbuf);
 
-/* Get IP address from nameserver */
-
-    if ((hp = gethostbyname(VFQNAME)) == NULL)
-    {
-        Log(LOG_LEVEL_VERBOSE, "Hostname lookup failed on node name '%s'", VSYSNAME.nodename);
-        return;
-    }
-    else
-    {
-        memset(&cin, 0, sizeof(cin));
-        cin.sin_addr.s_addr = ((struct in_addr *) (hp->h_addr))->s_addr;
-        Log(LOG_LEVEL_VERBOSE, "Address given by nameserver: %s", inet_ntoa(cin.sin_addr));
-        strcpy(VIPADDRESS, inet_ntoa(cin.sin_addr));
-
-        for (i = 0; hp->h_aliases[i] != NULL; i++)
-        {
-            Log(LOG_LEVEL_DEBUG, "Adding alias '%s'", hp->h_aliases[i]);
-            EvalContextClassPutHard(ctx, hp->h_aliases[i]);
-        }
-    }
-
 #ifdef HAVE_GETZONEID
     zoneid_t zid;
     char zone[ZONENAME_MAX];
@@ -903,7 +1045,199 @@ static void SetFlavour(EvalContext *ctx, const char *flavour)
     EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_SYS, "flavor", flavour, DATA_TYPE_STRING);
 }
 
-void OSClasses(EvalContext *ctx)
+/*******************************************************************/
+
+/*
+ * The classes and sys variables from release files, /proc, cpuid and the
+ * processor count change with upgrades and reboots only, so what
+ * OSReleaseClasses() adds is kept in the state directory and reused for
+ * OS_FACTS_CACHE_TTL while uname says the same.
+ */
+
+static bool GetOSFactsCacheFilename(char *path)
+{
+    if (snprintf(path, CF_BUFSIZE, "%s%cstate%c%s", CFWORKDIR, FILE_SEPARATOR, FILE_SEPARATOR,
+                 OS_FACTS_CACHE) >= CF_BUFSIZE)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Work directory path is too long to cache OS facts in it");
+        return false;
+    }
+
+    MapName(path);
+    return true;
+}
+
+static void GetOSFactsCacheKey(char *key)
+{
+    snprintf(key, CF_BUFSIZE, "%s %s %s %s", VSYSNAME.sysname, VSYSNAME.release, VSYSNAME.version, VSYSNAME.machine);
+}
+
+static StringSet *HardClassNames(const EvalContext *ctx)
+{
+    StringSet *names = StringSetNew();
+    ClassTableIterator *iter = EvalContextClassTableIteratorNewGlobal(ctx, NULL, true, false);
+    Class *cls;
+
+    while ((cls = ClassTableIteratorNext(iter)))
+    {
+        if (!cls->is_soft)
+        {
+            StringSetAdd(names, xstrdup(cls->name));
+        }
+    }
+
+    ClassTableIteratorDestroy(iter);
+    return names;
+}
+
+/* sys variables by name, NULL if any is not a string */
+static JsonElement *SysStringVariables(const EvalContext *ctx)
+{
+    JsonElement *vars = JsonObjectCreate(50);
+    VariableTableIterator *iter = EvalContextVariableTableIteratorNew(ctx, NULL, SpecialScopeToString(SPECIAL_SCOPE_SYS), NULL);
+    Variable *var;
+
+    while ((var = VariableTableIteratorNext(iter)))
+    {
+        if (var->rval.type != RVAL_TYPE_SCALAR || var->type != DATA_TYPE_STRING)
+        {
+            continue;
+        }
+
+        char *name = VarRefToString(var->ref, false);
+        JsonObjectAppendString(vars, name, RvalScalarValue(var->rval));
+        free(name);
+    }
+
+    VariableTableIteratorDestroy(iter);
+    return vars;
+}
+
+static bool LoadOSFacts(EvalContext *ctx)
+{
+    char path[CF_BUFSIZE], key[CF_BUFSIZE];
+    JsonElement *cache = NULL;
+
+    if (!GetOSFactsCacheFilename(path) ||
+        JsonParseFile(path, CF_BUFSIZE * 64, &cache) != JSON_PARSE_OK)
+    {
+        return false;
+    }
+
+    GetOSFactsCacheKey(key);
+    const char *cached_key = JsonObjectGetAsString(cache, "uname");
+    JsonElement *cached_time = JsonObjectGet(cache, "time");
+    JsonElement *classes = JsonObjectGetAsArray(cache, "classes");
+    JsonElement *vars = JsonObjectGetAsObject(cache, "variables");
+    time_t now = time(NULL);
+
+    if (cached_key == NULL || strcmp(cached_key, key) != 0 || cached_time == NULL || classes == NULL || vars == NULL)
+    {
+        Log(LOG_LEVEL_VERBOSE, "OS facts in '%s' are for another system, discovering them again", path);
+        JsonDestroy(cache);
+        return false;
+    }
+
+    time_t then = JsonPrimitiveGetAsInteger(cached_time);
+    if (then > now || now - then >= OS_FACTS_CACHE_TTL)
+    {
+        Log(LOG_LEVEL_VERBOSE, "OS facts in '%s' have expired, discovering them again", path);
+        JsonDestroy(cache);
+        return false;
+    }
+
+    for (size_t i = 0; i < JsonLength(classes); i++)
+    {
+        EvalContextClassPutHard(ctx, JsonArrayGetAsString(classes, i));
+    }
+
+    JsonIterator iter = JsonIteratorInit(vars);
+    const char *name;
+    while ((name = JsonIteratorNextKey(&iter)))
+    {
+        EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_SYS, name,
+                                      JsonPrimitiveGetAsString(JsonIteratorCurrentValue(&iter)), DATA_TYPE_STRING);
+    }
+
+    Log(LOG_LEVEL_VERBOSE, "Loaded %zu OS classes and %zu sys variables discovered %jd seconds ago from '%s'",
+        JsonLength(classes), JsonLength(vars), (intmax_t) (now - then), path);
+
+    JsonDestroy(cache);
+    return true;
+}
+
+static void SaveOSFacts(EvalContext *ctx, StringSet *classes_before, JsonElement *vars_before)
+{
+    char path[CF_BUFSIZE], tmp_path[CF_BUFSIZE], key[CF_BUFSIZE];
+
+    JsonElement *classes = JsonArrayCreate(50);
+    StringSet *classes_after = HardClassNames(ctx);
+    StringSetIterator class_iter = StringSetIteratorInit(classes_after);
+    const char *name;
+
+    while ((name = StringSetIteratorNext(&class_iter)))
+    {
+        if (!StringSetContains(classes_before, name))
+        {
+            JsonArrayAppendString(classes, name);
+        }
+    }
+    StringSetDestroy(classes_after);
+
+    JsonElement *vars = JsonObjectCreate(10);
+    JsonElement *vars_after = SysStringVariables(ctx);
+    JsonIterator var_iter = JsonIteratorInit(vars_after);
+
+    while ((name = JsonIteratorNextKey(&var_iter)))
+    {
+        const char *value = JsonPrimitiveGetAsString(JsonIteratorCurrentValue(&var_iter));
+        const char *value_before = JsonObjectGetAsString(vars_before, name);
+
+        if (value_before == NULL || strcmp(value, value_before) != 0)
+        {
+            JsonObjectAppendString(vars, name, value);
+        }
+    }
+    JsonDestroy(vars_after);
+
+    GetOSFactsCacheKey(key);
+    JsonElement *cache = JsonObjectCreate(4);
+    JsonObjectAppendString(cache, "uname", key);
+    JsonObjectAppendInteger(cache, "time", (int) time(NULL));
+    JsonObjectAppendArray(cache, "classes", classes);
+    JsonObjectAppendObject(cache, "variables", vars);
+
+    /* Written aside and renamed, so that a concurrent agent never reads a
+       partial file */
+    if (!GetOSFactsCacheFilename(path) ||
+        snprintf(tmp_path, sizeof(tmp_path), "%s.%ju", path, (uintmax_t) getpid()) >= (int) sizeof(tmp_path))
+    {
+        JsonDestroy(cache);
+        return;
+    }
+
+    FILE *fout = fopen(tmp_path, "w");
+    if (fout == NULL)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Could not create OS facts cache '%s'. (fopen: %s)", tmp_path, GetErrorStr());
+        JsonDestroy(cache);
+        return;
+    }
+
+    Writer *writer = FileWriter(fout);
+    JsonWrite(writer, cache, 0);
+    WriterWrite(writer, "\n");
+    WriterClose(writer);
+    JsonDestroy(cache);
+
+    if (rename(tmp_path, path) == -1)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Could not write OS facts cache '%s'. (rename: %s)", path, GetErrorStr());
+        unlink(tmp_path);
+    }
+}
+
+static void OSReleaseClasses(EvalContext *ctx)
 {
 #ifdef __linux__
     struct stat statbuf;
@@ -1057,6 +1391,21 @@ void OSClasses(EvalContext *ctx)
 #endif
 
     GetCPUInfo(ctx);
+}
+
+void OSClasses(EvalContext *ctx)
+{
+    if (!LoadOSFacts(ctx))
+    {
+        StringSet *classes_before = HardClassNames(ctx);
+        JsonElement *vars_before = SysStringVariables(ctx);
+
+        OSReleaseClasses(ctx);
+        SaveOSFacts(ctx, classes_before, vars_before);
+
+        StringSetDestroy(classes_before);
+        JsonDestroy(vars_before);
+    }
 
 #ifdef __CYGWIN__
 
@@ -29,7 +29,14 @@
 
 void DiscoverVersion(EvalContext *ctx);
 
+/**
+ * @brief Local host facts; starts looking the host name up in DNS
+ */
 void GetNameInfo3(EvalContext *ctx, AgentType agent_type);
+/**
+ * @brief Host name, domain and address classes from the lookup GetNameInfo3() started
+ */
+void GetHostnameInfo(EvalContext *ctx);
 void Get3Environment(EvalContext *ctx, AgentType agent_type);
 void BuiltinClasses(EvalContext *ctx);
 void OSClasses(EvalContext *ctx);
@@ -841,6 +841,10 @@ FileChange GetChangeMgtConstraints(const EvalContext *ctx, const Promise *pp)
     }
 
     c.report_diffs = PromiseGetConstraintAsBoolean(ctx, "report_diffs", pp);
+
+    value = (char *) ConstraintGetRvalValue(ctx, "rehash", pp, RVAL_TYPE_SCALAR);
+    c.rehash_always = value && (strcmp(value, "always") == 0);
+
     return c;
 }
 
@@ -1085,6 +1089,7 @@ Packages GetPackageConstraints(const EvalContext *ctx, const Promise *pp)
 
     p.package_list_update_command = (char *) ConstraintGetRvalValue(ctx, "package_list_update_command", pp, RVAL_TYPE_SCALAR);
     p.package_list_update_ifelapsed = PromiseGetConstraintAsInt(ctx, "package_list_update_ifelapsed", pp);
+    p.package_list_database = (char *) ConstraintGetRvalValue(ctx, "package_list_database", pp, RVAL_TYPE_SCALAR);
     p.package_list_command = (char *) ConstraintGetRvalValue(ctx, "package_list_command", pp, RVAL_TYPE_SCALAR);
     p.package_list_version_regex = (char *) ConstraintGetRvalValue(ctx, "package_list_version_regex", pp, RVAL_TYPE_SCALAR);
     p.package_list_name_regex = (char *) ConstraintGetRvalValue(ctx, "package_list_name_regex", pp, RVAL_TYPE_SCALAR);
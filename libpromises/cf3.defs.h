@@ -34,6 +34,7 @@
 #endif
 
 #include <sequence.h>
+#include <map.h>
 #include <logging.h>
 
 /*******************************************************************/
@@ -368,6 +369,13 @@ typedef struct
 {
     unsigned char mess_digest[EVP_MAX_MD_SIZE + 1];     /* Content digest */
     unsigned char attr_digest[EVP_MAX_MD_SIZE + 1];     /* Attribute digest */
+    /* Stat of the file the content digest was taken from, all 0 when it
+     * cannot vouch for the content (and in records of older versions) */
+    int64_t size;
+    int64_t mtime;
+    int64_t ctime;
+    int64_t ino;
+    int64_t dev;
 } ChecksumValue;
 
 /*******************************************************************/
@@ -615,6 +623,7 @@ typedef enum
 // Put this here now for caching efficiency
 
 #define SOFTWARE_PACKAGES_CACHE "software_packages.csv"
+#define SOFTWARE_PACKAGES_INVENTORY "software_packages.inventory"
 
 /*************************************************************************/
 
@@ -1110,6 +1119,9 @@ struct PackageManager_
     PackageItem *pack_list;
     PackageItem *patch_list;
     PackageItem *patch_avail;
+    Map *pack_index;            /* canonified name -> Seq of PackageItem in pack_list, built on demand */
+    time_t list_time;           /* when pack_list was taken, 0 until it is */
+    time_t database_mtime;      /* of package_list_database at list_time, 0 if none */
     PackageManager *next;
 };
 
@@ -1230,6 +1242,7 @@ typedef struct
     FileChangeReport report_changes;
     int report_diffs;
     int update;
+    int rehash_always;          /* Don't trust unchanged stat to mean unchanged content */
 } FileChange;
 
 /*************************************************************************/
@@ -1445,6 +1458,7 @@ typedef struct
 
     char *package_list_update_command;
     int package_list_update_ifelapsed;
+    char *package_list_database;
 
     char *package_version_regex;
     char *package_name_regex;
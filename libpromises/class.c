@@ -1,18 +1,32 @@
 #include <class.h>
 
-#include <rb-tree.h>
+#include <map.h>
 #include <alloc.h>
 #include <string_lib.h>
 #include <files_names.h>
 
+/*
+ * Classes are keyed on the Class itself: ClassRefHash picks the bucket and
+ * ClassKeyEqual compares the full (namespace, name) pair, so classes whose
+ * names hash the same are kept apart.
+ */
 struct ClassTable_
 {
-    RBTree *classes;
+    Map *classes;
+    unsigned long generation;
 };
 
+/* Generations are handed out from one counter, no two table states share one */
+static unsigned long CLASS_TABLE_GENERATIONS = 0;
+
+static void ClassTableChanged(ClassTable *table)
+{
+    table->generation = ++CLASS_TABLE_GENERATIONS;
+}
+
 struct ClassTableIterator_
 {
-    RBTreeIterator *iter;
+    MapIterator iter;
     char *ns;
     bool is_hard;
     bool is_soft;
@@ -39,6 +53,45 @@ static size_t ClassRefHash(const char *ns, const char *name)
     return (h & (INT_MAX - 1));
 }
 
+/*
+ * Names are stored canonified, but callers may look classes up by their raw
+ * name, so compare the way ClassRefHash hashes.
+ */
+static bool ClassNameEqual(const char *stored, const char *name)
+{
+    for (; *stored && *name; stored++, name++)
+    {
+        char c = (!isalnum(*name) || (*name == '.')) ? '_' : *name;
+        if (*stored != c)
+        {
+            return false;
+        }
+    }
+
+    return *stored == *name;
+}
+
+static unsigned int ClassKeyHash(const void *key, ARG_UNUSED unsigned int seed, unsigned int max)
+{
+    return ((const Class *)key)->hash % max;
+}
+
+static bool ClassKeyEqual(const void *stored, const void *key)
+{
+    const Class *a = stored;
+    const Class *b = key;
+
+    if (a->hash != b->hash)
+    {
+        return false;
+    }
+
+    const char *a_ns = a->ns ? a->ns : "default";
+    const char *b_ns = b->ns ? b->ns : "default";
+
+    return strcmp(a_ns, b_ns) == 0 && ClassNameEqual(a->name, b->name);
+}
+
 void ClassInit(Class *cls, const char *ns, const char *name, bool is_soft, ContextScope scope)
 {
     if (ns)
@@ -70,11 +123,20 @@ void ClassDestroy(Class *cls)
     }
 }
 
+static void ClassTableEntryDestroy(Class *cls)
+{
+    ClassDestroy(cls);
+    free(cls);
+}
+
 ClassTable *ClassTableNew(void)
 {
     ClassTable *table = xmalloc(sizeof(ClassTable));
 
-    table->classes = RBTreeNew(NULL, NULL, NULL, NULL, NULL, (RBTreeValueDestroyFn *)ClassDestroy);
+    /* the key is the stored Class itself, destroyed along with the value */
+    table->classes = MapNew(ClassKeyHash, ClassKeyEqual,
+                            NULL, (MapDestroyDataFn)ClassTableEntryDestroy);
+    ClassTableChanged(table);
 
     return table;
 }
@@ -83,7 +145,8 @@ void ClassTableDestroy(ClassTable *table)
 {
     if (table)
     {
-        RBTreeDestroy(table->classes);
+        MapDestroy(table->classes);
+        free(table);
     }
 }
 
@@ -98,6 +161,8 @@ bool ClassTablePut(ClassTable *table, const char *ns, const char *name, bool is_
         ns = NULL;
     }
 
+    ClassTableChanged(table);
+
     Class *cls = ClassTableGet(table, ns, name);
     if (cls)
     {
@@ -109,26 +174,47 @@ bool ClassTablePut(ClassTable *table, const char *ns, const char *name, bool is_
     {
         cls = xmalloc(sizeof(Class));
         ClassInit(cls, ns, name, is_soft, scope);
-        return RBTreePut(table->classes, (void *)cls->hash, cls);
+        MapInsert(table->classes, cls, cls);
+        return false;
     }
 }
 
+static Class ClassKey(const char *ns, const char *name)
+{
+    return (Class) {
+        .ns = (char *)ns,
+        .name = (char *)name,
+        .hash = ClassRefHash(ns, name)
+    };
+}
+
+unsigned long ClassTableGeneration(const ClassTable *table)
+{
+    return table->generation;
+}
+
 Class *ClassTableGet(const ClassTable *table, const char *ns, const char *name)
 {
-    size_t hash = ClassRefHash(ns, name);
-    return RBTreeGet(table->classes, (void *)hash);
+    Class key = ClassKey(ns, name);
+    return MapGet(table->classes, &key);
 }
 
 bool ClassTableRemove(ClassTable *table, const char *ns, const char *name)
 {
-    size_t hash = ClassRefHash(ns, name);
-    return RBTreeRemove(table->classes, (void *)hash);
+    Class key = ClassKey(ns, name);
+    if (MapRemove(table->classes, &key))
+    {
+        ClassTableChanged(table);
+        return true;
+    }
+    return false;
 }
 
 bool ClassTableClear(ClassTable *table)
 {
-    bool has_classes = RBTreeSize(table->classes) > 0;
-    RBTreeClear(table->classes);
+    bool has_classes = MapSize(table->classes) > 0;
+    MapClear(table->classes);
+    ClassTableChanged(table);
     return has_classes;
 }
 
@@ -137,7 +223,7 @@ ClassTableIterator *ClassTableIteratorNew(const ClassTable *table, const char *n
     ClassTableIterator *iter = xmalloc(sizeof(ClassTableIterator));
 
     iter->ns = ns ? xstrdup(ns) : NULL;
-    iter->iter = RBTreeIteratorNew(table->classes);
+    iter->iter = MapIteratorInit(table->classes);
     iter->is_soft = is_soft;
     iter->is_hard = is_hard;
 
@@ -146,11 +232,11 @@ ClassTableIterator *ClassTableIteratorNew(const ClassTable *table, const char *n
 
 Class *ClassTableIteratorNext(ClassTableIterator *iter)
 {
-    void *key_ref = NULL;
-    Class *cls = NULL;
+    MapKeyValue *item = NULL;
 
-    while (RBTreeIteratorNext(iter->iter, &key_ref, (void **)&cls))
+    while ((item = MapIteratorNext(&iter->iter)))
     {
+        Class *cls = item->value;
         const char *key_ns = cls->ns ? cls->ns : "default";
 
         if (iter->ns && strcmp(key_ns, iter->ns) != 0)
@@ -178,7 +264,6 @@ void ClassTableIteratorDestroy(ClassTableIterator *iter)
     if (iter)
     {
         free(iter->ns);
-        RBTreeIteratorDestroy(iter->iter);
         free(iter);
     }
 }
@@ -27,6 +27,12 @@ bool ClassTableRemove(ClassTable *table, const char *ns, const char *name);
 
 bool ClassTableClear(ClassTable *table);
 
+/**
+ * @brief Changes whenever a class is put in or removed from the table
+ * @note Different tables never share a generation, so it also tells tables apart
+ */
+unsigned long ClassTableGeneration(const ClassTable *table);
+
 ClassTableIterator *ClassTableIteratorNew(const ClassTable *table, const char *ns, bool is_hard, bool is_soft);
 Class *ClassTableIteratorNext(ClassTableIterator *iter);
 void ClassTableIteratorDestroy(ClassTableIterator *iter);
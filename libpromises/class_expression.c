@@ -0,0 +1,225 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <class_expression.h>
+
+#include <logic_expressions.h>
+#include <class.h>
+#include <alloc.h>
+#include <misc_lib.h>
+
+typedef enum
+{
+    CLASS_OP_TEST,              /* value = test(names[arg]) */
+    CLASS_OP_TRUE,              /* value = true */
+    CLASS_OP_NOT,               /* value = !value */
+    CLASS_OP_JUMP_IF_FALSE,     /* skip to arg, the rest of an and-expression */
+    CLASS_OP_JUMP_IF_TRUE,      /* skip to arg, the rest of an or-expression */
+} ClassOpCode;
+
+typedef struct
+{
+    ClassOpCode op;
+    size_t arg;
+} ClassOp;
+
+struct ClassExpression_
+{
+    ClassOp *ops;
+    size_t n_ops;
+    ClassRef *names;
+    size_t n_names;
+    bool unexpanded;            /* A name had a variable reference in it */
+};
+
+typedef struct
+{
+    ClassExpression *expr;
+    size_t ops_size;
+    size_t names_size;
+} Compiler;
+
+static size_t Emit(Compiler *c, ClassOpCode op, size_t arg)
+{
+    if (c->expr->n_ops == c->ops_size)
+    {
+        c->ops_size *= 2;
+        c->expr->ops = xrealloc(c->expr->ops, c->ops_size * sizeof(ClassOp));
+    }
+
+    c->expr->ops[c->expr->n_ops] = (ClassOp) { op, arg };
+    return c->expr->n_ops++;
+}
+
+static char *NoVariables(ARG_UNUSED const char *varname, ARG_UNUSED VarRefType type, ARG_UNUSED void *param)
+{
+    return NULL;
+}
+
+static void CompileName(Compiler *c, const StringExpression *name_expr)
+{
+    char *name = EvalStringExpression(name_expr, &NoVariables, NULL);
+
+    if (name == NULL)
+    {
+        /* Evaluation of the whole expression would fail */
+        c->expr->unexpanded = true;
+        return;
+    }
+
+    ClassRef ref = ClassRefParse(name);
+    free(name);
+
+    if (strcmp(ref.name, "any") == 0)
+    {
+        ClassRefDestroy(ref);
+        Emit(c, CLASS_OP_TRUE, 0);
+        return;
+    }
+
+    if (c->expr->n_names == c->names_size)
+    {
+        c->names_size *= 2;
+        c->expr->names = xrealloc(c->expr->names, c->names_size * sizeof(ClassRef));
+    }
+
+    c->expr->names[c->expr->n_names] = ref;
+    Emit(c, CLASS_OP_TEST, c->expr->n_names++);
+}
+
+static void CompileExpression(Compiler *c, const Expression *expr)
+{
+    switch (expr->op)
+    {
+    case LOGICAL_OP_OR:
+    case LOGICAL_OP_AND:
+    {
+        CompileExpression(c, expr->val.andor.lhs);
+        size_t jump = Emit(c, (expr->op == LOGICAL_OP_OR) ? CLASS_OP_JUMP_IF_TRUE : CLASS_OP_JUMP_IF_FALSE, 0);
+        CompileExpression(c, expr->val.andor.rhs);
+        c->expr->ops[jump].arg = c->expr->n_ops;
+        break;
+    }
+
+    case LOGICAL_OP_NOT:
+        CompileExpression(c, expr->val.not.arg);
+        Emit(c, CLASS_OP_NOT, 0);
+        break;
+
+    case LOGICAL_OP_EVAL:
+        CompileName(c, expr->val.eval.name);
+        break;
+
+    default:
+        ProgrammingError("Unexpected class expression type is found: %d", expr->op);
+    }
+}
+
+ClassExpression *ClassExpressionCompile(const char *expr)
+{
+    ParseResult res = ParseExpression(expr, 0, strlen(expr));
+
+    if (!res.result)
+    {
+        return NULL;
+    }
+
+    Compiler c = {
+        .expr = xcalloc(1, sizeof(ClassExpression)),
+        .ops_size = 4,
+        .names_size = 2,
+    };
+    c.expr->ops = xmalloc(c.ops_size * sizeof(ClassOp));
+    c.expr->names = xmalloc(c.names_size * sizeof(ClassRef));
+
+    CompileExpression(&c, res.result);
+    FreeExpression(res.result);
+
+    return c.expr;
+}
+
+void ClassExpressionDestroy(ClassExpression *expr)
+{
+    if (expr)
+    {
+        for (size_t i = 0; i < expr->n_names; i++)
+        {
+            ClassRefDestroy(expr->names[i]);
+        }
+        free(expr->names);
+        free(expr->ops);
+        free(expr);
+    }
+}
+
+bool ClassExpressionEvaluate(const ClassExpression *expr, ClassExpressionTestFn test, void *param)
+{
+    /* Unexpanded variables are errors, which are false whatever the rest
+       says. Without them nothing can fail, so short-circuiting gives what
+       evaluating every operand would. */
+    if (expr->unexpanded)
+    {
+        return false;
+    }
+
+    bool value = false;
+    size_t pc = 0;
+
+    while (pc < expr->n_ops)
+    {
+        const ClassOp *op = &expr->ops[pc++];
+
+        switch (op->op)
+        {
+        case CLASS_OP_TEST:
+            value = test(expr->names[op->arg].ns, expr->names[op->arg].name, param);
+            break;
+
+        case CLASS_OP_TRUE:
+            value = true;
+            break;
+
+        case CLASS_OP_NOT:
+            value = !value;
+            break;
+
+        case CLASS_OP_JUMP_IF_FALSE:
+            if (!value)
+            {
+                pc = op->arg;
+            }
+            break;
+
+        case CLASS_OP_JUMP_IF_TRUE:
+            if (value)
+            {
+                pc = op->arg;
+            }
+            break;
+        }
+    }
+
+    return value;
+}
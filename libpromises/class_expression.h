@@ -0,0 +1,58 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_CLASS_EXPRESSION_H
+#define CFENGINE_CLASS_EXPRESSION_H
+
+#include <cf3.defs.h>
+
+/*
+ * A class expression parsed once and flattened into a small program of
+ * class tests and short-circuit jumps, so that checking it again costs a
+ * handful of lookups instead of a parse. The class names are split into
+ * namespace and name when compiling.
+ */
+
+typedef struct ClassExpression_ ClassExpression;
+
+/**
+ * @brief Tells whether a class referenced by the expression is defined
+ * @param ns Namespace given in the expression, NULL if none
+ */
+typedef bool (*ClassExpressionTestFn)(const char *ns, const char *name, void *param);
+
+/**
+ * @return NULL if expr does not parse
+ */
+ClassExpression *ClassExpressionCompile(const char *expr);
+void ClassExpressionDestroy(ClassExpression *expr);
+
+/**
+ * @brief Evaluate the expression, the class "any" is always defined
+ * @note An expression with unexpanded variables is never true
+ */
+bool ClassExpressionEvaluate(const ClassExpression *expr, ClassExpressionTestFn test, void *param);
+
+#endif
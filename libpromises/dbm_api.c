@@ -300,6 +300,16 @@ bool DeleteDB(DBHandle *handle, const char *key)
     return DBPrivDelete(handle->priv, key, strlen(key) + 1);
 }
 
+bool BeginBatchDB(DBHandle *handle)
+{
+    return DBPrivBeginBatch(handle->priv);
+}
+
+bool CommitBatchDB(DBHandle *handle)
+{
+    return DBPrivCommitBatch(handle->priv);
+}
+
 bool NewDBCursor(DBHandle *handle, DBCursor **cursor)
 {
     DBCursorPriv *priv = DBPrivOpenCursor(handle->priv);
@@ -70,6 +70,17 @@ bool ReadDB(CF_DB *dbp, const char *key, void *dest, int destSz);
 bool WriteDB(CF_DB *dbp, const char *key, const void *src, int srcSz);
 bool DeleteDB(CF_DB *dbp, const char *key);
 
+/*
+ * Group all following writes and deletes done on dbp by the calling thread into
+ * one transaction, committed by CommitBatchDB(). Use this around loops which
+ * update many keys, as every standalone write is committed (and synced) on
+ * its own. Other threads and processes writing to the same database wait for
+ * the batch to be committed, so keep batches short-lived. Cursors may be used
+ * inside a batch, but a batch must not be started while a cursor is open.
+ */
+bool BeginBatchDB(CF_DB *dbp);
+bool CommitBatchDB(CF_DB *dbp);
+
 /*
  * Creating cursor locks the whole database, so keep the amount of work here to
  * minimum.
@@ -40,6 +40,11 @@ struct DBPriv_
     MDB_env *env;
     MDB_dbi dbi;
     MDB_cursor *mc;
+
+    /* Write txn opened by DBPrivBeginBatch, only usable by its owner thread */
+    MDB_txn *batch_txn;
+    pthread_t batch_owner;
+    int batch_depth;
 };
 
 struct DBCursorPriv_
@@ -49,10 +54,33 @@ struct DBCursorPriv_
     MDB_val delkey;
     void *curkv;
     bool pending_delete;
+    bool in_batch;
 };
 
 /******************************************************************************/
 
+static MDB_txn *GetBatchTxn(DBPriv *db)
+{
+    if (db->batch_txn && pthread_equal(db->batch_owner, pthread_self()))
+    {
+        return db->batch_txn;
+    }
+    return NULL;
+}
+
+/*
+ * Write txn which writes should join instead of committing on their own: the
+ * one of an open cursor, or the calling thread's batch.
+ */
+static MDB_txn *GetSharedWriteTxn(DBPriv *db)
+{
+    if (db->mc)
+    {
+        return mdb_cursor_txn(db->mc);
+    }
+    return GetBatchTxn(db);
+}
+
 const char *DBPrivGetFileExtension(void)
 {
     return "lmdb";
@@ -125,6 +153,11 @@ err:
 
 void DBPrivCloseDB(DBPriv *db)
 {
+    if (db->batch_txn)
+    {
+        Log(LOG_LEVEL_ERR, "Database closed with an uncommitted batch, discarding it");
+        mdb_txn_abort(db->batch_txn);
+    }
     if (db->env)
     {
         mdb_env_close(db->env);
@@ -139,7 +172,16 @@ bool DBPrivHasKey(DBPriv *db, const void *key, int key_size)
     int rc;
     // FIXME: distinguish between "entry not found" and "error occured"
 
-    rc = mdb_txn_begin(db->env, NULL, MDB_RDONLY, &txn);
+    MDB_txn *batch_txn = GetBatchTxn(db);
+    if (batch_txn)
+    {
+        txn = batch_txn;
+        rc = MDB_SUCCESS;
+    }
+    else
+    {
+        rc = mdb_txn_begin(db->env, NULL, MDB_RDONLY, &txn);
+    }
     if (rc == MDB_SUCCESS)
     {
         mkey.mv_data = (void *)key;
@@ -149,7 +191,10 @@ bool DBPrivHasKey(DBPriv *db, const void *key, int key_size)
         {
             Log(LOG_LEVEL_ERR, "Could not read: %s", mdb_strerror(rc));
         }
-        mdb_txn_abort(txn);
+        if (!batch_txn)
+        {
+            mdb_txn_abort(txn);
+        }
     }
     else
     {
@@ -167,7 +212,16 @@ int DBPrivGetValueSize(DBPriv *db, const void *key, int key_size)
 
     data.mv_size = 0;
 
-    rc = mdb_txn_begin(db->env, NULL, MDB_RDONLY, &txn);
+    MDB_txn *batch_txn = GetBatchTxn(db);
+    if (batch_txn)
+    {
+        txn = batch_txn;
+        rc = MDB_SUCCESS;
+    }
+    else
+    {
+        rc = mdb_txn_begin(db->env, NULL, MDB_RDONLY, &txn);
+    }
     if (rc == MDB_SUCCESS)
     {
         mkey.mv_data = (void *)key;
@@ -177,7 +231,10 @@ int DBPrivGetValueSize(DBPriv *db, const void *key, int key_size)
         {
             Log(LOG_LEVEL_ERR, "Could not read: %s", mdb_strerror(rc));
         }
-        mdb_txn_abort(txn);
+        if (!batch_txn)
+        {
+            mdb_txn_abort(txn);
+        }
     }
     else
     {
@@ -194,7 +251,16 @@ bool DBPrivRead(DBPriv *db, const void *key, int key_size, void *dest, int dest_
     int rc;
     bool ret = false;
 
-    rc = mdb_txn_begin(db->env, NULL, MDB_RDONLY, &txn);
+    MDB_txn *batch_txn = GetBatchTxn(db);
+    if (batch_txn)
+    {
+        txn = batch_txn;
+        rc = MDB_SUCCESS;
+    }
+    else
+    {
+        rc = mdb_txn_begin(db->env, NULL, MDB_RDONLY, &txn);
+    }
     if (rc == MDB_SUCCESS)
     {
         mkey.mv_data = (void *)key;
@@ -213,7 +279,10 @@ bool DBPrivRead(DBPriv *db, const void *key, int key_size, void *dest, int dest_
         {
             Log(LOG_LEVEL_ERR, "Could not read: %s", mdb_strerror(rc));
         }
-        mdb_txn_abort(txn);
+        if (!batch_txn)
+        {
+            mdb_txn_abort(txn);
+        }
     }
     else
     {
@@ -228,10 +297,11 @@ bool DBPrivWrite(DBPriv *db, const void *key, int key_size, const void *value, i
     MDB_txn *txn;
     int rc;
 
-    /* If there's an open cursor, use its txn */
-    if (db->mc)
+    /* If there's an open cursor or batch, use its txn */
+    MDB_txn *shared_txn = GetSharedWriteTxn(db);
+    if (shared_txn)
     {
-        txn = mdb_cursor_txn(db->mc);
+        txn = shared_txn;
         rc = MDB_SUCCESS;
     }
     else
@@ -245,8 +315,15 @@ bool DBPrivWrite(DBPriv *db, const void *key, int key_size, const void *value, i
         data.mv_data = (void *)value;
         data.mv_size = value_size;
         rc = mdb_put(txn, db->dbi, &mkey, &data, 0);
-        /* don't commit here if there's a cursor */
-        if (!db->mc)
+        /* don't commit here if the txn is shared */
+        if (shared_txn)
+        {
+            if (rc)
+            {
+                Log(LOG_LEVEL_ERR, "Could not write: %s", mdb_strerror(rc));
+            }
+        }
+        else
         {
             if (rc == MDB_SUCCESS)
             {
@@ -276,12 +353,14 @@ bool DBPrivDelete(DBPriv *db, const void *key, int key_size)
     MDB_txn *txn;
     int rc;
 
-    /* If there's an open cursor, use its txn */
-    if (db->mc)
+    /* If there's an open cursor or batch, use its txn */
+    MDB_txn *shared_txn = GetSharedWriteTxn(db);
+    if (shared_txn)
     {
-        txn = mdb_cursor_txn(db->mc);
+        txn = shared_txn;
         rc = MDB_SUCCESS;
-    } else
+    }
+    else
     {
         rc = mdb_txn_begin(db->env, NULL, 0, &txn);
     }
@@ -290,8 +369,15 @@ bool DBPrivDelete(DBPriv *db, const void *key, int key_size)
         mkey.mv_data = (void *)key;
         mkey.mv_size = key_size;
         rc = mdb_del(txn, db->dbi, &mkey, NULL);
-        /* don't commit here if there's a cursor */
-        if (!db->mc)
+        /* don't commit here if the txn is shared */
+        if (shared_txn)
+        {
+            if (rc && rc != MDB_NOTFOUND)
+            {
+                Log(LOG_LEVEL_ERR, "Could not delete: %s", mdb_strerror(rc));
+            }
+        }
+        else
         {
             if (rc == MDB_SUCCESS)
             {
@@ -321,7 +407,17 @@ DBCursorPriv *DBPrivOpenCursor(DBPriv *db)
     MDB_txn *txn;
     int rc;
 
-    rc = mdb_txn_begin(db->env, NULL, 0, &txn);
+    /* Iterating inside a batch uses (and leaves open) the batch txn */
+    MDB_txn *batch_txn = GetBatchTxn(db);
+    if (batch_txn)
+    {
+        txn = batch_txn;
+        rc = MDB_SUCCESS;
+    }
+    else
+    {
+        rc = mdb_txn_begin(db->env, NULL, 0, &txn);
+    }
     if (rc == MDB_SUCCESS)
     {
         rc = mdb_cursor_open(txn, db->dbi, &db->mc);
@@ -330,11 +426,15 @@ DBCursorPriv *DBPrivOpenCursor(DBPriv *db)
             cursor = xcalloc(1, sizeof(DBCursorPriv));
             cursor->db = db;
             cursor->mc = db->mc;
+            cursor->in_batch = (batch_txn != NULL);
         }
         else
         {
             Log(LOG_LEVEL_ERR, "Could not open cursor: %s", mdb_strerror(rc));
-            mdb_txn_abort(txn);
+            if (!batch_txn)
+            {
+                mdb_txn_abort(txn);
+            }
         }
         /* txn remains with cursor */
     }
@@ -437,14 +537,63 @@ void DBPrivCloseCursor(DBCursorPriv *cursor)
     cursor->db->mc = NULL;
     txn = mdb_cursor_txn(cursor->mc);
     mdb_cursor_close(cursor->mc);
-    rc = mdb_txn_commit(txn);
-    if (rc)
+    if (!cursor->in_batch)
     {
-        Log(LOG_LEVEL_ERR, "Could not commit cursor txn: %s", mdb_strerror(rc));
+        rc = mdb_txn_commit(txn);
+        if (rc)
+        {
+            Log(LOG_LEVEL_ERR, "Could not commit cursor txn: %s", mdb_strerror(rc));
+        }
     }
     free(cursor);
 }
 
+bool DBPrivBeginBatch(DBPriv *db)
+{
+    if (GetBatchTxn(db))
+    {
+        db->batch_depth++;
+        return true;
+    }
+
+    /* Blocks while another thread or process holds the write txn */
+    MDB_txn *txn;
+    int rc = mdb_txn_begin(db->env, NULL, 0, &txn);
+    if (rc)
+    {
+        Log(LOG_LEVEL_ERR, "Could not create batch txn: %s", mdb_strerror(rc));
+        return false;
+    }
+
+    db->batch_owner = pthread_self();
+    db->batch_depth = 1;
+    db->batch_txn = txn;
+    return true;
+}
+
+bool DBPrivCommitBatch(DBPriv *db)
+{
+    MDB_txn *txn = GetBatchTxn(db);
+    if (!txn)
+    {
+        Log(LOG_LEVEL_ERR, "Could not commit batch: no batch was started");
+        return false;
+    }
+
+    if (--db->batch_depth > 0)
+    {
+        return true;
+    }
+
+    db->batch_txn = NULL;
+    int rc = mdb_txn_commit(txn);
+    if (rc)
+    {
+        Log(LOG_LEVEL_ERR, "Could not commit batch txn: %s", mdb_strerror(rc));
+    }
+    return rc == MDB_SUCCESS;
+}
+
 char *DBPrivDiagnose(const char *dbpath)
 {
     return StringFormat("Unable to diagnose LMDB file (not implemented) for '%s'", dbpath);
@@ -60,6 +60,14 @@ bool DBPrivWrite(DBPriv *db, const void *key, int key_size,
 
 bool DBPrivDelete(DBPriv *db, const void *key, int key_size);
 
+/*
+ * Group the writes and deletes done by the calling thread into a single
+ * transaction until the matching DBPrivCommitBatch(). Batches may be nested,
+ * only the outermost commit has to reach the disk.
+ */
+bool DBPrivBeginBatch(DBPriv *db);
+bool DBPrivCommitBatch(DBPriv *db);
+
 
 DBCursorPriv *DBPrivOpenCursor(DBPriv *db);
 bool DBPrivAdvanceCursor(DBCursorPriv *cursor, void **key, int *key_size,
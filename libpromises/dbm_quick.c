@@ -324,6 +324,33 @@ bool DBPrivAdvanceCursor(DBCursorPriv *cursor, void **key, int *ksize, void **va
     return true;
 }
 
+/*
+ * QDBM has no transactions and does not sync on every write, so a batch only
+ * needs to flush once at the end.
+ */
+bool DBPrivBeginBatch(ARG_UNUSED DBPriv *db)
+{
+    return true;
+}
+
+bool DBPrivCommitBatch(DBPriv *db)
+{
+    if (!Lock(db))
+    {
+        return false;
+    }
+
+    if (!dpsync(db->depot))
+    {
+        Log(LOG_LEVEL_ERR, "Could not sync QDBM database. (dpsync: %s)", dperrmsg(dpecode));
+        Unlock(db);
+        return false;
+    }
+
+    Unlock(db);
+    return true;
+}
+
 bool DBPrivDeleteCursorEntry(DBCursorPriv *cursor)
 {
     return DBPrivDelete(cursor->db, cursor->curkey, cursor->curkey_size);
@@ -46,6 +46,13 @@ struct DBPriv_
     pthread_mutex_t cursor_lock;
 
     TCHDB *hdb;
+
+    /*
+     * Transaction opened by DBPrivBeginBatch. Tokyo Cabinet makes other
+     * threads wait while it is open, so only the owner touches these.
+     */
+    pthread_t batch_owner;
+    int batch_depth;
 };
 
 struct DBCursorPriv_
@@ -366,6 +373,52 @@ void DBPrivCloseCursor(DBCursorPriv *cursor)
     UnlockCursor(db);
 }
 
+static bool OwnsBatch(DBPriv *db)
+{
+    return db->batch_depth > 0 && pthread_equal(db->batch_owner, pthread_self());
+}
+
+bool DBPrivBeginBatch(DBPriv *db)
+{
+    if (OwnsBatch(db))
+    {
+        db->batch_depth++;
+        return true;
+    }
+
+    if (!tchdbtranbegin(db->hdb))
+    {
+        Log(LOG_LEVEL_ERR, "Could not start Tokyo Cabinet transaction. (tchdbtranbegin: %s)",
+            ErrorMessage(db->hdb));
+        return false;
+    }
+
+    db->batch_owner = pthread_self();
+    db->batch_depth = 1;
+    return true;
+}
+
+bool DBPrivCommitBatch(DBPriv *db)
+{
+    if (!OwnsBatch(db))
+    {
+        Log(LOG_LEVEL_ERR, "Could not commit batch: no batch was started");
+        return false;
+    }
+
+    if (--db->batch_depth > 0)
+    {
+        return true;
+    }
+
+    if (!tchdbtrancommit(db->hdb))
+    {
+        Log(LOG_LEVEL_ERR, "Could not commit Tokyo Cabinet transaction. (tchdbtrancommit: %s)",
+            ErrorMessage(db->hdb));
+        return false;
+    }
+    return true;
+}
 
 char *DBPrivDiagnose(const char *dbpath)
 {
@@ -26,6 +26,7 @@
 
 #include <files_names.h>
 #include <logic_expressions.h>
+#include <class_expression.h>
 #include <syntax.h>
 #include <item_lib.h>
 #include <ornaments.h>
@@ -39,6 +40,7 @@
 #include <syslog_client.h>
 #include <audit.h>
 #include <promise_logging.h>
+#include <logging_priv.h>
 #include <rlist.h>
 #include <buffer.h>
 #include <promises.h>
@@ -224,39 +226,13 @@ static void EvalContextStackFrameAddSoft(EvalContext *ctx, const char *context)
     }
 }
 
-typedef struct
-{
-    const EvalContext *ctx;
-    const char *ns;
-} EvalTokenAsClassContext;
-
-static ExpressionValue EvalTokenAsClass(const char *classname, void *param)
+static bool ClassIsDefined(const char *ns, const char *name, void *param)
 {
-    const EvalContext *ctx = ((EvalTokenAsClassContext *)param)->ctx;
-    ClassRef ref = ClassRefParse(classname);
-
-    if (strcmp("any", ref.name) == 0)
-    {
-        ClassRefDestroy(ref);
-        return true;
-    }
-    else if (!ref.ns && EvalContextHeapContainsHard(ctx, ref.name))
-    {
-        ClassRefDestroy(ref);
-        return true;
-    }
-    else if (EvalContextHeapContainsSoft(ctx, ref.ns, ref.name))
-    {
-        ClassRefDestroy(ref);
-        return true;
-    }
-    else if (EvalContextStackFrameContainsSoft(ctx, ref.name))
-    {
-        ClassRefDestroy(ref);
-        return true;
-    }
+    const EvalContext *ctx = param;
 
-    return false;
+    return (!ns && EvalContextHeapContainsHard(ctx, name))
+        || EvalContextHeapContainsSoft(ctx, ns, name)
+        || EvalContextStackFrameContainsSoft(ctx, name);
 }
 
 /**********************************************************************/
@@ -273,38 +249,106 @@ static char *EvalVarRef(ARG_UNUSED const char *varname, ARG_UNUSED VarRefType ty
 
 /**********************************************************************/
 
-bool IsDefinedClass(const EvalContext *ctx, const char *context, const char *ns)
+/*
+ * Class expressions are compiled once per EvalContext. The last result is
+ * kept along with the generations of the class tables it was computed
+ * from: the global one and the bundle frame one the stack lets it see.
+ * It is reused until either changes. With more than one bundle frame in
+ * sight, as when inheriting classes, the result is not kept.
+ */
+
+#define CLASS_EXPRESSION_CACHE_MAX 10000
+
+typedef struct
 {
-    ParseResult res;
+    ClassExpression *expr;      /* NULL if it does not parse */
+    bool memoized;
+    bool value;
+    unsigned long global_generation;
+    unsigned long local_generation;
+} ClassExpressionEntry;
 
+static void ClassExpressionEntryDestroy(void *p)
+{
+    ClassExpressionEntry *entry = p;
+    ClassExpressionDestroy(entry->expr);
+    free(entry);
+}
+
+/* Generation of the bundle frame class table in sight, 0 if none, false if more than one */
+static bool StackFrameClassesGeneration(const EvalContext *ctx, unsigned long *generation)
+{
+    *generation = 0;
+
+    for (size_t i = SeqLength(ctx->stack); i > 0; i--)
+    {
+        const StackFrame *frame = SeqAt(ctx->stack, i - 1);
+
+        if (frame->type == STACK_FRAME_TYPE_BUNDLE)
+        {
+            if (*generation != 0)
+            {
+                return false;
+            }
+            *generation = ClassTableGeneration(frame->data.bundle.classes);
+        }
+
+        if (!frame->inherits_previous)
+        {
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool IsDefinedClass(const EvalContext *ctx, const char *context, ARG_UNUSED const char *ns)
+{
     if (!context)
     {
         return true;
     }
 
-    res = ParseExpression(context, 0, strlen(context));
+    /* Connection threads of cf-serverd check classes concurrently */
+    pthread_mutex_lock(ctx->class_expressions_lock);
 
-    if (!res.result)
+    ClassExpressionEntry *entry = MapGet(ctx->class_expressions, context);
+    if (entry == NULL)
+    {
+        if (MapSize(ctx->class_expressions) >= CLASS_EXPRESSION_CACHE_MAX)
+        {
+            MapClear(ctx->class_expressions);
+        }
+
+        entry = xcalloc(1, sizeof(ClassExpressionEntry));
+        entry->expr = ClassExpressionCompile(context);
+        MapInsert(ctx->class_expressions, xstrdup(context), entry);
+    }
+
+    if (entry->expr == NULL)
     {
+        pthread_mutex_unlock(ctx->class_expressions_lock);
         Log(LOG_LEVEL_ERR, "Unable to parse class expression '%s'", context);
         return false;
     }
-    else
-    {
-        EvalTokenAsClassContext etacc = {
-            .ctx = ctx,
-            .ns = ns
-        };
 
-        ExpressionValue r = EvalExpression(res.result,
-                                           &EvalTokenAsClass, &EvalVarRef,
-                                           &etacc);
+    unsigned long global_generation = ClassTableGeneration(ctx->global_classes);
+    unsigned long local_generation;
+    bool memoizable = StackFrameClassesGeneration(ctx, &local_generation);
 
-        FreeExpression(res.result);
-
-        /* r is EvalResult which could be ERROR */
-        return r == true;
+    if (!memoizable || !entry->memoized
+        || entry->global_generation != global_generation || entry->local_generation != local_generation)
+    {
+        entry->value = ClassExpressionEvaluate(entry->expr, &ClassIsDefined, (void *) ctx);
+        entry->memoized = memoizable;
+        entry->global_generation = global_generation;
+        entry->local_generation = local_generation;
     }
+
+    bool value = entry->value;
+    pthread_mutex_unlock(ctx->class_expressions_lock);
+
+    return value;
 }
 
 /**********************************************************************/
@@ -712,6 +756,10 @@ EvalContext *EvalContextNew(void)
     ctx->stack = SeqNew(10, StackFrameDestroy);
 
     ctx->global_classes = ClassTableNew();
+    ctx->class_expressions = MapNew((MapHashFn) StringHash, (MapKeyEqualFn) StringSafeEqual,
+                                    free, ClassExpressionEntryDestroy);
+    ctx->class_expressions_lock = xmalloc(sizeof(pthread_mutex_t));
+    pthread_mutex_init(ctx->class_expressions_lock, NULL);
 
     ctx->global_variables = VariableTableNew();
     ctx->match_variables = VariableTableNew();
@@ -739,6 +787,9 @@ void EvalContextDestroy(EvalContext *ctx)
         SeqDestroy(ctx->stack);
 
         ClassTableDestroy(ctx->global_classes);
+        MapDestroy(ctx->class_expressions);
+        pthread_mutex_destroy(ctx->class_expressions_lock);
+        free(ctx->class_expressions_lock);
         VariableTableDestroy(ctx->global_variables);
         VariableTableDestroy(ctx->match_variables);
 
@@ -1861,9 +1912,9 @@ static void SummarizeTransaction(EvalContext *ctx, TransactionContext tc, const
 {
     if (logname && (tc.log_string))
     {
-        char buffer[CF_EXPANDSIZE];
-
-        ExpandScalar(ctx, NULL, NULL, tc.log_string, buffer);
+        Buffer *expanded = BufferNew();
+        ExpandScalar(ctx, NULL, NULL, tc.log_string, expanded);
+        const char *buffer = BufferData(expanded);
 
         if (strcmp(logname, "udp_syslog") == 0)
         {
@@ -1894,6 +1945,7 @@ static void SummarizeTransaction(EvalContext *ctx, TransactionContext tc, const
             if (fout == NULL)
             {
                 Log(LOG_LEVEL_ERR, "Unable to open private log '%s'", logname);
+                BufferDestroy(&expanded);
                 return;
             }
 
@@ -1903,6 +1955,7 @@ static void SummarizeTransaction(EvalContext *ctx, TransactionContext tc, const
             fclose(fout);
         }
 
+        BufferDestroy(&expanded);
         tc.log_string = NULL;     /* To avoid repetition */
     }
 }
@@ -2041,9 +2094,10 @@ void cfPS(EvalContext *ctx, LogLevel level, PromiseResult status, const Promise
         LogPromiseContext(ctx, pp);
     }
 
+    /* The message is the promise outcome recorded below, even if not shown */
     va_list ap;
     va_start(ap, fmt);
-    VLog(level, fmt, ap);
+    LoggingPrivVLogRecorded(level, fmt, ap);
     va_end(ap);
 
     const char *last_msg = PromiseLoggingLastMessage(ctx);
@@ -114,6 +114,9 @@ struct EvalContext_
     ClassTable *global_classes;
     VariableTable *global_variables;
 
+    Map *class_expressions;     /* For IsDefinedClass() */
+    pthread_mutex_t *class_expressions_lock;
+
     VariableTable *match_variables;
 
     StringSet *dependency_handles;
@@ -2046,7 +2046,7 @@ static FnCallResult FnCallLsDir(EvalContext *ctx, FnCall *fp, Rlist *finalargs)
 
 static FnCallResult FnCallMapArray(EvalContext *ctx, FnCall *fp, Rlist *finalargs)
 {
-    char expbuf[CF_EXPANDSIZE];
+    Buffer *expbuf = BufferNew();
     Rlist *returnlist = NULL;
 
     char *map = RlistScalarValue(finalargs);
@@ -2069,18 +2069,22 @@ static FnCallResult FnCallMapArray(EvalContext *ctx, FnCall *fp, Rlist *finalarg
         {
         case RVAL_TYPE_SCALAR:
             EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_THIS, "v", var->rval.item, DATA_TYPE_STRING);
+            BufferZero(expbuf);
             ExpandScalar(ctx, PromiseGetBundle(fp->caller)->ns, PromiseGetBundle(fp->caller)->name, map, expbuf);
 
-            if (strstr(expbuf, "$(this.k)") || strstr(expbuf, "${this.k}") ||
-                strstr(expbuf, "$(this.v)") || strstr(expbuf, "${this.v}"))
+            if (strstr(BufferData(expbuf), "$(this.k)") || strstr(BufferData(expbuf), "${this.k}") ||
+                strstr(BufferData(expbuf), "$(this.v)") || strstr(BufferData(expbuf), "${this.v}"))
             {
                 RlistDestroy(returnlist);
                 EvalContextVariableRemoveSpecial(ctx, SPECIAL_SCOPE_THIS, "k");
                 EvalContextVariableRemoveSpecial(ctx, SPECIAL_SCOPE_THIS, "v");
+                VariableTableIteratorDestroy(iter);
+                VarRefDestroy(ref);
+                BufferDestroy(&expbuf);
                 return (FnCallResult) { FNCALL_FAILURE };
             }
 
-            RlistAppendScalar(&returnlist, expbuf);
+            RlistAppendScalar(&returnlist, BufferData(expbuf));
             EvalContextVariableRemoveSpecial(ctx, SPECIAL_SCOPE_THIS, "v");
             break;
 
@@ -2088,18 +2092,22 @@ static FnCallResult FnCallMapArray(EvalContext *ctx, FnCall *fp, Rlist *finalarg
             for (const Rlist *rp = var->rval.item; rp != NULL; rp = rp->next)
             {
                 EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_THIS, "v", RlistScalarValue(rp), DATA_TYPE_STRING);
+                BufferZero(expbuf);
                 ExpandScalar(ctx, PromiseGetBundle(fp->caller)->ns, PromiseGetBundle(fp->caller)->name, map, expbuf);
 
-                if (strstr(expbuf, "$(this.k)") || strstr(expbuf, "${this.k}") ||
-                    strstr(expbuf, "$(this.v)") || strstr(expbuf, "${this.v}"))
+                if (strstr(BufferData(expbuf), "$(this.k)") || strstr(BufferData(expbuf), "${this.k}") ||
+                    strstr(BufferData(expbuf), "$(this.v)") || strstr(BufferData(expbuf), "${this.v}"))
                 {
                     RlistDestroy(returnlist);
                     EvalContextVariableRemoveSpecial(ctx, SPECIAL_SCOPE_THIS, "k");
                     EvalContextVariableRemoveSpecial(ctx, SPECIAL_SCOPE_THIS, "v");
+                    VariableTableIteratorDestroy(iter);
+                    VarRefDestroy(ref);
+                    BufferDestroy(&expbuf);
                     return (FnCallResult) { FNCALL_FAILURE };
                 }
 
-                RlistAppendScalarIdemp(&returnlist, expbuf);
+                RlistAppendScalarIdemp(&returnlist, BufferData(expbuf));
                 EvalContextVariableRemoveSpecial(ctx, SPECIAL_SCOPE_THIS, "v");
             }
             break;
@@ -2112,6 +2120,7 @@ static FnCallResult FnCallMapArray(EvalContext *ctx, FnCall *fp, Rlist *finalarg
 
     VariableTableIteratorDestroy(iter);
     VarRefDestroy(ref);
+    BufferDestroy(&expbuf);
 
     if (returnlist == NULL)
     {
@@ -2123,7 +2132,6 @@ static FnCallResult FnCallMapArray(EvalContext *ctx, FnCall *fp, Rlist *finalarg
 
 static FnCallResult FnCallMapList(EvalContext *ctx, FnCall *fp, Rlist *finalargs)
 {
-    char expbuf[CF_EXPANDSIZE];
     Rlist *newlist = NULL;
     Rval rval;
     DataType retype;
@@ -2157,23 +2165,29 @@ static FnCallResult FnCallMapList(EvalContext *ctx, FnCall *fp, Rlist *finalargs
         return (FnCallResult) { FNCALL_FAILURE };
     }
 
+    Buffer *expbuf = BufferNew();
+
     for (const Rlist *rp = RvalRlistValue(rval); rp != NULL; rp = rp->next)
     {
         EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_THIS, "this", RlistScalarValue(rp), DATA_TYPE_STRING);
 
+        BufferZero(expbuf);
         ExpandScalar(ctx, NULL, "this", map, expbuf);
 
-        if (strstr(expbuf, "$(this)") || strstr(expbuf, "${this}"))
+        if (strstr(BufferData(expbuf), "$(this)") || strstr(BufferData(expbuf), "${this}"))
         {
             RlistDestroy(newlist);
             EvalContextVariableRemoveSpecial(ctx, SPECIAL_SCOPE_THIS, "this");
+            BufferDestroy(&expbuf);
             return (FnCallResult) { FNCALL_FAILURE };
         }
 
-        RlistAppendScalar(&newlist, expbuf);
+        RlistAppendScalar(&newlist, BufferData(expbuf));
         EvalContextVariableRemoveSpecial(ctx, SPECIAL_SCOPE_THIS, "this");
     }
 
+    BufferDestroy(&expbuf);
+
     return (FnCallResult) { FNCALL_SUCCESS, { newlist, RVAL_TYPE_LIST } };
 }
 
@@ -4704,23 +4718,20 @@ static FnCallResult FnCallReadJson(EvalContext *ctx, FnCall *fp, Rlist *args)
     const char *input_path = RlistScalarValue(args);
     size_t size_max = IntFromString(RlistScalarValue(args->next));
 
-    /* FIXME: fail if truncated? */
-    Writer *contents = FileRead(input_path, size_max, NULL);
-    if (!contents)
+    /* The file is parsed as it is read, up to size_max bytes */
+    JsonElement *json = NULL;
+    JsonParseError err = JsonParseFile(input_path, size_max, &json);
+    if (err == JSON_PARSE_ERROR_NO_SUCH_FILE)
     {
         Log(LOG_LEVEL_ERR, "Error reading JSON input file '%s'", input_path);
         return (FnCallResult) { FNCALL_FAILURE, };
     }
-    JsonElement *json = NULL;
-    const char *data = StringWriterData(contents);
-    if (JsonParse(&data, &json) != JSON_PARSE_OK)
+    if (err != JSON_PARSE_OK)
     {
-        Log(LOG_LEVEL_ERR, "Error parsing JSON file '%s'", input_path);
-        WriterClose(contents);
+        Log(LOG_LEVEL_ERR, "Error parsing JSON file '%s': %s", input_path, JsonParseErrorToString(err));
         return (FnCallResult) { FNCALL_FAILURE };
     }
 
-    WriterClose(contents);
     return (FnCallResult) { FNCALL_SUCCESS, (Rval) { json, RVAL_TYPE_CONTAINER } };
 }
 
@@ -42,6 +42,7 @@
 #include <string_lib.h>
 #include <conversion.h>
 #include <verify_classes.h>
+#include <profiler.h>
 
 
 static void ExpandPromiseAndDo(EvalContext *ctx, const Promise *pp, Rlist *lists, Rlist *containers,
@@ -119,6 +120,9 @@ void ExpandPromise(EvalContext *ctx, Promise *pp, PromiseActuator *ActOnPromise,
     //fix me wth a general function SetMissingDefaults
     SetAnyMissingDefaults(ctx, pp);
 
+    ProfilerEnter(PROFILE_FRAME_PROMISE, pp->promiser);
+    ProfilerEnter(PROFILE_FRAME_EXPANSION, NULL);
+
     Promise *pcopy = DeRefCopyPromise(ctx, pp);
 
     MapIteratorsFromRval(ctx, PromiseGetBundle(pp)->name, (Rval) { pcopy->promiser, RVAL_TYPE_SCALAR }, &scalars, &lists, &containers);
@@ -138,6 +142,8 @@ void ExpandPromise(EvalContext *ctx, Promise *pp, PromiseActuator *ActOnPromise,
     CopyLocalizedReferencesToBundleScope(ctx, PromiseGetBundle(pp), scalars);
     CopyLocalizedReferencesToBundleScope(ctx, PromiseGetBundle(pp), containers);
 
+    ProfilerLeave();
+
     ExpandPromiseAndDo(ctx, pcopy, lists, containers, ActOnPromise, param);
 
     PromiseDestroy(pcopy);
@@ -145,6 +151,8 @@ void ExpandPromise(EvalContext *ctx, Promise *pp, PromiseActuator *ActOnPromise,
     RlistDestroy(lists);
     RlistDestroy(scalars);
     RlistDestroy(containers);
+
+    ProfilerLeave();
 }
 
 static void ExpandPromiseAndDo(EvalContext *ctx, const Promise *pp, Rlist *lists, Rlist *containers, PromiseActuator *ActOnPromise, void *param)
@@ -154,17 +162,22 @@ static void ExpandPromiseAndDo(EvalContext *ctx, const Promise *pp, Rlist *lists
     EvalContextStackPushPromiseFrame(ctx, pp, true);
 
     PromiseIterator *iter_ctx = NULL;
+    Buffer *expanded_handle = BufferNew();
     size_t i = 0;
     for (iter_ctx = PromiseIteratorNew(ctx, pp, lists, containers); PromiseIteratorHasMore(iter_ctx); i++, PromiseIteratorNext(iter_ctx))
     {
+        ProfilerEnter(PROFILE_FRAME_EXPANSION, NULL);
+
         if (handle)
         {
-            char tmp[CF_EXPANDSIZE];
             // This ordering is necessary to get automated canonification
-            ExpandScalar(ctx, NULL, "this", handle, tmp);
+            BufferZero(expanded_handle);
+            ExpandScalar(ctx, NULL, "this", handle, expanded_handle);
+            char *tmp = xstrdup(BufferData(expanded_handle));
             CanonifyNameInPlace(tmp);
             Log(LOG_LEVEL_DEBUG, "Expanded handle to '%s'", tmp);
             EvalContextVariablePutSpecial(ctx, SPECIAL_SCOPE_THIS, "handle", tmp, DATA_TYPE_STRING);
+            free(tmp);
         }
         else
         {
@@ -173,6 +186,8 @@ static void ExpandPromiseAndDo(EvalContext *ctx, const Promise *pp, Rlist *lists
 
         Promise *pexp = EvalContextStackPushPromiseIterationFrame(ctx, i, iter_ctx);
 
+        ProfilerLeave();
+
         assert(ActOnPromise);
         ActOnPromise(ctx, pexp, param);
 
@@ -184,6 +199,7 @@ static void ExpandPromiseAndDo(EvalContext *ctx, const Promise *pp, Rlist *lists
         EvalContextStackPopFrame(ctx);
     }
 
+    BufferDestroy(&expanded_handle);
     PromiseIteratorDestroy(iter_ctx);
     EvalContextStackPopFrame(ctx);
 }
@@ -522,7 +538,6 @@ Rlist *ExpandList(EvalContext *ctx, const char *ns, const char *scope, const Rli
 
 Rval ExpandPrivateRval(EvalContext *ctx, const char *ns, const char *scope, Rval rval)
 {
-    char buffer[CF_EXPANDSIZE];
     FnCall *fp, *fpe;
     Rval returnval;
 
@@ -534,9 +549,13 @@ Rval ExpandPrivateRval(EvalContext *ctx, const char *ns, const char *scope, Rval
     {
     case RVAL_TYPE_SCALAR:
 
-        ExpandScalar(ctx, ns, scope, (char *) rval.item, buffer);
-        returnval.item = xstrdup(buffer);
-        returnval.type = RVAL_TYPE_SCALAR;
+        {
+            Buffer *buffer = BufferNew();
+            ExpandScalar(ctx, ns, scope, (char *) rval.item, buffer);
+            returnval.item = xstrdup(BufferData(buffer));
+            returnval.type = RVAL_TYPE_SCALAR;
+            BufferDestroy(&buffer);
+        }
         break;
 
     case RVAL_TYPE_LIST:
@@ -574,9 +593,11 @@ Rval ExpandBundleReference(EvalContext *ctx, const char *ns, const char *scope,
     {
     case RVAL_TYPE_SCALAR:
         {
-            char buffer[CF_EXPANDSIZE];
+            Buffer *buffer = BufferNew();
             ExpandScalar(ctx, ns, scope, (char *) rval.item, buffer);
-            return RvalNew(buffer, RVAL_TYPE_SCALAR);
+            Rval expanded = RvalNew(BufferData(buffer), RVAL_TYPE_SCALAR);
+            BufferDestroy(&buffer);
+            return expanded;
         }
 
     case RVAL_TYPE_FNCALL:
@@ -594,208 +615,336 @@ Rval ExpandBundleReference(EvalContext *ctx, const char *ns, const char *scope,
 
 /*********************************************************************/
 
-static bool ExpandOverflow(const char *str1, const char *str2)
+/*
+ * A scalar is parsed once into a template: a sequence of literal runs and
+ * variable references. Templates are cached by string, so that expanding the
+ * same promise string again, e.g. on every iteration, only does the lookups.
+ */
+
+#define EXPAND_TEMPLATE_CACHE_SIZE 4096
+
+typedef struct ExpandTemplate_ ExpandTemplate;
+
+typedef struct
 {
-    int len = strlen(str2);
+    char *text;                 /* Literal run, or the name of a reference */
+    size_t length;
+    char bracket;               /* '(' or '{' for references, '\0' for literals */
+    ExpandTemplate *nested;     /* The name contains references itself */
+    bool expandable;            /* The name is left with references, expands to nothing */
+
+    Buffer *name;               /* Expanded name of a nested reference */
+    VarRef *ref;                /* Last parsed reference, and what it was parsed from */
+    char *ref_name;
+    char *ref_ns;
+    char *ref_scope;
+} ExpandSegment;
+
+struct ExpandTemplate_
+{
+    char *string;
+    Seq *segments;
+};
+
+static Map *EXPAND_TEMPLATES = NULL;
 
-    if ((strlen(str1) + len) > (CF_EXPANDSIZE - CF_BUFFERMARGIN))
+static ExpandTemplate *ExpandTemplateParse(const char *string);
+
+static void ExpandTemplateDestroy(ExpandTemplate *template);
+
+static void ExpandSegmentDestroy(ExpandSegment *segment)
+{
+    if (segment)
     {
-        Log(LOG_LEVEL_ERR,
-            "Expansion overflow constructing string. Increase CF_EXPANDSIZE macro. Tried to add '%s' to '%s'", str2,
-              str1);
-        return true;
+        free(segment->text);
+        ExpandTemplateDestroy(segment->nested);
+        BufferDestroy(&segment->name);
+        VarRefDestroy(segment->ref);
+        free(segment->ref_name);
+        free(segment->ref_ns);
+        free(segment->ref_scope);
+        free(segment);
     }
-
-    return false;
 }
 
-/*********************************************************************/
-
-bool ExpandScalar(const EvalContext *ctx, const char *ns, const char *scope, const char *string, char buffer[CF_EXPANDSIZE])
+static void ExpandTemplateDestroy(ExpandTemplate *template)
 {
-    Rval rval;
-    int varstring = false;
-    char currentitem[CF_EXPANDSIZE], temp[CF_BUFSIZE], name[CF_MAXVARSIZE];
-    int increment, returnval = true;
+    if (template)
+    {
+        SeqDestroy(template->segments);
+        free(template->string);
+        free(template);
+    }
+}
 
-    buffer[0] = '\0';
+static void ExpandTemplateAppendLiteral(ExpandTemplate *template, const char *text, size_t length)
+{
+    size_t num_segments = SeqLength(template->segments);
+    ExpandSegment *last = num_segments > 0 ? SeqAt(template->segments, num_segments - 1) : NULL;
 
-    if (string == 0 || strlen(string) == 0)
+    if (last && last->bracket == '\0')
     {
-        return false;
+        last->text = xrealloc(last->text, last->length + length + 1);
+        memcpy(last->text + last->length, text, length);
+        last->length += length;
+        last->text[last->length] = '\0';
+        return;
     }
 
-    for (const char *sp = string; /* No exit */ ; sp++)     /* check for varitems */
-    {
-        char var[CF_BUFSIZE];
+    ExpandSegment *segment = xcalloc(1, sizeof(ExpandSegment));
+    segment->text = xstrndup(text, length);
+    segment->length = length;
+    SeqAppend(template->segments, segment);
+}
 
-        var[0] = '\0';
+/* Length of the $(...) or ${...} reference at str, 0 if it is not one */
+static size_t ReferenceLength(const char *str)
+{
+    assert(str[0] == '$' && (str[1] == '(' || str[1] == '{'));
 
-        increment = 0;
+    int bracks = 0;
 
-        if (*sp == '\0')
+    for (const char *sp = str; *sp != '\0'; sp++)
+    {
+        switch (*sp)
         {
+        case '$':
+            if (sp[1] != '(' && sp[1] != '{')
+            {
+                return 0;       /* Stray dollar, not a variable */
+            }
+            break;
+        case '(':
+        case '{':
+            bracks++;
+            break;
+        case ')':
+        case '}':
+            bracks--;
             break;
         }
 
-        currentitem[0] = '\0';
-        StringNotMatchingSetCapped(sp,CF_EXPANDSIZE,"$",currentitem);
-
-        if (ExpandOverflow(buffer, currentitem))
+        if (bracks == 0 && sp > str)
         {
-            FatalError(ctx, "Can't expand varstring");
+            return sp - str + 1;
         }
+    }
 
-        strlcat(buffer, currentitem, CF_EXPANDSIZE);
-        sp += strlen(currentitem);
+    Log(LOG_LEVEL_ERR, "Broken variable syntax or bracket mismatch in '%s'", str);
+    return 0;
+}
 
-        Log(LOG_LEVEL_DEBUG, "  Aggregate result '%s', scanning at '%s' (current delta '%s')", buffer, sp, currentitem);
+static ExpandTemplate *ExpandTemplateParse(const char *string)
+{
+    ExpandTemplate *template = xmalloc(sizeof(ExpandTemplate));
+    template->string = xstrdup(string);
+    template->segments = SeqNew(4, ExpandSegmentDestroy);
 
-        if (*sp == '\0')
+    const char *sp = string;
+    while (*sp != '\0')
+    {
+        size_t literal = strcspn(sp, "$");
+        if (literal > 0)
         {
-            break;
+            ExpandTemplateAppendLiteral(template, sp, literal);
+            sp += literal;
+            continue;
         }
 
-        if (*sp == '$')
+        size_t length = (sp[1] == '(' || sp[1] == '{') ? ReferenceLength(sp) : 0;
+        if (length == 0)
         {
-            switch (*(sp + 1))
-            {
-            case '(':
-                ExtractOuterCf3VarString(sp, var);
-                varstring = ')';
-                if (strlen(var) == 0)
-                {
-                    strlcat(buffer, "$", CF_EXPANDSIZE);
-                    continue;
-                }
-                break;
+            ExpandTemplateAppendLiteral(template, "$", 1);
+            sp++;
+            continue;
+        }
 
-            case '{':
-                ExtractOuterCf3VarString(sp, var);
-                varstring = '}';
-                if (strlen(var) == 0)
-                {
-                    strlcat(buffer, "$", CF_EXPANDSIZE);
-                    continue;
-                }
-                break;
+        ExpandSegment *segment = xcalloc(1, sizeof(ExpandSegment));
+        segment->text = xstrndup(sp + 2, length - 3);
+        segment->length = length - 3;
+        segment->bracket = sp[1];
 
-            default:
-                strlcat(buffer, "$", CF_EXPANDSIZE);
-                continue;
-            }
+        if (IsCf3VarString(segment->text))
+        {
+            segment->nested = ExpandTemplateParse(segment->text);
+        }
+        else
+        {
+            segment->expandable = IsExpandable(segment->text);
         }
 
-        currentitem[0] = '\0';
+        SeqAppend(template->segments, segment);
+        sp += length;
+    }
 
-        temp[0] = '\0';
-        ExtractInnerCf3VarString(sp, temp);
+    return template;
+}
+
+static ExpandTemplate *GetExpandTemplate(const char *string)
+{
+    if (EXPAND_TEMPLATES == NULL)
+    {
+        /* Keys are owned by the templates */
+        EXPAND_TEMPLATES = MapNew((MapHashFn) StringHash, (MapKeyEqualFn) StringSafeEqual,
+                                  NULL, (MapDestroyDataFn) ExpandTemplateDestroy);
+    }
 
-        if (IsCf3VarString(temp))
+    ExpandTemplate *template = MapGet(EXPAND_TEMPLATES, string);
+    if (template == NULL)
+    {
+        if (MapSize(EXPAND_TEMPLATES) >= EXPAND_TEMPLATE_CACHE_SIZE)
         {
-            Log(LOG_LEVEL_DEBUG, "Nested variables '%s'", temp);
-            ExpandScalar(ctx, ns, scope, temp, currentitem);
+            MapClear(EXPAND_TEMPLATES);
         }
-        else
+
+        template = ExpandTemplateParse(string);
+        MapInsert(EXPAND_TEMPLATES, template->string, template);
+    }
+
+    return template;
+}
+
+static const VarRef *ExpandSegmentRef(ExpandSegment *segment, const char *name, const char *ns, const char *scope)
+{
+    if (segment->ref && StringSafeEqual(segment->ref_name, name)
+        && StringSafeEqual(segment->ref_ns, ns) && StringSafeEqual(segment->ref_scope, scope))
+    {
+        return segment->ref;
+    }
+
+    VarRefDestroy(segment->ref);
+    free(segment->ref_name);
+    free(segment->ref_ns);
+    free(segment->ref_scope);
+
+    segment->ref = VarRefParseFromNamespaceAndScope(name, ns, scope, CF_NS, '.');
+    segment->ref_name = xstrdup(name);
+    segment->ref_ns = SafeStringDuplicate(ns);
+    segment->ref_scope = SafeStringDuplicate(scope);
+
+    return segment->ref;
+}
+
+static void AppendUnexpandedReference(Buffer *out, char bracket, const char *name)
+{
+    BufferAppend(out, bracket == '{' ? "${" : "$(", 2);
+    BufferAppend(out, name, strlen(name));
+    BufferAppend(out, bracket == '{' ? "}" : ")", 1);
+}
+
+static bool ExpandTemplateInto(const EvalContext *ctx, const char *ns, const char *scope,
+                               const ExpandTemplate *template, Buffer *out)
+{
+    bool returnval = true;
+
+    for (size_t i = 0; i < SeqLength(template->segments); i++)
+    {
+        ExpandSegment *segment = SeqAt(template->segments, i);
+
+        if (segment->bracket == '\0')
         {
-            Log(LOG_LEVEL_DEBUG, "Delta '%s'", temp);
-            strncpy(currentitem, temp, CF_BUFSIZE - 1);
+            BufferAppend(out, segment->text, segment->length);
+            continue;
         }
 
-        increment = strlen(var) - 1;
+        const char *name = segment->text;
 
-        if (!IsExpandable(currentitem))
+        if (segment->nested)
         {
-            DataType type = DATA_TYPE_NONE;
-            bool variable_found = false;
+            if (segment->name == NULL)
             {
-                VarRef *ref = VarRefParseFromNamespaceAndScope(currentitem, ns, scope, CF_NS, '.');
-                variable_found = EvalContextVariableGet(ctx, ref, &rval, &type);
-                VarRefDestroy(ref);
+                segment->name = BufferNew();
+                BufferSetMemoryCap(segment->name, UINT_MAX);
             }
-
-            if (variable_found)
+            else
             {
-                switch (type)
-                {
-                case DATA_TYPE_STRING:
-                case DATA_TYPE_INT:
-                case DATA_TYPE_REAL:
-
-                    if (ExpandOverflow(buffer, (char *) rval.item))
-                    {
-                        FatalError(ctx, "Can't expand varstring");
-                    }
-
-                    strlcat(buffer, (char *) rval.item, CF_EXPANDSIZE);
-                    break;
+                BufferZero(segment->name);
+            }
 
-                case DATA_TYPE_STRING_LIST:
-                case DATA_TYPE_INT_LIST:
-                case DATA_TYPE_REAL_LIST:
-                case DATA_TYPE_NONE:
-                    if (type == DATA_TYPE_NONE)
-                    {
-                        Log(LOG_LEVEL_DEBUG,
-                            "Can't expand inexistent variable '%s'", currentitem);
-                    }
-                    else
-                    {
-                        Log(LOG_LEVEL_DEBUG,
-                            "Expecting scalar, can't expand list variable '%s'",
-                            currentitem);
-                    }
+            LogDebug(LOG_MOD_EXPAND, "Nested variables '%s'", segment->text);
+            ExpandTemplateInto(ctx, ns, scope, segment->nested, segment->name);
+            name = BufferData(segment->name);
 
-                    if (varstring == '}')
-                    {
-                        snprintf(name, CF_MAXVARSIZE, "${%s}", currentitem);
-                    }
-                    else
-                    {
-                        snprintf(name, CF_MAXVARSIZE, "$(%s)", currentitem);
-                    }
+            if (IsExpandable(name))
+            {
+                continue;
+            }
+        }
+        else if (segment->expandable)
+        {
+            continue;
+        }
 
-                    strlcat(buffer, name, CF_EXPANDSIZE);
-                    returnval = false;
-                    break;
+        Rval rval;
+        DataType type = DATA_TYPE_NONE;
+        if (!EvalContextVariableGet(ctx, ExpandSegmentRef(segment, name, ns, scope), &rval, &type))
+        {
+            LogDebug(LOG_MOD_EXPAND, "Currently non existent or list variable '%s'", name);
+            AppendUnexpandedReference(out, segment->bracket, name);
+            returnval = false;
+            continue;
+        }
 
-                default:
-                    Log(LOG_LEVEL_DEBUG, "Returning Unknown Scalar ('%s' => '%s')", string, buffer);
-                    return false;
+        switch (type)
+        {
+        case DATA_TYPE_STRING:
+        case DATA_TYPE_INT:
+        case DATA_TYPE_REAL:
+            BufferAppend(out, rval.item, strlen(rval.item));
+            break;
 
-                }
+        case DATA_TYPE_STRING_LIST:
+        case DATA_TYPE_INT_LIST:
+        case DATA_TYPE_REAL_LIST:
+        case DATA_TYPE_NONE:
+            if (type == DATA_TYPE_NONE)
+            {
+                LogDebug(LOG_MOD_EXPAND, "Can't expand inexistent variable '%s'", name);
             }
             else
             {
-                Log(LOG_LEVEL_DEBUG, "Currently non existent or list variable '%s'", currentitem);
+                LogDebug(LOG_MOD_EXPAND, "Expecting scalar, can't expand list variable '%s'", name);
+            }
 
-                if (varstring == '}')
-                {
-                    snprintf(name, CF_MAXVARSIZE, "${%s}", currentitem);
-                }
-                else
-                {
-                    snprintf(name, CF_MAXVARSIZE, "$(%s)", currentitem);
-                }
+            AppendUnexpandedReference(out, segment->bracket, name);
+            returnval = false;
+            break;
 
-                strlcat(buffer, name, CF_EXPANDSIZE);
-                returnval = false;
-            }
+        default:
+            LogDebug(LOG_MOD_EXPAND, "Returning Unknown Scalar ('%s' => '%s')", template->string, BufferData(out));
+            return false;
         }
+    }
 
-        sp += increment;
-        currentitem[0] = '\0';
+    return returnval;
+}
+
+bool ExpandScalar(const EvalContext *ctx, const char *ns, const char *scope, const char *string, Buffer *out)
+{
+    assert(out);
+
+    if (string == NULL || string[0] == '\0')
+    {
+        return false;
     }
 
-    if (returnval)
+    BufferSetMemoryCap(out, UINT_MAX);
+
+    if (strchr(string, '$') == NULL)
     {
-        Log(LOG_LEVEL_DEBUG, "Returning complete scalar expansion ('%s' => '%s')", string, buffer);
+        BufferAppend(out, string, strlen(string));
+        return true;
+    }
+
+    bool returnval = ExpandTemplateInto(ctx, ns, scope, GetExpandTemplate(string), out);
 
-        /* Can we be sure this is complete? What about recursion */
+    if (returnval)
+    {
+        LogDebug(LOG_MOD_EXPAND, "Returning complete scalar expansion ('%s' => '%s')", string, BufferData(out));
     }
     else
     {
-        Log(LOG_LEVEL_DEBUG, "Returning partial / best effort scalar expansion ('%s' => '%s')", string, buffer);
+        LogDebug(LOG_MOD_EXPAND, "Returning partial / best effort scalar expansion ('%s' => '%s')", string, BufferData(out));
     }
 
     return returnval;
@@ -960,6 +1109,8 @@ static void ResolveCommonClassPromises(EvalContext *ctx, PromiseType *pt)
     assert(strcmp("classes", pt->name) == 0);
     assert(strcmp(pt->parent_bundle->type, "common") == 0);
 
+    ProfilerEnter(PROFILE_FRAME_PROMISE_TYPE, pt->name);
+
     for (size_t i = 0; i < SeqLength(pt->promises); i++)
     {
         Promise *pp = SeqAt(pt->promises, i);
@@ -983,27 +1134,37 @@ static void ResolveCommonClassPromises(EvalContext *ctx, PromiseType *pt)
 
         ExpandPromise(ctx, pp, VerifyClassPromise, NULL);
     }
+
+    ProfilerLeave();
 }
 
 static void ResolveVariablesPromises(EvalContext *ctx, PromiseType *pt)
 {
     assert(strcmp("vars", pt->name) == 0);
 
+    ProfilerEnter(PROFILE_FRAME_PROMISE_TYPE, pt->name);
+
     for (size_t i = 0; i < SeqLength(pt->promises); i++)
     {
         Promise *pp = SeqAt(pt->promises, i);
+        ProfilerEnter(PROFILE_FRAME_PROMISE, pp->promiser);
         EvalContextStackPushPromiseFrame(ctx, pp, false);
         EvalContextStackPushPromiseIterationFrame(ctx, 0, NULL);
         VerifyVarPromise(ctx, pp, false);
         EvalContextStackPopFrame(ctx);
         EvalContextStackPopFrame(ctx);
+        ProfilerLeave();
     }
+
+    ProfilerLeave();
 }
 
 void BundleResolve(EvalContext *ctx, Bundle *bundle)
 {
     Log(LOG_LEVEL_VERBOSE, "Resolving variables in bundle '%s' '%s'", bundle->type, bundle->name);
 
+    ProfilerEnterBundle(bundle);
+
     for (size_t j = 0; j < SeqLength(bundle->promise_types); j++)
     {
         PromiseType *sp = SeqAt(bundle->promise_types, j);
@@ -1024,6 +1185,7 @@ void BundleResolve(EvalContext *ctx, Bundle *bundle)
         }
     }
 
+    ProfilerLeave();
 }
 
 static void ResolveControlBody(EvalContext *ctx, GenericAgentConfig *config, const Body *control_body)
@@ -28,6 +28,7 @@
 #include <cf3.defs.h>
 #include <generic_agent.h>
 #include <actuator.h>
+#include <buffer.h>
 
 PromiseResult CommonEvalPromise(EvalContext *ctx, Promise *pp, void *param);
 
@@ -38,7 +39,15 @@ void MapIteratorsFromRval(EvalContext *ctx, const char *scope, Rval rval, Rlist
 
 bool IsExpandable(const char *str);
 
-bool ExpandScalar(const EvalContext *ctx, const char *ns, const char *scope, const char *string, char buffer[CF_EXPANDSIZE]);
+/**
+  @brief Expands the $() and ${} references of a scalar in the given namespace and scope.
+
+  The expansion is appended to out, whose memory cap is lifted so that the result is never truncated. References that
+  cannot be resolved to a scalar are left in place. Parsed scalars are cached, so expanding the same string again only
+  costs the variable lookups.
+  @return True if every reference was expanded.
+  */
+bool ExpandScalar(const EvalContext *ctx, const char *ns, const char *scope, const char *string, Buffer *out);
 Rval ExpandBundleReference(EvalContext *ctx, const char *ns, const char *scope, Rval rval);
 Rval ExpandPrivateRval(EvalContext *ctx, const char *ns, const char *scope, Rval rval);
 Rlist *ExpandList(EvalContext *ctx, const char *ns, const char *scope, const Rlist *list, int expandnaked);
@@ -34,16 +34,110 @@
 #include <string_lib.h>
 #include <acl_tools.h>
 
+/* From <linux/fs.h>, which does not get along with <sys/mount.h> */
+#if defined(__linux__) && !defined(FICLONE)
+# define FICLONE _IOW(0x94, 9, int)
+#endif
+
 /*
- * Copy data jumping over areas filled by '\0', so files automatically become sparse if possible.
+ * Share the source's blocks with the destination, on file systems which
+ * can (btrfs, xfs, ...). Holes stay holes.
  */
-static bool CopyData(const char *source, int sd, const char *destination, int dd, char *buf, size_t buf_size)
+static bool CloneData(int sd, int dd)
 {
-    off_t n_read_total = 0;
+#if defined(FICLONE)
+    return ioctl(dd, FICLONE, sd) == 0;
+#else
+    return false;
+#endif
+}
 
-    while (true)
+/*
+ * Copy the bytes from offset up to end in the kernel, without going through
+ * a buffer. Returns the offset it got to, which is short of end if the
+ * kernel cannot copy between these files or the source ended early.
+ */
+static off_t CopyDataInKernel(const char *source, int sd, const char *destination, int dd,
+                              off_t offset, off_t end, bool *in_kernel)
+{
+#if defined(HAVE_COPY_FILE_RANGE)
+    while (*in_kernel && (offset < end))
     {
-        ssize_t n_read = read(sd, buf, buf_size);
+        loff_t off_in = offset, off_out = offset;
+        ssize_t n_copied = copy_file_range(sd, &off_in, dd, &off_out, end - offset, 0);
+
+        if ((n_copied == -1) && (errno == EINTR))
+        {
+            continue;
+        }
+
+        if (n_copied == -1)
+        {
+            /* Across file systems, or a file system that cannot; read() will do */
+            Log(LOG_LEVEL_DEBUG, "Copying '%s' to '%s' through a buffer. (copy_file_range: %s)",
+                source, destination, GetErrorStr());
+            *in_kernel = false;
+            break;
+        }
+
+        if (n_copied == 0)
+        {
+            break;
+        }
+
+        offset += n_copied;
+    }
+#else
+    *in_kernel = false;
+#endif
+
+    return offset;
+}
+
+/*
+ * The next extent of data at or after offset, as told by SEEK_DATA and
+ * SEEK_HOLE, so that the holes of the source are not even read. Without
+ * them, the rest of the file is one extent.
+ */
+static void NextExtent(int sd, off_t offset, off_t size, off_t *data, off_t *hole)
+{
+    *data = offset;
+    *hole = size;
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    *data = lseek(sd, offset, SEEK_DATA);
+    if (*data == -1)
+    {
+        /* ENXIO: a hole up to the end, anything else: not supported */
+        *data = (errno == ENXIO) ? size : offset;
+        return;
+    }
+
+    *hole = lseek(sd, *data, SEEK_HOLE);
+    if (*hole == -1)
+    {
+        *hole = size;
+    }
+#endif
+}
+
+/*
+ * Copy data from the current offsets up to end, or to the end of the source
+ * if end is -1, jumping over areas filled by '\0', so files automatically
+ * become sparse if possible. Returns the offset it got to, or -1 on error.
+ */
+static off_t CopyDataBuffered(const char *source, int sd, const char *destination, int dd,
+                              off_t offset, off_t end, char *buf, size_t buf_size, bool *eof)
+{
+    while ((end == -1) || (offset < end))
+    {
+        size_t n_wanted = buf_size;
+        if ((end != -1) && (end - offset < n_wanted))
+        {
+            n_wanted = end - offset;
+        }
+
+        ssize_t n_read = read(sd, buf, n_wanted);
 
         if (n_read == -1)
         {
@@ -53,61 +147,119 @@ static bool CopyData(const char *source, int sd, const char *destination, int dd
             }
 
             Log(LOG_LEVEL_ERR, "Unable to read source file while copying '%s' to '%s'. (read: %s)", source, destination, GetErrorStr());
-            return false;
+            return -1;
         }
 
         if (n_read == 0)
         {
-            /*
-             * As the tail of file may contain of bytes '\0' (and hence
-             * lseek(2)ed on destination instead of being written), do a
-             * ftruncate(2) here to ensure the whole file is written to the
-             * disc.
-             */
-            if (ftruncate(dd, n_read_total) < 0)
-            {
-                Log(LOG_LEVEL_ERR, "Copy failed (no space?) while copying '%s' to '%s'. (ftruncate: %s)", source, destination, GetErrorStr());
-                return false;
-            }
-
-            return true;
+            *eof = true;
+            break;
         }
 
-        n_read_total += n_read;
+        offset += n_read;
 
         /* Copy/seek */
 
         void *cur = buf;
-        void *end = buf + n_read;
+        void *end_buf = buf + n_read;
 
-        while (cur < end)
+        while (cur < end_buf)
         {
-            void *skip_span = MemSpan(cur, 0, end - cur);
+            void *skip_span = MemSpan(cur, 0, end_buf - cur);
             if (skip_span > cur)
             {
                 if (lseek(dd, skip_span - cur, SEEK_CUR) < 0)
                 {
                     Log(LOG_LEVEL_ERR, "Failed while copying '%s' to '%s' (no space?). (lseek: %s)", source, destination, GetErrorStr());
-                    return false;
+                    return -1;
                 }
 
                 cur = skip_span;
             }
 
 
-            void *copy_span = MemSpanInverse(cur, 0, end - cur);
+            void *copy_span = MemSpanInverse(cur, 0, end_buf - cur);
             if (copy_span > cur)
             {
                 if (FullWrite(dd, cur, copy_span - cur) < 0)
                 {
                     Log(LOG_LEVEL_ERR, "Failed while copying '%s' to '%s' (no space?). (write: %s)", source, destination, GetErrorStr());
-                    return false;
+                    return -1;
                 }
 
                 cur = copy_span;
             }
         }
     }
+
+    return offset;
+}
+
+/*
+ * Clone the file where the file system can. Otherwise copy each extent of
+ * data in the kernel, or else through the buffer, and leave the holes out.
+ * Files of unknown size, like those in /proc, are simply read to the end.
+ */
+static bool CopyData(const char *source, int sd, const char *destination, int dd, char *buf, size_t buf_size)
+{
+    struct stat statbuf;
+    off_t size = -1;
+
+    if ((fstat(sd, &statbuf) == 0) && S_ISREG(statbuf.st_mode) && (statbuf.st_size > 0))
+    {
+        size = statbuf.st_size;
+
+        if (CloneData(sd, dd))
+        {
+            return true;
+        }
+    }
+
+    off_t offset = 0;
+    bool in_kernel = true;
+    bool eof = false;
+
+    while (!eof)
+    {
+        off_t data = offset, hole = -1;
+
+        if (offset < size)
+        {
+            NextExtent(sd, offset, size, &data, &hole);
+            data = CopyDataInKernel(source, sd, destination, dd, data, hole, &in_kernel);
+
+            if ((lseek(sd, data, SEEK_SET) == -1) || (lseek(dd, data, SEEK_SET) == -1))
+            {
+                Log(LOG_LEVEL_ERR, "Failed while copying '%s' to '%s'. (lseek: %s)", source, destination, GetErrorStr());
+                return false;
+            }
+
+            /* The last extent is read to the end, in case the file grew */
+            if (hole == size)
+            {
+                hole = -1;
+            }
+        }
+
+        offset = CopyDataBuffered(source, sd, destination, dd, data, hole, buf, buf_size, &eof);
+        if (offset == -1)
+        {
+            return false;
+        }
+    }
+
+    /*
+     * As the tail of file may contain of bytes '\0' (and hence lseek(2)ed on
+     * destination instead of being written), do a ftruncate(2) here to ensure
+     * the whole file is written to the disc.
+     */
+    if (ftruncate(dd, offset) < 0)
+    {
+        Log(LOG_LEVEL_ERR, "Copy failed (no space?) while copying '%s' to '%s'. (ftruncate: %s)", source, destination, GetErrorStr());
+        return false;
+    }
+
+    return true;
 }
 
 bool CopyRegularFileDisk(const char *source, const char *destination)
@@ -59,34 +59,65 @@ static const int CF_DIGEST_SIZES[10] =
     0
 };
 
-void HashFile(const char *filename, unsigned char digest[EVP_MAX_MD_SIZE + 1], HashMethod type)
+#define HASH_FILE_BLOCKSIZE (64 * 1024)
+
+bool HashFileMulti(const char *filename, int n, const HashMethod types[], unsigned char digests[][EVP_MAX_MD_SIZE + 1])
 {
-    FILE *file;
-    EVP_MD_CTX context;
-    int len, md_len;
-    unsigned char buffer[1024];
-    const EVP_MD *md = NULL;
+    EVP_MD_CTX contexts[n];
+    unsigned int md_len;
+    ssize_t len;
+    int fd;
 
-    if ((file = fopen(filename, "rb")) == NULL)
+    if ((fd = open(filename, O_RDONLY | O_BINARY)) == -1)
     {
-        Log(LOG_LEVEL_INFO, "Cannot open file for hashing '%s'. (fopen: %s)", filename, GetErrorStr());
+        Log(LOG_LEVEL_INFO, "Cannot open file for hashing '%s'. (open: %s)", filename, GetErrorStr());
+        return false;
     }
-    else
+
+#if defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    for (int i = 0; i < n; i++)
     {
-        md = EVP_get_digestbyname(FileHashName(type));
+        EVP_DigestInit(&contexts[i], EVP_get_digestbyname(FileHashName(types[i])));
+    }
 
-        EVP_DigestInit(&context, md);
+    unsigned char *buffer = xmalloc(HASH_FILE_BLOCKSIZE);
 
-        while ((len = fread(buffer, 1, 1024, file)))
+    while ((len = read(fd, buffer, HASH_FILE_BLOCKSIZE)) != 0)
+    {
+        if (len == -1)
         {
-            EVP_DigestUpdate(&context, buffer, len);
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            Log(LOG_LEVEL_INFO, "Cannot read file for hashing '%s'. (read: %s)", filename, GetErrorStr());
+            break;
         }
 
-        EVP_DigestFinal(&context, digest, &md_len);
+        for (int i = 0; i < n; i++)
+        {
+            EVP_DigestUpdate(&contexts[i], buffer, len);
+        }
+    }
 
+    for (int i = 0; i < n; i++)
+    {
         /* Digest length stored in md_len */
-        fclose(file);
+        EVP_DigestFinal(&contexts[i], digests[i], &md_len);
     }
+
+    free(buffer);
+    close(fd);
+    return len == 0;
+}
+
+void HashFile(const char *filename, unsigned char digest[EVP_MAX_MD_SIZE + 1], HashMethod type)
+{
+    HashFileMulti(filename, 1, &type, (unsigned char (*)[EVP_MAX_MD_SIZE + 1]) digest);
 }
 
 /*******************************************************************/
@@ -28,6 +28,11 @@
 #include <cf3.defs.h>
 
 void HashFile(const char *filename, unsigned char digest[EVP_MAX_MD_SIZE + 1], HashMethod type);
+/**
+  @brief Computes digests of several types while reading the file once.
+  @return False if the file could not be read to the end.
+  */
+bool HashFileMulti(const char *filename, int n, const HashMethod types[], unsigned char digests[][EVP_MAX_MD_SIZE + 1]);
 void HashString(const char *buffer, int len, unsigned char digest[EVP_MAX_MD_SIZE + 1], HashMethod type);
 int HashesMatch(unsigned char digest1[EVP_MAX_MD_SIZE + 1], unsigned char digest2[EVP_MAX_MD_SIZE + 1],
                 HashMethod type);
@@ -690,3 +690,11 @@ const char *GetSoftwareCacheFilename(char *buffer)
     MapName(buffer);
     return buffer;
 }
+
+/* Buffer should be at least CF_MAXVARSIZE large */
+const char *GetSoftwareInventoryFilename(char *buffer)
+{
+    snprintf(buffer, CF_MAXVARSIZE, "%s/state/%s", CFWORKDIR, SOFTWARE_PACKAGES_INVENTORY);
+    MapName(buffer);
+    return buffer;
+}
@@ -58,4 +58,5 @@ int IsAbsoluteFileName(const char *f);
 bool IsFileOutsideDefaultRepository(const char *f);
 int RootDirLength(const char *f);
 const char *GetSoftwareCacheFilename(char *buffer);
+const char *GetSoftwareInventoryFilename(char *buffer);
 #endif
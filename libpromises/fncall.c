@@ -34,6 +34,7 @@
 #include <promises.h>
 #include <syntax.h>
 #include <audit.h>
+#include <profiler.h>
 
 /******************************************************************/
 /* Argument propagation                                           */
@@ -304,7 +305,9 @@ FnCallResult FnCallEvaluate(EvalContext *ctx, FnCall *fp, const Promise *caller)
         return (FnCallResult) { FNCALL_SUCCESS, RvalCopy(cached_rval) };
     }
 
+    ProfilerEnter(PROFILE_FRAME_FUNCTION, fp->name);
     FnCallResult result = CallFunction(ctx, fp, expargs);
+    ProfilerLeave();
 
     if (result.status == FNCALL_FAILURE)
     {
@@ -35,6 +35,7 @@
 #include <files_interfaces.h>
 #include <files_hashes.h>
 #include <parser.h>
+#include <policy_cache.h>
 #include <dbm_api.h>
 #include <crypto.h>
 #include <vars.h>
@@ -60,9 +61,12 @@
 #include <time_classes.h>
 #include <unix_iface.h>
 #include <constants.h>
+#include <profiler.h>
 
 #include <cf-windows-functions.h>
 
+#define SLOW_DISCOVERY_MS 1000
+
 static pthread_once_t pid_cleanup_once = PTHREAD_ONCE_INIT;
 
 static char PIDFILE[CF_BUFSIZE];
@@ -102,6 +106,44 @@ ENTERPRISE_VOID_FUNC_2ARG_DEFINE_STUB(void, GenericAgentSetDefaultDigest, HashMe
     *digest_len = CF_MD5_LEN;
 }
 
+static double DiscoveryClockMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/*
+ * The host name is looked up in DNS while the local facts are discovered.
+ * Interfaces come after the lookup as their address takes precedence over
+ * the one from DNS.
+ */
+static void DiscoverSystem(EvalContext *ctx, AgentType agent_type)
+{
+    double start = DiscoveryClockMs();
+
+    GetNameInfo3(ctx, agent_type);
+    double names = DiscoveryClockMs();
+
+    Get3Environment(ctx, agent_type);
+    BuiltinClasses(ctx);
+    double environment = DiscoveryClockMs();
+
+    OSClasses(ctx);
+    double os = DiscoveryClockMs();
+
+    GetHostnameInfo(ctx);
+    double hostname = DiscoveryClockMs();
+
+    GetInterfacesInfo(ctx);
+    double end = DiscoveryClockMs();
+
+    Log((end - start >= SLOW_DISCOVERY_MS) ? LOG_LEVEL_INFO : LOG_LEVEL_VERBOSE,
+        "System discovery took %.1f ms (names %.1f ms, environment %.1f ms, OS %.1f ms, "
+        "waiting for DNS %.1f ms, interfaces %.1f ms)",
+        end - start, names - start, environment - names, os - environment, hostname - os, end - hostname);
+}
+
 void GenericAgentDiscoverContext(EvalContext *ctx, GenericAgentConfig *config)
 {
     GenericAgentSetDefaultDigest(&CF_DEFAULT_DIGEST, &CF_DEFAULT_DIGEST_LEN);
@@ -116,12 +158,7 @@ void GenericAgentDiscoverContext(EvalContext *ctx, GenericAgentConfig *config)
     THIS_AGENT_TYPE = config->agent_type;
     EvalContextClassPutHard(ctx, CF_AGENTTYPES[config->agent_type]);
 
-    GetNameInfo3(ctx, config->agent_type);
-    GetInterfacesInfo(ctx);
-
-    Get3Environment(ctx, config->agent_type);
-    BuiltinClasses(ctx);
-    OSClasses(ctx);
+    DiscoverSystem(ctx, config->agent_type);
 
     EvalContextHeapPersistentLoadAll(ctx);
     LoadSystemConstants(ctx);
@@ -975,7 +1012,17 @@ static Policy *Cf3ParseFile(const GenericAgentConfig *config, const char *input_
         }
         else
         {
-            policy = ParserParseFile(config->agent_type, input_path, 0, 0);
+            /* cf-promises always parses, to report warnings and errors */
+            PolicyCacheKey key;
+            policy = PolicyCacheLoad(config->agent_type, input_path, &key);
+            if (!policy)
+            {
+                policy = ParserParseFile(config->agent_type, input_path, 0, 0);
+                if (policy)
+                {
+                    PolicyCacheStore(&key, policy);
+                }
+            }
         }
     }
 
@@ -1197,18 +1244,23 @@ static void VerifyPromises(EvalContext *ctx, Policy *policy, GenericAgentConfig
     {
         Bundle *bp = SeqAt(policy->bundles, i);
         EvalContextStackPushBundleFrame(ctx, bp, NULL, false);
+        ProfilerEnterBundle(bp);
 
         for (size_t j = 0; j < SeqLength(bp->promise_types); j++)
         {
             PromiseType *sp = SeqAt(bp->promise_types, j);
+            ProfilerEnter(PROFILE_FRAME_PROMISE_TYPE, sp->name);
 
             for (size_t ppi = 0; ppi < SeqLength(sp->promises); ppi++)
             {
                 Promise *pp = SeqAt(sp->promises, ppi);
                 ExpandPromise(ctx, pp, CommonEvalPromise, NULL);
             }
+
+            ProfilerLeave();
         }
 
+        ProfilerLeave();
         EvalContextStackPopFrame(ctx);
     }
 
@@ -110,6 +110,9 @@ void UpdateLastSawHost(const char *hostkey, const char *address,
         return;
     }
 
+    /* The three entries below are committed together */
+    BeginBatchDB(db);
+
     /* Update quality-of-connection entry */
 
     char quality_key[CF_BUFSIZE];
@@ -143,6 +146,7 @@ void UpdateLastSawHost(const char *hostkey, const char *address,
 
     WriteDB(db, address_key, hostkey, strlen(hostkey) + 1);
 
+    CommitBatchDB(db);
     CloseDB(db);
 }
 /*****************************************************************************/
@@ -958,8 +958,12 @@ void PurgeLocks(void)
 
     Log(LOG_LEVEL_VERBOSE, "Looking for stale locks to purge");
 
+    /* Commit the purged entries and the new horizon at once */
+    BeginBatchDB(dbp);
+
     if (!NewDBCursor(dbp, &dbcp))
     {
+        CommitBatchDB(dbp);
         CloseLock(dbp);
         return;
     }
@@ -983,6 +987,7 @@ void PurgeLocks(void)
     DeleteDBCursor(dbcp);
 
     WriteDB(dbp, "lock_horizon", &entry, sizeof(entry));
+    CommitBatchDB(dbp);
     CloseLock(dbp);
 }
 
@@ -33,32 +33,21 @@
 #include <misc_lib.h>
 #include <rlist.h>
 #include <string_lib.h>
+#include <regex_cache.h>
 
 /* Pure */
-static pcre *CompileRegExp(const char *regexp)
+static CachedRegex *CompileRegExp(const char *regexp)
 {
-    pcre *rx;
-    const char *errorstr;
-    int erroffset;
-
-    rx = pcre_compile(regexp, PCRE_MULTILINE | PCRE_DOTALL, &errorstr, &erroffset, NULL);
-
-    if (rx == NULL)
-    {
-        Log(LOG_LEVEL_ERR, "Regular expression error '%s' in expression '%s' at %d", errorstr, regexp,
-              erroffset);
-    }
-
-    return rx;
+    return RegexCacheGet(regexp, PCRE_MULTILINE | PCRE_DOTALL);
 }
 
 /* Sets variables */
-static int RegExMatchSubString(EvalContext *ctx, pcre *rx, const char *teststring, int *start, int *end)
+static int RegExMatchSubString(EvalContext *ctx, CachedRegex *rx, const char *teststring, int *start, int *end)
 {
     int ovector[OVECCOUNT];
     int rc = 0;
 
-    if ((rc = pcre_exec(rx, NULL, teststring, strlen(teststring), 0, 0, ovector, OVECCOUNT)) >= 0)
+    if ((rc = RegexCacheExec(rx, teststring, ovector, OVECCOUNT)) >= 0)
     {
         *start = ovector[0];
         *end = ovector[1];
@@ -90,12 +79,12 @@ static int RegExMatchSubString(EvalContext *ctx, pcre *rx, const char *teststrin
         *end = 0;
     }
 
-    free(rx);
+    RegexCacheRelease(rx);
     return rc >= 0;
 }
 
 /* Sets variables */
-static int RegExMatchFullString(EvalContext *ctx, pcre *rx, const char *teststring)
+static int RegExMatchFullString(EvalContext *ctx, CachedRegex *rx, const char *teststring)
 {
     int match_start;
     int match_len;
@@ -111,7 +100,7 @@ static int RegExMatchFullString(EvalContext *ctx, pcre *rx, const char *teststri
 }
 
 /* Pure, non-thread-safe */
-static char *FirstBackReference(pcre *rx, const char *teststring)
+static char *FirstBackReference(CachedRegex *rx, const char *teststring)
 {
     static char backreference[CF_BUFSIZE];
 
@@ -119,7 +108,7 @@ static char *FirstBackReference(pcre *rx, const char *teststring)
 
     memset(backreference, 0, CF_BUFSIZE);
 
-    if ((rc = pcre_exec(rx, NULL, teststring, strlen(teststring), 0, 0, ovector, OVECCOUNT)) >= 0)
+    if ((rc = RegexCacheExec(rx, teststring, ovector, OVECCOUNT)) >= 0)
     {
         for (i = 1; i < rc; i++)        /* make backref vars $(1),$(2) etc */
         {
@@ -135,23 +124,23 @@ static char *FirstBackReference(pcre *rx, const char *teststring)
         }
     }
 
-    free(rx);
+    RegexCacheRelease(rx);
 
     return backreference;
 }
 
 bool ValidateRegEx(const char *regex)
 {
-    pcre *rx = CompileRegExp(regex);
+    CachedRegex *rx = CompileRegExp(regex);
     bool regex_valid = rx != NULL;
 
-    free(rx);
+    RegexCacheRelease(rx);
     return regex_valid;
 }
 
 int FullTextMatch(EvalContext *ctx, const char *regexp, const char *teststring)
 {
-    pcre *rx;
+    CachedRegex *rx;
 
     if (strcmp(regexp, teststring) == 0)
     {
@@ -180,7 +169,7 @@ char *ExtractFirstReference(const char *regexp, const char *teststring)
     static char *nothing = "";
     char *backreference;
 
-    pcre *rx;
+    CachedRegex *rx;
 
     if ((regexp == NULL) || (teststring == NULL))
     {
@@ -206,7 +195,7 @@ char *ExtractFirstReference(const char *regexp, const char *teststring)
 
 int BlockTextMatch(EvalContext *ctx, const char *regexp, const char *teststring, int *start, int *end)
 {
-    pcre *rx = CompileRegExp(regexp);
+    CachedRegex *rx = CompileRegExp(regexp);
 
     if (rx == NULL)
     {
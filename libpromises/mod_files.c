@@ -174,6 +174,7 @@ static const ConstraintSyntax changes_constraints[] =
     ConstraintSyntaxNewOption("report_changes", "all,stats,content,none", "Specify criteria for change warnings", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewBool("update_hashes", "Update hash values immediately after change warning", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewBool("report_diffs","Generate reports summarizing the major differences between individual text files", SYNTAX_STATUS_NORMAL),
+    ConstraintSyntaxNewOption("rehash", "always,changed", "Hash every file on every run, or only files whose size, times or inode changed since they were last hashed. Default value: changed", SYNTAX_STATUS_NORMAL),
     ConstraintSyntaxNewNull()
 };
 
@@ -67,6 +67,9 @@ static void BundleDestroy(Bundle *bundle);
 static void BodyDestroy(Body *body);
 static SyntaxTypeMatch ConstraintCheckType(const Constraint *cp);
 static bool PromiseCheck(const Promise *pp, Seq *errors);
+static Map *PolicyIndexNew(void);
+static void PolicyIndexBundle(Policy *policy, Bundle *bundle);
+static void PolicyIndexBody(Policy *policy, Body *body);
 
 
 const char *NamespaceDefault(void)
@@ -81,6 +84,9 @@ Policy *PolicyNew(void)
     policy->bundles = SeqNew(100, BundleDestroy);
     policy->bodies = SeqNew(100, BodyDestroy);
 
+    policy->bundle_index = PolicyIndexNew();
+    policy->body_index = PolicyIndexNew();
+
     return policy;
 }
 
@@ -96,6 +102,9 @@ void PolicyDestroy(Policy *policy)
         SeqDestroy(policy->bundles);
         SeqDestroy(policy->bodies);
 
+        MapDestroy(policy->bundle_index);
+        MapDestroy(policy->body_index);
+
         free(policy);
     }
 }
@@ -216,41 +225,61 @@ StringSet *PolicySourceFiles(const Policy *policy)
     return files;
 }
 
-static char *StripNamespace(const char *full_symbol)
+static const char *StripNamespace(const char *full_symbol)
 {
-    char *sep = strchr(full_symbol, CF_NS);
-    if (sep)
+    const char *sep = strchr(full_symbol, CF_NS);
+    return sep ? sep + 1 : full_symbol;
+}
+
+static Map *PolicyIndexNew(void)
+{
+    return MapNew((MapHashFn) StringHash, (MapKeyEqualFn) StringSafeEqual, free, (MapDestroyDataFn) SeqDestroy);
+}
+
+static void PolicyIndexAdd(Map *index, const char *symbol, void *element)
+{
+    Seq *candidates = MapGet(index, symbol);
+    if (!candidates)
     {
-        return xstrdup(sep + 1);
+        candidates = SeqNew(1, NULL);
+        MapInsert(index, xstrdup(symbol), candidates);
     }
-    else
+    SeqAppend(candidates, element);
+}
+
+static void PolicyIndexBundle(Policy *policy, Bundle *bundle)
+{
+    const char *symbol = StripNamespace(bundle->name);
+
+    PolicyIndexAdd(policy->bundle_index, symbol, bundle);
+    if (symbol != bundle->name)
     {
-        return xstrdup(full_symbol);
+        PolicyIndexAdd(policy->bundle_index, bundle->name, bundle);
     }
 }
 
+static void PolicyIndexBody(Policy *policy, Body *body)
+{
+    PolicyIndexAdd(policy->body_index, StripNamespace(body->name), body);
+}
+
 Body *PolicyGetBody(const Policy *policy, const char *ns, const char *type, const char *name)
 {
-    for (size_t i = 0; i < SeqLength(policy->bodies); i++)
+    const Seq *candidates = MapGet(policy->body_index, name);
+    if (!candidates)
     {
-        Body *bp = SeqAt(policy->bodies, i);
+        return NULL;
+    }
 
-        char *body_symbol = StripNamespace(bp->name);
+    for (size_t i = 0; i < SeqLength(candidates); i++)
+    {
+        Body *bp = SeqAt(candidates, i);
 
-        if (strcmp(bp->type, type) == 0 && strcmp(body_symbol, name) == 0)
+        // allow type and namespace to be optionally matched
+        if ((!type || strcmp(bp->type, type) == 0) && (!ns || strcmp(bp->ns, ns) == 0))
         {
-            free(body_symbol);
-
-            // allow namespace to be optionally matched
-            if (ns && strcmp(bp->ns, ns) != 0)
-            {
-                continue;
-            }
-
             return bp;
         }
-
-        free(body_symbol);
     }
 
     return NULL;
@@ -258,26 +287,21 @@ Body *PolicyGetBody(const Policy *policy, const char *ns, const char *type, cons
 
 Bundle *PolicyGetBundle(const Policy *policy, const char *ns, const char *type, const char *name)
 {
-    for (size_t i = 0; i < SeqLength(policy->bundles); i++)
+    const Seq *candidates = MapGet(policy->bundle_index, name);
+    if (!candidates)
     {
-        Bundle *bp = SeqAt(policy->bundles, i);
+        return NULL;
+    }
 
-        char *bundle_symbol = StripNamespace(bp->name);
+    for (size_t i = 0; i < SeqLength(candidates); i++)
+    {
+        Bundle *bp = SeqAt(candidates, i);
 
-        if ((!type || strcmp(bp->type, type) == 0) && ((strcmp(bundle_symbol, name) == 0) || (strcmp(bp->name, name) == 0)))
+        // allow type and namespace to be optionally matched
+        if ((!type || strcmp(bp->type, type) == 0) && (!ns || strcmp(bp->ns, ns) == 0))
         {
-            free(bundle_symbol);
-
-            // allow namespace to be optionally matched
-            if (ns && strcmp(bp->ns, ns) != 0)
-            {
-                continue;
-            }
-
             return bp;
         }
-
-        free(bundle_symbol);
     }
 
     return NULL;
@@ -301,6 +325,7 @@ Policy *PolicyMerge(Policy *a, Policy *b)
     {
         Bundle *bp = SeqAt(result->bundles, i);
         bp->parent_policy = result;
+        PolicyIndexBundle(result, bp);
     }
 
     SeqAppendSeq(result->bodies, a->bodies);
@@ -312,9 +337,14 @@ Policy *PolicyMerge(Policy *a, Policy *b)
     {
         Body *bdp = SeqAt(result->bodies, i);
         bdp->parent_policy = result;
+        PolicyIndexBody(result, bdp);
     }
 
+    MapDestroy(a->bundle_index);
+    MapDestroy(a->body_index);
     free(a);
+    MapDestroy(b->bundle_index);
+    MapDestroy(b->body_index);
     free(b);
 
     return result;
@@ -1162,6 +1192,8 @@ Bundle *PolicyAppendBundle(Policy *policy, const char *ns, const char *name, con
     bundle->source_path = SafeStringDuplicate(source_path);
     bundle->promise_types = SeqNew(10, PromiseTypeDestroy);
 
+    PolicyIndexBundle(policy, bundle);
+
     return bundle;
 }
 
@@ -1181,6 +1213,8 @@ Body *PolicyAppendBody(Policy *policy, const char *ns, const char *name, const c
     body->source_path = SafeStringDuplicate(source_path);
     body->conlist = SeqNew(10, ConstraintDestroy);
 
+    PolicyIndexBody(policy, body);
+
     return body;
 }
 
@@ -31,6 +31,7 @@
 #include <sequence.h>
 #include <json.h>
 #include <set.h>
+#include <map.h>
 
 typedef enum
 {
@@ -53,6 +54,12 @@ struct Policy_
 {
     Seq *bundles;
     Seq *bodies;
+
+    /* Name without namespace -> Seq of the bundles/bodies by that name, in
+       the order they were appended. Bundles are also filed under their full
+       name if it has a namespace prefix. */
+    Map *bundle_index;
+    Map *body_index;
 };
 
 typedef struct
@@ -157,7 +164,7 @@ Policy *PolicyMerge(Policy *a, Policy *b);
  * @brief Query a policy for a body
  * @param policy The policy to query
  * @param ns Namespace filter (optionally NULL)
- * @param type Body type filter
+ * @param type Body type filter (optionally NULL)
  * @param name Body name filter
  * @return Body child object if found, otherwise NULL
  */
@@ -167,7 +174,7 @@ Body *PolicyGetBody(const Policy *policy, const char *ns, const char *type, cons
  * @brief Query a policy for a bundle
  * @param policy The policy to query
  * @param ns Namespace filter (optionally NULL)
- * @param type Bundle type filter
+ * @param type Bundle type filter (optionally NULL)
  * @param name Bundle name filter
  * @return Bundle child object if found, otherwise NULL
  */
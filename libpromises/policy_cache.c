@@ -0,0 +1,811 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <policy_cache.h>
+
+#include <rlist.h>
+#include <fncall.h>
+#include <files_hashes.h>
+#include <files_lib.h>
+#include <files_names.h>
+#include <file_lib.h>
+
+#ifndef __MINGW32__
+# include <sys/mman.h>
+#endif
+
+/*
+ * Cache file layout, all integers in host byte order:
+ *
+ *   magic, format version, CFEngine version, digest of the input file,
+ *   bundles: count, then for each type, name, namespace, arguments, offset,
+ *            promise types: count, then for each name, offset,
+ *              promises: count, then for each promiser, classes, comment,
+ *                promisee, has_subbundles, offset, constraints
+ *   bodies: count, then for each type, name, namespace, arguments, offset,
+ *           constraints
+ *
+ * Strings are a 32 bit length and the bytes without terminator, or the
+ * length NULL_STRING for NULL.
+ */
+
+#define POLICY_CACHE_MAGIC "CFPCACHE"
+#define POLICY_CACHE_FORMAT 1
+#define POLICY_CACHE_HASH HASH_METHOD_SHA256
+#define NULL_STRING UINT32_MAX
+
+typedef struct
+{
+    char *data;
+    size_t len;
+    size_t allocated;
+} Encoder;
+
+typedef struct
+{
+    const char *data;
+    size_t size;
+    size_t pos;
+    bool error;
+} Decoder;
+
+/*******************************************************************/
+
+static void EncodeBytes(Encoder *enc, const void *bytes, size_t len)
+{
+    if (enc->len + len > enc->allocated)
+    {
+        enc->allocated = MAX(enc->allocated * 2, enc->len + len);
+        enc->data = xrealloc(enc->data, enc->allocated);
+    }
+    memcpy(enc->data + enc->len, bytes, len);
+    enc->len += len;
+}
+
+static void EncodeU8(Encoder *enc, uint8_t value)
+{
+    EncodeBytes(enc, &value, sizeof(value));
+}
+
+static void EncodeU32(Encoder *enc, uint32_t value)
+{
+    EncodeBytes(enc, &value, sizeof(value));
+}
+
+static void EncodeU64(Encoder *enc, uint64_t value)
+{
+    EncodeBytes(enc, &value, sizeof(value));
+}
+
+static void EncodeString(Encoder *enc, const char *str)
+{
+    if (str == NULL)
+    {
+        EncodeU32(enc, NULL_STRING);
+        return;
+    }
+
+    size_t len = strlen(str);
+    EncodeU32(enc, len);
+    EncodeBytes(enc, str, len);
+}
+
+static void EncodeOffset(Encoder *enc, const SourceOffset *offset)
+{
+    EncodeU64(enc, offset->start);
+    EncodeU64(enc, offset->end);
+    EncodeU64(enc, offset->line);
+    EncodeU64(enc, offset->context);
+}
+
+static bool EncodeRlist(Encoder *enc, const Rlist *list);
+
+static bool EncodeRval(Encoder *enc, Rval rval)
+{
+    EncodeU8(enc, rval.type);
+
+    switch (rval.type)
+    {
+    case RVAL_TYPE_SCALAR:
+        EncodeString(enc, RvalScalarValue(rval));
+        return true;
+
+    case RVAL_TYPE_LIST:
+        return EncodeRlist(enc, RvalRlistValue(rval));
+
+    case RVAL_TYPE_FNCALL:
+        EncodeString(enc, RvalFnCallValue(rval)->name);
+        return EncodeRlist(enc, RvalFnCallValue(rval)->args);
+
+    case RVAL_TYPE_NOPROMISEE:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+static bool EncodeRlist(Encoder *enc, const Rlist *list)
+{
+    EncodeU32(enc, RlistLen(list));
+
+    for (const Rlist *rp = list; rp != NULL; rp = rp->next)
+    {
+        if (!EncodeRval(enc, rp->val))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool EncodeConstraints(Encoder *enc, const Seq *conlist)
+{
+    EncodeU32(enc, SeqLength(conlist));
+
+    for (size_t i = 0; i < SeqLength(conlist); i++)
+    {
+        const Constraint *cp = SeqAt(conlist, i);
+
+        EncodeString(enc, cp->lval);
+        if (!EncodeRval(enc, cp->rval))
+        {
+            return false;
+        }
+        EncodeString(enc, cp->classes);
+        EncodeU8(enc, cp->references_body);
+        EncodeOffset(enc, &cp->offset);
+    }
+
+    return true;
+}
+
+static bool EncodePolicy(Encoder *enc, const Policy *policy)
+{
+    EncodeU32(enc, SeqLength(policy->bundles));
+
+    for (size_t i = 0; i < SeqLength(policy->bundles); i++)
+    {
+        const Bundle *bp = SeqAt(policy->bundles, i);
+
+        EncodeString(enc, bp->type);
+        EncodeString(enc, bp->name);
+        EncodeString(enc, bp->ns);
+        if (!EncodeRlist(enc, bp->args))
+        {
+            return false;
+        }
+        EncodeOffset(enc, &bp->offset);
+
+        EncodeU32(enc, SeqLength(bp->promise_types));
+        for (size_t j = 0; j < SeqLength(bp->promise_types); j++)
+        {
+            const PromiseType *tp = SeqAt(bp->promise_types, j);
+
+            EncodeString(enc, tp->name);
+            EncodeOffset(enc, &tp->offset);
+
+            EncodeU32(enc, SeqLength(tp->promises));
+            for (size_t k = 0; k < SeqLength(tp->promises); k++)
+            {
+                const Promise *pp = SeqAt(tp->promises, k);
+
+                EncodeString(enc, pp->promiser);
+                EncodeString(enc, pp->classes);
+                EncodeString(enc, pp->comment);
+                if (!EncodeRval(enc, pp->promisee))
+                {
+                    return false;
+                }
+                EncodeU8(enc, pp->has_subbundles);
+                EncodeOffset(enc, &pp->offset);
+
+                if (!EncodeConstraints(enc, pp->conlist))
+                {
+                    return false;
+                }
+            }
+        }
+    }
+
+    EncodeU32(enc, SeqLength(policy->bodies));
+
+    for (size_t i = 0; i < SeqLength(policy->bodies); i++)
+    {
+        const Body *bdp = SeqAt(policy->bodies, i);
+
+        EncodeString(enc, bdp->type);
+        EncodeString(enc, bdp->name);
+        EncodeString(enc, bdp->ns);
+        if (!EncodeRlist(enc, bdp->args))
+        {
+            return false;
+        }
+        EncodeOffset(enc, &bdp->offset);
+
+        if (!EncodeConstraints(enc, bdp->conlist))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+char *PolicySerialize(const Policy *policy, size_t *size)
+{
+    Encoder enc = { 0 };
+
+    if (!EncodePolicy(&enc, policy))
+    {
+        free(enc.data);
+        return NULL;
+    }
+
+    *size = enc.len;
+    return enc.data;
+}
+
+/*******************************************************************/
+
+static const char *DecodeBytes(Decoder *dec, size_t len)
+{
+    if (dec->error || len > dec->size - dec->pos)
+    {
+        dec->error = true;
+        return NULL;
+    }
+
+    const char *bytes = dec->data + dec->pos;
+    dec->pos += len;
+    return bytes;
+}
+
+static uint8_t DecodeU8(Decoder *dec)
+{
+    uint8_t value = 0;
+    const char *bytes = DecodeBytes(dec, sizeof(value));
+    if (bytes)
+    {
+        memcpy(&value, bytes, sizeof(value));
+    }
+    return value;
+}
+
+static uint32_t DecodeU32(Decoder *dec)
+{
+    uint32_t value = 0;
+    const char *bytes = DecodeBytes(dec, sizeof(value));
+    if (bytes)
+    {
+        memcpy(&value, bytes, sizeof(value));
+    }
+    return value;
+}
+
+static uint64_t DecodeU64(Decoder *dec)
+{
+    uint64_t value = 0;
+    const char *bytes = DecodeBytes(dec, sizeof(value));
+    if (bytes)
+    {
+        memcpy(&value, bytes, sizeof(value));
+    }
+    return value;
+}
+
+/* Element counts, each element taking at least a byte */
+static uint32_t DecodeCount(Decoder *dec)
+{
+    uint32_t count = DecodeU32(dec);
+    if (count > dec->size - dec->pos)
+    {
+        dec->error = true;
+        return 0;
+    }
+    return count;
+}
+
+static char *DecodeString(Decoder *dec)
+{
+    uint32_t len = DecodeU32(dec);
+    if (len == NULL_STRING)
+    {
+        return NULL;
+    }
+
+    const char *bytes = DecodeBytes(dec, len);
+    return bytes ? xstrndup(bytes, len) : NULL;
+}
+
+static SourceOffset DecodeOffset(Decoder *dec)
+{
+    SourceOffset offset;
+    offset.start = DecodeU64(dec);
+    offset.end = DecodeU64(dec);
+    offset.line = DecodeU64(dec);
+    offset.context = DecodeU64(dec);
+    return offset;
+}
+
+static Rlist *DecodeRlist(Decoder *dec);
+
+static Rval DecodeRval(Decoder *dec)
+{
+    RvalType type = DecodeU8(dec);
+
+    switch (type)
+    {
+    case RVAL_TYPE_SCALAR:
+        {
+            char *scalar = DecodeString(dec);
+            if (scalar)
+            {
+                return (Rval) { scalar, RVAL_TYPE_SCALAR };
+            }
+        }
+        break;
+
+    case RVAL_TYPE_LIST:
+        {
+            Rlist *list = DecodeRlist(dec);
+            if (!dec->error)
+            {
+                return (Rval) { list, RVAL_TYPE_LIST };
+            }
+        }
+        break;
+
+    case RVAL_TYPE_FNCALL:
+        {
+            char *name = DecodeString(dec);
+            Rlist *args = DecodeRlist(dec);
+            if (name && !dec->error)
+            {
+                FnCall *fp = FnCallNew(name, args);
+                free(name);
+                return (Rval) { fp, RVAL_TYPE_FNCALL };
+            }
+            free(name);
+            RlistDestroy(args);
+        }
+        break;
+
+    case RVAL_TYPE_NOPROMISEE:
+        return (Rval) { NULL, RVAL_TYPE_NOPROMISEE };
+
+    default:
+        break;
+    }
+
+    dec->error = true;
+    return (Rval) { NULL, RVAL_TYPE_NOPROMISEE };
+}
+
+static Rlist *DecodeRlist(Decoder *dec)
+{
+    Rlist *list = NULL;
+
+    for (uint32_t count = DecodeCount(dec); count > 0 && !dec->error; count--)
+    {
+        Rval rval = DecodeRval(dec);
+        if (!dec->error)
+        {
+            RlistAppendRval(&list, rval);
+        }
+    }
+
+    return list;
+}
+
+static void DecodePromiseConstraints(Decoder *dec, Promise *pp)
+{
+    for (uint32_t count = DecodeCount(dec); count > 0 && !dec->error; count--)
+    {
+        char *lval = DecodeString(dec);
+        Rval rval = DecodeRval(dec);
+        char *classes = DecodeString(dec);
+        bool references_body = DecodeU8(dec);
+        SourceOffset offset = DecodeOffset(dec);
+
+        if (!dec->error)
+        {
+            Constraint *cp = PromiseAppendConstraint(pp, lval, rval, classes, references_body);
+            cp->offset = offset;
+        }
+        else if (rval.item)
+        {
+            RvalDestroy(rval);
+        }
+        free(lval);
+        free(classes);
+    }
+}
+
+static void DecodeBodyConstraints(Decoder *dec, Body *bdp)
+{
+    for (uint32_t count = DecodeCount(dec); count > 0 && !dec->error; count--)
+    {
+        char *lval = DecodeString(dec);
+        Rval rval = DecodeRval(dec);
+        char *classes = DecodeString(dec);
+        bool references_body = DecodeU8(dec);
+        SourceOffset offset = DecodeOffset(dec);
+
+        if (!dec->error)
+        {
+            Constraint *cp = BodyAppendConstraint(bdp, lval, rval, classes, references_body);
+            cp->offset = offset;
+        }
+        else if (rval.item)
+        {
+            RvalDestroy(rval);
+        }
+        free(lval);
+        free(classes);
+    }
+}
+
+static void DecodePromises(Decoder *dec, PromiseType *tp)
+{
+    for (uint32_t count = DecodeCount(dec); count > 0 && !dec->error; count--)
+    {
+        char *promiser = DecodeString(dec);
+        char *classes = DecodeString(dec);
+        char *comment = DecodeString(dec);
+        Rval promisee = DecodeRval(dec);
+        bool has_subbundles = DecodeU8(dec);
+        SourceOffset offset = DecodeOffset(dec);
+
+        if (!dec->error && promiser)
+        {
+            Promise *pp = PromiseTypeAppendPromise(tp, promiser, promisee, classes);
+            pp->comment = comment;
+            pp->has_subbundles = has_subbundles;
+            pp->offset = offset;
+
+            DecodePromiseConstraints(dec, pp);
+        }
+        else
+        {
+            dec->error = true;
+            free(comment);
+            if (promisee.item)
+            {
+                RvalDestroy(promisee);
+            }
+        }
+        free(promiser);
+        free(classes);
+    }
+}
+
+static void DecodeBundles(Decoder *dec, Policy *policy, const char *source_path)
+{
+    for (uint32_t count = DecodeCount(dec); count > 0 && !dec->error; count--)
+    {
+        char *type = DecodeString(dec);
+        char *name = DecodeString(dec);
+        char *ns = DecodeString(dec);
+        Rlist *args = DecodeRlist(dec);
+        SourceOffset offset = DecodeOffset(dec);
+
+        if (!dec->error && type && name && ns)
+        {
+            Bundle *bp = PolicyAppendBundle(policy, ns, name, type, args, source_path);
+            bp->offset = offset;
+
+            for (uint32_t n = DecodeCount(dec); n > 0 && !dec->error; n--)
+            {
+                char *tp_name = DecodeString(dec);
+                SourceOffset tp_offset = DecodeOffset(dec);
+
+                if (!dec->error && tp_name)
+                {
+                    PromiseType *tp = BundleAppendPromiseType(bp, tp_name);
+                    tp->offset = tp_offset;
+
+                    DecodePromises(dec, tp);
+                }
+                else
+                {
+                    dec->error = true;
+                }
+                free(tp_name);
+            }
+        }
+        else
+        {
+            dec->error = true;
+        }
+        free(type);
+        free(name);
+        free(ns);
+        RlistDestroy(args);
+    }
+}
+
+static void DecodeBodies(Decoder *dec, Policy *policy, const char *source_path)
+{
+    for (uint32_t count = DecodeCount(dec); count > 0 && !dec->error; count--)
+    {
+        char *type = DecodeString(dec);
+        char *name = DecodeString(dec);
+        char *ns = DecodeString(dec);
+        Rlist *args = DecodeRlist(dec);
+        SourceOffset offset = DecodeOffset(dec);
+
+        if (!dec->error && type && name && ns)
+        {
+            Body *bdp = PolicyAppendBody(policy, ns, name, type, args, source_path);
+            bdp->offset = offset;
+
+            DecodeBodyConstraints(dec, bdp);
+        }
+        else
+        {
+            dec->error = true;
+        }
+        free(type);
+        free(name);
+        free(ns);
+        RlistDestroy(args);
+    }
+}
+
+static Policy *DecodePolicy(Decoder *dec, const char *source_path)
+{
+    Policy *policy = PolicyNew();
+
+    DecodeBundles(dec, policy, source_path);
+    DecodeBodies(dec, policy, source_path);
+
+    if (dec->error || dec->pos != dec->size)
+    {
+        PolicyDestroy(policy);
+        return NULL;
+    }
+
+    return policy;
+}
+
+Policy *PolicyDeserialize(const char *data, size_t size, const char *source_path)
+{
+    Decoder dec = { data, size, 0, false };
+    return DecodePolicy(&dec, source_path);
+}
+
+/*******************************************************************/
+
+static char *MapFile(const char *path, size_t *size)
+{
+    int fd = open(path, O_RDONLY | O_BINARY);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    *size = sb.st_size;
+    char *data = NULL;
+
+#ifndef __MINGW32__
+    if (*size > 0)
+    {
+        data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            data = NULL;
+        }
+    }
+    else
+    {
+        /* Nothing to map */
+        data = xstrdup("");
+    }
+#else
+    data = xmalloc(*size + 1);
+    if (FullRead(fd, data, *size) != (int) *size)
+    {
+        free(data);
+        data = NULL;
+    }
+#endif
+
+    close(fd);
+    return data;
+}
+
+static void UnmapFile(char *data, size_t size)
+{
+#ifndef __MINGW32__
+    if (size > 0)
+    {
+        munmap(data, size);
+        return;
+    }
+#endif
+    free(data);
+}
+
+/* @include pulls in files that are not part of the digest */
+static bool HasInclude(const char *data, size_t size)
+{
+    static const char include[] = "@include";
+    const size_t len = sizeof(include) - 1;
+
+    for (const char *at = memchr(data, '@', size); at != NULL;
+         at = memchr(at + 1, '@', size - (at + 1 - data)))
+    {
+        if ((size_t) (data + size - at) >= len && memcmp(at, include, len) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool PolicyCacheDigest(const char *input_path, unsigned char digest[EVP_MAX_MD_SIZE + 1])
+{
+    /* Crypto may not have been initialized */
+    if (EVP_get_digestbyname(FileHashName(POLICY_CACHE_HASH)) == NULL)
+    {
+        return false;
+    }
+
+    size_t size;
+    char *data = MapFile(input_path, &size);
+    if (!data)
+    {
+        return false;
+    }
+
+    bool cacheable = size <= INT_MAX && !HasInclude(data, size);
+    if (cacheable)
+    {
+        HashString(data, size, digest, POLICY_CACHE_HASH);
+    }
+
+    UnmapFile(data, size);
+    return cacheable;
+}
+
+static void EncodeHeader(Encoder *enc, const unsigned char *digest)
+{
+    EncodeBytes(enc, POLICY_CACHE_MAGIC, sizeof(POLICY_CACHE_MAGIC) - 1);
+    EncodeU32(enc, POLICY_CACHE_FORMAT);
+    EncodeString(enc, Version());
+    EncodeBytes(enc, digest, FileHashSize(POLICY_CACHE_HASH));
+}
+
+Policy *PolicyCacheLoad(AgentType agent_type, const char *input_path, PolicyCacheKey *key)
+{
+    key->valid = false;
+
+    if (!PolicyCacheDigest(input_path, key->digest))
+    {
+        return NULL;
+    }
+
+    /* A truncated name could be another file's cache */
+    if ((strlen(input_path) >= CF_BUFSIZE) ||
+        (snprintf(key->path, sizeof(key->path), "%s%cstate%cpolicy_cache%c%s_%s", CFWORKDIR,
+                  FILE_SEPARATOR, FILE_SEPARATOR, FILE_SEPARATOR, CF_AGENTTYPES[agent_type],
+                  CanonifyName(input_path)) >= (int) sizeof(key->path)))
+    {
+        Log(LOG_LEVEL_VERBOSE, "Path to the policy cache file of '%s' is too long, not caching it", input_path);
+        return NULL;
+    }
+    key->valid = true;
+
+    size_t size;
+    char *data = MapFile(key->path, &size);
+    if (!data)
+    {
+        return NULL;
+    }
+
+    Encoder header = { 0 };
+    EncodeHeader(&header, key->digest);
+
+    Policy *policy = NULL;
+    if (size >= header.len && memcmp(data, header.data, header.len) == 0)
+    {
+        Decoder dec = { data, size, header.len, false };
+        policy = DecodePolicy(&dec, input_path);
+
+        if (policy)
+        {
+            Log(LOG_LEVEL_VERBOSE, "Loaded file '%s' from the policy cache", input_path);
+        }
+        else
+        {
+            Log(LOG_LEVEL_VERBOSE, "Policy cache file '%s' is corrupt, ignoring it", key->path);
+        }
+    }
+
+    free(header.data);
+    UnmapFile(data, size);
+
+    return policy;
+}
+
+void PolicyCacheStore(const PolicyCacheKey *key, const Policy *policy)
+{
+    if (!key->valid)
+    {
+        return;
+    }
+
+    Encoder enc = { 0 };
+    EncodeHeader(&enc, key->digest);
+
+    if (!EncodePolicy(&enc, policy))
+    {
+        free(enc.data);
+        return;
+    }
+
+    if (!MakeParentDirectory(key->path, false))
+    {
+        free(enc.data);
+        return;
+    }
+
+    /* Written aside and renamed, so that a concurrent agent never loads a
+       partial file */
+    char tmp_path[CF_BUFSIZE];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.%ju", key->path, (uintmax_t) getpid()) >= (int) sizeof(tmp_path))
+    {
+        Log(LOG_LEVEL_VERBOSE, "Path to the policy cache file '%s' is too long, not caching it", key->path);
+        free(enc.data);
+        return;
+    }
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0600);
+    if (fd == -1)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Could not create policy cache file '%s'. (open: %s)", tmp_path, GetErrorStr());
+        free(enc.data);
+        return;
+    }
+
+    bool written = (FullWrite(fd, enc.data, enc.len) == (int) enc.len);
+    written = (close(fd) == 0) && written;
+    free(enc.data);
+
+    if (!written || rename(tmp_path, key->path) == -1)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Could not write policy cache file '%s'. (%s)", key->path, GetErrorStr());
+        unlink(tmp_path);
+    }
+}
@@ -0,0 +1,73 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_POLICY_CACHE_H
+#define CFENGINE_POLICY_CACHE_H
+
+#include <policy.h>
+
+/*
+ * Parsed policy files are kept under WORKDIR/state/policy_cache, one file per
+ * input file and agent type, together with the digest of the input they were
+ * parsed from and the CFEngine version that parsed them. An entry is only
+ * used if both still match, so editing the input or upgrading invalidates it.
+ */
+
+typedef struct
+{
+    bool valid;
+    char path[CF_BUFSIZE];
+    unsigned char digest[EVP_MAX_MD_SIZE + 1];
+} PolicyCacheKey;
+
+/**
+ * @brief Load the cached parse of a policy file
+ * @param agent_type Agent the file is parsed for
+ * @param input_path Policy file
+ * @param key Filled in for PolicyCacheStore() if the file may be cached
+ * @return Policy if it was found in the cache, otherwise NULL
+ */
+Policy *PolicyCacheLoad(AgentType agent_type, const char *input_path, PolicyCacheKey *key);
+
+/**
+ * @brief Store a freshly parsed policy file for PolicyCacheLoad()
+ * @param key Key filled in by PolicyCacheLoad(), ignored if not valid
+ */
+void PolicyCacheStore(const PolicyCacheKey *key, const Policy *policy);
+
+/**
+ * @brief Serialize a policy in the cache format
+ * @param size Set to the size of the serialized policy
+ * @return Serialized policy, or NULL if it contains data containers
+ */
+char *PolicySerialize(const Policy *policy, size_t *size);
+
+/**
+ * @brief Inverse of PolicySerialize()
+ * @param source_path Source path of all bundles and bodies
+ * @return Policy, or NULL if the data is truncated or corrupt
+ */
+Policy *PolicyDeserialize(const char *data, size_t size, const char *source_path);
+
+#endif
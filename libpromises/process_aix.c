@@ -76,3 +76,9 @@ ProcessState GetProcessState(pid_t pid)
         return PROCESS_STATE_DOES_NOT_EXIST;
     }
 }
+
+Seq *LoadProcessInfoTable(void)
+{
+    /* No native reader yet, ps output is used instead */
+    return NULL;
+}
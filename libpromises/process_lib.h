@@ -25,8 +25,41 @@
 #ifndef CFENGINE_PROCESS_H
 #define CFENGINE_PROCESS_H
 
+#include <sequence.h>
+
 #define PROCESS_START_TIME_UNKNOWN ((time_t)0)
 
+/*
+ * One entry of the process table, as read directly from the kernel.
+ */
+typedef struct
+{
+    pid_t pid;
+    pid_t ppid;
+    pid_t pgid;
+    uid_t uid;                 /* effective uid */
+    char *user;                /* user name, or the uid if it has none */
+    char state;                /* R, S, D, T, Z... as in ps STAT */
+    long nice;
+    long threads;
+    unsigned long vsize;       /* virtual size in kB */
+    unsigned long rss;         /* resident set size in kB */
+    double pcpu;               /* CPU time / elapsed time, in percent */
+    double pmem;               /* RSS / physical memory, in percent */
+    time_t start_time;         /* Unix timestamp */
+    time_t cpu_time;           /* user + system time, in seconds */
+    char *command;             /* command line, or [name] if there is none */
+} ProcessInfo;
+
+/*
+ * Read the whole process table into a Seq of ProcessInfo, sorted by pid.
+ *
+ * @return NULL if the platform has no native way to do so, in which case
+ * callers fall back to running ps.
+ */
+Seq *LoadProcessInfoTable(void);
+void ProcessInfoDestroy(ProcessInfo *info);
+
 /*
  * Obtain start time of specified process.
  *
@@ -27,19 +27,31 @@
 #include <process_lib.h>
 #include <process_unix_priv.h>
 #include <files_lib.h>
+#include <string_lib.h>
 
 
 typedef struct
 {
-    time_t starttime;
+    time_t starttime;           /* seconds since boot */
     char state;
+    char name[64];
+    pid_t ppid;
+    pid_t pgid;
+    unsigned long long utime;   /* clock ticks */
+    unsigned long long stime;   /* clock ticks */
+    long nice;
+    long threads;
+    unsigned long vsize;        /* bytes */
+    long rss;                   /* pages */
 } ProcessStat;
 
-static bool GetProcessStat(pid_t pid, ProcessStat *state)
+/*
+ * Reads a (small) /proc file into buf and NUL-terminates it.
+ *
+ * @return number of bytes read, or -1 if the file could not be read
+ */
+static int ReadProcFile(const char *filename, char *buf, size_t buf_size)
 {
-    char filename[CF_BUFSIZE];
-    snprintf(filename, CF_BUFSIZE, "/proc/%d/stat", (int)pid);
-
     int fd;
     for (;;)
     {
@@ -55,22 +67,37 @@ static bool GetProcessStat(pid_t pid, ProcessStat *state)
 
         if (errno == ENOENT || errno == ENOTDIR)
         {
-            return false;
+            return -1;
         }
 
         if (errno == EACCES)
         {
-            return false;
+            return -1;
         }
 
-        assert (fd != -1 && "Unable to open /proc/<pid>/stat");
+        assert (fd != -1 && "Unable to open /proc file");
+        return -1;
     }
 
-    char stat[CF_BUFSIZE];
-    int res = FullRead(fd, stat, sizeof(stat));
+    int res = FullRead(fd, buf, buf_size - 1);
     close(fd);
 
     if (res < 0)
+    {
+        return -1;
+    }
+
+    buf[res] = '\0';
+    return res;
+}
+
+static bool GetProcessStat(pid_t pid, ProcessStat *state)
+{
+    char filename[CF_BUFSIZE];
+    snprintf(filename, CF_BUFSIZE, "/proc/%d/stat", (int)pid);
+
+    char stat[CF_BUFSIZE];
+    if (ReadProcFile(filename, stat, sizeof(stat)) < 0)
     {
         return false;
     }
@@ -79,21 +106,27 @@ static bool GetProcessStat(pid_t pid, ProcessStat *state)
        not to choke on weird task names, we search for closing parenthesis first */
 
     char *p = strrchr(stat, ')');
-    if (p == NULL)
+    char *name = strchr(stat, '(');
+    if (p == NULL || name == NULL || name > p)
     {
         /* Wrong field format! */
         return false;
     }
 
+    size_t name_len = MIN((size_t)(p - name - 1), sizeof(state->name) - 1);
+    memcpy(state->name, name + 1, name_len);
+    state->name[name_len] = '\0';
+
     p++; // Skip the parenthesis
 
     char proc_state[2];
+    int ppid, pgid;
     unsigned long long starttime;
 
     if (sscanf(p,
                "%1s" /* state */
-               "%*s" /* ppid */
-               "%*s" /* pgrp */
+               "%d" /* ppid */
+               "%d" /* pgrp */
                "%*s" /* session */
                "%*s" /* tty_nr */
                "%*s" /* tpgid */
@@ -102,22 +135,34 @@ static bool GetProcessStat(pid_t pid, ProcessStat *state)
                "%*s" /* cminflt */
                "%*s" /* majflt */
                "%*s" /* cmajflt */
-               "%*s" /* utime */
-               "%*s" /* stime */
+               "%llu" /* utime */
+               "%llu" /* stime */
                "%*s" /* cutime */
                "%*s" /* cstime */
                "%*s" /* priority */
-               "%*s" /* nice */
-               "%*s" /* num_threads */
+               "%ld" /* nice */
+               "%ld" /* num_threads */
                "%*s" /* itrealvalue */
-               "%llu" /* starttime */,
+               "%llu" /* starttime */
+               "%lu" /* vsize */
+               "%ld" /* rss */,
                proc_state,
-               &starttime) != 2)
+               &ppid,
+               &pgid,
+               &state->utime,
+               &state->stime,
+               &state->nice,
+               &state->threads,
+               &starttime,
+               &state->vsize,
+               &state->rss) != 10)
     {
         return false;
     }
 
     state->state = proc_state[0];
+    state->ppid = ppid;
+    state->pgid = pgid;
     state->starttime = (time_t)(starttime / sysconf(_SC_CLK_TCK));
 
     return true;
@@ -155,3 +200,209 @@ ProcessState GetProcessState(pid_t pid)
         return PROCESS_STATE_DOES_NOT_EXIST;
     }
 }
+
+/******************************************************************************/
+
+static bool GetProcessUid(pid_t pid, uid_t *uid)
+{
+    char filename[CF_BUFSIZE];
+    snprintf(filename, CF_BUFSIZE, "/proc/%d/status", (int)pid);
+
+    char status[CF_BUFSIZE];
+    if (ReadProcFile(filename, status, sizeof(status)) < 0)
+    {
+        return false;
+    }
+
+    /* Uid: <real> <effective> <saved> <fs>, ps reports the effective one */
+    const char *line = strstr(status, "\nUid:");
+    unsigned long ruid, euid;
+    if (line == NULL || sscanf(line, "\nUid: %lu %lu", &ruid, &euid) != 2)
+    {
+        return false;
+    }
+
+    *uid = (uid_t)euid;
+    return true;
+}
+
+static char *GetProcessCommand(pid_t pid, const char *name)
+{
+    char filename[CF_BUFSIZE];
+    snprintf(filename, CF_BUFSIZE, "/proc/%d/cmdline", (int)pid);
+
+    char cmdline[CF_BUFSIZE];
+    int len = ReadProcFile(filename, cmdline, sizeof(cmdline));
+
+    /* Arguments are separated by NULs, and kernel threads have none */
+    while (len > 0 && cmdline[len - 1] == '\0')
+    {
+        len--;
+    }
+
+    if (len <= 0)
+    {
+        return StringConcatenate(3, "[", name, "]");
+    }
+
+    for (int i = 0; i < len; i++)
+    {
+        if (cmdline[i] == '\0' || cmdline[i] == '\n')
+        {
+            cmdline[i] = ' ';
+        }
+    }
+    cmdline[len] = '\0';
+
+    return xstrdup(cmdline);
+}
+
+/*
+ * Reads the first value following key in a /proc file such as /proc/stat or
+ * /proc/meminfo.
+ */
+static bool ReadProcValue(const char *filename, const char *key, double *value)
+{
+    char buf[CF_BUFSIZE * 2];
+    if (ReadProcFile(filename, buf, sizeof(buf)) < 0)
+    {
+        return false;
+    }
+
+    const char *p = buf;
+    size_t key_len = strlen(key);
+    while (p && strncmp(p, key, key_len) != 0)
+    {
+        p = strchr(p, '\n');
+        if (p)
+        {
+            p++;
+        }
+    }
+
+    return p && sscanf(p + key_len, "%lf", value) == 1;
+}
+
+typedef struct
+{
+    uid_t uid;
+    char *name;
+} UserName;
+
+static void UserNameDestroy(UserName *user)
+{
+    free(user->name);
+    free(user);
+}
+
+/* There are few distinct owners, so a linear cache avoids a getpwuid() per process */
+static const char *LookupUserName(Seq *cache, uid_t uid)
+{
+    for (size_t i = 0; i < SeqLength(cache); i++)
+    {
+        UserName *user = SeqAt(cache, i);
+        if (user->uid == uid)
+        {
+            return user->name;
+        }
+    }
+
+    UserName *user = xmalloc(sizeof(UserName));
+    user->uid = uid;
+
+    struct passwd *pw = getpwuid(uid);
+    if (pw)
+    {
+        user->name = xstrdup(pw->pw_name);
+    }
+    else
+    {
+        user->name = StringFromLong((long)uid);
+    }
+
+    SeqAppend(cache, user);
+    return user->name;
+}
+
+static int ProcessInfoComparePid(const void *a, const void *b, ARG_UNUSED void *user_data)
+{
+    const ProcessInfo *pa = a;
+    const ProcessInfo *pb = b;
+
+    return (pa->pid > pb->pid) - (pa->pid < pb->pid);
+}
+
+Seq *LoadProcessInfoTable(void)
+{
+    DIR *dirh = opendir("/proc");
+    if (dirh == NULL)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Unable to read /proc, falling back to ps. (opendir: %s)", GetErrorStr());
+        return NULL;
+    }
+
+    const long ticks = sysconf(_SC_CLK_TCK);
+    const long page_kb = sysconf(_SC_PAGESIZE) / 1024;
+
+    double boot_time = 0, uptime = 0, mem_total_kb = 0;
+    ReadProcValue("/proc/stat", "btime", &boot_time);
+    ReadProcValue("/proc/uptime", "", &uptime);
+    ReadProcValue("/proc/meminfo", "MemTotal:", &mem_total_kb);
+
+    Seq *table = SeqNew(1000, ProcessInfoDestroy);
+    Seq *users = SeqNew(20, UserNameDestroy);
+
+    const struct dirent *dirp;
+    while ((dirp = readdir(dirh)) != NULL)
+    {
+        char *end;
+        long pid = strtol(dirp->d_name, &end, 10);
+        if (*end != '\0' || pid <= 0)
+        {
+            continue;
+        }
+
+        /* Processes may exit while the table is read, just skip them */
+
+        ProcessStat st;
+        uid_t uid;
+        if (!GetProcessStat(pid, &st) || !GetProcessUid(pid, &uid))
+        {
+            continue;
+        }
+
+        ProcessInfo *info = xcalloc(1, sizeof(ProcessInfo));
+
+        info->pid = pid;
+        info->ppid = st.ppid;
+        info->pgid = st.pgid;
+        info->uid = uid;
+        info->user = xstrdup(LookupUserName(users, uid));
+        info->state = st.state;
+        info->nice = st.nice;
+        info->threads = st.threads;
+        info->vsize = st.vsize / 1024;
+        info->rss = st.rss * page_kb;
+        info->start_time = (time_t)boot_time + st.starttime;
+        info->cpu_time = (time_t)((st.utime + st.stime) / ticks);
+        info->command = GetProcessCommand(pid, st.name);
+
+        double elapsed = uptime - st.starttime;
+        if (elapsed > 0)
+        {
+            info->pcpu = 100.0 * (st.utime + st.stime) / ticks / elapsed;
+        }
+        if (mem_total_kb > 0)
+        {
+            info->pmem = 100.0 * info->rss / mem_total_kb;
+        }
+
+        SeqAppend(table, info);
+    }
+
+    closedir(dirh);
+    SeqDestroy(users);
+
+    SeqSort(table, ProcessInfoComparePid, NULL);
+    return table;
+}
@@ -241,3 +241,13 @@ int GracefulTerminate(pid_t pid, time_t process_start_time)
 
     return true;
 }
+
+void ProcessInfoDestroy(ProcessInfo *info)
+{
+    if (info)
+    {
+        free(info->user);
+        free(info->command);
+        free(info);
+    }
+}
@@ -43,3 +43,9 @@ ProcessState GetProcessState(ARG_UNUSED pid_t pid)
 
     return PROCESS_STATE_RUNNING;
 }
+
+Seq *LoadProcessInfoTable(void)
+{
+    /* No native reader yet, ps output is used instead */
+    return NULL;
+}
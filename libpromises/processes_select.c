@@ -35,6 +35,8 @@
 #include <rlist.h>
 #include <policy.h>
 #include <zones.h>
+#include <process_lib.h>
+#include <sequence.h>
 
 static int SelectProcRangeMatch(char *name1, char *name2, int min, int max, char **names, char **line);
 static int SelectProcRegexMatch(EvalContext *ctx, char *name1, char *name2, char *regex, char **colNames, char **line);
@@ -45,8 +47,42 @@ static int GetProcColumnIndex(char *name1, char *name2, char **names);
 static void GetProcessColumnNames(char *proc, char **names, int *start, int *end);
 static int ExtractPid(char *psentry, char **names, int *end);
 
+/*
+ * Typed copy of PROCESSTABLE, sorted by pid, where the platform can read it
+ * natively. The counter of each PROCESSTABLE line is then its pid.
+ */
+static Seq *PROCESS_INFO_TABLE = NULL;
+
 /***************************************************************************/
 
+static bool EvalProcessSelectAttributes(ProcessSelect a, StringSet *process_select_attributes)
+{
+    if (a.process_result)
+    {
+        return EvalProcessResult(a.process_result, process_select_attributes);
+    }
+
+    if (StringSetSize(process_select_attributes) == 0)
+    {
+        return EvalProcessResult("", process_select_attributes);
+    }
+
+    Writer *w = StringWriter();
+    StringSetIterator iter = StringSetIteratorInit(process_select_attributes);
+    char *attr = StringSetIteratorNext(&iter);
+    WriterWrite(w, attr);
+
+    while ((attr = StringSetIteratorNext(&iter)))
+    {
+        WriterWriteChar(w, '.');
+        WriterWrite(w, attr);
+    }
+
+    bool result = EvalProcessResult(StringWriterData(w), process_select_attributes);
+    WriterClose(w);
+    return result;
+}
+
 static int SelectProcess(EvalContext *ctx, char *procentry, char **names, int *start, int *end, ProcessSelect a)
 {
     int result = true, i;
@@ -135,39 +171,163 @@ static int SelectProcess(EvalContext *ctx, char *procentry, char **names, int *s
         StringSetAdd(process_select_attributes, xstrdup("tty"));
     }
 
-    if (!a.process_result)
+    result = EvalProcessSelectAttributes(a, process_select_attributes);
+
+    StringSetDestroy(process_select_attributes);
+
+    for (i = 0; column[i] != NULL; i++)
+    {
+        free(column[i]);
+    }
+
+    return result;
+}
+
+static bool InRange(long value, long min, long max)
+{
+    if ((min == CF_NOINT) || (max == CF_NOINT))
+    {
+        return false;
+    }
+
+    return (min <= value) && (value <= max);
+}
+
+/*
+ * Same selection as SelectProcess, but evaluated against the typed fields of a
+ * ProcessInfo instead of re-splitting its ps line.
+ */
+static bool SelectProcessInfo(EvalContext *ctx, const ProcessInfo *info, ProcessSelect a)
+{
+    StringSet *process_select_attributes = StringSetNew();
+
+    char uid[32];
+    snprintf(uid, sizeof(uid), "%ju", (uintmax_t)info->uid);
+
+    for (Rlist *rp = a.owner; rp != NULL; rp = rp->next)
     {
-        if (StringSetSize(process_select_attributes) == 0)
+        if (FullTextMatch(ctx, RlistScalarValue(rp), info->user) ||
+            FullTextMatch(ctx, RlistScalarValue(rp), uid))
         {
-            result = EvalProcessResult("", process_select_attributes);
+            StringSetAdd(process_select_attributes, xstrdup("process_owner"));
+            break;
         }
-        else
-        {
-            Writer *w = StringWriter();
-            StringSetIterator iter = StringSetIteratorInit(process_select_attributes);
-            char *attr = StringSetIteratorNext(&iter);
-            WriterWrite(w, attr);
+    }
 
-            while ((attr = StringSetIteratorNext(&iter)))
-            {
-                WriterWriteChar(w, '.');
-                WriterWrite(w, attr);
-            }
+    if (InRange(info->pid, a.min_pid, a.max_pid))
+    {
+        StringSetAdd(process_select_attributes, xstrdup("pid"));
+    }
 
-            result = EvalProcessResult(StringWriterData(w), process_select_attributes);
-            WriterClose(w);
-        }
+    if (InRange(info->ppid, a.min_ppid, a.max_ppid))
+    {
+        StringSetAdd(process_select_attributes, xstrdup("ppid"));
     }
-    else
+
+    if (InRange(info->pgid, a.min_pgid, a.max_pgid))
+    {
+        StringSetAdd(process_select_attributes, xstrdup("pgid"));
+    }
+
+    if (InRange(info->vsize, a.min_vsize, a.max_vsize))
+    {
+        StringSetAdd(process_select_attributes, xstrdup("vsize"));
+    }
+
+    if (InRange(info->rss, a.min_rsize, a.max_rsize))
+    {
+        StringSetAdd(process_select_attributes, xstrdup("rsize"));
+    }
+
+    if (InRange(info->cpu_time, a.min_ttime, a.max_ttime))
+    {
+        StringSetAdd(process_select_attributes, xstrdup("ttime"));
+    }
+
+    if (InRange(info->start_time, a.min_stime, a.max_stime))
+    {
+        StringSetAdd(process_select_attributes, xstrdup("stime"));
+    }
+
+    if (InRange(info->nice, a.min_pri, a.max_pri))
+    {
+        StringSetAdd(process_select_attributes, xstrdup("priority"));
+    }
+
+    if (InRange(info->threads, a.min_thread, a.max_thread))
     {
-        result = EvalProcessResult(a.process_result, process_select_attributes);
+        StringSetAdd(process_select_attributes, xstrdup("threads"));
     }
 
+    char state[2] = { info->state, '\0' };
+    if (a.status && FullTextMatch(ctx, a.status, state))
+    {
+        StringSetAdd(process_select_attributes, xstrdup("status"));
+    }
+
+    if (a.command && FullTextMatch(ctx, a.command, info->command))
+    {
+        StringSetAdd(process_select_attributes, xstrdup("command"));
+    }
+
+    bool result = EvalProcessSelectAttributes(a, process_select_attributes);
     StringSetDestroy(process_select_attributes);
+    return result;
+}
 
-    for (i = 0; column[i] != NULL; i++)
+static const ProcessInfo *FindProcessInfo(pid_t pid)
+{
+    size_t low = 0;
+    size_t high = SeqLength(PROCESS_INFO_TABLE);
+
+    while (low < high)
     {
-        free(column[i]);
+        size_t mid = low + (high - low) / 2;
+        const ProcessInfo *info = SeqAt(PROCESS_INFO_TABLE, mid);
+
+        if (info->pid == pid)
+        {
+            return info;
+        }
+        else if (info->pid < pid)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return NULL;
+}
+
+static Item *SelectProcessInfos(EvalContext *ctx, const Item *processes, const char *process_name, ProcessSelect a, bool attrselect)
+{
+    Item *result = NULL;
+
+    for (const Item *ip = processes->next; ip != NULL; ip = ip->next)
+    {
+        int s, e;
+
+        if (!BlockTextMatch(ctx, process_name, ip->name, &s, &e))
+        {
+            continue;
+        }
+
+        const ProcessInfo *info = FindProcessInfo(ip->counter);
+        if (info == NULL)
+        {
+            continue;
+        }
+
+        if (attrselect && !SelectProcessInfo(ctx, info, a))
+        {
+            continue;
+        }
+
+        PrependItem(&result, ip->name, "");
+        result->counter = (int)info->pid;
     }
 
     return result;
@@ -182,6 +342,11 @@ Item *SelectProcesses(EvalContext *ctx, const Item *processes, const char *proce
         return result;
     }
 
+    if (PROCESS_INFO_TABLE && processes == PROCESSTABLE)
+    {
+        return SelectProcessInfos(ctx, processes, process_name, a, attrselect);
+    }
+
     char *names[CF_PROCCOLS];
     int start[CF_PROCCOLS];
     int end[CF_PROCCOLS];
@@ -548,6 +713,19 @@ bool IsProcessNameRunning(EvalContext *ctx, char *procNameRegex)
         return false;
     }
 
+    if (PROCESS_INFO_TABLE)
+    {
+        for (size_t i = 0; i < SeqLength(PROCESS_INFO_TABLE); i++)
+        {
+            const ProcessInfo *info = SeqAt(PROCESS_INFO_TABLE, i);
+            if (FullTextMatch(ctx, procNameRegex, info->command))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
     GetProcessColumnNames(PROCESSTABLE->name, (char **) colHeaders, start, end);
 
     for (ip = PROCESSTABLE->next; ip != NULL; ip = ip->next)    // iterate over ps lines
@@ -708,20 +886,100 @@ static int ExtractPid(char *psentry, char **names, int *end)
     return pid;
 }
 
+void ClearProcessTable(void)
+{
+    DeleteItemList(PROCESSTABLE);
+    PROCESSTABLE = NULL;
+
+    SeqDestroy(PROCESS_INFO_TABLE);
+    PROCESS_INFO_TABLE = NULL;
+}
+
 #ifndef __MINGW32__
-int LoadProcessTable(EvalContext *ctx, Item **procdata)
+
+#define PS_LINE_FORMAT "%-8s %5s %5s %5s %4s %4s %6s %3s %5s %4s %5s %8s %s"
+
+static void FormatStartTime(time_t start_time, time_t now, char *buf, size_t size)
 {
-    FILE *prp;
-    char pscomm[CF_MAXLINKSIZE], vbuff[CF_BUFSIZE], *sp;
-    Item *rootprocs = NULL;
-    Item *otherprocs = NULL;
+    struct tm start_tm, now_tm;
+    localtime_r(&start_time, &start_tm);
+    localtime_r(&now, &now_tm);
 
-    if (PROCESSTABLE)
+    /* Same as ps: time of day within the last day, else date, else year */
+    if (now - start_time < SECONDS_PER_DAY)
     {
-        Log(LOG_LEVEL_VERBOSE, "Reusing cached process table");
-        return true;
+        strftime(buf, size, "%H:%M", &start_tm);
+    }
+    else if (start_tm.tm_year == now_tm.tm_year)
+    {
+        strftime(buf, size, "%b%d", &start_tm);
+    }
+    else
+    {
+        strftime(buf, size, "%Y", &start_tm);
+    }
+}
+
+/*
+ * Renders a ProcessInfo like a line of the Linux ps output in VPSOPTS, so that
+ * promiser regexes and the saved state files stay as they were.
+ */
+static char *ProcessInfoToPsLine(const ProcessInfo *info, time_t now)
+{
+    char pid[32], ppid[32], pgid[32], pcpu[32], pmem[32], vsize[32], nice[32];
+    char rss[32], threads[32], stime[32], ttime[32];
+
+    snprintf(pid, sizeof(pid), "%d", (int)info->pid);
+    snprintf(ppid, sizeof(ppid), "%d", (int)info->ppid);
+    snprintf(pgid, sizeof(pgid), "%d", (int)info->pgid);
+    snprintf(pcpu, sizeof(pcpu), "%.1f", info->pcpu);
+    snprintf(pmem, sizeof(pmem), "%.1f", info->pmem);
+    snprintf(vsize, sizeof(vsize), "%lu", info->vsize);
+    snprintf(nice, sizeof(nice), "%ld", info->nice);
+    snprintf(rss, sizeof(rss), "%lu", info->rss);
+    snprintf(threads, sizeof(threads), "%ld", info->threads);
+    FormatStartTime(info->start_time, now, stime, sizeof(stime));
+
+    long days = info->cpu_time / SECONDS_PER_DAY;
+    long secs = info->cpu_time % SECONDS_PER_DAY;
+    if (days > 0)
+    {
+        snprintf(ttime, sizeof(ttime), "%ld-%02ld:%02ld:%02ld", days, secs / 3600, (secs / 60) % 60, secs % 60);
+    }
+    else
+    {
+        snprintf(ttime, sizeof(ttime), "%02ld:%02ld:%02ld", secs / 3600, (secs / 60) % 60, secs % 60);
+    }
+
+    return StringFormat(PS_LINE_FORMAT, info->user, pid, ppid, pgid, pcpu, pmem,
+                        vsize, nice, rss, threads, stime, ttime, info->command);
+}
+
+static void LoadProcessTableFromInfo(Item **procdata, const Seq *table)
+{
+    time_t now = time(NULL);
+
+    /* Build the list backwards to avoid walking it on every append */
+    for (size_t i = SeqLength(table); i > 0; i--)
+    {
+        const ProcessInfo *info = SeqAt(table, i - 1);
+        char *line = ProcessInfoToPsLine(info, now);
+        PrependItem(procdata, line, "");
+        (*procdata)->counter = (int)info->pid;
+        free(line);
     }
 
+    char *header = StringFormat(PS_LINE_FORMAT, "USER", "PID", "PPID", "PGID", "%CPU", "%MEM",
+                                "VSZ", "NI", "RSS", "NLWP", "STIME", "TIME", "COMMAND");
+    PrependItem(procdata, header, "");
+    free(header);
+}
+
+static bool LoadProcessTableFromPs(Item **procdata)
+{
+    FILE *prp;
+    char pscomm[CF_MAXLINKSIZE], vbuff[CF_BUFSIZE], *sp;
+
     const char *psopts = GetProcessOptions();
 
     snprintf(pscomm, CF_MAXLINKSIZE, "%s %s", VPSCOMM[VSYSTEMHARDCLASS], psopts);
@@ -734,6 +992,7 @@ int LoadProcessTable(EvalContext *ctx, Item **procdata)
         return false;
     }
 
+    Item *last = NULL;
     for (;;)
     {
         ssize_t res = CfReadLine(vbuff, CF_BUFSIZE, prp);
@@ -759,30 +1018,77 @@ int LoadProcessTable(EvalContext *ctx, Item **procdata)
             continue;
         }
 
-        AppendItem(procdata, vbuff, "");
+        if (last == NULL)
+        {
+            AppendItem(procdata, vbuff, "");
+            last = EndOfList(*procdata);
+        }
+        else
+        {
+            InsertAfter(procdata, last, vbuff);
+            last = last->next;
+        }
     }
 
     cf_pclose(prp);
+    return true;
+}
 
-/* Now save the data */
+int LoadProcessTable(ARG_UNUSED EvalContext *ctx, Item **procdata)
+{
+    char vbuff[CF_BUFSIZE];
 
-    snprintf(vbuff, CF_MAXVARSIZE, "%s/state/cf_procs", CFWORKDIR);
-    RawSaveItemList(*procdata, vbuff);
+    if (PROCESSTABLE)
+    {
+        Log(LOG_LEVEL_VERBOSE, "Reusing cached process table");
+        return true;
+    }
 
-    CopyList(&rootprocs, *procdata);
-    CopyList(&otherprocs, *procdata);
+    SeqDestroy(PROCESS_INFO_TABLE);
+    PROCESS_INFO_TABLE = IsGlobalZone() ? NULL : LoadProcessInfoTable();
 
-    while (DeleteItemNotContaining(ctx, &rootprocs, "root"))
+    if (PROCESS_INFO_TABLE)
     {
+        Log(LOG_LEVEL_VERBOSE, "Observed %zu processes in the kernel process table",
+            SeqLength(PROCESS_INFO_TABLE));
+        LoadProcessTableFromInfo(procdata, PROCESS_INFO_TABLE);
     }
-
-    while (DeleteItemContaining(ctx, &otherprocs, "root"))
+    else if (!LoadProcessTableFromPs(procdata))
     {
+        return false;
     }
 
-    if (otherprocs)
+/* Now save the data */
+
+    snprintf(vbuff, CF_MAXVARSIZE, "%s/state/cf_procs", CFWORKDIR);
+    RawSaveItemList(*procdata, vbuff);
+
+    /* Both lists start with the header, then the lines mentioning root or not */
+    Item *rootprocs = NULL;
+    Item *otherprocs = NULL;
+    Item *last_root = NULL;
+    Item *last_other = NULL;
+
+    if (*procdata)
     {
-        PrependItem(&rootprocs, otherprocs->name, NULL);
+        AppendItem(&rootprocs, (*procdata)->name, NULL);
+        AppendItem(&otherprocs, (*procdata)->name, NULL);
+        last_root = rootprocs;
+        last_other = otherprocs;
+
+        for (const Item *ip = (*procdata)->next; ip != NULL; ip = ip->next)
+        {
+            if (strstr(ip->name, "root"))
+            {
+                InsertAfter(&rootprocs, last_root, ip->name);
+                last_root = last_root->next;
+            }
+            else
+            {
+                InsertAfter(&otherprocs, last_other, ip->name);
+                last_other = last_other->next;
+            }
+        }
     }
 
     snprintf(vbuff, CF_MAXVARSIZE, "%s/state/cf_rootprocs", CFWORKDIR);
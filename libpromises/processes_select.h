@@ -28,6 +28,7 @@
 #include <cf3.defs.h>
 
 int LoadProcessTable(EvalContext *ctx, Item **procdata);
+void ClearProcessTable(void);
 
 Item *SelectProcesses(EvalContext *ctx, const Item *processes, const char *process_name, ProcessSelect a, bool attrselect);
 bool IsProcessNameRunning(EvalContext *ctx, char *procNameRegex);
@@ -0,0 +1,370 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#include <profiler.h>
+
+#include <alloc.h>
+#include <map.h>
+#include <sequence.h>
+#include <json.h>
+#include <writer.h>
+#include <string_lib.h>
+#include <logging.h>
+#include <policy.h>
+
+/* Deeper frames are counted but not timed, longer names are truncated */
+#define PROFILE_MAX_DEPTH 256
+#define PROFILE_MAX_NAME 256
+
+/* Reading the CPU clock is a system call, so the frequent function and
+ * expansion frames only measure wall time */
+#define PROFILE_CPU_TIMED(type) ((type) <= PROFILE_FRAME_PROMISE)
+
+typedef struct ProfileNode_ ProfileNode;
+
+struct ProfileNode_
+{
+    ProfileFrameType type;
+    char *name;
+    char *label;                /* name as a flamegraph frame */
+    uint64_t count;
+    uint64_t wall_ns;
+    uint64_t cpu_ns;
+    Map *index;                 /* type and name -> child */
+    Seq *children;              /* in the order first entered */
+};
+
+typedef struct
+{
+    ProfileNode *node;
+    uint64_t wall_start;
+    uint64_t cpu_start;
+} ProfileFrame;
+
+static const char *const PROFILE_FRAME_TYPES[] =
+{
+    [PROFILE_FRAME_BUNDLE] = "bundle",
+    [PROFILE_FRAME_PROMISE_TYPE] = "promise_type",
+    [PROFILE_FRAME_PROMISE] = "promise",
+    [PROFILE_FRAME_FUNCTION] = "function",
+    [PROFILE_FRAME_EXPANSION] = "expansion",
+};
+
+static bool PROFILE_ENABLED = false;
+static pthread_t PROFILE_THREAD;
+static ProfileNode *PROFILE_ROOT = NULL;
+static ProfileFrame PROFILE_STACK[PROFILE_MAX_DEPTH];
+static size_t PROFILE_DEPTH = 0;
+
+/*******************************************************************/
+
+static uint64_t ClockNs(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static ProfileNode *ProfileNodeNew(ProfileFrameType type, const char *name)
+{
+    ProfileNode *node = xcalloc(1, sizeof(ProfileNode));
+    node->type = type;
+    node->name = xstrdup(name);
+
+    switch (type)
+    {
+    case PROFILE_FRAME_FUNCTION:
+        node->label = StringFormat("%s()", name);
+        break;
+    case PROFILE_FRAME_EXPANSION:
+        node->label = xstrdup("(expansion)");
+        break;
+    default:
+        node->label = xstrdup(name);
+        break;
+    }
+
+    /* The folded format has one stack per line, frames separated by ';' */
+    for (char *sp = node->label; *sp != '\0'; sp++)
+    {
+        if ((*sp == ';') || (*sp == '\n') || (*sp == '\r'))
+        {
+            *sp = '_';
+        }
+    }
+
+    return node;
+}
+
+static void ProfileNodeDestroy(ProfileNode *node)
+{
+    if (node)
+    {
+        MapDestroy(node->index);
+        SeqDestroy(node->children);
+        free(node->name);
+        free(node->label);
+        free(node);
+    }
+}
+
+static ProfileNode *ProfileNodeChild(ProfileNode *parent, ProfileFrameType type, const char *name)
+{
+    char key[PROFILE_MAX_NAME + 2];
+    key[0] = 'a' + type;
+    strlcpy(key + 1, name ? name : "", sizeof(key) - 1);
+
+    if (parent->index == NULL)
+    {
+        parent->index = MapNew((MapHashFn) StringHash, (MapKeyEqualFn) StringSafeEqual, free, NULL);
+        parent->children = SeqNew(4, ProfileNodeDestroy);
+    }
+
+    ProfileNode *child = MapGet(parent->index, key);
+    if (child == NULL)
+    {
+        child = ProfileNodeNew(type, key + 1);
+        MapInsert(parent->index, xstrdup(key), child);
+        SeqAppend(parent->children, child);
+    }
+
+    return child;
+}
+
+/* Wall time spent in frames of the given type below node, outermost ones only */
+static uint64_t ProfileNodeTimeIn(const ProfileNode *node, ProfileFrameType type)
+{
+    uint64_t total = 0;
+
+    for (size_t i = 0; (node->children != NULL) && (i < SeqLength(node->children)); i++)
+    {
+        const ProfileNode *child = SeqAt(node->children, i);
+        total += (child->type == type) ? child->wall_ns : ProfileNodeTimeIn(child, type);
+    }
+
+    return total;
+}
+
+/*******************************************************************/
+
+void ProfilerEnable(void)
+{
+    ProfilerReset();
+
+    PROFILE_ROOT = ProfileNodeNew(PROFILE_FRAME_BUNDLE, "");
+    PROFILE_STACK[0] = (ProfileFrame) {
+        .node = PROFILE_ROOT,
+        .wall_start = ClockNs(CLOCK_MONOTONIC),
+        .cpu_start = ClockNs(CLOCK_PROCESS_CPUTIME_ID),
+    };
+    PROFILE_THREAD = pthread_self();
+    PROFILE_ENABLED = true;
+}
+
+bool ProfilerIsEnabled(void)
+{
+    return PROFILE_ENABLED;
+}
+
+void ProfilerReset(void)
+{
+    PROFILE_ENABLED = false;
+    PROFILE_DEPTH = 0;
+    ProfileNodeDestroy(PROFILE_ROOT);
+    PROFILE_ROOT = NULL;
+}
+
+void ProfilerEnter(ProfileFrameType type, const char *name)
+{
+    if (!PROFILE_ENABLED || !pthread_equal(pthread_self(), PROFILE_THREAD))
+    {
+        return;
+    }
+
+    if (PROFILE_DEPTH + 1 >= PROFILE_MAX_DEPTH)
+    {
+        PROFILE_DEPTH++;
+        return;
+    }
+
+    ProfileNode *parent = PROFILE_STACK[PROFILE_DEPTH].node;
+    ProfileFrame *frame = &PROFILE_STACK[++PROFILE_DEPTH];
+
+    frame->node = ProfileNodeChild(parent, type, name);
+    frame->cpu_start = PROFILE_CPU_TIMED(type) ? ClockNs(CLOCK_PROCESS_CPUTIME_ID) : 0;
+    frame->wall_start = ClockNs(CLOCK_MONOTONIC);
+}
+
+void ProfilerEnterBundle(const Bundle *bp)
+{
+    if (PROFILE_ENABLED)
+    {
+        char *name = BundleQualifiedName(bp);
+        ProfilerEnter(PROFILE_FRAME_BUNDLE, name);
+        free(name);
+    }
+}
+
+void ProfilerLeave(void)
+{
+    if (!PROFILE_ENABLED || !pthread_equal(pthread_self(), PROFILE_THREAD) || (PROFILE_DEPTH == 0))
+    {
+        return;
+    }
+
+    if (PROFILE_DEPTH >= PROFILE_MAX_DEPTH)
+    {
+        PROFILE_DEPTH--;
+        return;
+    }
+
+    ProfileFrame *frame = &PROFILE_STACK[PROFILE_DEPTH--];
+
+    frame->node->wall_ns += ClockNs(CLOCK_MONOTONIC) - frame->wall_start;
+    if (PROFILE_CPU_TIMED(frame->node->type))
+    {
+        frame->node->cpu_ns += ClockNs(CLOCK_PROCESS_CPUTIME_ID) - frame->cpu_start;
+    }
+    frame->node->count++;
+}
+
+/*******************************************************************/
+
+static JsonElement *ProfileNodeToJson(const ProfileNode *node)
+{
+    JsonElement *json = JsonObjectCreate(8);
+
+    if (node != PROFILE_ROOT)
+    {
+        JsonObjectAppendString(json, "type", PROFILE_FRAME_TYPES[node->type]);
+        if (node->type != PROFILE_FRAME_EXPANSION)
+        {
+            JsonObjectAppendString(json, "name", node->name);
+        }
+        JsonObjectAppendInteger(json, "count", node->count);
+    }
+
+    JsonObjectAppendReal(json, "wall_ms", node->wall_ns / 1e6);
+    if (PROFILE_CPU_TIMED(node->type))
+    {
+        JsonObjectAppendReal(json, "cpu_ms", node->cpu_ns / 1e6);
+    }
+    JsonObjectAppendReal(json, "function_ms", ProfileNodeTimeIn(node, PROFILE_FRAME_FUNCTION) / 1e6);
+    JsonObjectAppendReal(json, "expansion_ms", ProfileNodeTimeIn(node, PROFILE_FRAME_EXPANSION) / 1e6);
+
+    if (node->children)
+    {
+        JsonElement *children = JsonArrayCreate(SeqLength(node->children));
+        for (size_t i = 0; i < SeqLength(node->children); i++)
+        {
+            JsonArrayAppendObject(children, ProfileNodeToJson(SeqAt(node->children, i)));
+        }
+        JsonObjectAppendArray(json, "children", children);
+    }
+
+    return json;
+}
+
+/* One line per call path with the wall time spent in it but not below it, in us */
+static void ProfileNodeWriteFolded(Writer *writer, const ProfileNode *node, Seq *path)
+{
+    uint64_t self_ns = node->wall_ns;
+
+    for (size_t i = 0; (node->children != NULL) && (i < SeqLength(node->children)); i++)
+    {
+        const ProfileNode *child = SeqAt(node->children, i);
+        self_ns -= MIN(self_ns, child->wall_ns);
+    }
+
+    if ((SeqLength(path) > 0) && (self_ns >= 1000))
+    {
+        for (size_t i = 0; i < SeqLength(path); i++)
+        {
+            WriterWriteF(writer, "%s%s", (i == 0) ? "" : ";", (const char *) SeqAt(path, i));
+        }
+        WriterWriteF(writer, " %ju\n", (uintmax_t) (self_ns / 1000));
+    }
+
+    for (size_t i = 0; (node->children != NULL) && (i < SeqLength(node->children)); i++)
+    {
+        const ProfileNode *child = SeqAt(node->children, i);
+        SeqAppend(path, child->label);
+        ProfileNodeWriteFolded(writer, child, path);
+        SeqRemove(path, SeqLength(path) - 1);
+    }
+}
+
+static bool WriteProfileFile(const char *path, const ProfileNode *root, bool folded)
+{
+    FILE *fout = fopen(path, "w");
+
+    if (fout == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Cannot open profile '%s' for writing. (fopen: %s)", path, GetErrorStr());
+        return false;
+    }
+
+    Writer *writer = FileWriter(fout);
+
+    if (folded)
+    {
+        Seq *stack = SeqNew(16, NULL);
+        ProfileNodeWriteFolded(writer, root, stack);
+        SeqDestroy(stack);
+    }
+    else
+    {
+        JsonElement *json = ProfileNodeToJson(root);
+        JsonWrite(writer, json, 0);
+        WriterWrite(writer, "\n");
+        JsonDestroy(json);
+    }
+
+    WriterClose(writer);
+    return true;
+}
+
+bool ProfilerWrite(const char *path_prefix)
+{
+    if (PROFILE_ROOT == NULL)
+    {
+        return false;
+    }
+
+    /* The run so far, without closing it */
+    PROFILE_ROOT->wall_ns = ClockNs(CLOCK_MONOTONIC) - PROFILE_STACK[0].wall_start;
+    PROFILE_ROOT->cpu_ns = ClockNs(CLOCK_PROCESS_CPUTIME_ID) - PROFILE_STACK[0].cpu_start;
+
+    char path[CF_BUFSIZE];
+    bool ok = true;
+
+    snprintf(path, sizeof(path), "%s.json", path_prefix);
+    ok = WriteProfileFile(path, PROFILE_ROOT, false) && ok;
+
+    snprintf(path, sizeof(path), "%s.folded", path_prefix);
+    ok = WriteProfileFile(path, PROFILE_ROOT, true) && ok;
+
+    return ok;
+}
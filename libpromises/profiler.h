@@ -0,0 +1,81 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+
+#ifndef CFENGINE_PROFILER_H
+#define CFENGINE_PROFILER_H
+
+#include <cf3.defs.h>
+
+/*
+ * Promise level profiler for cf-agent --profile. Evaluation enters and leaves
+ * frames for bundles, promise types, promises, function calls and expansion;
+ * the time spent in each is summed per call path, which is a tree rooted at
+ * the whole run. Bundles, promise types and promises also get the CPU time
+ * of the agent process, which leaves out the commands it runs. Nothing is
+ * recorded unless ProfilerEnable() was called, and only the thread that
+ * called it is followed.
+ */
+
+typedef enum
+{
+    PROFILE_FRAME_BUNDLE,
+    PROFILE_FRAME_PROMISE_TYPE,
+    PROFILE_FRAME_PROMISE,
+    PROFILE_FRAME_FUNCTION,
+    PROFILE_FRAME_EXPANSION,
+} ProfileFrameType;
+
+void ProfilerEnable(void);
+bool ProfilerIsEnabled(void);
+
+/**
+ * @brief Start timing a frame under the current one
+ * @param name Bundle, promise type, promiser or function name, NULL for expansion
+ */
+void ProfilerEnter(ProfileFrameType type, const char *name);
+
+/**
+ * @brief ProfilerEnter() for a bundle, named with its namespace
+ */
+void ProfilerEnterBundle(const Bundle *bp);
+
+/**
+ * @brief Stop timing the frame last entered
+ */
+void ProfilerLeave(void);
+
+/**
+ * @brief Write the profile as JSON and as folded stacks for flamegraph.pl
+ * @param path_prefix Written to path_prefix.json and path_prefix.folded
+ * @return false if either file could not be written
+ */
+bool ProfilerWrite(const char *path_prefix);
+
+/**
+ * @brief Forget what was recorded and stop recording
+ */
+void ProfilerReset(void);
+
+#endif
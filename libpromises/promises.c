@@ -40,44 +40,19 @@ static void DereferenceComment(Promise *pp);
 
 /*****************************************************************************/
 
-static Body *IsBody(Seq *bodies, const char *ns, const char *name)
+static Body *IsBody(const Policy *policy, const char *ns, const char *name)
 {
-    if (!ns)
+    if (!policy)
     {
-        ns = "default";
+        return NULL;
     }
 
-    for (size_t i = 0; i < SeqLength(bodies); i++)
-    {
-        Body *bp = SeqAt(bodies, i);
-
-        if (strcmp(bp->ns, ns) == 0 && strcmp(bp->name, name) == 0)
-        {
-            return bp;
-        }
-    }
-
-    return NULL;
+    return PolicyGetBody(policy, ns ? ns : NamespaceDefault(), NULL, name);
 }
 
-static Bundle *IsBundle(Seq *bundles, const char *ns, const char *name)
+static Bundle *IsBundle(const Policy *policy, const char *ns, const char *name)
 {
-    if (!ns)
-    {
-        ns = "default";
-    }
-
-    for (size_t i = 0; i < SeqLength(bundles); i++)
-    {
-        Bundle *bp = SeqAt(bundles, i);
-
-        if (strcmp(bp->ns, ns) == 0 && strcmp(bp->name, name) == 0)
-        {
-            return bp;
-        }
-    }
-
-    return NULL;
+    return PolicyGetBundle(policy, ns ? ns : NamespaceDefault(), NULL, name);
 }
 
 Promise *DeRefCopyPromise(EvalContext *ctx, const Promise *pp)
@@ -133,7 +108,6 @@ Promise *DeRefCopyPromise(EvalContext *ctx, const Promise *pp)
 
         /* A body template reference could look like a scalar or fn to the parser w/w () */
         Policy *policy = PolicyFromPromise(pp);
-        Seq *bodies = policy ? policy->bodies : NULL;
 
         char body_ns[CF_MAXVARSIZE] = "";
         char body_name[CF_MAXVARSIZE] = "";
@@ -148,7 +122,7 @@ Promise *DeRefCopyPromise(EvalContext *ctx, const Promise *pp)
                 {
                     strncpy(body_ns, PromiseGetNamespace(pp), CF_MAXVARSIZE);
                 }
-                bp = IsBody(bodies, body_ns, body_name);
+                bp = IsBody(policy, body_ns, body_name);
             }
             fp = NULL;
             break;
@@ -159,7 +133,7 @@ Promise *DeRefCopyPromise(EvalContext *ctx, const Promise *pp)
             {
                 strncpy(body_ns, PromiseGetNamespace(pp), CF_MAXVARSIZE);
             }
-            bp = IsBody(bodies, body_ns, body_name);
+            bp = IsBody(policy, body_ns, body_name);
             break;
         default:
             bp = NULL;
@@ -246,7 +220,7 @@ Promise *DeRefCopyPromise(EvalContext *ctx, const Promise *pp)
         {
             Policy *policy = PolicyFromPromise(pp);
 
-            if (cp->references_body && !IsBundle(policy->bundles, EmptyString(body_ns) ? NULL : body_ns, body_name))
+            if (cp->references_body && !IsBundle(policy, EmptyString(body_ns) ? NULL : body_ns, body_name))
             {
                 Log(LOG_LEVEL_ERR,
                       "Apparent body \"%s()\" was undeclared, but used in a promise near line %zu of %s (possible unquoted literal value)",
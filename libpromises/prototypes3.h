@@ -47,6 +47,7 @@ int ScheduleAgentOperations(EvalContext *ctx, Bundle *bp);
 
 void ConnectionsInit(void);
 void ConnectionsCleanup(void);
+void ConnectionsFlushCache(void);
 
 /* client_protocol.c */
 
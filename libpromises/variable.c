@@ -1,18 +1,24 @@
 #include <variable.h>
 
 #include <alloc.h>
-#include <rb-tree.h>
+#include <map.h>
+#include <sequence.h>
 #include <rlist.h>
 
+/*
+ * Variables are keyed on their own VarRef. The precomputed VarRef hash picks
+ * the bucket, but lookups always compare the full reference, so two names
+ * with the same hash can never shadow each other.
+ */
 struct VariableTable_
 {
-    RBTree *vars;
+    Map *vars;
 };
 
 struct VariableTableIterator_
 {
     VarRef *ref;
-    RBTreeIterator *iter;
+    MapIterator iter;
 };
 
 void VariableDestroy(Variable *var)
@@ -27,12 +33,26 @@ void VariableDestroy(Variable *var)
     }
 }
 
+static unsigned int VarRefKeyHash(const void *key, ARG_UNUSED unsigned int seed, unsigned int max)
+{
+    return ((const VarRef *)key)->hash % max;
+}
+
+static bool VarRefKeyEqual(const void *a, const void *b)
+{
+    const VarRef *ref_a = a;
+    const VarRef *ref_b = b;
+
+    return ref_a->hash == ref_b->hash && VarRefCompare(ref_a, ref_b) == 0;
+}
+
 VariableTable *VariableTableNew(void)
 {
     VariableTable *table = xmalloc(sizeof(VariableTable));
 
-    table->vars = RBTreeNew(NULL, NULL, NULL,
-                            NULL, NULL, (RBTreeValueDestroyFn*)VariableDestroy);
+    /* the key is the VarRef owned by the Variable, destroyed along with it */
+    table->vars = MapNew(VarRefKeyHash, VarRefKeyEqual,
+                         NULL, (MapDestroyDataFn)VariableDestroy);
 
     return table;
 }
@@ -41,19 +61,19 @@ void VariableTableDestroy(VariableTable *table)
 {
     if (table)
     {
-        RBTreeDestroy(table->vars);
+        MapDestroy(table->vars);
         free(table);
     }
 }
 
 Variable *VariableTableGet(const VariableTable *table, const VarRef *ref)
 {
-    return RBTreeGet(table->vars, (void *)ref->hash);
+    return MapGet(table->vars, ref);
 }
 
 bool VariableTableRemove(VariableTable *table, const VarRef *ref)
 {
-    return RBTreeRemove(table->vars, (void *)ref->hash);
+    return MapRemove(table->vars, ref);
 }
 
 static Variable *VariableNew(VarRef *ref, Rval rval, DataType type)
@@ -83,7 +103,8 @@ bool VariableTablePut(VariableTable *table, const VarRef *ref, const Rval *rval,
     else
     {
         var = VariableNew(VarRefCopy(ref), RvalCopy(*rval), type);
-        return RBTreePut(table->vars, (void *)var->ref->hash, var);
+        MapInsert(table->vars, var->ref, var);
+        return false;
     }
 }
 
@@ -91,46 +112,39 @@ bool VariableTableClear(VariableTable *table, const char *ns, const char *scope,
 {
     if (!ns && !scope && !lval)
     {
-        bool has_vars = RBTreeSize(table->vars) > 0;
-        RBTreeClear(table->vars);
+        bool has_vars = MapSize(table->vars) > 0;
+        MapClear(table->vars);
         return has_vars;
     }
 
-    RBTree *remove_set = RBTreeNew(NULL, NULL, NULL, NULL, NULL, NULL);
+    Seq *remove_set = SeqNew(100, NULL);
 
     {
         VariableTableIterator *iter = VariableTableIteratorNew(table, ns, scope, lval);
         for (Variable *v = VariableTableIteratorNext(iter); v; v = VariableTableIteratorNext(iter))
         {
-            RBTreePut(remove_set, (void *)v->ref->hash, v);
+            SeqAppend(remove_set, v->ref);
         }
         VariableTableIteratorDestroy(iter);
     }
 
-    size_t remove_count = RBTreeSize(remove_set);
+    size_t remove_count = SeqLength(remove_set);
     if (remove_count == 0)
     {
-        RBTreeDestroy(remove_set);
+        SeqDestroy(remove_set);
         return false;
     }
 
     size_t removed = 0;
-
+    for (size_t i = 0; i < remove_count; i++)
     {
-        RBTreeIterator *iter = RBTreeIteratorNew(remove_set);
-        void *ref_key = NULL;
-        Variable *var = NULL;
-        while (RBTreeIteratorNext(iter, &ref_key, (void **)&var))
+        if (VariableTableRemove(table, SeqAt(remove_set, i)))
         {
-            if (VariableTableRemove(table, var->ref))
-            {
-                removed++;
-            }
+            removed++;
         }
-        RBTreeIteratorDestroy(iter);
     }
 
-    RBTreeDestroy(remove_set);
+    SeqDestroy(remove_set);
     assert(removed == remove_count);
     return true;
 }
@@ -139,7 +153,7 @@ size_t VariableTableCount(const VariableTable *table, const char *ns, const char
 {
     if (!ns && !scope && !lval)
     {
-        return RBTreeSize(table->vars);
+        return MapSize(table->vars);
     }
 
     VariableTableIterator *iter = VariableTableIteratorNew(table, ns, scope, lval);
@@ -157,7 +171,7 @@ VariableTableIterator *VariableTableIteratorNewFromVarRef(const VariableTable *t
     VariableTableIterator *iter = xmalloc(sizeof(VariableTableIterator));
 
     iter->ref = VarRefCopy(ref);
-    iter->iter = RBTreeIteratorNew(table->vars);
+    iter->iter = MapIteratorInit(table->vars);
 
     return iter;
 }
@@ -174,11 +188,11 @@ VariableTableIterator *VariableTableIteratorNew(const VariableTable *table, cons
 
 Variable *VariableTableIteratorNext(VariableTableIterator *iter)
 {
-    void *key_ref = NULL;
-    Variable *var = NULL;
+    MapKeyValue *item = NULL;
 
-    while (RBTreeIteratorNext(iter->iter, &key_ref, (void **)&var))
+    while ((item = MapIteratorNext(&iter->iter)))
     {
+        Variable *var = item->value;
         const char *key_ns = var->ref->ns ? var->ref->ns : "default";
 
         if (iter->ref->ns && strcmp(key_ns, iter->ref->ns) != 0)
@@ -230,7 +244,6 @@ void VariableTableIteratorDestroy(VariableTableIterator *iter)
     if (iter)
     {
         VarRefDestroy(iter->ref);
-        RBTreeIteratorDestroy(iter->iter);
         free(iter);
     }
 }
@@ -244,7 +257,7 @@ VariableTable *VariableTableCopyLocalized(const VariableTable *table, const char
     while ((foreign_var = VariableTableIteratorNext(iter)))
     {
         Variable *localized_var = VariableNew(VarRefCopyLocalized(foreign_var->ref), RvalCopy(foreign_var->rval), foreign_var->type);
-        RBTreePut(localized_copy->vars, (void *)localized_var->ref->hash, localized_var);
+        MapInsert(localized_copy->vars, localized_var->ref, localized_var);
     }
     VariableTableIteratorDestroy(iter);
 
@@ -431,7 +431,6 @@ static int CompareRval(Rval rval1, Rval rval2)
 static bool Epimenides(EvalContext *ctx, const char *ns, const char *scope, const char *var, Rval rval, int level)
 {
     Rlist *rp, *list;
-    char exp[CF_EXPANDSIZE];
 
     switch (rval.type)
     {
@@ -445,19 +444,19 @@ static bool Epimenides(EvalContext *ctx, const char *ns, const char *scope, cons
 
         if (IsCf3VarString(rval.item))
         {
+            Buffer *exp = BufferNew();
             ExpandScalar(ctx, ns, scope, rval.item, exp);
 
-            if (strcmp(exp, (const char *) rval.item) == 0)
+            if (strcmp(BufferData(exp), (const char *) rval.item) == 0 || level > 3)
             {
+                BufferDestroy(&exp);
                 return false;
             }
 
-            if (level > 3)
-            {
-                return false;
-            }
+            bool contains_itself = Epimenides(ctx, ns, scope, var, (Rval) {(char *) BufferData(exp), RVAL_TYPE_SCALAR}, level + 1);
+            BufferDestroy(&exp);
 
-            if (Epimenides(ctx, ns, scope, var, (Rval) {exp, RVAL_TYPE_SCALAR}, level + 1))
+            if (contains_itself)
             {
                 return true;
             }
@@ -505,25 +505,24 @@ int BufferAppend(Buffer *buffer, const char *bytes, unsigned int length)
      */
     if (buffer->used + length >= buffer->capacity)
     {
+        /*
+         * Grow at least twice the current capacity, so that building up a buffer
+         * with many small appends stays linear.
+         */
         unsigned int required_blocks = ((buffer->used + length)/ DEFAULT_BUFFER_SIZE) + 1;
-        buffer->buffer = (char *)xrealloc(buffer->buffer, required_blocks * DEFAULT_BUFFER_SIZE);
-        buffer->capacity = required_blocks * DEFAULT_BUFFER_SIZE;
+        unsigned int capacity = required_blocks * DEFAULT_BUFFER_SIZE;
+        if (capacity < 2 * buffer->capacity)
+        {
+            capacity = 2 * buffer->capacity;
+        }
+        buffer->buffer = (char *)xrealloc(buffer->buffer, capacity);
+        buffer->capacity = capacity;
     }
     /*
      * We have a buffer that is large enough, copy the data.
      */
-    unsigned int c = 0;
-    unsigned int total = 0;
-    for (c = 0; c < length; ++c)
-    {
-        buffer->buffer[c + buffer->used] = bytes[c];
-        if ((bytes[c] == '\0') && (buffer->mode = BUFFER_BEHAVIOR_CSTRING))
-        {
-            break;
-        }
-        ++total;
-    }
-    buffer->used += total;
+    memcpy(buffer->buffer + buffer->used, bytes, length);
+    buffer->used += length;
     if (buffer->mode == BUFFER_BEHAVIOR_CSTRING)
     {
         buffer->buffer[buffer->used] = '\0';
@@ -117,8 +117,8 @@ int BufferCompare(Buffer *buffer1, Buffer *buffer2);
 /**
   @brief Replaces the current content of the buffer with the given string.
 
-  In CString mode the content of bytes is copied until length bytes have been copied or a '\0' is found, whatever
-  happens first. In ByteArray mode length bytes are copied regardless of if there are '\0' or not.
+  In both modes length bytes are copied, '\0' included. In CString mode a '\0' is then added after them, so length
+  should not count the terminator of a string.
   @note The content of the buffer are overwritten with the new content, it is not possible to access them afterwards.
   @note For complex data it is preferable to use Printf since that will make sure that all data is represented properly.
   @note The data will be preserved if this operation fails, although it might be in a detached state.
@@ -131,9 +131,8 @@ int BufferSet(Buffer *buffer, char *bytes, unsigned int length);
 /**
   @brief Appends the collection of bytes at the end of the current buffer.
 
-  As with BufferSet(Buffer *buffer, char *bytes, unsigned int length), CString mode appends until a '\0' is found or up to
-  the specified length. The data is NULL terminated. In ByteArray mode length bytes are copied and '\0' are not taken into
-  account.
+  As with BufferSet(Buffer *buffer, char *bytes, unsigned int length), length bytes are appended in both modes, '\0'
+  included. In CString mode the data is then NULL terminated, so length should not count the terminator of a string.
   @note There is a big difference between CString mode and ByteArray mode. In CString mode the final '\0' character will be
   overwritten and replaced with the content. In ByteArray mode there is no '\0', and therefore the last character is not replaced.
   @note The data will be preserved if this operation fails, although it might be in a detached state.
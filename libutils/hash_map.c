@@ -22,12 +22,42 @@
   included file COSL.txt.
 */
 
+
 #include <platform.h>
 #include <hash_map_priv.h>
 #include <alloc.h>
 
-/* FIXME: make configurable and move to map.c */
-#define HASHMAP_BUCKETS 8192
+/*
+ * Map only turns into a HashMap once it holds more items than fit in an
+ * ArrayMap, so start with room for those without growing.
+ */
+#define HASHMAP_INITIAL_SIZE 32
+
+/*
+ * Hash functions reduce the hash to [0, max). The full value is kept in the
+ * slot, so that resizing does not call hash_fn again and most mismatches are
+ * found without calling equal_fn. Hash functions either mask or take the
+ * modulo of max, either way a power of two keeps every bit they produce.
+ */
+#define HASHMAP_HASH_MAX (1U << 31)
+
+/*
+ * Linear probing stays fast as long as the table is at most 3/4 full.
+ */
+#define HASHMAP_MAX_LOAD(size) ((size) / 4 * 3)
+
+static void HashMapSetSize(HashMap *map, size_t size)
+{
+    map->slots = xcalloc(size, sizeof(HashMapSlot));
+    map->size = size;
+
+    map->shift = 32;
+    while (size > 1)
+    {
+        size >>= 1;
+        map->shift--;
+    }
+}
 
 HashMap *HashMapNew(MapHashFn hash_fn, MapKeyEqualFn equal_fn,
                     MapDestroyDataFn destroy_key_fn,
@@ -38,105 +68,145 @@ HashMap *HashMapNew(MapHashFn hash_fn, MapKeyEqualFn equal_fn,
     map->equal_fn = equal_fn;
     map->destroy_key_fn = destroy_key_fn;
     map->destroy_value_fn = destroy_value_fn;
-    map->buckets = xcalloc(1, sizeof(BucketListItem *) * HASHMAP_BUCKETS);
+    HashMapSetSize(map, HASHMAP_INITIAL_SIZE);
+    map->load = 0;
     return map;
 }
 
-static unsigned int HashMapGetBucket(const HashMap *map, const void *key)
+/*
+ * Fibonacci hashing: the multiplication spreads every bit of the hash into the
+ * top bits, which matters for pointer hashes whose low bits are all zero.
+ */
+static size_t HashMapHomeSlot(const HashMap *map, unsigned int hash)
 {
-    return map->hash_fn(key, 0, HASHMAP_BUCKETS);
+    return (uint32_t) (hash * 2654435769U) >> map->shift;
 }
 
-bool HashMapInsert(HashMap *map, void *key, void *value)
+static unsigned int HashMapHash(const HashMap *map, const void *key)
 {
-    unsigned bucket = HashMapGetBucket(map, key);
+    return map->hash_fn(key, 0, HASHMAP_HASH_MAX);
+}
+
+/*
+ * Returns the slot holding the key, or the empty slot ending its probe
+ * sequence.
+ */
+static HashMapSlot *HashMapFindSlot(const HashMap *map, const void *key, unsigned int hash)
+{
+    size_t mask = map->size - 1;
 
-    for (BucketListItem *i = map->buckets[bucket]; i != NULL; i = i->next)
+    for (size_t i = HashMapHomeSlot(map, hash); ; i = (i + 1) & mask)
     {
-        if (map->equal_fn(i->value.key, key))
+        HashMapSlot *slot = &map->slots[i];
+
+        if (!slot->used ||
+            (slot->hash == hash && map->equal_fn(slot->value.key, key)))
         {
-            map->destroy_key_fn(key);
-            map->destroy_value_fn(i->value.value);
-            i->value.value = value;
-            return true;
+            return slot;
         }
     }
-
-    BucketListItem *i = xcalloc(1, sizeof(BucketListItem));
-    i->value.key = key;
-    i->value.value = value;
-    i->next = map->buckets[bucket];
-    map->buckets[bucket] = i;
-
-    return false;
 }
 
-bool HashMapRemove(HashMap *map, const void *key)
+static void HashMapResize(HashMap *map, size_t new_size)
 {
-    unsigned bucket = HashMapGetBucket(map, key);
+    HashMapSlot *old_slots = map->slots;
+    size_t old_size = map->size;
 
-    /*
-     * prev points to a previous "next" pointer to rewrite it in case value need
-     * to be deleted
-     */
+    HashMapSetSize(map, new_size);
 
-    for (BucketListItem **prev = &map->buckets[bucket];
-         *prev != NULL;
-         prev = &((*prev)->next))
+    size_t mask = map->size - 1;
+    for (size_t i = 0; i < old_size; i++)
     {
-        BucketListItem *cur = *prev;
-        if (map->equal_fn(cur->value.key, key))
+        if (old_slots[i].used)
         {
-            map->destroy_key_fn(cur->value.key);
-            map->destroy_value_fn(cur->value.value);
-            *prev = cur->next;
-            free(cur);
-            return true;
+            size_t j = HashMapHomeSlot(map, old_slots[i].hash);
+            while (map->slots[j].used)
+            {
+                j = (j + 1) & mask;
+            }
+            map->slots[j] = old_slots[i];
         }
     }
 
-    return false;
+    free(old_slots);
 }
 
-MapKeyValue *HashMapGet(const HashMap *map, const void *key)
+bool HashMapInsert(HashMap *map, void *key, void *value)
 {
-    unsigned bucket = HashMapGetBucket(map, key);
+    unsigned int hash = HashMapHash(map, key);
+    HashMapSlot *slot = HashMapFindSlot(map, key, hash);
 
-    for (BucketListItem *cur = map->buckets[bucket];
-         cur != NULL;
-         cur = cur->next)
+    if (slot->used)
     {
-        if (map->equal_fn(cur->value.key, key))
-        {
-            return &cur->value;
-        }
+        map->destroy_key_fn(key);
+        map->destroy_value_fn(slot->value.value);
+        slot->value.value = value;
+        return true;
     }
 
-    return NULL;
+    *slot = (HashMapSlot) { { key, value }, hash, true };
+
+    if (++map->load > HASHMAP_MAX_LOAD(map->size))
+    {
+        HashMapResize(map, map->size * 2);
+    }
+
+    return false;
 }
 
-static void FreeBucketListItem(HashMap *map, BucketListItem *item)
+bool HashMapRemove(HashMap *map, const void *key)
 {
-    if (item->next)
+    HashMapSlot *slot = HashMapFindSlot(map, key, HashMapHash(map, key));
+
+    if (!slot->used)
     {
-        FreeBucketListItem(map, item->next);
+        return false;
     }
 
-    map->destroy_key_fn(item->value.key);
-    map->destroy_value_fn(item->value.value);
-    free(item);
+    map->destroy_key_fn(slot->value.key);
+    map->destroy_value_fn(slot->value.value);
+    map->load--;
+
+    /*
+     * No tombstones: move back the following items of the probe run that
+     * may not be found past the hole otherwise.
+     */
+    size_t mask = map->size - 1;
+    size_t hole = slot - map->slots;
+
+    for (size_t i = (hole + 1) & mask; map->slots[i].used; i = (i + 1) & mask)
+    {
+        size_t home = HashMapHomeSlot(map, map->slots[i].hash);
+
+        if (((i - home) & mask) >= ((i - hole) & mask))
+        {
+            map->slots[hole] = map->slots[i];
+            hole = i;
+        }
+    }
+
+    map->slots[hole].used = false;
+    return true;
+}
+
+MapKeyValue *HashMapGet(const HashMap *map, const void *key)
+{
+    HashMapSlot *slot = HashMapFindSlot(map, key, HashMapHash(map, key));
+    return slot->used ? &slot->value : NULL;
 }
 
 void HashMapClear(HashMap *map)
 {
-    for (int i = 0; i < HASHMAP_BUCKETS; ++i)
+    for (size_t i = 0; i < map->size; ++i)
     {
-        if (map->buckets[i])
+        if (map->slots[i].used)
         {
-            FreeBucketListItem(map, map->buckets[i]);
+            map->destroy_key_fn(map->slots[i].value.key);
+            map->destroy_value_fn(map->slots[i].value.value);
+            map->slots[i].used = false;
         }
-        map->buckets[i] = NULL;
     }
+    map->load = 0;
 }
 
 void HashMapDestroy(HashMap *map)
@@ -144,7 +214,7 @@ void HashMapDestroy(HashMap *map)
     if (map)
     {
         HashMapClear(map);
-        free(map->buckets);
+        free(map->slots);
         free(map);
     }
 }
@@ -153,22 +223,19 @@ void HashMapDestroy(HashMap *map)
 
 HashMapIterator HashMapIteratorInit(HashMap *map)
 {
-    return (HashMapIterator) { map, map->buckets[0], 0 };
+    return (HashMapIterator) { map, 0 };
 }
 
 MapKeyValue *HashMapIteratorNext(HashMapIterator *i)
 {
-    while (i->cur == NULL)
+    while (i->pos < i->map->size)
     {
-        if (++i->bucket >= HASHMAP_BUCKETS)
+        HashMapSlot *slot = &i->map->slots[i->pos++];
+        if (slot->used)
         {
-            return NULL;
+            return &slot->value;
         }
-
-        i->cur = i->map->buckets[i->bucket];
     }
 
-    MapKeyValue *ret = &i->cur->value;
-    i->cur = i->cur->next;
-    return ret;
+    return NULL;
 }
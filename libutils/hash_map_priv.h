@@ -27,11 +27,17 @@
 
 #include <map_common.h>
 
-typedef struct BucketListItem_
+/*
+ * Slots hold the key/value pairs themselves: lookups probe consecutive slots
+ * (linear probing) instead of following a chain of separately allocated
+ * nodes.
+ */
+typedef struct
 {
     MapKeyValue value;
-    struct BucketListItem_ *next;
-} BucketListItem;
+    unsigned int hash;          /* hash_fn(key, 0, HASHMAP_HASH_MAX) */
+    bool used;
+} HashMapSlot;
 
 typedef unsigned int (*MapHashFn) (const void *p, unsigned int seed, unsigned int max);
 
@@ -41,14 +47,16 @@ typedef struct
     MapKeyEqualFn equal_fn;
     MapDestroyDataFn destroy_key_fn;
     MapDestroyDataFn destroy_value_fn;
-    BucketListItem **buckets;
+    HashMapSlot *slots;
+    size_t size;   /* number of slots, a power of two */
+    size_t load;   /* number of stored items */
+    unsigned int shift; /* 32 - log2(size), see HashMapHomeSlot() */
 } HashMap;
 
 typedef struct
 {
     HashMap *map;
-    BucketListItem *cur;
-    int bucket;
+    size_t pos;
 } HashMapIterator;
 
 HashMap *HashMapNew(MapHashFn hash_fn, MapKeyEqualFn equal_fn,
@@ -63,6 +71,10 @@ void HashMapDestroy(HashMap *map);
 
 /******************************************************************************/
 
+/*
+ * The map must not be modified while it is being iterated: removing an item
+ * moves other items between slots.
+ */
 HashMapIterator HashMapIteratorInit(HashMap *m);
 MapKeyValue *HashMapIteratorNext(HashMapIterator *i);
 
@@ -25,13 +25,17 @@
 
 #include <alloc.h>
 #include <sequence.h>
+#include <map.h>
 #include <string_lib.h>
 
 #include <json.h>
 
 
 static const int SPACES_PER_INDENT = 2;
-static const int DEFAULT_CONTAINER_CAPACITY = 64;
+/* Parsed containers grow as needed, most of them stay small */
+static const int DEFAULT_CONTAINER_CAPACITY = 8;
+/* Objects with at least this many properties get a hash index on lookup */
+static const size_t OBJECT_INDEX_THRESHOLD = 16;
 
 static const char *JSON_TRUE = "true";
 static const char *JSON_FALSE = "false";
@@ -47,6 +51,7 @@ struct JsonElement_
         {
             JsonContainerType type;
             Seq *children;
+            Map *index;         // objects only: property name -> child, or NULL
         } container;
         struct JsonPrimitive
         {
@@ -316,6 +321,10 @@ void JsonDestroy(JsonElement *element)
             assert(element->container.children);
             SeqDestroy(element->container.children);
             element->container.children = NULL;
+            if (element->container.index)
+            {
+                MapDestroy(element->container.index);
+            }
             break;
 
         case JSON_ELEMENT_TYPE_PRIMITIVE:
@@ -685,6 +694,11 @@ static char *JsonDecodeString(const char *encoded_string)
 {
     assert(encoded_string);
 
+    if (strchr(encoded_string, '\\') == NULL)
+    {
+        return xstrdup(encoded_string);
+    }
+
     Writer *w = StringWriter();
 
     for (const char *c = encoded_string; *c != '\0'; c++)
@@ -793,71 +807,117 @@ void JsonObjectAppendElement(JsonElement *object, const char *key, JsonElement *
 
     JsonElementSetPropertyName(element, key);
     SeqAppend(object->container.children, element);
-}
-
-static int JsonElementHasProperty(const void *propertyName, const void *jsonElement, ARG_UNUSED void *user_data)
-{
-    assert(propertyName);
-
-    const JsonElement *element = jsonElement;
 
-    assert(element->propertyName);
-
-    if (strcmp(propertyName, element->propertyName) == 0)
+    if (object->container.index)
     {
-        return 0;
+        MapInsert(object->container.index, element->propertyName, element);
     }
-    return -1;
 }
 
-static int CompareKeyToPropertyName(const void *a, const void *b, ARG_UNUSED void *user_data)
+/*
+ * Small objects are scanned. Past OBJECT_INDEX_THRESHOLD properties, the
+ * first lookup builds an index of the children by property name, which is
+ * then kept up to date as properties are added and removed. The keys are
+ * the children's own property names.
+ */
+static JsonElement *JsonObjectLookup(JsonElement *object, const char *key)
 {
-    return StringSafeCompare((char*)a, ((JsonElement*)b)->propertyName);
-}
+    Seq *children = object->container.children;
 
-static size_t JsonElementIndexInParentObject(JsonElement *parent, const char* key)
-{
-    assert(parent);
-    assert(parent->type == JSON_ELEMENT_TYPE_CONTAINER);
-    assert(parent->container.type == JSON_CONTAINER_TYPE_OBJECT);
-    assert(key);
+    if (object->container.index == NULL)
+    {
+        if (SeqLength(children) < OBJECT_INDEX_THRESHOLD)
+        {
+            for (size_t i = 0; i < SeqLength(children); i++)
+            {
+                JsonElement *child = SeqAt(children, i);
+                if (strcmp(child->propertyName, key) == 0)
+                {
+                    return child;
+                }
+            }
+            return NULL;
+        }
+
+        object->container.index = MapNew((MapHashFn) StringHash, (MapKeyEqualFn) StringSafeEqual,
+                                         NULL, NULL);
+        for (size_t i = 0; i < SeqLength(children); i++)
+        {
+            JsonElement *child = SeqAt(children, i);
+            MapInsert(object->container.index, child->propertyName, child);
+        }
+    }
 
-    return SeqIndexOf(parent->container.children, key, CompareKeyToPropertyName);
+    return MapGet(object->container.index, key);
 }
 
-bool JsonObjectRemoveKey(JsonElement *object, const char *key)
+/**
+ * Unlinks the child with the given property name, if any, from the object
+ * and its index, without destroying it. Small objects are scanned once by
+ * name. Indexed objects are only searched for a child the index has, and by
+ * pointer, from the end where replaced and merged keys usually are: the
+ * children after it are shifted down anyway.
+ */
+static JsonElement *JsonObjectUnlinkKey(JsonElement *object, const char *key)
 {
     assert(object);
     assert(object->type == JSON_ELEMENT_TYPE_CONTAINER);
     assert(object->container.type == JSON_CONTAINER_TYPE_OBJECT);
     assert(key);
 
-    size_t index = JsonElementIndexInParentObject(object, key);
-    if (index != -1)
+    Seq *children = object->container.children;
+    size_t length = SeqLength(children);
+
+    if (object->container.index == NULL && length < OBJECT_INDEX_THRESHOLD)
     {
-        SeqRemove(object->container.children, index);
-        return true;
+        for (size_t i = 0; i < length; i++)
+        {
+            JsonElement *child = SeqAt(children, i);
+            if (strcmp(child->propertyName, key) == 0)
+            {
+                SeqSoftRemove(children, i);
+                return child;
+            }
+        }
+        return NULL;
     }
-    return false;
-}
 
-JsonElement *JsonObjectDetachKey(JsonElement *object, const char *key)
-{
-    assert(object);
-    assert(object->type == JSON_ELEMENT_TYPE_CONTAINER);
-    assert(object->container.type == JSON_CONTAINER_TYPE_OBJECT);
-    assert(key);
+    JsonElement *child = JsonObjectLookup(object, key);
+    if (child == NULL)
+    {
+        return NULL;
+    }
 
-    JsonElement *detached = NULL;
+    size_t i = length;
+    while (i > 0 && SeqAt(children, i - 1) != child)
+    {
+        i--;
+    }
+    if (i == 0)
+    {
+        assert(false && "indexed property is not a child");
+        return NULL;
+    }
+
+    MapRemove(object->container.index, child->propertyName);
+    SeqSoftRemove(children, i - 1);
+    return child;
+}
 
-    size_t index = JsonElementIndexInParentObject(object, key);
-    if (index != -1)
+bool JsonObjectRemoveKey(JsonElement *object, const char *key)
+{
+    JsonElement *removed = JsonObjectUnlinkKey(object, key);
+    if (removed)
     {
-        detached = SeqLookup(object->container.children, key, JsonElementHasProperty);
-        SeqSoftRemove(object->container.children, index);
+        JsonDestroy(removed);
+        return true;
     }
+    return false;
+}
 
-    return detached;
+JsonElement *JsonObjectDetachKey(JsonElement *object, const char *key)
+{
+    return JsonObjectUnlinkKey(object, key);
 }
 
 const char *JsonObjectGetAsString(JsonElement *object, const char *key)
@@ -867,7 +927,7 @@ const char *JsonObjectGetAsString(JsonElement *object, const char *key)
     assert(object->container.type == JSON_CONTAINER_TYPE_OBJECT);
     assert(key);
 
-    JsonElement *childPrimitive = SeqLookup(object->container.children, key, JsonElementHasProperty);
+    JsonElement *childPrimitive = JsonObjectLookup(object, key);
 
     if (childPrimitive)
     {
@@ -886,7 +946,7 @@ JsonElement *JsonObjectGetAsObject(JsonElement *object, const char *key)
     assert(object->container.type == JSON_CONTAINER_TYPE_OBJECT);
     assert(key);
 
-    JsonElement *childPrimitive = SeqLookup(object->container.children, key, JsonElementHasProperty);
+    JsonElement *childPrimitive = JsonObjectLookup(object, key);
 
     if (childPrimitive)
     {
@@ -905,7 +965,7 @@ JsonElement *JsonObjectGetAsArray(JsonElement *object, const char *key)
     assert(object->container.type == JSON_CONTAINER_TYPE_OBJECT);
     assert(key);
 
-    JsonElement *childPrimitive = SeqLookup(object->container.children, key, JsonElementHasProperty);
+    JsonElement *childPrimitive = JsonObjectLookup(object, key);
 
     if (childPrimitive)
     {
@@ -924,7 +984,7 @@ JsonElement *JsonObjectGet(JsonElement *object, const char *key)
     assert(object->container.type == JSON_CONTAINER_TYPE_OBJECT);
     assert(key);
 
-    return SeqLookup(object->container.children, key, JsonElementHasProperty);
+    return JsonObjectLookup(object, key);
 }
 
 // *******************************************************************************************
@@ -1276,7 +1336,7 @@ static JsonParseError JsonParseAsObject(const char **data, JsonElement **json_ou
 
 static JsonElement *JsonParseAsBoolean(const char **data)
 {
-    if (StringMatch("^true", *data, NULL, NULL))
+    if (strncmp(*data, "true", 4) == 0)
     {
         char next = *(*data + 4);
         if (IsSeparator(next) || next == '\0')
@@ -1285,7 +1345,7 @@ static JsonElement *JsonParseAsBoolean(const char **data)
             return JsonBoolCreate(true);
         }
     }
-    else if (StringMatch("^false", *data, NULL, NULL))
+    else if (strncmp(*data, "false", 5) == 0)
     {
         char next = *(*data + 5);
         if (IsSeparator(next) || next == '\0')
@@ -1300,7 +1360,7 @@ static JsonElement *JsonParseAsBoolean(const char **data)
 
 static JsonElement *JsonParseAsNull(const char **data)
 {
-    if (StringMatch("^null", *data, NULL, NULL))
+    if (strncmp(*data, "null", 4) == 0)
     {
         char next = *(*data + 4);
         if (IsSeparator(next) || next == '\0')
@@ -1345,7 +1405,8 @@ const char* JsonParseErrorToString(JsonParseError error)
         [JSON_PARSE_ERROR_OBJECT_OPEN_LVAL] = "Unable to parse json data as object, tried to close object having opened an l-value",
 
         [JSON_PARSE_ERROR_INVALID_START] = "Unwilling to parse json data starting with invalid character",
-        [JSON_PARSE_ERROR_NO_DATA] = "No data"
+        [JSON_PARSE_ERROR_NO_DATA] = "No data",
+        [JSON_PARSE_ERROR_NO_SUCH_FILE] = "Unable to open the file"
     };
 
     assert(error < JSON_PARSE_ERROR_MAX);
@@ -1828,3 +1889,432 @@ JsonParseError JsonParse(const char **data, JsonElement **json_out)
 
     return JSON_PARSE_ERROR_NO_DATA;
 }
+
+// *******************************************************************************************
+// Streaming
+// *******************************************************************************************
+
+#define JSON_READER_BUFSIZE (64 * 1024)
+
+struct JsonReader_
+{
+    int fd;
+    size_t bytes_left;          // how much more may be read from fd
+    bool eof;
+    size_t pos;
+    size_t len;
+    char buffer[JSON_READER_BUFSIZE];
+
+    char *token;                // the last string, number or literal read
+    size_t token_len;
+    size_t token_size;
+
+    char *stack;                // '{' or '[' for each open container
+    size_t depth;
+    size_t stack_size;
+    bool started;
+
+    char *pending_key;          // property name waiting for its value
+    char *key;
+    JsonElement *value;
+};
+
+JsonReader *JsonReaderNew(int fd, size_t size_max)
+{
+    JsonReader *reader = xcalloc(1, sizeof(JsonReader));
+
+    reader->fd = fd;
+    reader->bytes_left = size_max;
+    reader->token_size = 256;
+    reader->token = xmalloc(reader->token_size);
+    reader->stack_size = 16;
+    reader->stack = xmalloc(reader->stack_size);
+
+    return reader;
+}
+
+void JsonReaderDestroy(JsonReader *reader)
+{
+    if (reader)
+    {
+        free(reader->token);
+        free(reader->stack);
+        free(reader->pending_key);
+        free(reader->key);
+        JsonDestroy(reader->value);
+        free(reader);
+    }
+}
+
+static int JsonReaderPeek(JsonReader *reader)
+{
+    if (reader->pos < reader->len)
+    {
+        return (unsigned char) reader->buffer[reader->pos];
+    }
+
+    while (!reader->eof && reader->bytes_left > 0)
+    {
+        ssize_t n = read(reader->fd, reader->buffer, MIN(sizeof(reader->buffer), reader->bytes_left));
+        if (n == -1 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (n <= 0)
+        {
+            reader->eof = true;
+            break;
+        }
+
+        reader->bytes_left -= n;
+        reader->pos = 0;
+        reader->len = n;
+        return (unsigned char) reader->buffer[0];
+    }
+
+    return EOF;
+}
+
+static void JsonReaderTokenAppend(JsonReader *reader, char ch)
+{
+    if (reader->token_len + 1 >= reader->token_size)
+    {
+        reader->token_size *= 2;
+        reader->token = xrealloc(reader->token, reader->token_size);
+    }
+
+    reader->token[reader->token_len++] = ch;
+    reader->token[reader->token_len] = '\0';
+}
+
+/* Same rules as JsonParseAsString(), the token is left undecoded */
+static JsonParseError JsonReaderString(JsonReader *reader)
+{
+    reader->token_len = 0;
+    reader->token[0] = '\0';
+    reader->pos++;
+
+    char prev = '"';
+    for (int ch = JsonReaderPeek(reader); ch != EOF; ch = JsonReaderPeek(reader))
+    {
+        reader->pos++;
+
+        if (ch == '"' && prev != '\\')
+        {
+            return JSON_PARSE_OK;
+        }
+
+        if (ch == '\\')
+        {
+            int next = JsonReaderPeek(reader);
+            if (next == '\"' || next == '\\' || next == '\b' || next == '\f' ||
+                next == '\n' || next == '\r' || next == '\t')
+            {
+                prev = ch;
+                continue;
+            }
+        }
+
+        JsonReaderTokenAppend(reader, ch);
+        prev = ch;
+    }
+
+    return JSON_PARSE_ERROR_STRING_NO_DOUBLEQUOTE_END;
+}
+
+static JsonParseError JsonReaderPrimitive(JsonReader *reader)
+{
+    int ch = JsonReaderPeek(reader);
+
+    if (ch == '"')
+    {
+        JsonParseError err = JsonReaderString(reader);
+        if (err == JSON_PARSE_OK)
+        {
+            reader->value = JsonElementCreatePrimitive(JSON_PRIMITIVE_TYPE_STRING,
+                                                       JsonDecodeString(reader->token));
+        }
+        return err;
+    }
+
+    reader->token_len = 0;
+    reader->token[0] = '\0';
+    for (; ch != EOF && !IsSeparator(ch); ch = JsonReaderPeek(reader))
+    {
+        JsonReaderTokenAppend(reader, ch);
+        reader->pos++;
+    }
+
+    if (reader->token[0] == '-' || reader->token[0] == '0' || IsDigit(reader->token[0]))
+    {
+        const char *data = reader->token;
+        return JsonParseAsNumber(&data, &reader->value);
+    }
+    else if (strcmp(reader->token, JSON_TRUE) == 0)
+    {
+        reader->value = JsonBoolCreate(true);
+    }
+    else if (strcmp(reader->token, JSON_FALSE) == 0)
+    {
+        reader->value = JsonBoolCreate(false);
+    }
+    else if (strcmp(reader->token, JSON_NULL) == 0)
+    {
+        reader->value = JsonNullCreate();
+    }
+    else
+    {
+        return JSON_PARSE_ERROR_OBJECT_BAD_SYMBOL;
+    }
+
+    return JSON_PARSE_OK;
+}
+
+static JsonEvent JsonReaderOpen(JsonReader *reader, char ch)
+{
+    if (reader->depth == reader->stack_size)
+    {
+        reader->stack_size *= 2;
+        reader->stack = xrealloc(reader->stack, reader->stack_size);
+    }
+
+    reader->stack[reader->depth++] = ch;
+    reader->started = true;
+    reader->pos++;
+
+    return (ch == '{') ? JSON_EVENT_OBJECT_START : JSON_EVENT_ARRAY_START;
+}
+
+/*
+ * Accepts the same documents as JsonParse(), and like it stops reading at the
+ * end of the top level container.
+ */
+JsonParseError JsonReaderNext(JsonReader *reader, JsonEvent *event)
+{
+    free(reader->key);
+    reader->key = NULL;
+    JsonDestroy(reader->value);
+    reader->value = NULL;
+
+    if (reader->started && reader->depth == 0)
+    {
+        *event = JSON_EVENT_END;
+        return JSON_PARSE_OK;
+    }
+
+    for (int ch = JsonReaderPeek(reader); ; ch = JsonReaderPeek(reader))
+    {
+        if (ch == EOF)
+        {
+            if (!reader->started)
+            {
+                return JSON_PARSE_ERROR_NO_DATA;
+            }
+            return (reader->stack[reader->depth - 1] == '{') ?
+                JSON_PARSE_ERROR_OBJECT_END : JSON_PARSE_ERROR_ARRAY_END;
+        }
+
+        if (IsWhitespace(ch))
+        {
+            reader->pos++;
+            continue;
+        }
+
+        if (!reader->started)
+        {
+            if (ch != '{' && ch != '[')
+            {
+                return JSON_PARSE_ERROR_INVALID_START;
+            }
+            *event = JsonReaderOpen(reader, ch);
+            return JSON_PARSE_OK;
+        }
+
+        if (reader->stack[reader->depth - 1] == '[')
+        {
+            switch (ch)
+            {
+            case ',':
+                reader->pos++;
+                continue;
+
+            case ']':
+                reader->pos++;
+                reader->depth--;
+                *event = JSON_EVENT_ARRAY_END;
+                return JSON_PARSE_OK;
+
+            case '[':
+            case '{':
+                *event = JsonReaderOpen(reader, ch);
+                return JSON_PARSE_OK;
+
+            default:
+                *event = JSON_EVENT_VALUE;
+                return JsonReaderPrimitive(reader);
+            }
+        }
+
+        switch (ch)
+        {
+        case '"':
+            if (reader->pending_key == NULL)
+            {
+                JsonParseError err = JsonReaderString(reader);
+                if (err != JSON_PARSE_OK)
+                {
+                    return err;
+                }
+                reader->pending_key = xstrdup(reader->token);
+                continue;
+            }
+            break;
+
+        case ':':
+            if (reader->pending_key == NULL)
+            {
+                return JSON_PARSE_ERROR_OBJECT_COLON;
+            }
+            reader->pos++;
+            continue;
+
+        case ',':
+            if (reader->pending_key != NULL)
+            {
+                return JSON_PARSE_ERROR_OBJECT_COMMA;
+            }
+            reader->pos++;
+            continue;
+
+        case '[':
+            if (reader->pending_key == NULL)
+            {
+                return JSON_PARSE_ERROR_OBJECT_ARRAY_LVAL;
+            }
+            break;
+
+        case '{':
+            if (reader->pending_key == NULL)
+            {
+                return JSON_PARSE_ERROR_OBJECT_OBJECT_LVAL;
+            }
+            break;
+
+        case '}':
+            if (reader->pending_key != NULL)
+            {
+                return JSON_PARSE_ERROR_OBJECT_OPEN_LVAL;
+            }
+            reader->pos++;
+            reader->depth--;
+            *event = JSON_EVENT_OBJECT_END;
+            return JSON_PARSE_OK;
+
+        default:
+            if (reader->pending_key == NULL)
+            {
+                return JSON_PARSE_ERROR_OBJECT_BAD_SYMBOL;
+            }
+            break;
+        }
+
+        /* A value for the pending key */
+        reader->key = reader->pending_key;
+        reader->pending_key = NULL;
+
+        if (ch == '[' || ch == '{')
+        {
+            *event = JsonReaderOpen(reader, ch);
+            return JSON_PARSE_OK;
+        }
+
+        *event = JSON_EVENT_VALUE;
+        return JsonReaderPrimitive(reader);
+    }
+}
+
+const char *JsonReaderKey(const JsonReader *reader)
+{
+    return reader->key;
+}
+
+JsonElement *JsonReaderTakeValue(JsonReader *reader)
+{
+    JsonElement *value = reader->value;
+    reader->value = NULL;
+    return value;
+}
+
+JsonParseError JsonParseFile(const char *path, size_t size_max, JsonElement **json_out)
+{
+    *json_out = NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        return JSON_PARSE_ERROR_NO_SUCH_FILE;
+    }
+
+    JsonReader *reader = JsonReaderNew(fd, size_max);
+    Seq *open_containers = SeqNew(16, NULL);
+    JsonElement *root = NULL;
+    JsonParseError err;
+    JsonEvent event;
+
+    while ((err = JsonReaderNext(reader, &event)) == JSON_PARSE_OK && event != JSON_EVENT_END)
+    {
+        JsonElement *element = NULL;
+
+        switch (event)
+        {
+        case JSON_EVENT_OBJECT_START:
+            element = JsonObjectCreate(DEFAULT_CONTAINER_CAPACITY);
+            break;
+        case JSON_EVENT_ARRAY_START:
+            element = JsonArrayCreate(DEFAULT_CONTAINER_CAPACITY);
+            break;
+        case JSON_EVENT_VALUE:
+            element = JsonReaderTakeValue(reader);
+            break;
+        default:
+            SeqSoftRemove(open_containers, SeqLength(open_containers) - 1);
+            continue;
+        }
+
+        if (root == NULL)
+        {
+            root = element;
+        }
+        else
+        {
+            JsonElement *parent = SeqAt(open_containers, SeqLength(open_containers) - 1);
+            if (parent->container.type == JSON_CONTAINER_TYPE_OBJECT)
+            {
+                JsonObjectAppendElement(parent, JsonReaderKey(reader), element);
+            }
+            else
+            {
+                JsonArrayAppendElement(parent, element);
+            }
+        }
+
+        if (event != JSON_EVENT_VALUE)
+        {
+            SeqAppend(open_containers, element);
+        }
+    }
+
+    SeqDestroy(open_containers);
+    JsonReaderDestroy(reader);
+    close(fd);
+
+    if (err != JSON_PARSE_OK)
+    {
+        JsonDestroy(root);
+        return err;
+    }
+
+    *json_out = root;
+    return JSON_PARSE_OK;
+}
@@ -93,12 +93,25 @@ typedef enum
 
     JSON_PARSE_ERROR_INVALID_START,
     JSON_PARSE_ERROR_NO_DATA,
+    JSON_PARSE_ERROR_NO_SUCH_FILE,
 
     JSON_PARSE_ERROR_MAX
 } JsonParseError;
 
 typedef struct JsonElement_ JsonElement;
 
+typedef enum
+{
+    JSON_EVENT_OBJECT_START,
+    JSON_EVENT_OBJECT_END,
+    JSON_EVENT_ARRAY_START,
+    JSON_EVENT_ARRAY_END,
+    JSON_EVENT_VALUE,
+    JSON_EVENT_END
+} JsonEvent;
+
+typedef struct JsonReader_ JsonReader;
+
 #include <writer.h>
 
 typedef struct
@@ -348,8 +361,44 @@ JsonElement *JsonArrayGet(JsonElement *array, size_t index);
   */
 JsonParseError JsonParse(const char **data, JsonElement **json_out);
 
+/**
+  @brief Parse a file to create a JsonElement, reading it in chunks
+  @param path [in] The file to parse
+  @param size_max [in] Read at most this many bytes of the file
+  @param json_out Resulting JSON object
+  @returns See JsonParseError and JsonParseErrorToString
+  */
+JsonParseError JsonParseFile(const char *path, size_t size_max, JsonElement **json_out);
+
 const char* JsonParseErrorToString(JsonParseError error);
 
+/**
+  @brief Create a pull parser reading JSON from a file descriptor
+  @param fd [in] Where to read from, left open
+  @param size_max [in] Read at most this many bytes from fd
+  */
+JsonReader *JsonReaderNew(int fd, size_t size_max);
+void JsonReaderDestroy(JsonReader *reader);
+
+/**
+  @brief Read up to the next event. JSON_EVENT_END follows the end of the top
+         level container.
+  @param event [out] The event read
+  @returns See JsonParseError and JsonParseErrorToString
+  */
+JsonParseError JsonReaderNext(JsonReader *reader, JsonEvent *event);
+
+/**
+  @brief The property name of the value or container just started, if its
+         parent is an object. Valid until the next call to JsonReaderNext().
+  */
+const char *JsonReaderKey(const JsonReader *reader);
+
+/**
+  @brief Take ownership of the primitive read with JSON_EVENT_VALUE
+  */
+JsonElement *JsonReaderTakeValue(JsonReader *reader);
+
 /**
   @brief Remove key from the object
   @param object containing the key property
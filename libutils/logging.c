@@ -43,8 +43,34 @@ typedef struct
 
 static LogLevel global_level = LOG_LEVEL_NOTICE;
 
+/* No thread reports or logs messages above this level, which lets Log() drop
+   them without looking up the thread's context. It only ever goes up. */
+static LogLevel level_ceiling = LOG_LEVEL_NOTICE;
+
+static LogLevel module_levels[LOG_MOD_MAX] =
+{
+    [LOG_MOD_NONE] = LOG_LEVEL_NOTHING,
+    [LOG_MOD_NET] = LOG_LEVEL_NOTHING,
+    [LOG_MOD_EXPAND] = LOG_LEVEL_NOTHING,
+};
+
+static const char *const module_names[LOG_MOD_MAX] =
+{
+    [LOG_MOD_NONE] = "",
+    [LOG_MOD_NET] = "net",
+    [LOG_MOD_EXPAND] = "expand",
+};
+
 static void LogToSystemLog(const char *msg, LogLevel level);
 
+static void RaiseLevelCeiling(LogLevel level)
+{
+    if (level > level_ceiling)
+    {
+        level_ceiling = level;
+    }
+}
+
 static pthread_once_t log_context_init_once = PTHREAD_ONCE_INIT;
 static pthread_key_t log_context_key;
 
@@ -92,6 +118,9 @@ void LoggingPrivSetLevels(LogLevel log_level, LogLevel report_level)
     LoggingContext *lctx = GetCurrentThreadContext();
     lctx->log_level = log_level;
     lctx->report_level = report_level;
+
+    RaiseLevelCeiling(log_level);
+    RaiseLevelCeiling(report_level);
 }
 
 const char *LogLevelToString(LogLevel level)
@@ -204,8 +233,150 @@ static int LogLevelToSyslogPriority(LogLevel level)
 
 }
 
+typedef struct
+{
+    LogLevel level;
+    char *msg;
+} QueuedLogMessage;
+
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t writer;
+    bool running;
+    bool stopping;
+
+    QueuedLogMessage *ring;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    size_t dropped;
+} ASYNC_SYSLOG = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void *AsyncSystemLogRun(ARG_UNUSED void *arg)
+{
+    pthread_mutex_lock(&ASYNC_SYSLOG.lock);
+
+    for (;;)
+    {
+        while (ASYNC_SYSLOG.count == 0 && !ASYNC_SYSLOG.stopping)
+        {
+            pthread_cond_wait(&ASYNC_SYSLOG.cond, &ASYNC_SYSLOG.lock);
+        }
+
+        if (ASYNC_SYSLOG.count == 0)
+        {
+            break;
+        }
+
+        QueuedLogMessage entry = ASYNC_SYSLOG.ring[ASYNC_SYSLOG.head];
+        ASYNC_SYSLOG.head = (ASYNC_SYSLOG.head + 1) % ASYNC_SYSLOG.capacity;
+        ASYNC_SYSLOG.count--;
+
+        size_t dropped = ASYNC_SYSLOG.dropped;
+        ASYNC_SYSLOG.dropped = 0;
+
+        pthread_mutex_unlock(&ASYNC_SYSLOG.lock);
+
+        if (dropped > 0)
+        {
+            syslog(LOG_WARNING, "%zu log messages were dropped, syslog could not keep up", dropped);
+        }
+        syslog(LogLevelToSyslogPriority(entry.level), "%s", entry.msg);
+        free(entry.msg);
+
+        pthread_mutex_lock(&ASYNC_SYSLOG.lock);
+    }
+
+    pthread_mutex_unlock(&ASYNC_SYSLOG.lock);
+    return NULL;
+}
+
+void LoggingEnableAsyncSystemLog(size_t capacity)
+{
+    pthread_mutex_lock(&ASYNC_SYSLOG.lock);
+
+    if (!ASYNC_SYSLOG.running && capacity > 0)
+    {
+        ASYNC_SYSLOG.ring = xcalloc(capacity, sizeof(QueuedLogMessage));
+        ASYNC_SYSLOG.capacity = capacity;
+        ASYNC_SYSLOG.head = 0;
+        ASYNC_SYSLOG.count = 0;
+        ASYNC_SYSLOG.stopping = false;
+
+        int ret = pthread_create(&ASYNC_SYSLOG.writer, NULL, AsyncSystemLogRun, NULL);
+        if (ret == 0)
+        {
+            ASYNC_SYSLOG.running = true;
+        }
+        else
+        {
+            free(ASYNC_SYSLOG.ring);
+            ASYNC_SYSLOG.ring = NULL;
+        }
+    }
+
+    pthread_mutex_unlock(&ASYNC_SYSLOG.lock);
+}
+
+void LoggingFlushAsyncSystemLog(void)
+{
+    pthread_mutex_lock(&ASYNC_SYSLOG.lock);
+
+    if (!ASYNC_SYSLOG.running)
+    {
+        pthread_mutex_unlock(&ASYNC_SYSLOG.lock);
+        return;
+    }
+
+    /* From now on messages go straight to syslog, the writer empties the
+       ring and exits */
+    ASYNC_SYSLOG.running = false;
+    ASYNC_SYSLOG.stopping = true;
+    pthread_cond_signal(&ASYNC_SYSLOG.cond);
+    pthread_mutex_unlock(&ASYNC_SYSLOG.lock);
+
+    pthread_join(ASYNC_SYSLOG.writer, NULL);
+
+    pthread_mutex_lock(&ASYNC_SYSLOG.lock);
+    if (ASYNC_SYSLOG.dropped > 0)
+    {
+        syslog(LOG_WARNING, "%zu log messages were dropped, syslog could not keep up", ASYNC_SYSLOG.dropped);
+        ASYNC_SYSLOG.dropped = 0;
+    }
+    free(ASYNC_SYSLOG.ring);
+    ASYNC_SYSLOG.ring = NULL;
+    pthread_mutex_unlock(&ASYNC_SYSLOG.lock);
+}
+
 static void LogToSystemLog(const char *msg, LogLevel level)
 {
+    pthread_mutex_lock(&ASYNC_SYSLOG.lock);
+
+    if (ASYNC_SYSLOG.running)
+    {
+        if (ASYNC_SYSLOG.count < ASYNC_SYSLOG.capacity)
+        {
+            size_t tail = (ASYNC_SYSLOG.head + ASYNC_SYSLOG.count) % ASYNC_SYSLOG.capacity;
+            ASYNC_SYSLOG.ring[tail] = (QueuedLogMessage) { level, xstrdup(msg) };
+            ASYNC_SYSLOG.count++;
+            pthread_cond_signal(&ASYNC_SYSLOG.cond);
+        }
+        else
+        {
+            ASYNC_SYSLOG.dropped++;
+        }
+
+        pthread_mutex_unlock(&ASYNC_SYSLOG.lock);
+        return;
+    }
+
+    pthread_mutex_unlock(&ASYNC_SYSLOG.lock);
+
     syslog(LogLevelToSyslogPriority(level), "%s", msg);
 }
 
@@ -218,11 +389,29 @@ const char *GetErrorStr(void)
 {
     return strerror(errno);
 }
+
+#else /* __MINGW32__ */
+
+void LoggingEnableAsyncSystemLog(ARG_UNUSED size_t capacity)
+{
+}
+
+void LoggingFlushAsyncSystemLog(void)
+{
+}
+
 #endif
 
-void VLog(LogLevel level, const char *fmt, va_list ap)
+static void LogMessage(LoggingContext *lctx, LogModule mod, LogLevel level, bool record,
+                       const char *fmt, va_list ap)
 {
-    LoggingContext *lctx = GetCurrentThreadContext();
+    bool report = (level <= lctx->report_level) || (level <= module_levels[mod]);
+    bool log = (level <= lctx->log_level);
+
+    if (!report && !log && !record)
+    {
+        return;
+    }
 
     char *msg = StringVFormat(fmt, ap);
     const char *hooked_msg = NULL;
@@ -236,27 +425,81 @@ void VLog(LogLevel level, const char *fmt, va_list ap)
         hooked_msg = msg;
     }
 
-    if (level <= lctx->report_level)
+    if (report)
     {
         LogToConsole(hooked_msg, level, lctx->color);
     }
 
-    if (level <= lctx->log_level)
+    if (log)
     {
         LogToSystemLog(hooked_msg, level);
     }
     free(msg);
 }
 
+static void LogModuleMessage(LogModule mod, LogLevel level, const char *fmt, ...) FUNC_ATTR_PRINTF(3, 4);
+
+static void LogModuleMessage(LogModule mod, LogLevel level, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    LogMessage(GetCurrentThreadContext(), mod, level, false, fmt, ap);
+    va_end(ap);
+}
+
+void VLog(LogLevel level, const char *fmt, va_list ap)
+{
+    if (level > level_ceiling)
+    {
+        return;
+    }
+
+    LogMessage(GetCurrentThreadContext(), LOG_MOD_NONE, level, false, fmt, ap);
+}
+
+void LoggingPrivVLogRecorded(LogLevel level, const char *fmt, va_list ap)
+{
+    LogMessage(GetCurrentThreadContext(), LOG_MOD_NONE, level, true, fmt, ap);
+}
+
+bool LogLevelEnabled(LogLevel level)
+{
+    if (level > level_ceiling)
+    {
+        return false;
+    }
+
+    LoggingContext *lctx = GetCurrentThreadContext();
+    return (level <= lctx->report_level) || (level <= lctx->log_level);
+}
+
+bool LogModuleEnabled(LogModule mod, LogLevel level)
+{
+    return (level <= module_levels[mod]) || LogLevelEnabled(level);
+}
+
+void LogModuleDebug(LogModule mod, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    LogMessage(GetCurrentThreadContext(), mod, LOG_LEVEL_DEBUG, false, fmt, ap);
+    va_end(ap);
+}
+
 /**
  * @brief Logs binary data in #buf, with each byte translated to '.' if not
  *        printable. Message is prefixed with #prefix.
  */
-void LogRaw(LogLevel level, const char *prefix, void *buf, size_t buflen)
+void LogRaw(LogModule mod, LogLevel level, const char *prefix, void *buf, size_t buflen)
 {
+    if (!LogModuleEnabled(mod, level))
+    {
+        return;
+    }
+
     /* Translate non printable characters to printable ones. */
     char *src = (char *) buf;
-    char dst[buflen+1];
+    char *dst = xmalloc(buflen + 1);
     size_t i;
 
     for (i = 0; i < buflen; i++)
@@ -269,20 +512,64 @@ void LogRaw(LogLevel level, const char *prefix, void *buf, size_t buflen)
     dst[i] = '\0';
 
     /* And Log the translated buffer, which is now a valid string. */
-    Log(level, "%s%s", prefix, dst);
+    LogModuleMessage(mod, level, "%s%s", prefix, dst);
+    free(dst);
 }
 
 void Log(LogLevel level, const char *fmt, ...)
 {
+    if (level > level_ceiling)
+    {
+        return;
+    }
+
     va_list ap;
     va_start(ap, fmt);
-    VLog(level, fmt, ap);
+    LogMessage(GetCurrentThreadContext(), LOG_MOD_NONE, level, false, fmt, ap);
     va_end(ap);
 }
 
+void LogModuleSetLevel(LogModule mod, LogLevel level)
+{
+    module_levels[mod] = level;
+    RaiseLevelCeiling(level);
+}
+
+bool LogEnableModulesFromString(const char *modules)
+{
+    bool all_known = true;
+    char *copy = xstrdup(modules);
+    char *saveptr = NULL;
+
+    for (char *token = strtok_r(copy, ",", &saveptr); token != NULL;
+         token = strtok_r(NULL, ",", &saveptr))
+    {
+        bool known = false;
+
+        for (int mod = LOG_MOD_NONE + 1; mod < LOG_MOD_MAX; mod++)
+        {
+            if (strcmp(token, "all") == 0 || strcmp(token, module_names[mod]) == 0)
+            {
+                LogModuleSetLevel(mod, LOG_LEVEL_DEBUG);
+                known = true;
+            }
+        }
+
+        if (!known)
+        {
+            Log(LOG_LEVEL_WARNING, "Unknown log module '%s'", token);
+            all_known = false;
+        }
+    }
+
+    free(copy);
+    return all_known;
+}
+
 void LogSetGlobalLevel(LogLevel level)
 {
     global_level = level;
+    RaiseLevelCeiling(level);
     LoggingPrivSetLevels(level, level);
 }
 
@@ -43,15 +43,77 @@ typedef enum
     LOG_LEVEL_DEBUG
 } LogLevel;
 
+/*
+ * Areas of the code whose debug output is too chatty for --debug alone, they
+ * can be given a level of their own (see --log-modules).
+ */
+typedef enum
+{
+    LOG_MOD_NONE = 0,                  /* Not part of any module */
+    LOG_MOD_NET,                       /* Protocol transactions */
+    LOG_MOD_EXPAND,                    /* Variable expansion */
+    LOG_MOD_MAX
+} LogModule;
+
 const char *LogLevelToString(LogLevel level);
 
 void Log(LogLevel level, const char *fmt, ...) FUNC_ATTR_PRINTF(2, 3);
-void LogRaw(LogLevel level, const char *prefix, void *buf, size_t buflen);
+void LogRaw(LogModule mod, LogLevel level, const char *prefix, void *buf, size_t buflen);
 void VLog(LogLevel level, const char *fmt, va_list ap);
 
+/**
+ * @brief Whether a message of this level would be reported or logged by the
+ *        current thread. Messages that would not are dropped by Log() before
+ *        they are formatted, check first only if computing the arguments is
+ *        expensive.
+ */
+bool LogLevelEnabled(LogLevel level);
+bool LogModuleEnabled(LogModule mod, LogLevel level);
+
+/**
+ * @brief Debug message of a module, the arguments are not evaluated unless
+ *        the module or the current thread is at debug level.
+ */
+#define LogDebug(mod, ...)                                  \
+    do                                                      \
+    {                                                       \
+        if (LogModuleEnabled(mod, LOG_LEVEL_DEBUG))         \
+        {                                                   \
+            LogModuleDebug(mod, __VA_ARGS__);               \
+        }                                                   \
+    } while (0)
+
+void LogModuleDebug(LogModule mod, const char *fmt, ...) FUNC_ATTR_PRINTF(2, 3);
+
+/**
+ * @brief Report messages of the module up to the given level, regardless of
+ *        the global level.
+ */
+void LogModuleSetLevel(LogModule mod, LogLevel level);
+
+/**
+ * @brief Set the comma separated modules (or "all") to debug level.
+ * @return False if a module name is unknown, the others are still set.
+ */
+bool LogEnableModulesFromString(const char *modules);
+
 void LogSetGlobalLevel(LogLevel level);
 LogLevel LogGetGlobalLevel(void);
 
+/**
+ * @brief Hand syslog messages to a background thread through a ring buffer
+ *        of the given capacity, so logging threads never wait for syslog.
+ *        Messages that find the buffer full are dropped and counted.
+ *        Must be called after any fork().
+ */
+void LoggingEnableAsyncSystemLog(size_t capacity);
+
+/**
+ * @brief Write out queued syslog messages and go back to logging
+ *        synchronously.
+ */
+void LoggingFlushAsyncSystemLog(void);
+
 void LoggingSetColor(bool enabled);
 
 /*
@@ -57,4 +57,10 @@ LoggingPrivContext *LoggingPrivGetContext(void);
  */
 void LoggingPrivSetLevels(LogLevel log_level, LogLevel report_level);
 
+/**
+ * @brief Like VLog(), but the message reaches the log hook even if the current
+ *        levels drop it, for messages that are recorded as well as logged
+ */
+void LoggingPrivVLogRecorded(LogLevel level, const char *fmt, va_list ap);
+
 #endif
@@ -51,9 +51,9 @@ struct Map_
     };
 };
 
-static unsigned IdentityHashFn(const void *ptr, ARG_UNUSED unsigned int seed, ARG_UNUSED unsigned int max)
+static unsigned IdentityHashFn(const void *ptr, ARG_UNUSED unsigned int seed, unsigned int max)
 {
-    return (unsigned)(uintptr_t)ptr;
+    return ((unsigned)(uintptr_t)ptr) % max;
 }
 
 static bool IdentityEqualFn(const void *p1, const void *p2)
@@ -114,15 +114,7 @@ size_t MapSize(const Map *map)
     }
     else
     {
-        MapIterator i = MapIteratorInit((Map*)map);
-        size_t size = 0;
-
-        while (MapIteratorNext(&i))
-        {
-            size++;
-        }
-
-        return size;
+        return map->hashmap->load;
     }
 }
 
@@ -0,0 +1,293 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#include <regex_cache.h>
+
+#include <alloc.h>
+#include <logging.h>
+#include <string_lib.h>
+
+#define REGEX_CACHE_BUCKETS 512         /* must be a power of two */
+#define REGEX_CACHE_MAX_ENTRIES 256
+#define REGEX_CACHE_STUDY_USES 2        /* study from the second use on */
+
+struct CachedRegex_
+{
+    char *pattern;
+    int options;
+    unsigned int bucket;
+
+    pcre *rx;
+    pcre_extra *extra;
+    bool studied;
+
+    unsigned long uses;
+    unsigned int refcount;              /* references out with callers */
+
+    CachedRegex *bucket_next;
+    CachedRegex *lru_prev;              /* towards most recently used */
+    CachedRegex *lru_next;              /* towards least recently used */
+};
+
+static struct
+{
+    pthread_mutex_t lock;
+    CachedRegex *buckets[REGEX_CACHE_BUCKETS];
+    CachedRegex *lru_first;
+    CachedRegex *lru_last;
+    RegexCacheStats stats;
+} CACHE = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void LRUUnlink(CachedRegex *entry)
+{
+    if (entry->lru_prev)
+    {
+        entry->lru_prev->lru_next = entry->lru_next;
+    }
+    else
+    {
+        CACHE.lru_first = entry->lru_next;
+    }
+
+    if (entry->lru_next)
+    {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    }
+    else
+    {
+        CACHE.lru_last = entry->lru_prev;
+    }
+
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+static void LRUPushFront(CachedRegex *entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = CACHE.lru_first;
+
+    if (CACHE.lru_first)
+    {
+        CACHE.lru_first->lru_prev = entry;
+    }
+    else
+    {
+        CACHE.lru_last = entry;
+    }
+
+    CACHE.lru_first = entry;
+}
+
+static void CachedRegexDestroy(CachedRegex *entry)
+{
+    if (entry->extra)
+    {
+#ifdef PCRE_STUDY_JIT_COMPILE
+        pcre_free_study(entry->extra);
+#else
+        pcre_free(entry->extra);
+#endif
+    }
+    pcre_free(entry->rx);
+    free(entry->pattern);
+    free(entry);
+}
+
+/* Unlink from bucket and LRU list and free. Caller holds the lock. */
+static void CacheRemove(CachedRegex *entry)
+{
+    CachedRegex **link = &CACHE.buckets[entry->bucket];
+    while (*link != entry)
+    {
+        link = &(*link)->bucket_next;
+    }
+    *link = entry->bucket_next;
+
+    LRUUnlink(entry);
+    CachedRegexDestroy(entry);
+    CACHE.stats.entries--;
+}
+
+/* Evict least recently used entries nobody holds until under the limit. */
+static void CacheTrim(void)
+{
+    CachedRegex *entry = CACHE.lru_last;
+
+    while (entry && CACHE.stats.entries > REGEX_CACHE_MAX_ENTRIES)
+    {
+        CachedRegex *prev = entry->lru_prev;
+        if (entry->refcount == 0)
+        {
+            CacheRemove(entry);
+            CACHE.stats.evictions++;
+        }
+        entry = prev;
+    }
+}
+
+/* Only study entries nobody else is executing, so extra never changes
+ * under a concurrent RegexCacheExec(). */
+static void MaybeStudy(CachedRegex *entry)
+{
+    if (entry->studied || entry->refcount > 0 || entry->uses < REGEX_CACHE_STUDY_USES)
+    {
+        return;
+    }
+
+    const char *errorstr = NULL;
+#ifdef PCRE_STUDY_JIT_COMPILE
+    entry->extra = pcre_study(entry->rx, PCRE_STUDY_JIT_COMPILE, &errorstr);
+#else
+    entry->extra = pcre_study(entry->rx, 0, &errorstr);
+#endif
+    if (errorstr)
+    {
+        Log(LOG_LEVEL_DEBUG, "Could not study regular expression '%s' (%s)",
+            entry->pattern, errorstr);
+    }
+
+    entry->studied = true;
+    CACHE.stats.studied++;
+}
+
+CachedRegex *RegexCacheGet(const char *pattern, int options)
+{
+    assert(pattern);
+
+    unsigned int bucket = StringHash(pattern, options, REGEX_CACHE_BUCKETS);
+
+    pthread_mutex_lock(&CACHE.lock);
+
+    for (CachedRegex *entry = CACHE.buckets[bucket]; entry; entry = entry->bucket_next)
+    {
+        if (entry->options == options && strcmp(entry->pattern, pattern) == 0)
+        {
+            CACHE.stats.hits++;
+            entry->uses++;
+            MaybeStudy(entry);
+            entry->refcount++;
+
+            LRUUnlink(entry);
+            LRUPushFront(entry);
+
+            pthread_mutex_unlock(&CACHE.lock);
+            return entry;
+        }
+    }
+
+    CACHE.stats.misses++;
+    pthread_mutex_unlock(&CACHE.lock);
+
+    /* Compile outside the lock, patterns can be expensive to compile. */
+    const char *errorstr;
+    int erroffset;
+    pcre *rx = pcre_compile(pattern, options, &errorstr, &erroffset, NULL);
+
+    if (rx == NULL)
+    {
+        Log(LOG_LEVEL_ERR, "Regular expression error '%s' in expression '%s' at %d",
+            errorstr, pattern, erroffset);
+        return NULL;
+    }
+
+    CachedRegex *entry = xcalloc(1, sizeof(CachedRegex));
+    entry->pattern = xstrdup(pattern);
+    entry->options = options;
+    entry->bucket = bucket;
+    entry->rx = rx;
+    entry->uses = 1;
+    entry->refcount = 1;
+
+    /* Another thread may have inserted the same pattern meanwhile, which
+     * only costs a duplicate entry that ages out of the LRU list. */
+    pthread_mutex_lock(&CACHE.lock);
+
+    entry->bucket_next = CACHE.buckets[bucket];
+    CACHE.buckets[bucket] = entry;
+    LRUPushFront(entry);
+    CACHE.stats.entries++;
+    CacheTrim();
+
+    pthread_mutex_unlock(&CACHE.lock);
+
+    return entry;
+}
+
+void RegexCacheRelease(CachedRegex *regex)
+{
+    if (regex == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&CACHE.lock);
+
+    assert(regex->refcount > 0);
+    regex->refcount--;
+    CacheTrim();
+
+    pthread_mutex_unlock(&CACHE.lock);
+}
+
+int RegexCacheExec(const CachedRegex *regex, const char *subject, int *ovector, int ovecsize)
+{
+    assert(regex);
+    assert(subject);
+
+    return pcre_exec(regex->rx, regex->extra, subject, strlen(subject), 0, 0, ovector, ovecsize);
+}
+
+RegexCacheStats RegexCacheGetStats(void)
+{
+    pthread_mutex_lock(&CACHE.lock);
+    RegexCacheStats stats = CACHE.stats;
+    pthread_mutex_unlock(&CACHE.lock);
+
+    return stats;
+}
+
+void RegexCacheClear(void)
+{
+    pthread_mutex_lock(&CACHE.lock);
+
+    CachedRegex *entry = CACHE.lru_first;
+    while (entry)
+    {
+        CachedRegex *next = entry->lru_next;
+        if (entry->refcount == 0)
+        {
+            CacheRemove(entry);
+        }
+        entry = next;
+    }
+
+    size_t entries = CACHE.stats.entries;
+    memset(&CACHE.stats, 0, sizeof(CACHE.stats));
+    CACHE.stats.entries = entries;
+
+    pthread_mutex_unlock(&CACHE.lock);
+}
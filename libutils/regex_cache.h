@@ -0,0 +1,75 @@
+/*
+   Copyright (C) CFEngine AS
+
+   This file is part of CFEngine 3 - written and maintained by CFEngine AS.
+
+   This program is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by the
+   Free Software Foundation; version 3.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+
+  To the extent this program is licensed as part of the Enterprise
+  versions of CFEngine, the applicable Commercial Open Source License
+  (COSL) may apply to this file if you as a licensee so wish it. See
+  included file COSL.txt.
+*/
+
+#ifndef CFENGINE_REGEX_CACHE_H
+#define CFENGINE_REGEX_CACHE_H
+
+#include <platform.h>
+
+/**
+  @brief Process-wide cache of compiled PCRE patterns.
+
+  Policy matches the same handful of patterns against every line, file and
+  process, so compiling them on each match dominates. Entries are keyed by
+  pattern and compile options, evicted least-recently-used first, and
+  pcre_study()'d (JIT where available) once they are used repeatedly.
+
+  The cache is thread-safe. An entry handed out by RegexCacheGet() stays
+  valid until it is given back with RegexCacheRelease().
+  */
+typedef struct CachedRegex_ CachedRegex;
+
+typedef struct
+{
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long studied;
+    size_t entries;
+} RegexCacheStats;
+
+/**
+  @brief Get the compiled form of a pattern, compiling it on first use.
+  @param pattern PCRE pattern.
+  @param options pcre_compile() options, part of the cache key.
+  @return A reference to release with RegexCacheRelease(), or NULL if the
+          pattern does not compile (the error is logged).
+  */
+CachedRegex *RegexCacheGet(const char *pattern, int options);
+void RegexCacheRelease(CachedRegex *regex);
+
+/**
+  @brief pcre_exec() a cached pattern against a whole NUL-terminated string.
+  @return As pcre_exec().
+  */
+int RegexCacheExec(const CachedRegex *regex, const char *subject, int *ovector, int ovecsize);
+
+RegexCacheStats RegexCacheGetStats(void);
+
+/**
+  @brief Drop all entries not currently in use and reset the counters.
+  */
+void RegexCacheClear(void);
+
+#endif
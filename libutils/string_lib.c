@@ -28,6 +28,7 @@
 #include <alloc.h>
 #include <writer.h>
 #include <misc_lib.h>
+#include <regex_cache.h>
 
 char *StringVFormat(const char *fmt, va_list ap)
 {
@@ -383,12 +384,7 @@ bool StringMatch(const char *regex, const char *str, int *start, int *end)
     assert(regex);
     assert(str);
 
-    pcre *pattern = NULL;
-    {
-        const char *errorstr;
-        int erroffset;
-        pattern = pcre_compile(regex, PCRE_MULTILINE | PCRE_DOTALL, &errorstr, &erroffset, NULL);
-    }
+    CachedRegex *pattern = RegexCacheGet(regex, PCRE_MULTILINE | PCRE_DOTALL);
     assert(pattern);
 
     if (pattern == NULL)
@@ -397,7 +393,7 @@ bool StringMatch(const char *regex, const char *str, int *start, int *end)
     }
 
     int ovector[STRING_MATCH_OVECCOUNT] = { 0 };
-    int result = pcre_exec(pattern, NULL, str, strlen(str), 0, 0, ovector, STRING_MATCH_OVECCOUNT);
+    int result = RegexCacheExec(pattern, str, ovector, STRING_MATCH_OVECCOUNT);
 
     if (result)
     {
@@ -422,7 +418,7 @@ bool StringMatch(const char *regex, const char *str, int *start, int *end)
         }
     }
 
-    free(pattern);
+    RegexCacheRelease(pattern);
 
     return result >= 0;
 }
@@ -903,30 +899,51 @@ bool StringStartsWith(const char *str, const char *prefix)
 
 void *MemSpan(const void *mem, char c, size_t n)
 {
-    const char *end = mem + n;
-    for (; (char*)mem < end; ++mem)
+    const unsigned char *p = mem;
+    const unsigned char *end = p + n;
+
+    /*
+     * Compare four words at a time, which compilers turn into vector
+     * instructions, then single words, then the remaining bytes.
+     */
+    const unsigned long pattern = (ULONG_MAX / UCHAR_MAX) * (unsigned char) c;
+    unsigned long words[4];
+
+    while (end - p >= sizeof(words))
     {
-        if (*((char *)mem) != c)
+        memcpy(words, p, sizeof(words));
+        if (((words[0] ^ pattern) | (words[1] ^ pattern) | (words[2] ^ pattern) | (words[3] ^ pattern)) != 0)
         {
-            return (char *)mem;
+            break;
         }
+        p += sizeof(words);
     }
 
-    return (char *)mem;
-}
+    while (end - p >= sizeof(words[0]))
+    {
+        memcpy(words, p, sizeof(words[0]));
+        if (words[0] != pattern)
+        {
+            break;
+        }
+        p += sizeof(words[0]);
+    }
 
-void *MemSpanInverse(const void *mem, char c, size_t n)
-{
-    const char *end = mem + n;
-    for (; (char*)mem < end; ++mem)
+    for (; p < end; ++p)
     {
-        if (*((char*)mem) == c)
+        if (*p != (unsigned char) c)
         {
-            return (char *)mem;
+            break;
         }
     }
 
-    return (char *)mem;
+    return (void *) p;
+}
+
+void *MemSpanInverse(const void *mem, char c, size_t n)
+{
+    const void *found = memchr(mem, c, n);
+    return (char *) (found ? found : mem + n);
 }
 
 bool CompareStringOrRegex(const char *value, const char *compareTo, bool regex)
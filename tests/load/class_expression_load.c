@@ -0,0 +1,134 @@
+#include <cf3.defs.h>
+#include <env_context.h>
+#include <logic_expressions.h>
+#include <class_expression.h>
+#include <policy.h>
+
+/*
+ * A handful of class expressions checked over and over, as guards of the
+ * promises of a large policy: parsed and evaluated on every check, as
+ * IsDefinedClass() used to, against compiled once and evaluated, and
+ * against IsDefinedClass() with its results kept until the classes change.
+ *
+ * Usage: class_expression_load [checks]
+ */
+
+static const char *EXPRESSIONS[] =
+{
+    "any",
+    "linux",
+    "(debian|ubuntu).!(webserver|dbserver)",
+    "redhat_7.x86_64.(Monday|Tuesday|Wednesday).Hr08",
+    "cfengine_3.!bootstrap_mode.(policy_server|am_policy_hub)",
+    "(linux|solaris|aix|hpux).!windows.(ipv4_10_0|ipv4_192_168).!debug_mode",
+};
+
+#define N_EXPRESSIONS (sizeof(EXPRESSIONS) / sizeof(EXPRESSIONS[0]))
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const EvalContext *CTX;
+
+static ExpressionValue TestToken(const char *classname, ARG_UNUSED void *param)
+{
+    ClassRef ref = ClassRefParse(classname);
+    bool defined = (strcmp(ref.name, "any") == 0) || EvalContextClassGet(CTX, ref.ns, ref.name) != NULL;
+    ClassRefDestroy(ref);
+    return defined;
+}
+
+static char *NoVariables(ARG_UNUSED const char *varname, ARG_UNUSED VarRefType type, ARG_UNUSED void *param)
+{
+    return NULL;
+}
+
+static bool TestClass(const char *ns, const char *name, ARG_UNUSED void *param)
+{
+    return EvalContextClassGet(CTX, ns, name) != NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int checks = (argc > 1) ? atoi(argv[1]) : 1000000;
+
+    EvalContext *ctx = EvalContextNew();
+    CTX = ctx;
+    const char *hard[] = { "linux", "debian", "x86_64", "cfengine_3", "ipv4_10_0", "Monday", "Hr08", NULL };
+    for (int i = 0; hard[i] != NULL; i++)
+    {
+        EvalContextClassPutHard(ctx, hard[i]);
+    }
+    for (int i = 0; i < 500; i++)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "class_%d", i);
+        EvalContextClassPutHard(ctx, name);
+    }
+
+    Policy *policy = PolicyNew();
+    Bundle *bundle = PolicyAppendBundle(policy, NamespaceDefault(), "main", "agent", NULL, NULL);
+    EvalContextStackPushBundleFrame(ctx, bundle, NULL, false);
+
+    int defined = 0;
+    double start = Now();
+    for (int i = 0; i < checks; i++)
+    {
+        const char *expr = EXPRESSIONS[i % N_EXPRESSIONS];
+        ParseResult res = ParseExpression(expr, 0, strlen(expr));
+        defined += (EvalExpression(res.result, TestToken, NoVariables, NULL) == EXPRESSION_VALUE_TRUE);
+        FreeExpression(res.result);
+    }
+    printf("%8d checks  parse and evaluate: %8.2f ms (%d true)\n", checks, (Now() - start) * 1000, defined);
+
+    ClassExpression *compiled[N_EXPRESSIONS];
+    for (size_t i = 0; i < N_EXPRESSIONS; i++)
+    {
+        compiled[i] = ClassExpressionCompile(EXPRESSIONS[i]);
+    }
+
+    defined = 0;
+    start = Now();
+    for (int i = 0; i < checks; i++)
+    {
+        defined += ClassExpressionEvaluate(compiled[i % N_EXPRESSIONS], TestClass, NULL);
+    }
+    printf("%8d checks  compiled:           %8.2f ms (%d true)\n", checks, (Now() - start) * 1000, defined);
+
+    for (size_t i = 0; i < N_EXPRESSIONS; i++)
+    {
+        ClassExpressionDestroy(compiled[i]);
+    }
+
+    defined = 0;
+    start = Now();
+    for (int i = 0; i < checks; i++)
+    {
+        defined += IsDefinedClass(ctx, EXPRESSIONS[i % N_EXPRESSIONS], NULL);
+    }
+    printf("%8d checks  IsDefinedClass:     %8.2f ms (%d true)\n", checks, (Now() - start) * 1000, defined);
+
+    /* A class defined every 100 checks, as classes promises would */
+    defined = 0;
+    start = Now();
+    for (int i = 0; i < checks; i++)
+    {
+        if (i % 100 == 0)
+        {
+            char name[64];
+            snprintf(name, sizeof(name), "defined_%d", i);
+            EvalContextClassPut(ctx, NULL, name, true, CONTEXT_SCOPE_BUNDLE);
+        }
+        defined += IsDefinedClass(ctx, EXPRESSIONS[i % N_EXPRESSIONS], NULL);
+    }
+    printf("%8d checks  with changes:       %8.2f ms (%d true)\n", checks, (Now() - start) * 1000, defined);
+
+    EvalContextStackPopFrame(ctx);
+    PolicyDestroy(policy);
+    EvalContextDestroy(ctx);
+    return 0;
+}
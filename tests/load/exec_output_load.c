@@ -0,0 +1,118 @@
+#include <cf3.defs.h>
+#include <exec-output.h>
+#include <crypto.h>
+#include <files_interfaces.h>
+
+/*
+ * Two agent runs of 20000 lines (by default) of output that differ only in
+ * their timestamps: written to a file and compared line by line with the
+ * previous one through the timestamp regex, as CompareResult() did, against
+ * digesting the output as it is captured and comparing the digest.
+ *
+ * Usage: exec_output_load [lines]
+ */
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void Line(char *buf, size_t size, int run, int i)
+{
+    snprintf(buf, size, "2014-05-13T16:%02d:%02d+0000    info: /default/main/files/'/etc/file%d'[0]: Repaired",
+             run, i % 60, i);
+}
+
+/* What CompareResult() did */
+static bool CompareFiles(const char *filename, const char *prev_file)
+{
+    const char *errptr;
+    int erroffset;
+    pcre *regex = pcre_compile(LOGGING_TIMESTAMP_REGEX, PCRE_MULTILINE, &errptr, &erroffset, NULL);
+    pcre_extra *regex_extra = pcre_study(regex, 0, &errptr);
+
+    FILE *old_fp = fopen(prev_file, "r");
+    FILE *new_fp = fopen(filename, "r");
+    bool changed = false;
+    for (;;)
+    {
+        char old_line[CF_BUFSIZE], new_line[CF_BUFSIZE];
+        char *old_msg = (CfReadLine(old_line, sizeof(old_line), old_fp) > 0) ? old_line : NULL;
+        char *new_msg = (CfReadLine(new_line, sizeof(new_line), new_fp) > 0) ? new_line : NULL;
+        if (!old_msg || !new_msg)
+        {
+            changed = (old_msg != new_msg);
+            break;
+        }
+        if (pcre_exec(regex, regex_extra, old_msg, strlen(old_msg), 0, 0, NULL, 0) >= 0)
+        {
+            old_msg = strstr(old_msg, ": ") + 2;
+        }
+        if (pcre_exec(regex, regex_extra, new_msg, strlen(new_msg), 0, 0, NULL, 0) >= 0)
+        {
+            new_msg = strstr(new_msg, ": ") + 2;
+        }
+        if (strcmp(old_msg, new_msg) != 0)
+        {
+            changed = true;
+            break;
+        }
+    }
+
+    fclose(old_fp);
+    fclose(new_fp);
+    free(regex_extra);
+    free(regex);
+    return changed;
+}
+
+int main(int argc, char **argv)
+{
+    int lines = (argc > 1) ? atoi(argv[1]) : 20000;
+    char dir[] = "/tmp/exec_output_load.XXXXXX";
+    mkdtemp(dir);
+    CryptoInitialize();
+
+    char files[2][CF_BUFSIZE], digest_file[CF_BUFSIZE], line[CF_BUFSIZE];
+    snprintf(files[0], sizeof(files[0]), "%s/previous", dir);
+    snprintf(files[1], sizeof(files[1]), "%s/output", dir);
+    snprintf(digest_file, sizeof(digest_file), "%s/digest", dir);
+
+    double start = Now();
+    for (int run = 0; run < 2; run++)
+    {
+        FILE *fp = fopen(files[run], "w");
+        for (int i = 0; i < lines; i++)
+        {
+            Line(line, sizeof(line), run, i);
+            fprintf(fp, "%s\n", line);
+        }
+        fclose(fp);
+    }
+    bool changed = CompareFiles(files[1], files[0]);
+    printf("%6d lines  file and regex compare: %8.2f ms (changed: %d)\n", lines, (Now() - start) * 1000, changed);
+
+    start = Now();
+    for (int run = 0; run < 2; run++)
+    {
+        ExecOutput *output = ExecOutputNew(files[run], EXEC_OUTPUT_BUFFER_MAX);
+        for (int i = 0; i < lines; i++)
+        {
+            Line(line, sizeof(line), run, i);
+            ExecOutputAppendLine(output, line);
+        }
+        changed = ExecOutputDigestChanged(output, digest_file);
+        if (changed)
+        {
+            ExecOutputStoreDigest(ExecOutputDigest(output), digest_file);
+        }
+        ExecOutputClose(output, changed);
+    }
+    printf("%6d lines  streaming digest:       %8.2f ms (changed: %d)\n", lines, (Now() - start) * 1000, changed);
+
+    char cmd[CF_BUFSIZE];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", dir);
+    return system(cmd);
+}
@@ -0,0 +1,195 @@
+#include <cf3.defs.h>
+#include <expand.h>
+#include <env_context.h>
+#include <vars.h>
+#include <string_lib.h>
+
+/*
+ * Expands the same promise strings over and over, with the ExpandScalar that
+ * rescanned the string into fixed stack buffers and strlcat()'ed the result,
+ * and with the current ExpandScalar into a Buffer.
+ *
+ * Usage: expand_load [iterations]
+ */
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void PrintTiming(const char *what, double start, double end, int iterations)
+{
+    printf("%-44s %8.2f ms  %6.0f ns/expansion\n", what, (end - start) * 1000,
+           (end - start) * 1e9 / iterations);
+}
+
+/* The previous ExpandScalar, without its debug logging */
+static bool LegacyExpandScalar(const EvalContext *ctx, const char *ns, const char *scope, const char *string,
+                               char buffer[CF_EXPANDSIZE])
+{
+    Rval rval;
+    int varstring = false;
+    char currentitem[CF_EXPANDSIZE], temp[CF_BUFSIZE], name[CF_MAXVARSIZE];
+    int increment, returnval = true;
+
+    buffer[0] = '\0';
+
+    if (string == 0 || strlen(string) == 0)
+    {
+        return false;
+    }
+
+    for (const char *sp = string; /* No exit */ ; sp++)
+    {
+        char var[CF_BUFSIZE];
+
+        var[0] = '\0';
+        increment = 0;
+
+        if (*sp == '\0')
+        {
+            break;
+        }
+
+        currentitem[0] = '\0';
+        StringNotMatchingSetCapped(sp, CF_EXPANDSIZE, "$", currentitem);
+        strlcat(buffer, currentitem, CF_EXPANDSIZE);
+        sp += strlen(currentitem);
+
+        if (*sp == '\0')
+        {
+            break;
+        }
+
+        if (*sp == '$')
+        {
+            switch (*(sp + 1))
+            {
+            case '(':
+            case '{':
+                ExtractOuterCf3VarString(sp, var);
+                varstring = (*(sp + 1) == '(') ? ')' : '}';
+                if (strlen(var) == 0)
+                {
+                    strlcat(buffer, "$", CF_EXPANDSIZE);
+                    continue;
+                }
+                break;
+
+            default:
+                strlcat(buffer, "$", CF_EXPANDSIZE);
+                continue;
+            }
+        }
+
+        currentitem[0] = '\0';
+        temp[0] = '\0';
+        ExtractInnerCf3VarString(sp, temp);
+
+        if (IsCf3VarString(temp))
+        {
+            LegacyExpandScalar(ctx, ns, scope, temp, currentitem);
+        }
+        else
+        {
+            strlcpy(currentitem, temp, CF_BUFSIZE);
+        }
+
+        increment = strlen(var) - 1;
+
+        if (!IsExpandable(currentitem))
+        {
+            DataType type = DATA_TYPE_NONE;
+            VarRef *ref = VarRefParseFromNamespaceAndScope(currentitem, ns, scope, CF_NS, '.');
+            bool variable_found = EvalContextVariableGet(ctx, ref, &rval, &type);
+            VarRefDestroy(ref);
+
+            if (variable_found && (type == DATA_TYPE_STRING || type == DATA_TYPE_INT || type == DATA_TYPE_REAL))
+            {
+                strlcat(buffer, (char *) rval.item, CF_EXPANDSIZE);
+            }
+            else
+            {
+                snprintf(name, CF_MAXVARSIZE, varstring == '}' ? "${%s}" : "$(%s)", currentitem);
+                strlcat(buffer, name, CF_EXPANDSIZE);
+                returnval = false;
+            }
+        }
+
+        sp += increment;
+    }
+
+    return returnval;
+}
+
+static void Put(EvalContext *ctx, const char *name, const char *value)
+{
+    VarRef *ref = VarRefParse(name);
+    EvalContextVariablePut(ctx, ref, value, DATA_TYPE_STRING);
+    VarRefDestroy(ref);
+}
+
+static void Compare(EvalContext *ctx, const char *what, const char *string, int iterations)
+{
+    char legacy[CF_EXPANDSIZE];
+    Buffer *current = BufferNew();
+
+    char label[CF_MAXVARSIZE];
+
+    double start = Now();
+    for (int i = 0; i < iterations; i++)
+    {
+        LegacyExpandScalar(ctx, "default", "bundle", string, legacy);
+    }
+    double end = Now();
+    snprintf(label, sizeof(label), "%s, strlcat into stack buffers", what);
+    PrintTiming(label, start, end, iterations);
+
+    start = Now();
+    for (int i = 0; i < iterations; i++)
+    {
+        BufferZero(current);
+        ExpandScalar(ctx, "default", "bundle", string, current);
+    }
+    end = Now();
+    snprintf(label, sizeof(label), "%s, cached template into Buffer", what);
+    PrintTiming(label, start, end, iterations);
+
+    if (strcmp(legacy, BufferData(current)) != 0)
+    {
+        printf("Expansions differ: '%s' != '%s'\n", legacy, BufferData(current));
+        exit(1);
+    }
+
+    BufferDestroy(&current);
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = (argc > 1) ? atoi(argv[1]) : 1000000;
+
+    EvalContext *ctx = EvalContextNew();
+
+    Put(ctx, "default:bundle.host", "node042.example.com");
+    Put(ctx, "default:bundle.service", "httpd");
+    Put(ctx, "default:bundle.key", "port");
+    Put(ctx, "default:bundle.config[port]", "8080");
+    Put(ctx, "default:bundle.config[user]", "www-data");
+
+    char *long_value = xmalloc(1001);
+    memset(long_value, 'v', 1000);
+    long_value[1000] = '\0';
+    Put(ctx, "default:bundle.long", long_value);
+    free(long_value);
+
+    Compare(ctx, "literal", "/etc/httpd/conf.d/default.conf", iterations);
+    Compare(ctx, "templated",
+            "/srv/$(host)/$(service)/$(config[user]).conf listen=$(config[$(key)]) ${service}", iterations);
+    Compare(ctx, "7 kB expansion",
+            "$(long)$(long)$(long)$(long)$(long)$(long)$(long)", iterations / 10);
+
+    EvalContextDestroy(ctx);
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include <cf3.defs.h>
+#include <files_copy.h>
+#include <file_lib.h>
+
+/*
+ * A sparse file of 1 GB (by default) with 4 MB of data in it, and a dense
+ * one of 128 MB, copied through a buffer while testing every byte for '\0',
+ * as CopyRegularFileDisk() did, against CopyRegularFileDisk() itself.
+ *
+ * Usage: files_copy_load [sparse MB] [dense MB]
+ */
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* What CopyData() did */
+static void CopyBytewise(const char *source, const char *destination)
+{
+    int sd = open(source, O_RDONLY);
+    int dd = open(destination, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    char buf[4096];
+    off_t total = 0;
+    ssize_t n_read;
+
+    while ((n_read = read(sd, buf, sizeof(buf))) > 0)
+    {
+        total += n_read;
+
+        for (char *cur = buf, *end = buf + n_read; cur < end;)
+        {
+            char *skip = cur;
+            while ((skip < end) && (*skip == '\0'))
+            {
+                skip++;
+            }
+            lseek(dd, skip - cur, SEEK_CUR);
+            cur = skip;
+
+            char *copy = memchr(cur, '\0', end - cur);
+            copy = (copy != NULL) ? copy : end;
+            FullWrite(dd, cur, copy - cur);
+            cur = copy;
+        }
+    }
+
+    ftruncate(dd, total);
+    close(sd);
+    close(dd);
+}
+
+static void Measure(const char *label, const char *source, const char *destination)
+{
+    double start = Now();
+    CopyBytewise(source, destination);
+    printf("%-7s byte loop:           %8.2f ms\n", label, (Now() - start) * 1000);
+    unlink(destination);
+
+    start = Now();
+    CopyRegularFileDisk(source, destination);
+    printf("%-7s CopyRegularFileDisk: %8.2f ms\n", label, (Now() - start) * 1000);
+    unlink(destination);
+}
+
+int main(int argc, char **argv)
+{
+    off_t sparse_size = ((argc > 1) ? atoi(argv[1]) : 1024) * 1024 * 1024LL;
+    off_t dense_size = ((argc > 2) ? atoi(argv[2]) : 128) * 1024 * 1024LL;
+
+    char dir[] = "/tmp/files_copy_load.XXXXXX";
+    mkdtemp(dir);
+
+    char source[CF_BUFSIZE], destination[CF_BUFSIZE];
+    snprintf(source, sizeof(source), "%s/source", dir);
+    snprintf(destination, sizeof(destination), "%s/destination", dir);
+
+    char block[1024 * 1024];
+    for (size_t i = 0; i < sizeof(block); i++)
+    {
+        block[i] = (i % 512 == 0) ? 0 : (char) (i * 7919);
+    }
+
+    /* Sparse: four 1 MB extents of data spread over the file */
+    int fd = open(source, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    for (int i = 0; i < 4; i++)
+    {
+        pwrite(fd, block, sizeof(block), i * (sparse_size / 4));
+    }
+    ftruncate(fd, sparse_size);
+    close(fd);
+
+    Measure("sparse", source, destination);
+
+    /* Dense */
+    fd = open(source, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    for (off_t written = 0; written < dense_size; written += sizeof(block))
+    {
+        FullWrite(fd, block, sizeof(block));
+    }
+    close(fd);
+
+    Measure("dense", source, destination);
+
+    unlink(source);
+    rmdir(dir);
+    return 0;
+}
@@ -0,0 +1,241 @@
+#include <cf3.defs.h>
+#include <server.h>
+#include <server_common.h>
+#include <client_code.h>
+#include <classic.h>
+#include <net.h>
+#include <item_lib.h>
+#include <string_lib.h>
+#include <file_lib.h>
+
+/*
+ * Compares protocol version 1 transactions (ASCII header, at most CF_BUFSIZE)
+ * with version 2 frames over a local socket, for one huge file, many small
+ * files and a large directory listing. TLS is left out, so the saving in TLS
+ * records, one per transaction, comes on top of what is shown here.
+ *
+ * Usage: frame_load [megabytes] [small files]
+ */
+
+static char TEST_DIR[] = "/tmp/frame_load.XXXXXX";
+static char SOURCE[CF_BUFSIZE];
+static char DEST[CF_BUFSIZE];
+static int SOCKETS[2];
+static int PROTOCOL_VERSION;
+static off_t SIZE;
+static int REQUESTS;
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void WriteFile(const char *path, off_t size)
+{
+    char block[64 * 1024];
+    for (size_t i = 0; i < sizeof(block); i++)
+    {
+        block[i] = 1 + i % 251;      /* no zeros, which would be written as holes */
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    for (off_t written = 0; written < size; written += sizeof(block))
+    {
+        FullWrite(fd, block, MIN(sizeof(block), size - written));
+    }
+    close(fd);
+}
+
+/* The file chopped into protocol version 1 transactions */
+static void *ServeTransactions(ARG_UNUSED void *arg)
+{
+    ConnectionInfo conn_info = { .type = CF_PROTOCOL_CLASSIC, .sd = SOCKETS[1] };
+    char buffer[CF_BUFSIZE];
+    int fd = open(SOURCE, O_RDONLY);
+    off_t total = 0;
+
+    while (total < SIZE)
+    {
+        int n_read = FullRead(fd, buffer, MIN(CF_BUFSIZE - CF_INBAND_OFFSET, SIZE - total));
+        total += n_read;
+        SendTransaction(&conn_info, buffer, n_read, (total == SIZE) ? CF_DONE : CF_MORE);
+    }
+
+    close(fd);
+    return NULL;
+}
+
+static void RecvTransactions(void)
+{
+    ConnectionInfo conn_info = { .type = CF_PROTOCOL_CLASSIC, .sd = SOCKETS[0] };
+    char buffer[CF_BUFSIZE];
+    int fd = open(DEST, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    int more = true;
+
+    while (more)
+    {
+        int n_read = ReceiveTransaction(&conn_info, buffer, &more);
+        if (n_read <= 0)
+        {
+            break;
+        }
+        FullWrite(fd, buffer, n_read);
+    }
+
+    close(fd);
+}
+
+static void *Serve(ARG_UNUSED void *arg)
+{
+    ServerConnectionState *conn = xcalloc(1, sizeof(ServerConnectionState));
+    conn->conn_info.type = CF_PROTOCOL_CLASSIC;
+    conn->conn_info.sd = SOCKETS[1];
+    conn->conn_info.protocol_version = PROTOCOL_VERSION;
+    conn->uid = getuid();
+
+    char recvbuffer[CF_BUFSIZE], sendbuffer[CF_BUFSIZE], filename[CF_BUFSIZE];
+
+    for (int i = 0; i < REQUESTS; i++)
+    {
+        ReceiveTransaction(&conn->conn_info, recvbuffer, NULL);
+
+        if (strncmp(recvbuffer, "OPENDIR ", 8) == 0)
+        {
+            CfOpenDirectory(conn, sendbuffer, recvbuffer + 8);
+        }
+        else
+        {
+            ServerFileGetState args = {
+                .connect = conn,
+                .replybuff = sendbuffer,
+                .replyfile = filename,
+            };
+            sscanf(recvbuffer, "GET %d %[^\n]", &args.buf_size, filename);
+            CfGetFile(&args);
+        }
+    }
+
+    free(conn);
+    return NULL;
+}
+
+static AgentConnection *StartServer(pthread_t *thread, int version, int requests)
+{
+    static AgentConnection conn;
+    conn = (AgentConnection) {
+        .conn_info = { .type = CF_PROTOCOL_CLASSIC, .sd = SOCKETS[0], .protocol_version = version },
+        .this_server = "localhost",
+    };
+
+    PROTOCOL_VERSION = version;
+    REQUESTS = requests;
+    pthread_create(thread, NULL, Serve, NULL);
+    return &conn;
+}
+
+static void HugeFile(void)
+{
+    pthread_t thread;
+
+    WriteFile(SOURCE, SIZE);
+
+    double start = Now();
+    pthread_create(&thread, NULL, ServeTransactions, NULL);
+    RecvTransactions();
+    pthread_join(thread, NULL);
+    printf("%-44s %8.1f MB/s\n", "huge file, 4 kB transactions",
+           SIZE / (1024.0 * 1024.0) / (Now() - start));
+
+    start = Now();
+    AgentConnection *conn = StartServer(&thread, 2, 1);
+    CopyRegularFileNet(SOURCE, DEST, SIZE, false, conn);
+    pthread_join(thread, NULL);
+    printf("%-44s %8.1f MB/s\n", "huge file, frames",
+           SIZE / (1024.0 * 1024.0) / (Now() - start));
+}
+
+static void SmallFiles(int count)
+{
+    const off_t size = 10 * 1024;
+    WriteFile(SOURCE, size);
+
+    /* Version 1 here is the classic plaintext stream, the fastest of them */
+    for (int version = 1; version <= 2; version++)
+    {
+        pthread_t thread;
+        double start = Now();
+        AgentConnection *conn = StartServer(&thread, (version == 1) ? 0 : 2, count);
+
+        for (int i = 0; i < count; i++)
+        {
+            CopyRegularFileNet(SOURCE, DEST, size, false, conn);
+        }
+
+        pthread_join(thread, NULL);
+        printf("%6d x 10 kB files, %-23s %8.1f us/file\n", count,
+               (version == 1) ? "classic stream" : "frames",
+               (Now() - start) * 1e6 / count);
+    }
+}
+
+static void DirectoryListing(int count)
+{
+    char dir[CF_BUFSIZE];
+    snprintf(dir, sizeof(dir), "%s/dir", TEST_DIR);
+    mkdir(dir, 0700);
+
+    for (int i = 0; i < count; i++)
+    {
+        char path[CF_BUFSIZE];
+        snprintf(path, sizeof(path), "%s/some_file_name_%d", dir, i);
+        close(open(path, O_WRONLY | O_CREAT, 0600));
+    }
+
+    for (int version = 1; version <= 2; version++)
+    {
+        const int repeat = 20;
+        pthread_t thread;
+        double start = Now();
+        AgentConnection *conn = StartServer(&thread, version, repeat);
+
+        for (int i = 0; i < repeat; i++)
+        {
+            DeleteItemList(RemoteDirList(dir, false, conn));
+        }
+
+        pthread_join(thread, NULL);
+        printf("%6d entries listing, %-23s %8.2f ms\n", count,
+               (version == 1) ? "4 kB transactions" : "frames",
+               (Now() - start) * 1000 / repeat);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        char path[CF_BUFSIZE];
+        snprintf(path, sizeof(path), "%s/some_file_name_%d", dir, i);
+        unlink(path);
+    }
+    rmdir(dir);
+}
+
+int main(int argc, char **argv)
+{
+    SIZE = (off_t) ((argc > 1) ? atoi(argv[1]) : 256) * 1024 * 1024;
+    int small_files = (argc > 2) ? atoi(argv[2]) : 5000;
+
+    mkdtemp(TEST_DIR);
+    snprintf(SOURCE, sizeof(SOURCE), "%s/source", TEST_DIR);
+    snprintf(DEST, sizeof(DEST), "%s/dest", TEST_DIR);
+    socketpair(AF_UNIX, SOCK_STREAM, 0, SOCKETS);
+
+    HugeFile();
+    SmallFiles(small_files);
+    DirectoryListing(20000);
+
+    unlink(SOURCE);
+    unlink(DEST);
+    rmdir(TEST_DIR);
+    return 0;
+}
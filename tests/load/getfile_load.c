@@ -0,0 +1,182 @@
+#include <cf3.defs.h>
+#include <server.h>
+#include <server_common.h>
+#include <client_code.h>
+#include <classic.h>
+#include <net.h>
+#include <string_lib.h>
+#include <file_lib.h>
+
+/*
+ * Throughput of a plaintext classic GET over a local socket: the 2 kB
+ * read()/send() and recv()/write() loop that CfGetFile and CopyRegularFileNet
+ * used to run, against the current CfGetFile and CopyRegularFileNet.
+ *
+ * Usage: getfile_load [megabytes]
+ */
+
+#define BLOCKSIZE 2048
+
+static char SOURCE[] = "/tmp/getfile_load.XXXXXX";
+static char DEST[CF_BUFSIZE];
+static int SOCKETS[2];
+static off_t SIZE;
+
+static double SERVER_CPU;
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* CPU time (user + system) of the calling thread */
+static double ThreadCpu(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void PrintThroughput(const char *what, double start, double end, double client_cpu)
+{
+    printf("%-30s %8.1f MB/s  server cpu %7.2f ms  client cpu %7.2f ms\n", what,
+           SIZE / (1024.0 * 1024.0) / (end - start), SERVER_CPU * 1000, client_cpu * 1000);
+}
+
+static void *ServeLegacy(ARG_UNUSED void *arg)
+{
+    double cpu = ThreadCpu();
+    char buffer[BLOCKSIZE];
+    int fd = open(SOURCE, O_RDONLY);
+    ssize_t n_read;
+
+    while ((n_read = read(fd, buffer, BLOCKSIZE)) > 0)
+    {
+        SendSocketStream(SOCKETS[1], buffer, n_read);
+    }
+
+    close(fd);
+    SERVER_CPU = ThreadCpu() - cpu;
+    return NULL;
+}
+
+/* Same as FSWrite in client_code.c: zero runs become holes */
+static void WriteSparse(int fd, const char *buf, size_t n_write)
+{
+    const void *cur = buf;
+    const void *end = buf + n_write;
+
+    while (cur < end)
+    {
+        const void *skip_span = MemSpan(cur, 0, end - cur);
+        if (skip_span > cur)
+        {
+            lseek(fd, skip_span - cur, SEEK_CUR);
+            cur = skip_span;
+        }
+
+        const void *copy_span = MemSpanInverse(cur, 0, end - cur);
+        if (copy_span > cur)
+        {
+            FullWrite(fd, cur, copy_span - cur);
+            cur = copy_span;
+        }
+    }
+}
+
+static void RecvLegacy(void)
+{
+    char buffer[CF_BUFSIZE];
+    int fd = open(DEST, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+    for (off_t total = 0; total < SIZE; total += BLOCKSIZE)
+    {
+        int toget = MIN(BLOCKSIZE, SIZE - total);
+        RecvSocketStream(SOCKETS[0], buffer, toget);
+        WriteSparse(fd, buffer, toget);
+    }
+
+    close(fd);
+}
+
+static void *ServeGet(ARG_UNUSED void *arg)
+{
+    double cpu = ThreadCpu();
+    ServerConnectionState *conn = xcalloc(1, sizeof(ServerConnectionState));
+    conn->conn_info.type = CF_PROTOCOL_CLASSIC;
+    conn->conn_info.sd = SOCKETS[1];
+    conn->uid = getuid();
+
+    char recvbuffer[CF_BUFSIZE], sendbuffer[CF_BUFSIZE], filename[CF_BUFSIZE];
+    ServerFileGetState args = {
+        .connect = conn,
+        .replybuff = sendbuffer,
+        .replyfile = filename,
+    };
+
+    ReceiveTransaction(&conn->conn_info, recvbuffer, NULL);
+    sscanf(recvbuffer, "GET %d %[^\n]", &args.buf_size, filename);
+    CfGetFile(&args);
+
+    free(conn);
+    SERVER_CPU = ThreadCpu() - cpu;
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    SIZE = (off_t) ((argc > 1) ? atoi(argv[1]) : 256) * 1024 * 1024;
+
+    int fd = mkstemp(SOURCE);
+    char *block = xmalloc(1024 * 1024);
+    for (int i = 0; i < 1024 * 1024; i++)
+    {
+        block[i] = 1 + i % 251;      /* no zeros, which would be written as holes */
+    }
+    for (off_t written = 0; written < SIZE; written += 1024 * 1024)
+    {
+        write(fd, block, 1024 * 1024);
+    }
+    close(fd);
+    free(block);
+
+    snprintf(DEST, sizeof(DEST), "%s.copy", SOURCE);
+    socketpair(AF_UNIX, SOCK_STREAM, 0, SOCKETS);
+
+    {
+        pthread_t thread;
+        double start = Now(), cpu = ThreadCpu();
+        pthread_create(&thread, NULL, ServeLegacy, NULL);
+        RecvLegacy();
+        cpu = ThreadCpu() - cpu;
+        pthread_join(thread, NULL);
+        PrintThroughput("2 kB read/send loop", start, Now(), cpu);
+    }
+
+    {
+        AgentConnection conn = {
+            .conn_info = { .type = CF_PROTOCOL_CLASSIC, .sd = SOCKETS[0] },
+            .this_server = "localhost",
+        };
+
+        pthread_t thread;
+        double start = Now(), cpu = ThreadCpu();
+        pthread_create(&thread, NULL, ServeGet, NULL);
+        bool ok = CopyRegularFileNet(SOURCE, DEST, SIZE, false, &conn);
+        cpu = ThreadCpu() - cpu;
+        pthread_join(thread, NULL);
+        PrintThroughput("CfGetFile/CopyRegularFileNet", start, Now(), cpu);
+
+        if (!ok)
+        {
+            printf("Copy failed\n");
+            return 1;
+        }
+    }
+
+    unlink(SOURCE);
+    unlink(DEST);
+    return 0;
+}
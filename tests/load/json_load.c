@@ -0,0 +1,149 @@
+#include <platform.h>
+#include <sys/resource.h>
+#include <json.h>
+#include <alloc.h>
+#include <file_lib.h>
+#include <writer.h>
+
+/*
+ * Reads an inventory-style JSON document (an object with one entry per host,
+ * each with a list of packages) of 100 MB by default: with FileRead() and
+ * JsonParse(), then with JsonParseFile(), each in a child process so that
+ * their peak memory can be told apart. Then builds objects of up to 20000
+ * properties, with and without the scan that looked for an existing key on
+ * every append before objects had an index.
+ *
+ * Usage: json_load [megabytes]
+ */
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void WriteInventory(const char *path, size_t size)
+{
+    FILE *fp = fopen(path, "w");
+    size_t written = fprintf(fp, "{\n");
+
+    for (int host = 0; written < size; host++)
+    {
+        written += fprintf(fp, "%s  \"host%d.example.com\": {\n"
+                           "    \"os\": \"linux\",\n    \"address\": \"10.%d.%d.%d\",\n"
+                           "    \"uptime\": %d,\n    \"virtual\": %s,\n    \"packages\": [\n",
+                           (host == 0) ? "" : ",\n", host, (host >> 16) & 0xff,
+                           (host >> 8) & 0xff, host & 0xff, host * 7, (host % 3) ? "true" : "false");
+
+        for (int i = 0; i < 10; i++)
+        {
+            written += fprintf(fp, "      { \"name\": \"package-%d\", \"version\": \"%d.%d-%d\", \"arch\": \"x86_64\" }%s\n",
+                               (host + i * 31) % 2000, i, host % 10, host % 7, (i < 9) ? "," : "");
+        }
+
+        written += fprintf(fp, "    ]\n  }");
+    }
+
+    fprintf(fp, "\n}\n");
+    fclose(fp);
+}
+
+static void ParseInChild(const char *what, const char *path, bool streaming)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        double start = Now();
+        JsonElement *json = NULL;
+        JsonParseError err;
+
+        if (streaming)
+        {
+            err = JsonParseFile(path, SIZE_MAX, &json);
+        }
+        else
+        {
+            Writer *contents = FileRead(path, SIZE_MAX, NULL);
+            const char *data = StringWriterData(contents);
+            err = JsonParse(&data, &json);
+            WriterClose(contents);
+        }
+
+        double end = Now();
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+
+        printf("%-28s %8.0f ms  %8ld MB peak  %zu hosts%s\n", what, (end - start) * 1000,
+               usage.ru_maxrss / 1024, json ? JsonLength(json) : 0,
+               (err == JSON_PARSE_OK) ? "" : ", failed");
+        fflush(stdout);
+        _exit(0);
+    }
+
+    waitpid(pid, NULL, 0);
+}
+
+/* What JsonObjectAppendElement() did before appending: scan for the key */
+static bool LegacyHasKey(const JsonElement *object, const char *key)
+{
+    for (size_t i = 0; i < JsonLength(object); i++)
+    {
+        if (strcmp(JsonGetPropertyAsString(JsonAt(object, i)), key) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void BuildObject(int count)
+{
+    char key[64];
+    int found = 0;
+
+    double start = Now();
+    JsonElement *object = JsonObjectCreate(64);
+    for (int i = 0; i < count; i++)
+    {
+        snprintf(key, sizeof(key), "property_number_%d", i);
+        found += LegacyHasKey(object, key);
+        JsonObjectAppendInteger(object, key, i);
+    }
+    double legacy = Now() - start;
+    JsonDestroy(object);
+
+    start = Now();
+    object = JsonObjectCreate(64);
+    for (int i = 0; i < count; i++)
+    {
+        snprintf(key, sizeof(key), "property_number_%d", i);
+        JsonObjectAppendInteger(object, key, i);
+    }
+    double indexed = Now() - start;
+    JsonDestroy(object);
+
+    printf("%6d properties  scan: %9.2f ms  index: %7.2f ms%s\n", count,
+           legacy * 1000, indexed * 1000, found ? " (duplicates?)" : "");
+}
+
+int main(int argc, char **argv)
+{
+    size_t size = (size_t) ((argc > 1) ? atoi(argv[1]) : 100) * 1024 * 1024;
+
+    char path[] = "/tmp/json_load.XXXXXX";
+    close(mkstemp(path));
+    WriteInventory(path, size);
+
+    ParseInChild("FileRead + JsonParse", path, false);
+    ParseInChild("JsonParseFile", path, true);
+    unlink(path);
+
+    const int counts[] = { 1000, 10000, 20000 };
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+    {
+        BuildObject(counts[i]);
+    }
+
+    return 0;
+}
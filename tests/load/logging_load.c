@@ -0,0 +1,105 @@
+#include <cf3.defs.h>
+#include <string_lib.h>
+
+/*
+ * Measures what a DEBUG message costs when debug logging is off: formatting
+ * it before looking at the levels as VLog() did, the level check Log() does
+ * now, and the LogDebug() macro that does not even evaluate the arguments.
+ * Also a 4 kB LogRaw() dump, which used to be copied before being dropped.
+ *
+ * Usage: logging_load [iterations]
+ */
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void PrintTiming(const char *what, double start, double end, int iterations)
+{
+    printf("%-40s %8.2f ms  %8.1f ns/call\n", what, (end - start) * 1000,
+           (end - start) * 1e9 / iterations);
+}
+
+/* The previous VLog(): format, then drop */
+static void LegacyLog(LogLevel level, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    char *msg = StringVFormat(fmt, ap);
+    va_end(ap);
+
+    if (level <= LogGetGlobalLevel())
+    {
+        fputs(msg, stdout);
+    }
+    free(msg);
+}
+
+/* The previous LogRaw(): copy the buffer, then format and drop */
+static void LegacyLogRaw(LogLevel level, const char *prefix, void *buf, size_t buflen)
+{
+    char *src = buf;
+    char dst[buflen + 1];
+    size_t i;
+
+    for (i = 0; i < buflen; i++)
+    {
+        dst[i] = isprint(src[i]) ? src[i] : '.';
+    }
+    dst[i] = '\0';
+
+    LegacyLog(level, "%s%s", prefix, dst);
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = (argc > 1) ? atoi(argv[1]) : 10000000;
+
+    LogSetGlobalLevel(LOG_LEVEL_NOTICE);
+
+    const char *header = "t 4096";
+    char data[4096];
+    memset(data, 'x', sizeof(data));
+
+    double start = Now();
+    for (int i = 0; i < iterations; i++)
+    {
+        LegacyLog(LOG_LEVEL_DEBUG, "SendTransaction header:'%s' %d", header, i);
+    }
+    PrintTiming("format, then check level", start, Now(), iterations);
+
+    start = Now();
+    for (int i = 0; i < iterations; i++)
+    {
+        Log(LOG_LEVEL_DEBUG, "SendTransaction header:'%s' %d", header, i);
+    }
+    PrintTiming("Log()", start, Now(), iterations);
+
+    start = Now();
+    for (int i = 0; i < iterations; i++)
+    {
+        LogDebug(LOG_MOD_NET, "SendTransaction header:'%s' %d", header, i);
+    }
+    PrintTiming("LogDebug()", start, Now(), iterations);
+
+    int raw_iterations = iterations / 100;
+
+    start = Now();
+    for (int i = 0; i < raw_iterations; i++)
+    {
+        LegacyLogRaw(LOG_LEVEL_DEBUG, "SendTransaction data: ", data, sizeof(data));
+    }
+    PrintTiming("4 kB raw dump, copy then check level", start, Now(), raw_iterations);
+
+    start = Now();
+    for (int i = 0; i < raw_iterations; i++)
+    {
+        LogRaw(LOG_MOD_NET, LOG_LEVEL_DEBUG, "SendTransaction data: ", data, sizeof(data));
+    }
+    PrintTiming("4 kB raw dump, LogRaw()", start, Now(), raw_iterations);
+
+    return 0;
+}
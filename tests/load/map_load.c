@@ -0,0 +1,200 @@
+#include <platform.h>
+#include <hash_map_priv.h>
+#include <map.h>
+#include <alloc.h>
+#include <string_lib.h>
+
+/*
+ * Compares the open addressing HashMap with the chained one it replaced
+ * (8192 buckets to start with, one allocation per item) at 10, 1k and 1M
+ * string keys: memory held by the table, and the time of a successful and
+ * of a failed lookup.
+ *
+ * Usage: map_load [lookups]
+ */
+
+typedef struct LegacyItem_
+{
+    MapKeyValue value;
+    struct LegacyItem_ *next;
+} LegacyItem;
+
+typedef struct
+{
+    MapHashFn hash_fn;
+    MapKeyEqualFn equal_fn;
+    LegacyItem **buckets;
+    size_t size;
+    size_t load;
+} LegacyHashMap;
+
+static size_t FOUND;
+
+static void Nop(ARG_UNUSED void *p)
+{
+}
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static LegacyHashMap *LegacyNew(void)
+{
+    LegacyHashMap *map = xcalloc(1, sizeof(LegacyHashMap));
+    map->hash_fn = (MapHashFn) StringHash;
+    map->equal_fn = (MapKeyEqualFn) StringSafeEqual;
+    map->size = 8192;
+    map->buckets = xcalloc(map->size, sizeof(LegacyItem *));
+    return map;
+}
+
+static void LegacyInsert(LegacyHashMap *map, void *key, void *value)
+{
+    unsigned bucket = map->hash_fn(key, 0, map->size);
+    LegacyItem *item = xcalloc(1, sizeof(LegacyItem));
+    item->value = (MapKeyValue) { key, value };
+    item->next = map->buckets[bucket];
+    map->buckets[bucket] = item;
+
+    if (++map->load > map->size)
+    {
+        LegacyItem **old_buckets = map->buckets;
+        size_t old_size = map->size;
+
+        map->size *= 2;
+        map->buckets = xcalloc(map->size, sizeof(LegacyItem *));
+
+        for (size_t i = 0; i < old_size; i++)
+        {
+            for (LegacyItem *it = old_buckets[i], *next; it != NULL; it = next)
+            {
+                next = it->next;
+                unsigned b = map->hash_fn(it->value.key, 0, map->size);
+                it->next = map->buckets[b];
+                map->buckets[b] = it;
+            }
+        }
+        free(old_buckets);
+    }
+}
+
+static MapKeyValue *LegacyGet(const LegacyHashMap *map, const void *key)
+{
+    for (LegacyItem *it = map->buckets[map->hash_fn(key, 0, map->size)]; it != NULL; it = it->next)
+    {
+        if (map->equal_fn(it->value.key, key))
+        {
+            return &it->value;
+        }
+    }
+    return NULL;
+}
+
+static void LegacyDestroy(LegacyHashMap *map)
+{
+    for (size_t i = 0; i < map->size; i++)
+    {
+        for (LegacyItem *it = map->buckets[i], *next; it != NULL; it = next)
+        {
+            next = it->next;
+            free(it);
+        }
+    }
+    free(map->buckets);
+    free(map);
+}
+
+static void Compare(char **keys, int n, int lookups)
+{
+    LegacyHashMap *legacy = LegacyNew();
+    HashMap *current = HashMapNew((MapHashFn) StringHash, (MapKeyEqualFn) StringSafeEqual, Nop, Nop);
+
+    for (int i = 0; i < n; i++)
+    {
+        LegacyInsert(legacy, keys[i], keys[i]);
+        HashMapInsert(current, keys[i], keys[i]);
+    }
+
+    /* Without malloc's own overhead, which the chained items pay once each */
+    size_t legacy_bytes = legacy->size * sizeof(LegacyItem *) + n * sizeof(LegacyItem);
+    size_t current_bytes = current->size * sizeof(HashMapSlot);
+
+    double start = Now();
+    for (int i = 0; i < lookups; i++)
+    {
+        FOUND += (LegacyGet(legacy, keys[i % n]) != NULL);
+    }
+    double legacy_hit = (Now() - start) * 1e9 / lookups;
+
+    start = Now();
+    for (int i = 0; i < lookups; i++)
+    {
+        FOUND += (HashMapGet(current, keys[i % n]) != NULL);
+    }
+    double current_hit = (Now() - start) * 1e9 / lookups;
+
+    start = Now();
+    for (int i = 0; i < lookups; i++)
+    {
+        FOUND += (LegacyGet(legacy, "missing key") != NULL);
+    }
+    double legacy_miss = (Now() - start) * 1e9 / lookups;
+
+    start = Now();
+    for (int i = 0; i < lookups; i++)
+    {
+        FOUND += (HashMapGet(current, "missing key") != NULL);
+    }
+    double current_miss = (Now() - start) * 1e9 / lookups;
+
+    printf("%8d items  chained: %10zu bytes %6.1f ns hit %6.1f ns miss\n",
+           n, legacy_bytes, legacy_hit, legacy_miss);
+    printf("%8s        open:    %10zu bytes %6.1f ns hit %6.1f ns miss\n",
+           "", current_bytes, current_hit, current_miss);
+
+    LegacyDestroy(legacy);
+    HashMapDestroy(current);
+}
+
+int main(int argc, char **argv)
+{
+    int lookups = (argc > 1) ? atoi(argv[1]) : 5000000;
+    const int sizes[] = { 10, 1000, 1000000 };
+
+    char **keys = xcalloc(1000000, sizeof(char *));
+    for (int i = 0; i < 1000000; i++)
+    {
+        keys[i] = StringFormat("default:bundle.variable_%d", i);
+    }
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        Compare(keys, sizes[i], lookups);
+    }
+
+    /* Small maps never get past the ArrayMap */
+    Map *map = MapNew((MapHashFn) StringHash, (MapKeyEqualFn) StringSafeEqual, NULL, NULL);
+    for (int i = 0; i < 10; i++)
+    {
+        MapInsert(map, keys[i], keys[i]);
+    }
+    double start = Now();
+    for (int i = 0; i < lookups; i++)
+    {
+        FOUND += (MapGet(map, keys[i % 10]) != NULL);
+    }
+    printf("%8d items  Map (array): %6.1f ns hit\n", 10, (Now() - start) * 1e9 / lookups);
+    MapDestroy(map);
+
+    for (int i = 0; i < 1000000; i++)
+    {
+        free(keys[i]);
+    }
+    free(keys);
+
+    /* Keeps the lookups from being optimized out */
+    return (FOUND == 0);
+}
@@ -0,0 +1,155 @@
+#include <cf3.defs.h>
+#include <verify_packages.h>
+#include <env_context.h>
+#include <files_names.h>
+#include <string_lib.h>
+
+/*
+ * An installed list of 3000 packages (by default) matched by 500 package
+ * promises: reading the list back from the CSV cache as the agent used to,
+ * against loading it from the binary inventory, then the promises matched by
+ * scanning the whole list with ComparePackages(), as PackageMatch() did,
+ * against looking the name up in an index like pack_index first.
+ *
+ * Usage: package_load [packages] [promises]
+ */
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* What GetCachedPackageList() did with each line of the CSV cache */
+static PackageItem *ReadCSVCache(const char *path, const char *thismanager)
+{
+    char name[CF_MAXVARSIZE], version[CF_MAXVARSIZE], arch[CF_MAXVARSIZE], mgr[CF_MAXVARSIZE], line[CF_BUFSIZE];
+    PackageItem *list = NULL;
+    FILE *fin = fopen(path, "r");
+
+    while (fgets(line, sizeof(line), fin) != NULL)
+    {
+        sscanf(line, "%250[^,],%250[^,],%250[^,],%250[^\n]", name, version, arch, mgr);
+        if (strcmp(thismanager, mgr) == 0)
+        {
+            PrependPackageItem(NULL, &list, name, version, arch, NULL);
+        }
+    }
+
+    fclose(fin);
+    return list;
+}
+
+static void DeleteItems(PackageItem *list)
+{
+    for (PackageItem *pi = list, *next; pi != NULL; pi = next)
+    {
+        next = pi->next;
+        free(pi->name);
+        free(pi->version);
+        free(pi->arch);
+        free(pi);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int packages = (argc > 1) ? atoi(argv[1]) : 3000;
+    int promises = (argc > 2) ? atoi(argv[2]) : 500;
+
+    snprintf(CFWORKDIR, CF_BUFSIZE, "/tmp/package_load.XXXXXX");
+    mkdtemp(CFWORKDIR);
+    char path[CF_BUFSIZE];
+    snprintf(path, sizeof(path), "%s/state", CFWORKDIR);
+    mkdir(path, 0700);
+
+    PackageManager manager = { .manager = "/bin/rpm -qa", .list_time = time(NULL) };
+    for (int i = 0; i < packages; i++)
+    {
+        char name[64], version[64];
+        snprintf(name, sizeof(name), "package-number-%d", i);
+        snprintf(version, sizeof(version), "%d.%d.%d-%d.el7", i % 5, i % 17, i % 3, i % 11);
+        PrependPackageItem(NULL, &manager.pack_list, name, version, "x86_64", NULL);
+    }
+
+    /* Loading */
+    FILE *fout = fopen(GetSoftwareCacheFilename(path), "w");
+    for (PackageItem *pi = manager.pack_list; pi != NULL; pi = pi->next)
+    {
+        fprintf(fout, "%s,%s,%s,rpm\n", pi->name, pi->version, pi->arch);
+    }
+    fclose(fout);
+
+    double start = Now();
+    DeleteItems(ReadCSVCache(path, "rpm"));
+    printf("%6d packages  CSV cache:        %8.2f ms\n", packages, (Now() - start) * 1000);
+
+    WriteSoftwareInventory(&manager);
+    PackageManager loaded = { .manager = manager.manager };
+    Attributes a = { .packages = { .package_list_update_ifelapsed = CF_NOINT, .package_select = PACKAGE_VERSION_COMPARATOR_GE } };
+
+    start = Now();
+    LoadSoftwareInventory(&loaded, "x86_64", a);
+    printf("%6d packages  binary inventory: %8.2f ms\n", packages, (Now() - start) * 1000);
+    DeleteItems(loaded.pack_list);
+
+    /* Matching */
+    EvalContext *ctx = EvalContextNew();
+    PromiseResult result;
+    int matched = 0;
+
+    start = Now();
+    for (int i = 0; i < promises; i++)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "package-number-%d", (i * 7919) % packages);
+        for (PackageItem *pi = manager.pack_list; pi != NULL; pi = pi->next)
+        {
+            if (ComparePackages(ctx, name, "0", "*", pi, a, NULL, "test", &result) != VERCMP_NO_MATCH)
+            {
+                matched++;
+                break;
+            }
+        }
+    }
+    printf("%6d promises  list scan:        %8.2f ms (%d matched)\n", promises, (Now() - start) * 1000, matched);
+
+    matched = 0;
+    start = Now();
+    Map *index = MapNew((MapHashFn) StringHash, (MapKeyEqualFn) StringSafeEqual, free, (MapDestroyDataFn) SeqDestroy);
+    for (PackageItem *pi = manager.pack_list; pi != NULL; pi = pi->next)
+    {
+        const char *key = CanonifyChar(pi->name, ',');
+        Seq *items = MapGet(index, key);
+        if (items == NULL)
+        {
+            items = SeqNew(1, NULL);
+            MapInsert(index, xstrdup(key), items);
+        }
+        SeqAppend(items, pi);
+    }
+    for (int i = 0; i < promises; i++)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "package-number-%d", (i * 7919) % packages);
+        Seq *items = MapGet(index, CanonifyChar(name, ','));
+        for (size_t j = 0; (items != NULL) && (j < SeqLength(items)); j++)
+        {
+            if (ComparePackages(ctx, name, "0", "*", SeqAt(items, j), a, NULL, "test", &result) != VERCMP_NO_MATCH)
+            {
+                matched++;
+                break;
+            }
+        }
+    }
+    printf("%6d promises  name index:       %8.2f ms (%d matched)\n", promises, (Now() - start) * 1000, matched);
+
+    MapDestroy(index);
+    EvalContextDestroy(ctx);
+    DeleteItems(manager.pack_list);
+
+    char cmd[CF_BUFSIZE];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", CFWORKDIR);
+    return system(cmd);
+}
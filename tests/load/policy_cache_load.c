@@ -0,0 +1,86 @@
+#include <cf3.defs.h>
+#include <policy_cache.h>
+#include <parser.h>
+#include <crypto.h>
+
+/*
+ * Loads a generated policy file of about 40k lines by parsing it and from
+ * the policy cache.
+ *
+ * Usage: policy_cache_load [bundles]
+ */
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void WritePolicy(const char *path, int bundles)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+    {
+        exit(1);
+    }
+
+    for (int i = 0; i < bundles; i++)
+    {
+        fprintf(fp, "bundle agent library_%d(path)\n{\n  vars:\n", i);
+        for (int j = 0; j < 10; j++)
+        {
+            fprintf(fp, "      \"v%d\" string => concat(\"$(path)\", \"/%d\"),\n"
+                        "              comment => \"Variable %d\";\n", j, j, j);
+        }
+        fprintf(fp, "  files:\n    linux::\n      \"$(path)\"\n        create => \"true\",\n"
+                    "        perms => m(\"644\");\n  reports:\n      \"library_%d done\";\n}\n\n", i);
+    }
+
+    fprintf(fp, "body perms m(mode)\n{\n  mode => \"$(mode)\";\n}\n");
+    fclose(fp);
+}
+
+int main(int argc, char **argv)
+{
+    int bundles = (argc > 1) ? atoi(argv[1]) : 1300;
+
+    CryptoInitialize();
+
+    char dir[] = "/tmp/policy_cache_load.XXXXXX";
+    if (!mkdtemp(dir))
+    {
+        return 1;
+    }
+    snprintf(CFWORKDIR, CF_BUFSIZE, "%s", dir);
+
+    char path[CF_BUFSIZE];
+    snprintf(path, sizeof(path), "%s/promises.cf", dir);
+    WritePolicy(path, bundles);
+
+    double start = Now();
+    Policy *parsed = ParserParseFile(AGENT_TYPE_AGENT, path, 0, 0);
+    double parse = Now() - start;
+
+    PolicyCacheKey key;
+    PolicyCacheLoad(AGENT_TYPE_AGENT, path, &key);
+    PolicyCacheStore(&key, parsed);
+
+    start = Now();
+    Policy *cached = PolicyCacheLoad(AGENT_TYPE_AGENT, path, &key);
+    double load = Now() - start;
+
+    printf("%d bundles, %zu parsed\n", bundles, parsed ? SeqLength(parsed->bundles) : 0);
+    printf("%-40s %8.2f ms\n", "parse", parse * 1000);
+    printf("%-40s %8.2f ms\n", "load from the cache", load * 1000);
+
+    int ret = (cached == NULL);
+    PolicyDestroy(parsed);
+    PolicyDestroy(cached);
+
+    char cmd[CF_BUFSIZE];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", dir);
+    system(cmd);
+
+    return ret;
+}
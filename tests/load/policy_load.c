@@ -0,0 +1,99 @@
+#include <cf3.defs.h>
+#include <policy.h>
+#include <string_lib.h>
+
+/*
+ * Resolves every bundle and body of a policy the size of masterfiles plus a
+ * large library by name, as usebundle and body references do: with the scan
+ * PolicyGetBundle()/PolicyGetBody() did, copying each candidate name to
+ * strip its namespace, and with the index.
+ *
+ * Usage: policy_load [bundles]
+ */
+
+static size_t FOUND;
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *LegacyStripNamespace(const char *full_symbol)
+{
+    char *sep = strchr(full_symbol, CF_NS);
+    return xstrdup(sep ? sep + 1 : full_symbol);
+}
+
+/* The previous PolicyGetBundle() */
+static Bundle *LegacyGetBundle(const Policy *policy, const char *ns, const char *type, const char *name)
+{
+    for (size_t i = 0; i < SeqLength(policy->bundles); i++)
+    {
+        Bundle *bp = SeqAt(policy->bundles, i);
+
+        char *bundle_symbol = LegacyStripNamespace(bp->name);
+
+        if ((!type || strcmp(bp->type, type) == 0) && ((strcmp(bundle_symbol, name) == 0) || (strcmp(bp->name, name) == 0)))
+        {
+            free(bundle_symbol);
+
+            if (ns && strcmp(bp->ns, ns) != 0)
+            {
+                continue;
+            }
+
+            return bp;
+        }
+
+        free(bundle_symbol);
+    }
+
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int n = (argc > 1) ? atoi(argv[1]) : 3000;
+
+    Policy *policy = PolicyNew();
+    char **names = xcalloc(n, sizeof(char *));
+
+    double start = Now();
+    for (int i = 0; i < n; i++)
+    {
+        names[i] = StringFormat("library_bundle_%d", i);
+        PolicyAppendBundle(policy, NamespaceDefault(), names[i], "agent", NULL, NULL);
+        PolicyAppendBody(policy, NamespaceDefault(), names[i], "perms", NULL, NULL);
+    }
+    printf("%d bundles and bodies appended and indexed in %.2f ms\n", n, (Now() - start) * 1000);
+
+    start = Now();
+    for (int i = 0; i < n; i++)
+    {
+        FOUND += (LegacyGetBundle(policy, NULL, "agent", names[i]) != NULL);
+    }
+    double legacy = Now() - start;
+
+    start = Now();
+    for (int i = 0; i < n; i++)
+    {
+        FOUND += (PolicyGetBundle(policy, NULL, "agent", names[i]) != NULL);
+        FOUND += (PolicyGetBody(policy, NamespaceDefault(), "perms", names[i]) != NULL);
+    }
+    double indexed = Now() - start;
+
+    printf("%-40s %8.2f ms\n", "resolve every bundle, scan", legacy * 1000);
+    printf("%-40s %8.2f ms\n", "resolve every bundle and body, index", indexed * 1000);
+
+    PolicyDestroy(policy);
+    for (int i = 0; i < n; i++)
+    {
+        free(names[i]);
+    }
+    free(names);
+
+    /* Keeps the lookups from being optimized out */
+    return (FOUND == 0);
+}
@@ -0,0 +1,134 @@
+#include <cf3.defs.h>
+#include <server.h>
+#include <server_common.h>
+#include <client_code.h>
+#include <communication.h>
+#include <net.h>
+
+#include <sys/ioctl.h>
+
+/*
+ * Stats every file of a directory through a local cf-serverd connection, one
+ * SYNCH STAT round trip per file as cf_remote_stat did for each directory
+ * entry of a recursive copy, and with RemoteStatPrefetch batches. Optionally
+ * delays every reply to stand in for network latency.
+ *
+ * Usage: remote_stat_load [files] [latency_us]
+ */
+
+static char DIRECTORY[] = "/tmp/remote_stat_load.XXXXXX";
+static int SOCKETS[2];
+static int REQUESTS;
+static int LATENCY_US;
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *ServeStat(ARG_UNUSED void *arg)
+{
+    ServerConnectionState *conn = xcalloc(1, sizeof(ServerConnectionState));
+    conn->conn_info.type = CF_PROTOCOL_CLASSIC;
+    conn->conn_info.sd = SOCKETS[1];
+
+    char recvbuffer[CF_BUFSIZE], sendbuffer[CF_BUFSIZE], filename[CF_BUFSIZE];
+    long time_sent;
+
+    for (int i = 0; i < REQUESTS; i++)
+    {
+        memset(recvbuffer, 0, sizeof(recvbuffer));
+        ReceiveTransaction(&conn->conn_info, recvbuffer, NULL);
+        sscanf(recvbuffer, "SYNCH %ld STAT %[^\n]", &time_sent, filename);
+
+        /* Replies to requests that arrived together share the delay */
+        int pending = 0;
+        if (LATENCY_US > 0 && ioctl(SOCKETS[1], FIONREAD, &pending) == 0 && pending == 0)
+        {
+            usleep(LATENCY_US);
+        }
+
+        StatFile(conn, sendbuffer, filename);
+    }
+
+    free(conn);
+    return NULL;
+}
+
+static AgentConnection *Connect(void)
+{
+    AgentConnection *conn = NewAgentConn("localhost");
+    conn->conn_info.type = CF_PROTOCOL_CLASSIC;
+    conn->conn_info.sd = SOCKETS[0];
+    return conn;
+}
+
+int main(int argc, char **argv)
+{
+    int n_files = (argc > 1) ? atoi(argv[1]) : 5000;
+    LATENCY_US = (argc > 2) ? atoi(argv[2]) : 0;
+
+    mkdtemp(DIRECTORY);
+    Seq *files = SeqNew(n_files, free);
+    char path[CF_BUFSIZE];
+
+    for (int i = 0; i < n_files; i++)
+    {
+        snprintf(path, sizeof(path), "%s/file%06d", DIRECTORY, i);
+        FILE *fp = fopen(path, "w");
+        fclose(fp);
+        SeqAppend(files, xstrdup(path));
+    }
+
+    REQUESTS = n_files;
+    socketpair(AF_UNIX, SOCK_STREAM, 0, SOCKETS);
+
+    {
+        AgentConnection *conn = Connect();
+        struct stat sb;
+        pthread_t thread;
+
+        double start = Now();
+        pthread_create(&thread, NULL, ServeStat, NULL);
+        for (int i = 0; i < n_files; i++)
+        {
+            cf_remote_stat(SeqAt(files, i), &sb, "file", false, conn);
+        }
+        pthread_join(thread, NULL);
+        printf("%-30s %8.2f ms\n", "one round trip per file", (Now() - start) * 1000);
+
+        DeleteAgentConn(conn);
+    }
+
+    {
+        AgentConnection *conn = Connect();
+        struct stat sb;
+        pthread_t thread;
+
+        double start = Now();
+        pthread_create(&thread, NULL, ServeStat, NULL);
+        RemoteStatPrefetch(files, false, conn);
+        for (int i = 0; i < n_files; i++)
+        {
+            cf_remote_stat(SeqAt(files, i), &sb, "file", false, conn);
+        }
+        pthread_join(thread, NULL);
+        printf("%-30s %8.2f ms\n", "RemoteStatPrefetch", (Now() - start) * 1000);
+
+        ConnectionStats stats = ConnectionsGetStats();
+        printf("%lu requests pipelined, %lu round trips saved\n",
+               stats.pipelined, stats.round_trips_saved);
+
+        DeleteAgentConn(conn);
+    }
+
+    for (int i = 0; i < n_files; i++)
+    {
+        unlink(SeqAt(files, i));
+    }
+    rmdir(DIRECTORY);
+    SeqDestroy(files);
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include <cf3.defs.h>
+#include <server.h>
+#include <server_access.h>
+#include <item_lib.h>
+#include <matching.h>
+#include <env_context.h>
+
+/*
+ * 2000 admit rules (by default), one per host directory, and every file of
+ * 100 of those directories requested 50 times over: walking the whole rule
+ * list for each request, as AccessControl() did, against the compiled rules
+ * and the connection's cache.
+ *
+ * Usage: server_access_load [rules] [files]
+ */
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* What AccessControl() did for every request */
+static const Auth *WalkRules(EvalContext *ctx, const Auth *admit, const char *request, const char *hostname, bool *access)
+{
+    char transpath[CF_BUFSIZE];
+    struct stat statbuf;
+
+    for (const Auth *ap = admit; ap != NULL; ap = ap->next)
+    {
+        strncpy(transpath, ap->path, CF_BUFSIZE - 1);
+        MapName(transpath);
+
+        if (((strlen(request) > strlen(transpath)) && (strncmp(transpath, request, strlen(transpath)) == 0)
+             && (request[strlen(transpath)] == FILE_SEPARATOR)) || (strcmp(transpath, request) == 0)
+            || (strcmp(transpath, "/") == 0))
+        {
+            if (stat(transpath, &statbuf) == -1)
+            {
+                continue;
+            }
+
+            *access = IsMatchItemIn(ctx, ap->accesslist, "10.0.0.1") || IsRegexItemIn(ctx, ap->accesslist, (char *) hostname);
+            return ap;
+        }
+    }
+
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int rules = (argc > 1) ? atoi(argv[1]) : 2000;
+    int files = (argc > 2) ? atoi(argv[2]) : 50;
+    int dirs = 100;
+
+    char base[] = "/tmp/server_access_load.XXXXXX";
+    mkdtemp(base);
+
+    Auth *admit = NULL, **last = &admit;
+    char path[CF_BUFSIZE];
+
+    for (int i = 0; i < rules; i++)
+    {
+        snprintf(path, sizeof(path), "%s/host%d", base, i);
+        mkdir(path, 0700);
+
+        Auth *rule = xcalloc(1, sizeof(Auth));
+        rule->path = xstrdup(path);
+        PrependItem(&rule->accesslist, "10.1.0.0/16", NULL);
+        PrependItem(&rule->accesslist, "client.*\\.example\\.com", NULL);
+        *last = rule;
+        last = &rule->next;
+    }
+
+    EvalContext *ctx = EvalContextNew();
+    const char *hostname = "client1.example.com";
+    int requests = 0, granted = 0;
+
+    double start = Now();
+    for (int i = 0; i < dirs; i++)
+    {
+        for (int j = 0; j < files; j++)
+        {
+            bool access = false;
+            snprintf(path, sizeof(path), "%s/host%d/file%d", base, (i * 7919) % rules, j);
+            if (WalkRules(ctx, admit, path, hostname, &access) && access)
+            {
+                granted++;
+            }
+            requests++;
+        }
+    }
+    printf("%6d requests  rule list walk:  %8.2f ms (%d granted)\n", requests, (Now() - start) * 1000, granted);
+
+    granted = 0;
+    start = Now();
+    PathAcl *acl = PathAclCompile(admit, NULL);
+    AccessCache *cache = AccessCacheNew();
+    for (int i = 0; i < dirs; i++)
+    {
+        for (int j = 0; j < files; j++)
+        {
+            snprintf(path, sizeof(path), "%s/host%d/file%d", base, (i * 7919) % rules, j);
+            AccessDecision decision = AccessCacheDecide(cache, acl, ctx, path, "10.0.0.1", hostname);
+            if ((decision.rule != NULL) && decision.access)
+            {
+                granted++;
+            }
+        }
+    }
+    printf("%6d requests  compiled, cached:%8.2f ms (%d granted)\n", requests, (Now() - start) * 1000, granted);
+
+    AccessCacheDestroy(cache);
+    PathAclDestroy(acl);
+    EvalContextDestroy(ctx);
+
+    char cmd[CF_BUFSIZE];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", base);
+    return system(cmd);
+}
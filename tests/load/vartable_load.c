@@ -0,0 +1,132 @@
+#include <cf3.defs.h>
+#include <variable.h>
+#include <class.h>
+#include <rb-tree.h>
+#include <rlist.h>
+
+/*
+ * Compares VariableTable/ClassTable against the RBTree keyed on the bare
+ * hash that they used to be, on 100k variables and 100k classes.
+ */
+
+#define ENTRIES 100000
+#define SCOPES 100
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void PrintTiming(const char *what, double start, double end)
+{
+    printf("%-36s %8.2f ms\n", what, (end - start) * 1000);
+}
+
+int main()
+{
+    VarRef **refs = xmalloc(ENTRIES * sizeof(VarRef *));
+    char **class_names = xmalloc(ENTRIES * sizeof(char *));
+
+    for (int i = 0; i < ENTRIES; i++)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "scope_%d.var_%d", i % SCOPES, i);
+        refs[i] = VarRefParse(name);
+
+        snprintf(name, sizeof(name), "class_%d", i);
+        class_names[i] = xstrdup(name);
+    }
+
+    {
+        RBTree *tree = RBTreeNew(NULL, NULL, NULL, NULL, NULL, NULL);
+        size_t collisions = 0;
+
+        double start = Now();
+        for (int i = 0; i < ENTRIES; i++)
+        {
+            if (RBTreePut(tree, (void *)refs[i]->hash, refs[i]))
+            {
+                collisions++;
+            }
+        }
+        double put = Now();
+        for (int i = 0; i < ENTRIES; i++)
+        {
+            RBTreeGet(tree, (void *)refs[i]->hash);
+        }
+        double get = Now();
+
+        PrintTiming("RBTree variables put", start, put);
+        PrintTiming("RBTree variables get", put, get);
+        printf("RBTree variables lost to collisions: %zu\n", collisions);
+
+        RBTreeDestroy(tree);
+    }
+
+    {
+        VariableTable *table = VariableTableNew();
+        Rval rval = (Rval) { "value", RVAL_TYPE_SCALAR };
+
+        double start = Now();
+        for (int i = 0; i < ENTRIES; i++)
+        {
+            VariableTablePut(table, refs[i], &rval, DATA_TYPE_STRING);
+        }
+        double put = Now();
+        for (int i = 0; i < ENTRIES; i++)
+        {
+            if (!VariableTableGet(table, refs[i]))
+            {
+                printf("Variable %d missing\n", i);
+                return 1;
+            }
+        }
+        double get = Now();
+        size_t count = VariableTableCount(table, NULL, "scope_0", NULL);
+        double iterate = Now();
+
+        PrintTiming("VariableTable put", start, put);
+        PrintTiming("VariableTable get", put, get);
+        PrintTiming("VariableTable scope count", get, iterate);
+        printf("VariableTable entries in scope_0: %zu\n", count);
+
+        VariableTableDestroy(table);
+    }
+
+    {
+        ClassTable *table = ClassTableNew();
+
+        double start = Now();
+        for (int i = 0; i < ENTRIES; i++)
+        {
+            ClassTablePut(table, NULL, class_names[i], true, CONTEXT_SCOPE_NAMESPACE);
+        }
+        double put = Now();
+        for (int i = 0; i < ENTRIES; i++)
+        {
+            if (!ClassTableGet(table, NULL, class_names[i]))
+            {
+                printf("Class %s missing\n", class_names[i]);
+                return 1;
+            }
+        }
+        double get = Now();
+
+        PrintTiming("ClassTable put", start, put);
+        PrintTiming("ClassTable get", put, get);
+
+        ClassTableDestroy(table);
+    }
+
+    for (int i = 0; i < ENTRIES; i++)
+    {
+        VarRefDestroy(refs[i]);
+        free(class_names[i]);
+    }
+    free(refs);
+    free(class_names);
+
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include <test.h>
+
+#include <class_expression.h>
+#include <env_context.h>
+#include <policy.h>
+
+static bool InSet(const char *ns, const char *name, void *param)
+{
+    char *ref = ClassRefToString(ns, name);
+    bool found = StringSetContains(param, ref);
+    free(ref);
+    return found;
+}
+
+static bool Evaluate(const char *expr, StringSet *defined)
+{
+    ClassExpression *compiled = ClassExpressionCompile(expr);
+    assert_true(compiled != NULL);
+    bool value = ClassExpressionEvaluate(compiled, InSet, defined);
+    ClassExpressionDestroy(compiled);
+    return value;
+}
+
+static void test_evaluate(void)
+{
+    StringSet *defined = StringSetNew();
+    StringSetAdd(defined, xstrdup("linux"));
+    StringSetAdd(defined, xstrdup("x86_64"));
+    StringSetAdd(defined, xstrdup("ns:web"));
+
+    assert_true(Evaluate("linux", defined));
+    assert_false(Evaluate("solaris", defined));
+    assert_true(Evaluate("any", defined));
+    assert_true(Evaluate("default:linux", defined));
+    assert_true(Evaluate("ns:web", defined));
+    assert_false(Evaluate("web", defined));
+
+    assert_true(Evaluate("linux.x86_64", defined));
+    assert_true(Evaluate("linux&x86_64", defined));
+    assert_false(Evaluate("linux.solaris", defined));
+    assert_true(Evaluate("solaris|linux", defined));
+    assert_true(Evaluate("solaris||linux", defined));
+    assert_false(Evaluate("solaris|hpux", defined));
+    assert_false(Evaluate("!linux", defined));
+    assert_true(Evaluate("!solaris", defined));
+
+    /* & binds tighter than |, and ! tighter than both */
+    assert_true(Evaluate("solaris.hpux|linux", defined));
+    assert_false(Evaluate("solaris.(hpux|linux)", defined));
+    assert_true(Evaluate("!solaris.linux", defined));
+    assert_false(Evaluate("!(solaris|linux).x86_64", defined));
+    assert_true(Evaluate("(solaris|(linux.!hpux)).(x86_64|i686)", defined));
+
+    /* Unexpanded variables make the whole expression false */
+    assert_false(Evaluate("linux|$(var)", defined));
+    assert_false(Evaluate("!$(var)", defined));
+
+    assert_true(ClassExpressionCompile("linux.(") == NULL);
+
+    StringSetDestroy(defined);
+}
+
+static void test_is_defined_class_memo(void)
+{
+    EvalContext *ctx = EvalContextNew();
+    EvalContextClassPutHard(ctx, "linux");
+
+    assert_true(IsDefinedClass(ctx, "linux.!web", NULL));
+    assert_true(IsDefinedClass(ctx, "linux.!web", NULL));
+
+    /* Changes of the class table are seen */
+    EvalContextClassPut(ctx, NULL, "web", true, CONTEXT_SCOPE_NAMESPACE);
+    assert_false(IsDefinedClass(ctx, "linux.!web", NULL));
+    EvalContextClassRemove(ctx, NULL, "web");
+    assert_true(IsDefinedClass(ctx, "linux.!web", NULL));
+
+    /* So are bundle classes, of the frame in sight only */
+    Policy *policy = PolicyNew();
+    Bundle *bundle = PolicyAppendBundle(policy, NamespaceDefault(), "bundle", "agent", NULL, NULL);
+
+    EvalContextStackPushBundleFrame(ctx, bundle, NULL, false);
+    assert_true(IsDefinedClass(ctx, "linux.!web", NULL));
+    EvalContextClassPut(ctx, NULL, "web", true, CONTEXT_SCOPE_BUNDLE);
+    assert_false(IsDefinedClass(ctx, "linux.!web", NULL));
+
+    EvalContextStackPushBundleFrame(ctx, bundle, NULL, false);
+    assert_true(IsDefinedClass(ctx, "linux.!web", NULL));
+    EvalContextStackPopFrame(ctx);
+
+    assert_false(IsDefinedClass(ctx, "linux.!web", NULL));
+    EvalContextStackPopFrame(ctx);
+
+    assert_true(IsDefinedClass(ctx, "linux.!web", NULL));
+
+    assert_false(IsDefinedClass(ctx, "linux.(", NULL));
+    assert_true(IsDefinedClass(ctx, NULL, NULL));
+
+    PolicyDestroy(policy);
+    EvalContextDestroy(ctx);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    const UnitTest tests[] =
+    {
+        unit_test(test_evaluate),
+        unit_test(test_is_defined_class_memo),
+    };
+
+    return run_tests(tests);
+}
@@ -74,6 +74,51 @@ static void test_default_ns(void)
     }
 }
 
+static void test_hash_collision(void)
+{
+    ClassTable *t = ClassTableNew();
+
+    /* these two names have the same ClassRefHash */
+    assert_false(ClassTablePut(t, NULL, "class_64145", true, CONTEXT_SCOPE_NAMESPACE));
+    assert_false(ClassTablePut(t, NULL, "class_60409", false, CONTEXT_SCOPE_NAMESPACE));
+
+    Class *cls = ClassTableGet(t, NULL, "class_64145");
+    assert_string_equal("class_64145", cls->name);
+    assert_true(cls->is_soft);
+
+    cls = ClassTableGet(t, NULL, "class_60409");
+    assert_string_equal("class_60409", cls->name);
+    assert_false(cls->is_soft);
+
+    assert_true(ClassTableRemove(t, NULL, "class_64145"));
+    assert_true(ClassTableGet(t, NULL, "class_64145") == NULL);
+    assert_true(ClassTableGet(t, NULL, "class_60409") != NULL);
+
+    ClassTableDestroy(t);
+}
+
+static void test_generation(void)
+{
+    ClassTable *t = ClassTableNew();
+    ClassTable *u = ClassTableNew();
+    assert_true(ClassTableGeneration(t) != ClassTableGeneration(u));
+
+    unsigned long generation = ClassTableGeneration(t);
+    ClassTablePut(t, NULL, "a", true, CONTEXT_SCOPE_NAMESPACE);
+    assert_true(ClassTableGeneration(t) != generation);
+
+    generation = ClassTableGeneration(t);
+    ClassTableGet(t, NULL, "a");
+    assert_false(ClassTableRemove(t, NULL, "b"));
+    assert_true(ClassTableGeneration(t) == generation);
+
+    assert_true(ClassTableRemove(t, NULL, "a"));
+    assert_true(ClassTableGeneration(t) != generation);
+
+    ClassTableDestroy(u);
+    ClassTableDestroy(t);
+}
+
 int main()
 {
     PRINT_TEST_BANNER();
@@ -82,6 +127,8 @@ int main()
         unit_test(test_default_ns),
         unit_test(test_ns),
         unit_test(test_class_ref),
+        unit_test(test_hash_collision),
+        unit_test(test_generation),
     };
 
     return run_tests(tests);
@@ -81,6 +81,55 @@ void test_iter_delete_entry(void)
     CloseDB(db);
 }
 
+void test_batch(void)
+{
+    /* Test that writes inside a (nested) batch are visible and committed */
+
+    CF_DB *db;
+    assert_int_equal(OpenDB(&db, dbid_classes), true);
+
+    assert_int_equal(BeginBatchDB(db), true);
+    assert_int_equal(WriteDB(db, "batch1", "abc", 3), true);
+    assert_int_equal(WriteDB(db, "batch2", "def", 3), true);
+    assert_int_equal(DeleteDB(db, "batch1"), true);
+
+    assert_int_equal(BeginBatchDB(db), true);
+    assert_int_equal(WriteDB(db, "batch3", "ghi", 3), true);
+    assert_int_equal(CommitBatchDB(db), true);
+
+    char value[3];
+    assert_int_equal(HasKeyDB(db, "batch1", strlen("batch1") + 1), false);
+    assert_int_equal(ReadDB(db, "batch2", value, sizeof(value)), true);
+    assert_memory_equal(value, "def", 3);
+
+    /* Iterating inside a batch shares its transaction */
+    CF_DBC *cursor;
+    assert_int_equal(NewDBCursor(db, &cursor), true);
+
+    char *key;
+    int ksize;
+    void *val;
+    int vsize;
+    int count = 0;
+    while (NextDB(cursor, &key, &ksize, &val, &vsize))
+    {
+        count++;
+    }
+    assert_true(count >= 2);
+    assert_int_equal(DeleteDBCursor(cursor), true);
+
+    assert_int_equal(CommitBatchDB(db), true);
+    assert_int_equal(CommitBatchDB(db), false);
+    CloseDB(db);
+
+    /* and everything survives reopening */
+    assert_int_equal(OpenDB(&db, dbid_classes), true);
+    assert_int_equal(HasKeyDB(db, "batch1", strlen("batch1") + 1), false);
+    assert_int_equal(ReadDB(db, "batch3", value, sizeof(value)), true);
+    assert_memory_equal(value, "ghi", 3);
+    CloseDB(db);
+}
+
 static void CreateGarbage(const char *filename)
 {
     FILE *fh = fopen(filename, "w");
@@ -118,6 +167,7 @@ int main()
         {
             unit_test(test_iter_modify_entry),
             unit_test(test_iter_delete_entry),
+            unit_test(test_batch),
             unit_test(test_recreate),
         };
 
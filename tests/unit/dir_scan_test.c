@@ -0,0 +1,224 @@
+#include <test.h>
+
+#include <dir_scan.h>
+
+static char TEST_DIR[] = "/tmp/dir_scan_test.XXXXXX";
+
+#define N_DIRS 20
+#define N_FILES 10
+
+static void MakePath(char *buf, size_t size, int dir, int file)
+{
+    if (file < 0)
+    {
+        snprintf(buf, size, "%s/dir%02d", TEST_DIR, dir);
+    }
+    else
+    {
+        snprintf(buf, size, "%s/dir%02d/file%02d", TEST_DIR, dir, file);
+    }
+}
+
+static void AssertDirEntries(Seq *entries)
+{
+    char path[CF_BUFSIZE];
+
+    assert_true(entries != NULL);
+    assert_int_equal(SeqLength(entries), N_FILES);
+
+    for (int i = 0; i < N_FILES; i++)
+    {
+        const DirScanEntry *entry = SeqAt(entries, i);
+        snprintf(path, sizeof(path), "file%02d", i);
+
+        assert_string_equal(entry->name, path);
+        assert_false(entry->is_dir);
+    }
+}
+
+static void test_read_sorted(void)
+{
+    Seq *entries = DirScannerGet(NULL, TEST_DIR);
+    assert_true(entries != NULL);
+    assert_int_equal(SeqLength(entries), N_DIRS);
+
+    for (int i = 0; i < N_DIRS; i++)
+    {
+        const DirScanEntry *entry = SeqAt(entries, i);
+        char name[32];
+        snprintf(name, sizeof(name), "dir%02d", i);
+
+        assert_string_equal(entry->name, name);
+        assert_true(entry->is_dir);
+    }
+
+    SeqDestroy(entries);
+
+    char path[CF_BUFSIZE];
+    MakePath(path, sizeof(path), 3, -1);
+    entries = DirScannerGet(NULL, path);
+    AssertDirEntries(entries);
+    SeqDestroy(entries);
+}
+
+static void test_read_missing(void)
+{
+    char path[CF_BUFSIZE];
+    snprintf(path, sizeof(path), "%s/missing", TEST_DIR);
+
+    errno = 0;
+    assert_true(DirScannerGet(NULL, path) == NULL);
+    assert_int_equal(errno, ENOENT);
+
+    DirScanner *scanner = DirScannerNew(2, 8);
+    DirScannerPrefetch(scanner, path);
+
+    errno = 0;
+    assert_true(DirScannerGet(scanner, path) == NULL);
+    assert_int_equal(errno, ENOENT);
+
+    DirScannerDestroy(scanner);
+}
+
+static void test_prefetch(void)
+{
+    /* More directories than may be queued: the rest are read on demand */
+    DirScanner *scanner = DirScannerNew(4, N_DIRS / 2);
+    char path[CF_BUFSIZE];
+
+    for (int i = N_DIRS - 1; i >= 0; i--)
+    {
+        MakePath(path, sizeof(path), i, -1);
+        DirScannerPrefetch(scanner, path);
+    }
+
+    for (int i = 0; i < N_DIRS; i++)
+    {
+        MakePath(path, sizeof(path), i, -1);
+        Seq *entries = DirScannerGet(scanner, path);
+        AssertDirEntries(entries);
+        SeqDestroy(entries);
+    }
+
+    DirScannerDestroy(scanner);
+}
+
+static void test_cancel(void)
+{
+    DirScanner *scanner = DirScannerNew(4, N_DIRS);
+    char path[CF_BUFSIZE];
+
+    for (int i = 0; i < N_DIRS; i++)
+    {
+        MakePath(path, sizeof(path), i, -1);
+        DirScannerPrefetch(scanner, path);
+    }
+
+    for (int i = 0; i < N_DIRS; i += 2)
+    {
+        MakePath(path, sizeof(path), i, -1);
+        DirScannerCancel(scanner, path);
+    }
+
+    for (int i = 0; i < N_DIRS; i++)
+    {
+        MakePath(path, sizeof(path), i, -1);
+        Seq *entries = DirScannerGet(scanner, path);
+        AssertDirEntries(entries);
+        SeqDestroy(entries);
+    }
+
+    /* Unclaimed reads are dropped with the scanner */
+    for (int i = 0; i < N_DIRS; i++)
+    {
+        MakePath(path, sizeof(path), i, -1);
+        DirScannerPrefetch(scanner, path);
+    }
+
+    DirScannerDestroy(scanner);
+}
+
+static void test_take_checks_identity(void)
+{
+    DirScanner *scanner = DirScannerNew(2, 8);
+    char path[CF_BUFSIZE];
+    char other[CF_BUFSIZE];
+    struct stat sb, other_sb;
+
+    MakePath(path, sizeof(path), 1, -1);
+    MakePath(other, sizeof(other), 2, -1);
+    assert_int_equal(stat(path, &sb), 0);
+    assert_int_equal(stat(other, &other_sb), 0);
+
+    /* Nothing read ahead */
+    assert_true(DirScannerTake(scanner, path, &sb) == NULL);
+
+    /* Read ahead, but not from the directory the caller is in */
+    DirScannerPrefetch(scanner, path);
+    usleep(10000);
+    assert_true(DirScannerTake(scanner, path, &other_sb) == NULL);
+
+    /* A listing that is still queued is left to the caller, so allow the
+     * workers some time */
+    Seq *entries = NULL;
+    for (int i = 0; (entries == NULL) && (i < 100); i++)
+    {
+        DirScannerPrefetch(scanner, path);
+        usleep(10000);
+        entries = DirScannerTake(scanner, path, &sb);
+    }
+
+    AssertDirEntries(entries);
+    SeqDestroy(entries);
+
+    DirScannerDestroy(scanner);
+}
+
+static void setup(void)
+{
+    char path[CF_BUFSIZE];
+
+    assert_true(mkdtemp(TEST_DIR) != NULL);
+
+    for (int i = N_DIRS - 1; i >= 0; i--)
+    {
+        MakePath(path, sizeof(path), i, -1);
+        assert_int_equal(mkdir(path, 0700), 0);
+
+        for (int j = N_FILES - 1; j >= 0; j--)
+        {
+            MakePath(path, sizeof(path), i, j);
+            FILE *fp = fopen(path, "w");
+            assert_true(fp != NULL);
+            fprintf(fp, "%*s", i + j, "");
+            fclose(fp);
+        }
+    }
+}
+
+static void teardown(void)
+{
+    char cmd[CF_BUFSIZE];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", TEST_DIR);
+    system(cmd);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    setup();
+
+    const UnitTest tests[] =
+    {
+        unit_test(test_read_sorted),
+        unit_test(test_read_missing),
+        unit_test(test_prefetch),
+        unit_test(test_cancel),
+        unit_test(test_take_checks_identity),
+    };
+
+    int ret = run_tests(tests);
+
+    teardown();
+    return ret;
+}
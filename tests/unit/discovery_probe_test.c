@@ -0,0 +1,95 @@
+#include <test.h>
+
+#include <discovery_probe.h>
+
+static int DESTROYED = 0;
+
+static void *Double(void *arg)
+{
+    int *n = arg;
+    *n *= 2;
+    return n;
+}
+
+static void *SlowDouble(void *arg)
+{
+    usleep(300 * 1000);
+    return Double(arg);
+}
+
+static void DestroyResult(void *result)
+{
+    DESTROYED++;
+    free(result);
+}
+
+static int *NewInt(int value)
+{
+    int *n = xmalloc(sizeof(int));
+    *n = value;
+    return n;
+}
+
+static void test_result(void)
+{
+    DiscoveryProbe *probe = DiscoveryProbeStart("double", Double, NewInt(21), DestroyResult);
+
+    int *result = DiscoveryProbeWait(probe, 5000);
+    assert_true(result != NULL);
+    assert_int_equal(*result, 42);
+    free(result);
+
+    assert_int_equal(DESTROYED, 0);
+}
+
+static void test_timeout(void)
+{
+    DiscoveryProbe *probe = DiscoveryProbeStart("slow", SlowDouble, NewInt(1), DestroyResult);
+
+    assert_true(DiscoveryProbeWait(probe, 50) == NULL);
+
+    /* The abandoned probe cleans up after itself */
+    for (int i = 0; i < 100 && DESTROYED == 0; i++)
+    {
+        usleep(50 * 1000);
+    }
+    assert_int_equal(DESTROYED, 1);
+}
+
+static void test_concurrent(void)
+{
+    DiscoveryProbe *probes[4];
+
+    for (int i = 0; i < 4; i++)
+    {
+        probes[i] = DiscoveryProbeStart("slow", SlowDouble, NewInt(i), DestroyResult);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < 4; i++)
+    {
+        int *result = DiscoveryProbeWait(probes[i], 5000);
+        assert_true(result != NULL);
+        assert_int_equal(*result, 2 * i);
+        free(result);
+    }
+
+    /* Four probes of 300 ms each run side by side */
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    assert_true((end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000 < 1000);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    const UnitTest tests[] =
+    {
+        unit_test(test_result),
+        unit_test(test_timeout),
+        unit_test(test_concurrent),
+    };
+
+    return run_tests(tests);
+}
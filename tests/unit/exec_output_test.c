@@ -0,0 +1,122 @@
+#include <test.h>
+
+#include <exec-output.h>
+
+#include <crypto.h>
+#include <file_lib.h>
+#include <writer.h>
+
+static char TEST_DIR[] = "/tmp/exec_output_test.XXXXXX";
+static char OUTPUT[CF_BUFSIZE];
+static char DIGEST[CF_BUFSIZE];
+
+static ExecOutput *Capture(size_t buffer_max, const char **lines, size_t n)
+{
+    ExecOutput *output = ExecOutputNew(OUTPUT, buffer_max);
+    for (size_t i = 0; i < n; i++)
+    {
+        ExecOutputAppendLine(output, lines[i]);
+    }
+    return output;
+}
+
+static void test_strip_timestamp(void)
+{
+    assert_string_equal(ExecOutputStripTimestamp("2014-05-13T16:53:20+0000    info: Repaired"), "Repaired");
+    assert_string_equal(ExecOutputStripTimestamp("2014-05-13T16:53:20+0000 no separator"),
+                        "2014-05-13T16:53:20+0000 no separator");
+    assert_string_equal(ExecOutputStripTimestamp("2014-05-13 16:53:20: not a timestamp"),
+                        "2014-05-13 16:53:20: not a timestamp");
+    assert_string_equal(ExecOutputStripTimestamp("2014-25-13T16:53:20: bad month"), "2014-25-13T16:53:20: bad month");
+    assert_string_equal(ExecOutputStripTimestamp("20"), "20");
+    assert_string_equal(ExecOutputStripTimestamp("R: hello"), "R: hello");
+}
+
+static void test_digest(void)
+{
+    const char *run1[] = { "2014-05-13T16:53:20+0000  notice: Q: \"...date\": hello", "R: done" };
+    const char *run2[] = { "2014-05-13T17:03:21+0000  notice: Q: \"...date\": hello", "R: done" };
+    const char *run3[] = { "2014-05-13T17:03:21+0000  notice: Q: \"...date\": hello", "R: done", "R: more" };
+
+    ExecOutput *a = Capture(SIZE_MAX, run1, 2);
+    ExecOutput *b = Capture(SIZE_MAX, run2, 2);
+    ExecOutput *c = Capture(SIZE_MAX, run3, 3);
+
+    assert_int_equal(ExecOutputLines(c), 3);
+    assert_string_equal(ExecOutputDigest(a), ExecOutputDigest(b));
+    assert_string_not_equal(ExecOutputDigest(a), ExecOutputDigest(c));
+
+    unlink(DIGEST);
+    assert_true(ExecOutputDigestChanged(a, DIGEST));
+    /* Comparing alone does not store the digest */
+    assert_true(ExecOutputDigestChanged(a, DIGEST));
+    assert_true(ExecOutputStoreDigest(ExecOutputDigest(a), DIGEST));
+    assert_false(ExecOutputDigestChanged(a, DIGEST));
+    assert_false(ExecOutputDigestChanged(b, DIGEST));
+    assert_true(ExecOutputDigestChanged(c, DIGEST));
+    assert_true(ExecOutputStoreDigest(ExecOutputDigest(c), DIGEST));
+    assert_false(ExecOutputDigestChanged(c, DIGEST));
+
+    ExecOutputClose(a, false);
+    ExecOutputClose(b, false);
+    ExecOutputClose(c, false);
+}
+
+static void AssertOutputFile(const char *expected)
+{
+    Writer *w = FileRead(OUTPUT, SIZE_MAX, NULL);
+    assert_true(w != NULL);
+    assert_string_equal(StringWriterData(w), expected);
+    WriterClose(w);
+}
+
+static void test_keep(void)
+{
+    const char *lines[] = { "first line", "second line", "third line" };
+
+    /* In memory: nothing is written unless kept */
+    unlink(OUTPUT);
+    ExecOutput *output = Capture(SIZE_MAX, lines, 3);
+    assert_true(access(OUTPUT, F_OK) != 0);
+    assert_true(ExecOutputClose(output, false));
+    assert_true(access(OUTPUT, F_OK) != 0);
+
+    output = Capture(SIZE_MAX, lines, 3);
+    assert_true(ExecOutputClose(output, true));
+    AssertOutputFile("first line\nsecond line\nthird line\n");
+
+    /* Spilled: the file is removed unless kept */
+    unlink(OUTPUT);
+    output = Capture(16, lines, 3);
+    assert_true(access(OUTPUT, F_OK) == 0);
+    assert_true(ExecOutputClose(output, false));
+    assert_true(access(OUTPUT, F_OK) != 0);
+
+    output = Capture(16, lines, 3);
+    ExecOutputDigest(output);
+    assert_true(ExecOutputClose(output, true));
+    AssertOutputFile("first line\nsecond line\nthird line\n");
+    unlink(OUTPUT);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    CryptoInitialize();
+    mkdtemp(TEST_DIR);
+    snprintf(OUTPUT, sizeof(OUTPUT), "%s/output", TEST_DIR);
+    snprintf(DIGEST, sizeof(DIGEST), "%s/digest", TEST_DIR);
+
+    const UnitTest tests[] =
+    {
+        unit_test(test_strip_timestamp),
+        unit_test(test_digest),
+        unit_test(test_keep),
+    };
+
+    int ret = run_tests(tests);
+
+    unlink(DIGEST);
+    rmdir(TEST_DIR);
+    return ret;
+}
@@ -0,0 +1,110 @@
+#include <test.h>
+
+#include <exec-schedule.h>
+
+#include <env_context.h>
+#include <time_classes.h>
+#include <signals.h>
+
+/* 2014-05-13 16:53:20 UTC */
+#define FROM 1400000000
+
+static StringSet *Schedule(const char *classes)
+{
+    return StringSetFromString(classes, ',');
+}
+
+static void test_next_run(void)
+{
+    EvalContext *ctx = EvalContextNew();
+    CFSTARTTIME = FROM;
+    UpdateTimeClasses(ctx, FROM);
+
+    StringSet *schedule = Schedule("GMT_Min30,GMT_Hr17.GMT_Min45");
+    assert_int_equal(ExecScheduleNextRun(ctx, schedule, FROM), FROM + 40 + 36 * 60);
+    StringSetDestroy(schedule);
+
+    /* The minute containing from counts */
+    schedule = Schedule("GMT_Min53");
+    assert_int_equal(ExecScheduleNextRun(ctx, schedule, FROM), FROM - 20);
+    StringSetDestroy(schedule);
+
+    /* Other classes are taken as they are */
+    EvalContextClassPutHard(ctx, "some_class");
+    schedule = Schedule("GMT_Q1.!some_class,GMT_Min10.some_class");
+    assert_int_equal(ExecScheduleNextRun(ctx, schedule, FROM), FROM + 40 + 16 * 60);
+    StringSetDestroy(schedule);
+
+    /* Beyond the horizon */
+    schedule = Schedule("GMT_Hr05");
+    assert_int_equal(ExecScheduleNextRun(ctx, schedule, FROM), 0);
+    StringSetDestroy(schedule);
+
+    /* The time classes are back to the reference time */
+    assert_true(IsDefinedClass(ctx, "GMT_Min53", NULL));
+    assert_false(IsDefinedClass(ctx, "GMT_Hr05", NULL));
+
+    EvalContextDestroy(ctx);
+}
+
+static void test_watch(void)
+{
+    char dir[] = "/tmp/exec_schedule_test.XXXXXX";
+    assert_true(mkdtemp(dir) != NULL);
+
+    ExecWatch *watch = ExecWatchNew();
+    if (!ExecWatchIsActive(watch))
+    {
+        /* No inotify here, the executor checks the inputs on a timer */
+        assert_false(ExecWatchAddDirectory(watch, dir));
+        assert_int_equal(ExecWatchWait(watch, 0), EXEC_WAKE_TIMEOUT);
+        ExecWatchDestroy(watch);
+        rmdir(dir);
+        return;
+    }
+
+    assert_true(ExecWatchAddDirectory(watch, dir));
+    assert_int_equal(ExecWatchWait(watch, 0), EXEC_WAKE_TIMEOUT);
+
+    char path[CF_BUFSIZE];
+    snprintf(path, sizeof(path), "%s/promises.cf", dir);
+    FILE *f = fopen(path, "w");
+    fputs("bundle agent main {}\n", f);
+    fclose(f);
+
+    assert_int_equal(ExecWatchWait(watch, 10), EXEC_WAKE_INPUTS);
+    /* The whole change was reported at once */
+    assert_int_equal(ExecWatchWait(watch, 0), EXEC_WAKE_TIMEOUT);
+
+    ExecWatchReset(watch, NULL, NULL);
+    unlink(path);
+    assert_int_equal(ExecWatchWait(watch, 0), EXEC_WAKE_TIMEOUT);
+
+    ExecWatchDestroy(watch);
+    rmdir(dir);
+}
+
+static void test_wait_signal(void)
+{
+    MakeSignalPipe();
+    signal(SIGUSR2, HandleSignalsForDaemon);
+
+    ExecWatch *watch = ExecWatchNew();
+    raise(SIGUSR2);
+    assert_int_equal(ExecWatchWait(watch, 10), EXEC_WAKE_SIGNAL);
+    assert_int_equal(ExecWatchWait(watch, 0), EXEC_WAKE_TIMEOUT);
+    ExecWatchDestroy(watch);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    const UnitTest tests[] =
+    {
+        unit_test(test_next_run),
+        unit_test(test_watch),
+        unit_test(test_wait_signal),
+    };
+
+    return run_tests(tests);
+}
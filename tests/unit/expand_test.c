@@ -76,10 +76,11 @@ static void test_expand_scalar_two_scalars_concat(void)
         VarRefDestroy(lval);
     }
 
-    char res[CF_EXPANDSIZE] = { 0 };
+    Buffer *res = BufferNew();
     ExpandScalar(ctx, "default", "bundle", "a $(one) b $(two)c", res);
 
-    assert_string_equal("a first b secondc", res);
+    assert_string_equal("a first b secondc", BufferData(res));
+    BufferDestroy(&res);
 
     EvalContextDestroy(ctx);
 }
@@ -98,10 +99,11 @@ static void test_expand_scalar_two_scalars_nested(void)
         VarRefDestroy(lval);
     }
 
-    char res[CF_EXPANDSIZE] = { 0 };
+    Buffer *res = BufferNew();
     ExpandScalar(ctx, "default", "bundle", "a $($(two))b", res);
 
-    assert_string_equal("a firstb", res);
+    assert_string_equal("a firstb", BufferData(res));
+    BufferDestroy(&res);
 
     EvalContextDestroy(ctx);
 }
@@ -120,10 +122,11 @@ static void test_expand_scalar_array_concat(void)
         VarRefDestroy(lval);
     }
 
-    char res[CF_EXPANDSIZE] = { 0 };
+    Buffer *res = BufferNew();
     ExpandScalar(ctx, "default", "bundle", "a $(foo[one]) b $(foo[two])c", res);
 
-    assert_string_equal("a first b secondc", res);
+    assert_string_equal("a first b secondc", BufferData(res));
+    BufferDestroy(&res);
 
     EvalContextDestroy(ctx);
 }
@@ -142,14 +145,103 @@ static void test_expand_scalar_array_with_scalar_arg(void)
         VarRefDestroy(lval);
     }
 
-    char res[CF_EXPANDSIZE] = { 0 };
+    Buffer *res = BufferNew();
     ExpandScalar(ctx, "default", "bundle", "a$(foo[$(bar)])b", res);
 
-    assert_string_equal("afirstb", res);
+    assert_string_equal("afirstb", BufferData(res));
+    BufferDestroy(&res);
 
     EvalContextDestroy(ctx);
 }
 
+static void test_expand_scalar_unresolved(void)
+{
+    EvalContext *ctx = EvalContextNew();
+    {
+        VarRef *lval = VarRefParse("default:bundle.one");
+        EvalContextVariablePut(ctx, lval, "first", DATA_TYPE_STRING);
+        VarRefDestroy(lval);
+    }
+
+    Buffer *res = BufferNew();
+    assert_false(ExpandScalar(ctx, "default", "bundle", "$(one) ${missing} $(missing[$(one)]) $ $x $(", res));
+    assert_string_equal("first ${missing} $(missing[first]) $ $x $(", BufferData(res));
+
+    BufferZero(res);
+    assert_true(ExpandScalar(ctx, "default", "bundle", "no references", res));
+    assert_string_equal("no references", BufferData(res));
+
+    BufferDestroy(&res);
+    EvalContextDestroy(ctx);
+}
+
+static void test_expand_scalar_reexpand(void)
+{
+    EvalContext *ctx = EvalContextNew();
+    VarRef *one = VarRefParse("default:bundle.one");
+    VarRef *two = VarRefParse("default:bundle.two");
+    Buffer *res = BufferNew();
+
+    EvalContextVariablePut(ctx, two, "one", DATA_TYPE_STRING);
+
+    for (int i = 0; i < 3; i++)
+    {
+        char value[32];
+        snprintf(value, sizeof(value), "value%d", i);
+        EvalContextVariablePut(ctx, one, value, DATA_TYPE_STRING);
+
+        BufferZero(res);
+        assert_true(ExpandScalar(ctx, "default", "bundle", "$(one)-$($(two))", res));
+
+        char expected[64];
+        snprintf(expected, sizeof(expected), "%s-%s", value, value);
+        assert_string_equal(expected, BufferData(res));
+    }
+
+    /* Same string, other scope */
+    {
+        VarRef *lval = VarRefParse("default:other.one");
+        EvalContextVariablePut(ctx, lval, "other", DATA_TYPE_STRING);
+        VarRefDestroy(lval);
+    }
+    {
+        VarRef *lval = VarRefParse("default:other.two");
+        EvalContextVariablePut(ctx, lval, "one", DATA_TYPE_STRING);
+        VarRefDestroy(lval);
+    }
+
+    BufferZero(res);
+    assert_true(ExpandScalar(ctx, "default", "other", "$(one)-$($(two))", res));
+    assert_string_equal("other-other", BufferData(res));
+
+    BufferDestroy(&res);
+    VarRefDestroy(one);
+    VarRefDestroy(two);
+    EvalContextDestroy(ctx);
+}
+
+static void test_expand_scalar_long(void)
+{
+    EvalContext *ctx = EvalContextNew();
+    char *value = xmalloc(CF_EXPANDSIZE);
+    memset(value, 'x', CF_EXPANDSIZE - 1);
+    value[CF_EXPANDSIZE - 1] = '\0';
+    {
+        VarRef *lval = VarRefParse("default:bundle.long");
+        EvalContextVariablePut(ctx, lval, value, DATA_TYPE_STRING);
+        VarRefDestroy(lval);
+    }
+
+    /* Far more than the old CF_EXPANDSIZE limit */
+    Buffer *res = BufferNew();
+    assert_true(ExpandScalar(ctx, "default", "bundle", "$(long)$(long)$(long)$(long)$(long)$(long)$(long)$(long)$(long)", res));
+    assert_int_equal(BufferSize(res), 9 * (CF_EXPANDSIZE - 1));
+
+    BufferDestroy(&res);
+    free(value);
+    EvalContextDestroy(ctx);
+}
+
 static PromiseResult actuator_expand_promise_array_with_scalar_arg(EvalContext *ctx, Promise *pp, ARG_UNUSED void *param)
 {
     assert_string_equal("first", pp->promiser);
@@ -316,6 +408,9 @@ int main()
         unit_test(test_expand_scalar_two_scalars_nested),
         unit_test(test_expand_scalar_array_concat),
         unit_test(test_expand_scalar_array_with_scalar_arg),
+        unit_test(test_expand_scalar_unresolved),
+        unit_test(test_expand_scalar_reexpand),
+        unit_test(test_expand_scalar_long),
         unit_test(test_expand_promise_array_with_scalar_arg),
         unit_test(test_expand_promise_slist),
         unit_test(test_expand_promise_array_with_slist_arg)
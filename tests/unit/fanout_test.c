@@ -0,0 +1,131 @@
+#include <test.h>
+
+#include <fanout.h>
+#include <rlist.h>
+#include <string_lib.h>
+
+static pthread_mutex_t LOCK = PTHREAD_MUTEX_INITIALIZER;
+static int RUNNING = 0;
+static int MAX_RUNNING = 0;
+
+/* Hosts named "fail..." fail, "slow..." take a second, the others 10 ms */
+static bool FakeHail(FanoutHost *host, const char *name, Writer *out, ARG_UNUSED void *param)
+{
+    pthread_mutex_lock(&LOCK);
+    RUNNING++;
+    MAX_RUNNING = MAX(MAX_RUNNING, RUNNING);
+    pthread_mutex_unlock(&LOCK);
+
+    /* The connection is shut down when the host times out */
+    int sockets[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sockets);
+    FanoutHostSetSocket(host, sockets[0]);
+
+    for (int i = 0; i < 3; i++)
+    {
+        WriterWriteF(out, "%s line %d\n", name, i);
+        usleep(3000);
+    }
+
+    char c;
+    if (StringStartsWith(name, "slow"))
+    {
+        struct timeval tv = { .tv_sec = 10 };
+        setsockopt(sockets[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        recv(sockets[0], &c, 1, 0);
+    }
+
+    FanoutHostSetSocket(host, -1);
+    close(sockets[0]);
+    close(sockets[1]);
+
+    pthread_mutex_lock(&LOCK);
+    RUNNING--;
+    pthread_mutex_unlock(&LOCK);
+
+    return !StringStartsWith(name, "fail");
+}
+
+static void test_fanout(void)
+{
+    Rlist *hosts = NULL;
+    char name[64];
+
+    for (int i = 0; i < 40; i++)
+    {
+        snprintf(name, sizeof(name), "%shost%d", (i % 10 == 0) ? "fail" : "", i);
+        RlistAppendScalar(&hosts, name);
+    }
+
+    FILE *out = tmpfile();
+    FanoutSummary summary = FanoutRun(hosts, 8, 0, FakeHail, NULL, out);
+
+    assert_int_equal(summary.hosts, 40);
+    assert_int_equal(summary.succeeded, 36);
+    assert_int_equal(summary.failed, 4);
+    assert_int_equal(summary.timed_out, 0);
+    assert_true(MAX_RUNNING > 1 && MAX_RUNNING <= 8);
+    assert_true(summary.latency_p50 >= 9);
+    assert_true(summary.latency_p50 <= summary.latency_p90);
+    assert_true(summary.latency_p99 <= summary.latency_max);
+
+    /* The output of each host comes in one piece */
+    char line[CF_BUFSIZE], previous[CF_BUFSIZE] = "";
+    int lines = 0;
+
+    rewind(out);
+    while (fgets(line, sizeof(line), out) != NULL)
+    {
+        char host[64];
+        int n;
+        assert_int_equal(sscanf(line, "%63s line %d", host, &n), 2);
+        assert_int_equal(n, lines % 3);
+        if (n > 0)
+        {
+            assert_string_equal(host, previous);
+        }
+        strlcpy(previous, host, sizeof(previous));
+        lines++;
+    }
+    assert_int_equal(lines, 120);
+
+    fclose(out);
+    RlistDestroy(hosts);
+}
+
+static void test_timeout(void)
+{
+    Rlist *hosts = NULL;
+    RlistAppendScalar(&hosts, "host1");
+    RlistAppendScalar(&hosts, "slowhost2");
+    RlistAppendScalar(&hosts, "host3");
+
+    FILE *out = tmpfile();
+    FanoutSummary summary = FanoutRun(hosts, 2, 1, FakeHail, NULL, out);
+
+    assert_int_equal(summary.hosts, 3);
+    assert_int_equal(summary.succeeded, 2);
+    assert_int_equal(summary.timed_out, 1);
+    assert_true(summary.latency_max >= 1000);
+    assert_true(summary.latency_max < 5000);
+
+    Writer *w = StringWriter();
+    FanoutSummaryWrite(&summary, w);
+    assert_true(StringStartsWith(StringWriterData(w), "Hailed 3 hosts: 2 succeeded, 0 failed, 1 timed out\n"));
+    WriterClose(w);
+
+    fclose(out);
+    RlistDestroy(hosts);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    const UnitTest tests[] =
+    {
+        unit_test(test_fanout),
+        unit_test(test_timeout),
+    };
+
+    return run_tests(tests);
+}
@@ -0,0 +1,122 @@
+#include <test.h>
+
+#include <cf3.defs.h>
+#include <files_copy.h>
+#include <file_lib.h>
+#include <writer.h>
+
+static char TEST_DIR[] = "/tmp/files_copy_test.XXXXXX";
+static char SOURCE[CF_BUFSIZE];
+static char DESTINATION[CF_BUFSIZE];
+
+static void WriteAt(int fd, off_t offset, const char *data, size_t size)
+{
+    assert_int_equal(pwrite(fd, data, size, offset), size);
+}
+
+static void AssertSameContents(const char *a, const char *b)
+{
+    Writer *wa = FileRead(a, SIZE_MAX, NULL);
+    Writer *wb = FileRead(b, SIZE_MAX, NULL);
+
+    assert_int_equal(StringWriterLength(wa), StringWriterLength(wb));
+    assert_true(memcmp(StringWriterData(wa), StringWriterData(wb), StringWriterLength(wa)) == 0);
+
+    WriterClose(wa);
+    WriterClose(wb);
+}
+
+static void test_sparse(void)
+{
+    const off_t size = 16 * 1024 * 1024;
+
+    int fd = open(SOURCE, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    WriteAt(fd, 0, "head", 4);
+    WriteAt(fd, size / 2, "middle", 6);
+    assert_int_equal(ftruncate(fd, size), 0);
+    close(fd);
+
+    assert_true(CopyRegularFileDisk(SOURCE, DESTINATION));
+
+    struct stat sb_source, sb_destination;
+    assert_int_equal(stat(SOURCE, &sb_source), 0);
+    assert_int_equal(stat(DESTINATION, &sb_destination), 0);
+    assert_int_equal(sb_destination.st_size, size);
+
+    /* The holes are kept, where the file system has any */
+    if (sb_source.st_blocks * 512 < size / 2)
+    {
+        assert_true(sb_destination.st_blocks * 512 < size / 2);
+    }
+
+    AssertSameContents(SOURCE, DESTINATION);
+}
+
+static void test_dense(void)
+{
+    char buf[4096];
+    int fd = open(SOURCE, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+    srand(42);
+    for (int i = 0; i < 300; i++)
+    {
+        for (size_t j = 0; j < sizeof(buf); j++)
+        {
+            /* Runs of zeros too, which are written as holes when buffered */
+            buf[j] = (i % 3 == 0) ? 0 : rand();
+        }
+        WriteAt(fd, (off_t) i * sizeof(buf), buf, sizeof(buf) - (i == 299 ? 100 : 0));
+    }
+    close(fd);
+
+    assert_true(CopyRegularFileDisk(SOURCE, DESTINATION));
+    AssertSameContents(SOURCE, DESTINATION);
+}
+
+static void test_empty(void)
+{
+    close(open(SOURCE, O_WRONLY | O_CREAT | O_TRUNC, 0600));
+
+    assert_true(CopyRegularFileDisk(SOURCE, DESTINATION));
+
+    struct stat sb;
+    assert_int_equal(stat(DESTINATION, &sb), 0);
+    assert_int_equal(sb.st_size, 0);
+}
+
+static void test_unknown_size(void)
+{
+    struct stat sb;
+
+    /* Files in /proc claim to be empty, but are not */
+    if ((stat("/proc/self/status", &sb) == 0) && (sb.st_size == 0))
+    {
+        assert_true(CopyRegularFileDisk("/proc/self/status", DESTINATION));
+        assert_int_equal(stat(DESTINATION, &sb), 0);
+        assert_true(sb.st_size > 0);
+    }
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    mkdtemp(TEST_DIR);
+    snprintf(SOURCE, sizeof(SOURCE), "%s/source", TEST_DIR);
+    snprintf(DESTINATION, sizeof(DESTINATION), "%s/destination", TEST_DIR);
+
+    const UnitTest tests[] =
+    {
+        unit_test(test_sparse),
+        unit_test(test_dense),
+        unit_test(test_empty),
+        unit_test(test_unknown_size),
+    };
+
+    int ret = run_tests(tests);
+
+    unlink(SOURCE);
+    unlink(DESTINATION);
+    rmdir(TEST_DIR);
+
+    return ret;
+}
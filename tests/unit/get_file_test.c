@@ -0,0 +1,297 @@
+#include <test.h>
+
+#include <server.h>
+#include <server_common.h>
+#include <client_code.h>
+#include <classic.h>
+#include <net.h>
+#include <file_lib.h>
+#include <writer.h>
+#include <item_lib.h>
+
+#define BLOCKSIZE 2048
+
+static char TEST_DIR[] = "/tmp/get_file_test.XXXXXX";
+static char SOURCE[CF_BUFSIZE];
+static char DEST[CF_BUFSIZE];
+static int SOCKETS[2];
+static int PROTOCOL_VERSION;
+
+static void ServeGetAs(uid_t uid)
+{
+    ServerConnectionState *conn = xcalloc(1, sizeof(ServerConnectionState));
+    conn->conn_info.type = CF_PROTOCOL_CLASSIC;
+    conn->conn_info.sd = SOCKETS[1];
+    conn->conn_info.protocol_version = PROTOCOL_VERSION;
+    conn->uid = uid;
+
+    char recvbuffer[CF_BUFSIZE], sendbuffer[CF_BUFSIZE], filename[CF_BUFSIZE];
+    ServerFileGetState args = {
+        .connect = conn,
+        .replybuff = sendbuffer,
+        .replyfile = filename,
+    };
+
+    assert_true(ReceiveTransaction(&conn->conn_info, recvbuffer, NULL) > 0);
+    assert_int_equal(sscanf(recvbuffer, "GET %d %[^\n]", &args.buf_size, filename), 2);
+    CfGetFile(&args);
+
+    free(conn);
+}
+
+static void *ServeGet(ARG_UNUSED void *arg)
+{
+    ServeGetAs(getuid());
+    return NULL;
+}
+
+/* Serves a caller that neither owns the source nor may read it */
+static void *ServeRefusedGet(ARG_UNUSED void *arg)
+{
+    ServeGetAs(getuid() + 1);
+    return NULL;
+}
+
+/* Sends some data blocks, then the whole block the server uses to abort */
+static void *ServeChangingFile(ARG_UNUSED void *arg)
+{
+    ConnectionInfo conn_info = { .type = CF_PROTOCOL_CLASSIC, .sd = SOCKETS[1] };
+    char buffer[CF_BUFSIZE] = { 0 };
+
+    assert_true(ReceiveTransaction(&conn_info, buffer, NULL) > 0);
+
+    memset(buffer, 'x', BLOCKSIZE);
+    for (int i = 0; i < 3; i++)
+    {
+        assert_int_equal(SendSocketStream(SOCKETS[1], buffer, BLOCKSIZE), BLOCKSIZE);
+    }
+
+    memset(buffer, 0, BLOCKSIZE);
+    snprintf(buffer, BLOCKSIZE, "%s%s: %s", CF_CHANGEDSTR1, CF_CHANGEDSTR2, "source");
+    assert_int_equal(SendSocketStream(SOCKETS[1], buffer, BLOCKSIZE), BLOCKSIZE);
+
+    return NULL;
+}
+
+/* Sends some data frames, then the frame the server uses to abort */
+static void *ServeChangingFileFramed(ARG_UNUSED void *arg)
+{
+    ConnectionInfo conn_info = { .type = CF_PROTOCOL_CLASSIC, .sd = SOCKETS[1], .protocol_version = 2 };
+    char buffer[CF_BUFSIZE] = { 0 };
+
+    assert_true(ReceiveTransaction(&conn_info, buffer, NULL) > 0);
+
+    memset(buffer, 'x', BLOCKSIZE);
+    for (int i = 0; i < 3; i++)
+    {
+        assert_int_equal(SendTransaction(&conn_info, buffer, BLOCKSIZE, CF_MORE), 0);
+    }
+
+    snprintf(buffer, BLOCKSIZE, "%s%s: %s", CF_CHANGEDSTR1, CF_CHANGEDSTR2, "source");
+    assert_int_equal(SendTransaction(&conn_info, buffer, 0, CF_FAILED), 0);
+
+    return NULL;
+}
+
+static void *ServeOpenDir(ARG_UNUSED void *arg)
+{
+    ServerConnectionState *conn = xcalloc(1, sizeof(ServerConnectionState));
+    conn->conn_info.type = CF_PROTOCOL_CLASSIC;
+    conn->conn_info.sd = SOCKETS[1];
+    conn->conn_info.protocol_version = PROTOCOL_VERSION;
+
+    char recvbuffer[CF_BUFSIZE], sendbuffer[CF_BUFSIZE];
+
+    assert_true(ReceiveTransaction(&conn->conn_info, recvbuffer, NULL) > 0);
+    assert_int_equal(strncmp(recvbuffer, "OPENDIR ", 8), 0);
+    CfOpenDirectory(conn, sendbuffer, recvbuffer + 8);
+
+    free(conn);
+    return NULL;
+}
+
+static bool Copy(void *(*server)(void *), off_t size)
+{
+    AgentConnection conn = {
+        .conn_info = { .type = CF_PROTOCOL_CLASSIC, .sd = SOCKETS[0], .protocol_version = PROTOCOL_VERSION },
+        .this_server = "localhost",
+    };
+
+    pthread_t thread;
+    assert_int_equal(pthread_create(&thread, NULL, server, NULL), 0);
+    bool result = CopyRegularFileNet(SOURCE, DEST, size, false, &conn);
+    assert_int_equal(pthread_join(thread, NULL), 0);
+
+    return result;
+}
+
+static void WriteSource(off_t size)
+{
+    FILE *fp = fopen(SOURCE, "w");
+    assert_true(fp != NULL);
+
+    for (off_t i = 0; i < size; i++)
+    {
+        fputc((i * 7 + i / 4099) & 0xff, fp);
+    }
+
+    fclose(fp);
+}
+
+static void AssertSameFiles(void)
+{
+    Writer *expected = FileRead(SOURCE, SIZE_MAX, NULL);
+    Writer *actual = FileRead(DEST, SIZE_MAX, NULL);
+    assert_true(expected != NULL && actual != NULL);
+
+    assert_int_equal(StringWriterLength(actual), StringWriterLength(expected));
+    assert_memory_equal(StringWriterData(actual), StringWriterData(expected),
+                        StringWriterLength(expected));
+
+    WriterClose(expected);
+    WriterClose(actual);
+}
+
+static void test_get_file(void)
+{
+    /* Not a multiple of the block size, and larger than a receive buffer */
+    off_t size = 3 * 256 * 1024 + 1234;
+    WriteSource(size);
+
+    assert_true(Copy(ServeGet, size));
+    AssertSameFiles();
+
+    WriteSource(100);
+    assert_true(Copy(ServeGet, 100));
+    AssertSameFiles();
+}
+
+static void test_get_changing_file(void)
+{
+    assert_false(Copy(ServeChangingFile, 10 * BLOCKSIZE));
+
+    /* The connection must still be usable */
+    WriteSource(5000);
+    assert_true(Copy(ServeGet, 5000));
+    AssertSameFiles();
+}
+
+static void test_get_file_framed(void)
+{
+    PROTOCOL_VERSION = 2;
+
+    /* Spans several frames, the last one short */
+    off_t size = 3 * 256 * 1024 + 1234;
+    WriteSource(size);
+    assert_true(Copy(ServeGet, size));
+    AssertSameFiles();
+
+    WriteSource(0);
+    assert_true(Copy(ServeGet, 0));
+    AssertSameFiles();
+
+    WriteSource(100);
+    assert_true(Copy(ServeGet, 100));
+    AssertSameFiles();
+
+    /* Stale size from an earlier STAT: the file comes up short */
+    assert_false(Copy(ServeGet, 200));
+
+    assert_false(Copy(ServeChangingFileFramed, 10 * BLOCKSIZE));
+
+    /* The connection must still be usable */
+    WriteSource(5000);
+    assert_true(Copy(ServeGet, 5000));
+    AssertSameFiles();
+
+    PROTOCOL_VERSION = 0;
+}
+
+static void test_get_refused_file_framed(void)
+{
+    PROTOCOL_VERSION = 2;
+
+    WriteSource(100);
+    assert_int_equal(chmod(SOURCE, 0600), 0);
+    assert_false(Copy(ServeRefusedGet, 100));
+
+    /* The refusal is a single frame, so the connection is still in sync */
+    WriteSource(5000);
+    assert_true(Copy(ServeGet, 5000));
+    AssertSameFiles();
+
+    PROTOCOL_VERSION = 0;
+}
+
+static void test_list_directory(void)
+{
+    char dir[CF_BUFSIZE];
+    snprintf(dir, sizeof(dir), "%s/dir", TEST_DIR);
+    assert_int_equal(mkdir(dir, 0700), 0);
+
+    /* More than fits in one classic transaction */
+    const int count = 500;
+    for (int i = 0; i < count; i++)
+    {
+        char path[CF_BUFSIZE];
+        snprintf(path, sizeof(path), "%s/file_with_a_rather_long_name_%d", dir, i);
+        int fd = open(path, O_WRONLY | O_CREAT, 0600);
+        assert_true(fd != -1);
+        close(fd);
+    }
+
+    for (PROTOCOL_VERSION = 0; PROTOCOL_VERSION <= 2; PROTOCOL_VERSION += 2)
+    {
+        AgentConnection conn = {
+            .conn_info = { .type = CF_PROTOCOL_CLASSIC, .sd = SOCKETS[0], .protocol_version = PROTOCOL_VERSION },
+            .this_server = "localhost",
+        };
+
+        pthread_t thread;
+        assert_int_equal(pthread_create(&thread, NULL, ServeOpenDir, NULL), 0);
+        Item *files = RemoteDirList(dir, false, &conn);
+        assert_int_equal(pthread_join(thread, NULL), 0);
+
+        /* Plus . and .. */
+        assert_int_equal(ListLen(files), count + 2);
+        DeleteItemList(files);
+    }
+    PROTOCOL_VERSION = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        char path[CF_BUFSIZE];
+        snprintf(path, sizeof(path), "%s/file_with_a_rather_long_name_%d", dir, i);
+        unlink(path);
+    }
+    rmdir(dir);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+
+    assert_true(mkdtemp(TEST_DIR) != NULL);
+    snprintf(SOURCE, sizeof(SOURCE), "%s/source", TEST_DIR);
+    snprintf(DEST, sizeof(DEST), "%s/dest", TEST_DIR);
+    assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, SOCKETS), 0);
+
+    const UnitTest tests[] =
+    {
+        unit_test(test_get_file),
+        unit_test(test_get_changing_file),
+        unit_test(test_get_file_framed),
+        unit_test(test_get_refused_file_framed),
+        unit_test(test_list_directory),
+    };
+
+    int ret = run_tests(tests);
+
+    close(SOCKETS[0]);
+    close(SOCKETS[1]);
+    unlink(SOURCE);
+    unlink(DEST);
+    rmdir(TEST_DIR);
+
+    return ret;
+}
@@ -1096,6 +1096,174 @@ static void test_detach_key_from_object(void)
     JsonDestroy(detached);
 }
 
+static void test_object_index(void)
+{
+    JsonElement *object = JsonObjectCreate(10);
+    char key[32];
+
+    for (int i = 0; i < 1000; i++)
+    {
+        snprintf(key, sizeof(key), "key%d", i);
+        JsonObjectAppendInteger(object, key, i);
+    }
+    assert_string_equal(JsonPrimitiveGetAsString(JsonObjectGet(object, "key999")), "999");
+
+    /* Replacing a key moves it to the end */
+    JsonObjectAppendString(object, "key0", "zero");
+    assert_int_equal(JsonLength(object), 1000);
+    assert_string_equal(JsonObjectGetAsString(object, "key0"), "zero");
+    assert_string_equal(JsonGetPropertyAsString(JsonAt(object, 999)), "key0");
+
+    for (int i = 1; i < 1000; i += 2)
+    {
+        snprintf(key, sizeof(key), "key%d", i);
+        assert_true(JsonObjectRemoveKey(object, key));
+    }
+    assert_false(JsonObjectRemoveKey(object, "key1"));
+    assert_int_equal(JsonLength(object), 500);
+    assert_true(JsonObjectGet(object, "key1") == NULL);
+
+    JsonElement *detached = JsonObjectDetachKey(object, "key500");
+    assert_string_equal(JsonPrimitiveGetAsString(detached), "500");
+    JsonDestroy(detached);
+    assert_true(JsonObjectGet(object, "key500") == NULL);
+    assert_int_equal(JsonLength(object), 499);
+
+    JsonElement *copy = JsonCopy(object);
+    assert_string_equal(JsonPrimitiveGetAsString(JsonObjectGet(copy, "key998")), "998");
+    JsonDestroy(copy);
+
+    /* Removals keep the remaining children in order and in the index */
+    for (size_t i = 0; i < JsonLength(object); i++)
+    {
+        const char *name = JsonGetPropertyAsString(JsonAt(object, i));
+        assert_true(JsonObjectGet(object, name) == JsonAt(object, i));
+    }
+    assert_string_equal(JsonGetPropertyAsString(JsonAt(object, 0)), "key2");
+    assert_string_equal(JsonGetPropertyAsString(JsonAt(object, 498)), "key0");
+
+    JsonObjectAppendString(object, "key1", "one");
+    assert_string_equal(JsonObjectGetAsString(object, "key1"), "one");
+    assert_int_equal(JsonLength(object), 500);
+
+    JsonDestroy(object);
+}
+
+static char *JsonToString(JsonElement *json)
+{
+    Writer *w = StringWriter();
+    JsonWrite(w, json, 0);
+    return StringWriterClose(w);
+}
+
+/* JsonParseFile() must agree with JsonParse() on results and errors */
+static void AssertParseFileSame(const char *text, size_t size_max)
+{
+    char path[] = "/tmp/json_test.XXXXXX";
+    int fd = mkstemp(path);
+    assert_true(fd != -1);
+    assert_int_equal(write(fd, text, strlen(text)), strlen(text));
+    close(fd);
+
+    char *truncated = xstrndup(text, size_max);
+    const char *data = truncated;
+    JsonElement *expected = NULL;
+    JsonParseError expected_err = JsonParse(&data, &expected);
+
+    JsonElement *actual = NULL;
+    JsonParseError err = JsonParseFile(path, size_max, &actual);
+    assert_int_equal(err, expected_err);
+
+    if (err == JSON_PARSE_OK)
+    {
+        char *expected_str = JsonToString(expected);
+        char *actual_str = JsonToString(actual);
+        assert_string_equal(actual_str, expected_str);
+        free(expected_str);
+        free(actual_str);
+        JsonDestroy(expected);
+        JsonDestroy(actual);
+    }
+
+    free(truncated);
+    unlink(path);
+}
+
+static void test_parse_file(void)
+{
+    const char *documents[] =
+    {
+        OBJECT_ARRAY, OBJECT_COMPOUND, OBJECT_SIMPLE, OBJECT_NUMERIC, OBJECT_BOOLEAN,
+        OBJECT_ESCAPED, ARRAY_SIMPLE, ARRAY_NUMERIC, ARRAY_OBJECT,
+        "  [ [], {}, null, false, -0.5e3, \"\\\\\" ] trailing",
+        "{ \"a\": { \"b\": [ 1, 2, { \"c\": \"d\" } ] }, \"a\": 2 }",
+        "", "x", "[ 01 ]", "[ truex ]", "{ \"a\" }", "{ : 1 }", "{ \"a\": 1, , }",
+        "{ [ ] }", "[ \"unterminated ]", "{ \"a\": [ 1, 2 }",
+    };
+
+    for (size_t i = 0; i < sizeof(documents) / sizeof(documents[0]); i++)
+    {
+        AssertParseFileSame(documents[i], SIZE_MAX);
+    }
+
+    /* Cut short by size_max */
+    AssertParseFileSame(OBJECT_COMPOUND, 20);
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", TESTDATADIR, "benchmark.json");
+    Writer *w = FileRead(path, SIZE_MAX, NULL);
+    assert_true(w != NULL);
+    AssertParseFileSame(StringWriterData(w), SIZE_MAX);
+    WriterClose(w);
+
+    JsonElement *json = NULL;
+    assert_int_equal(JsonParseFile("/nonexistent/file.json", SIZE_MAX, &json), JSON_PARSE_ERROR_NO_SUCH_FILE);
+    assert_true(json == NULL);
+}
+
+static void test_reader_events(void)
+{
+    const char *text = "{ \"list\": [ 1, \"two\" ], \"empty\": {} }";
+    const JsonEvent expected[] =
+    {
+        JSON_EVENT_OBJECT_START, JSON_EVENT_ARRAY_START, JSON_EVENT_VALUE, JSON_EVENT_VALUE,
+        JSON_EVENT_ARRAY_END, JSON_EVENT_OBJECT_START, JSON_EVENT_OBJECT_END,
+        JSON_EVENT_OBJECT_END, JSON_EVENT_END,
+    };
+
+    int fds[2];
+    assert_int_equal(pipe(fds), 0);
+    assert_int_equal(write(fds[1], text, strlen(text)), strlen(text));
+    close(fds[1]);
+
+    JsonReader *reader = JsonReaderNew(fds[0], SIZE_MAX);
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++)
+    {
+        JsonEvent event;
+        assert_int_equal(JsonReaderNext(reader, &event), JSON_PARSE_OK);
+        assert_int_equal(event, expected[i]);
+
+        if (i == 1)
+        {
+            assert_string_equal(JsonReaderKey(reader), "list");
+        }
+        else if (i == 3)
+        {
+            assert_true(JsonReaderKey(reader) == NULL);
+            JsonElement *value = JsonReaderTakeValue(reader);
+            assert_string_equal(JsonPrimitiveGetAsString(value), "two");
+            JsonDestroy(value);
+        }
+        else if (i == 5)
+        {
+            assert_string_equal(JsonReaderKey(reader), "empty");
+        }
+    }
+
+    JsonReaderDestroy(reader);
+    close(fds[0]);
+}
+
 int main()
 {
     PRINT_TEST_BANNER();
@@ -1149,6 +1317,9 @@ int main()
         unit_test(test_array_remove_range),
         unit_test(test_remove_key_from_object),
         unit_test(test_detach_key_from_object),
+        unit_test(test_object_index),
+        unit_test(test_parse_file),
+        unit_test(test_reader_events),
     };
 
     return run_tests(tests);
@@ -0,0 +1,124 @@
+#include <test.h>
+
+#include <cf3.defs.h>
+#include <process_lib.h>
+#include <processes_select.h>
+#include <env_context.h>
+#include <item_lib.h>
+#include <sequence.h>
+#include <string_lib.h>
+
+static const ProcessInfo *FindSelf(const Seq *table)
+{
+    for (size_t i = 0; i < SeqLength(table); i++)
+    {
+        const ProcessInfo *info = SeqAt(table, i);
+        if (info->pid == getpid())
+        {
+            return info;
+        }
+    }
+    return NULL;
+}
+
+static void test_load_process_info_table(void)
+{
+    Seq *table = LoadProcessInfoTable();
+    assert_true(table != NULL);
+
+    for (size_t i = 1; i < SeqLength(table); i++)
+    {
+        const ProcessInfo *prev = SeqAt(table, i - 1);
+        const ProcessInfo *info = SeqAt(table, i);
+        assert_true(prev->pid < info->pid);
+    }
+
+    const ProcessInfo *self = FindSelf(table);
+    assert_true(self != NULL);
+    assert_int_equal(self->ppid, getppid());
+    assert_int_equal(self->pgid, getpgrp());
+    assert_int_equal(self->uid, geteuid());
+    assert_int_equal(self->state, 'R');
+    assert_true(self->threads >= 1);
+    assert_true(self->rss > 0);
+    assert_true(self->vsize >= self->rss);
+    assert_true(self->start_time <= time(NULL));
+    assert_true(strstr(self->command, "linux_process_info_test") != NULL);
+
+    SeqDestroy(table);
+}
+
+static ProcessSelect EmptyProcessSelect(void)
+{
+    return (ProcessSelect) {
+        .min_pid = CF_NOINT, .max_pid = CF_NOINT,
+        .min_ppid = CF_NOINT, .max_ppid = CF_NOINT,
+        .min_pgid = CF_NOINT, .max_pgid = CF_NOINT,
+        .min_rsize = CF_NOINT, .max_rsize = CF_NOINT,
+        .min_vsize = CF_NOINT, .max_vsize = CF_NOINT,
+        .min_ttime = CF_NOINT, .max_ttime = CF_NOINT,
+        .min_stime = CF_NOINT, .max_stime = CF_NOINT,
+        .min_pri = CF_NOINT, .max_pri = CF_NOINT,
+        .min_thread = CF_NOINT, .max_thread = CF_NOINT,
+    };
+}
+
+static void test_select_from_process_table(void)
+{
+    EvalContext *ctx = EvalContextNew();
+
+    snprintf(CFWORKDIR, CF_BUFSIZE, "/tmp/linux_process_info_test.XXXXXX");
+    assert_true(mkdtemp(CFWORKDIR) != NULL);
+    char *state_dir = StringConcatenate(2, CFWORKDIR, "/state");
+    assert_int_equal(mkdir(state_dir, 0700), 0);
+
+    assert_true(LoadProcessTable(ctx, &PROCESSTABLE));
+    assert_true(PROCESSTABLE != NULL);
+    assert_true(strstr(PROCESSTABLE->name, "PID") != NULL);
+
+    ProcessSelect a = EmptyProcessSelect();
+    a.min_pid = getpid();
+    a.max_pid = getpid();
+    a.process_result = "pid";
+
+    Item *selected = SelectProcesses(ctx, PROCESSTABLE, ".*", a, true);
+    assert_int_equal(ListLen(selected), 1);
+    assert_int_equal(selected->counter, getpid());
+    DeleteItemList(selected);
+
+    a = EmptyProcessSelect();
+    a.command = ".*linux_process_info_test.*";
+    a.min_ppid = getppid();
+    a.max_ppid = getppid();
+    a.process_result = "command.ppid";
+
+    selected = SelectProcesses(ctx, PROCESSTABLE, "linux_process_info_test", a, true);
+    assert_int_equal(ListLen(selected), 1);
+    assert_int_equal(selected->counter, getpid());
+    DeleteItemList(selected);
+
+    assert_true(IsProcessNameRunning(ctx, ".*linux_process_info_test.*"));
+    assert_false(IsProcessNameRunning(ctx, "no_such_process_name"));
+
+    ClearProcessTable();
+    assert_true(PROCESSTABLE == NULL);
+
+    char cmd[CF_BUFSIZE];
+    snprintf(cmd, CF_BUFSIZE, "rm -rf '%s'", CFWORKDIR);
+    system(cmd);
+    free(state_dir);
+    EvalContextDestroy(ctx);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+
+    const UnitTest tests[] =
+    {
+        unit_test(test_load_process_info_table),
+        unit_test(test_select_from_process_table),
+    };
+
+    return run_tests(tests);
+}
@@ -0,0 +1,127 @@
+#include <test.h>
+
+#include <logging.h>
+#include <logging_priv.h>
+
+static int HOOK_CALLS;
+static int ARGUMENTS_EVALUATED;
+
+static const char *CountingHook(ARG_UNUSED LoggingPrivContext *pctx, const char *message)
+{
+    HOOK_CALLS++;
+    return message;
+}
+
+static LoggingPrivContext COUNTING_CONTEXT = { .log_hook = &CountingHook };
+
+static const char *Argument(void)
+{
+    ARGUMENTS_EVALUATED++;
+    return "argument";
+}
+
+static void LogRecorded(LogLevel level, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    LoggingPrivVLogRecorded(level, fmt, ap);
+    va_end(ap);
+}
+
+static void test_disabled_levels_are_dropped(void)
+{
+    LogSetGlobalLevel(LOG_LEVEL_ERR);
+    HOOK_CALLS = 0;
+
+    Log(LOG_LEVEL_DEBUG, "not %s", "formatted");
+    Log(LOG_LEVEL_INFO, "not %s", "formatted");
+    assert_int_equal(HOOK_CALLS, 0);
+    assert_false(LogLevelEnabled(LOG_LEVEL_WARNING));
+    assert_true(LogLevelEnabled(LOG_LEVEL_ERR));
+
+    /* Recorded messages reach the hook even if they are not shown */
+    LogRecorded(LOG_LEVEL_VERBOSE, "recorded %s", "message");
+    assert_int_equal(HOOK_CALLS, 1);
+
+    Log(LOG_LEVEL_ERR, "shown %s", "message");
+    assert_int_equal(HOOK_CALLS, 2);
+
+    LoggingPrivSetLevels(LOG_LEVEL_ERR, LOG_LEVEL_VERBOSE);
+    assert_true(LogLevelEnabled(LOG_LEVEL_VERBOSE));
+    assert_false(LogLevelEnabled(LOG_LEVEL_DEBUG));
+    LogSetGlobalLevel(LOG_LEVEL_ERR);
+}
+
+static void test_module_levels(void)
+{
+    LogSetGlobalLevel(LOG_LEVEL_ERR);
+    ARGUMENTS_EVALUATED = 0;
+    HOOK_CALLS = 0;
+
+    assert_false(LogModuleEnabled(LOG_MOD_NET, LOG_LEVEL_DEBUG));
+    LogDebug(LOG_MOD_NET, "%s", Argument());
+    assert_int_equal(ARGUMENTS_EVALUATED, 0);
+
+    assert_true(LogEnableModulesFromString("net"));
+    assert_true(LogModuleEnabled(LOG_MOD_NET, LOG_LEVEL_DEBUG));
+    assert_false(LogModuleEnabled(LOG_MOD_EXPAND, LOG_LEVEL_DEBUG));
+    assert_false(LogLevelEnabled(LOG_LEVEL_DEBUG));
+
+    LogDebug(LOG_MOD_NET, "%s", Argument());
+    LogDebug(LOG_MOD_EXPAND, "%s", Argument());
+    assert_int_equal(ARGUMENTS_EVALUATED, 1);
+    assert_int_equal(HOOK_CALLS, 1);
+
+    char data[] = "a\nb";
+    LogRaw(LOG_MOD_NET, LOG_LEVEL_DEBUG, "raw: ", data, sizeof(data) - 1);
+    LogRaw(LOG_MOD_EXPAND, LOG_LEVEL_DEBUG, "raw: ", data, sizeof(data) - 1);
+    assert_int_equal(HOOK_CALLS, 2);
+
+    assert_false(LogEnableModulesFromString("expand,bogus"));
+    assert_true(LogModuleEnabled(LOG_MOD_EXPAND, LOG_LEVEL_DEBUG));
+
+    LogModuleSetLevel(LOG_MOD_NET, LOG_LEVEL_NOTHING);
+    LogModuleSetLevel(LOG_MOD_EXPAND, LOG_LEVEL_NOTHING);
+    assert_false(LogModuleEnabled(LOG_MOD_NET, LOG_LEVEL_DEBUG));
+}
+
+static void test_async_system_log(void)
+{
+    LoggingPrivSetLevels(LOG_LEVEL_ERR, LOG_LEVEL_NOTHING);
+    HOOK_CALLS = 0;
+
+    /* More messages than fit: the rest are dropped, not waited for */
+    LoggingEnableAsyncSystemLog(4);
+    for (int i = 0; i < 100; i++)
+    {
+        Log(LOG_LEVEL_ERR, "logging_levels_test message %d", i);
+    }
+    LoggingFlushAsyncSystemLog();
+    assert_int_equal(HOOK_CALLS, 100);
+
+    /* Back to synchronous logging, and can be started again */
+    Log(LOG_LEVEL_ERR, "logging_levels_test synchronous message");
+    LoggingEnableAsyncSystemLog(4);
+    LoggingFlushAsyncSystemLog();
+    LoggingFlushAsyncSystemLog();
+
+    LogSetGlobalLevel(LOG_LEVEL_ERR);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    LoggingPrivSetContext(&COUNTING_CONTEXT);
+
+    const UnitTest tests[] =
+    {
+        unit_test(test_disabled_levels_are_dropped),
+        unit_test(test_module_levels),
+        unit_test(test_async_system_log),
+    };
+
+    int ret = run_tests(tests);
+
+    LoggingPrivSetContext(NULL);
+    return ret;
+}
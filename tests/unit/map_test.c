@@ -186,6 +186,103 @@ static void test_hashmap_degenerate_hash_fn(void)
     HashMapDestroy(hashmap);
 }
 
+static void test_hashmap_grow(void)
+{
+    HashMap *hashmap = HashMapNew((MapHashFn)StringHash, (MapKeyEqualFn)StringSafeEqual, free, free);
+    size_t initial_size = hashmap->size;
+
+    for (int i = 0; i < 20000; i++)
+    {
+        char *key = StringFromLong(i);
+        HashMapInsert(hashmap, key, xstrdup(key));
+    }
+
+    assert_int_equal(hashmap->load, 20000);
+    assert_true(hashmap->size > initial_size);
+
+    for (int i = 0; i < 20000; i++)
+    {
+        char *key = StringFromLong(i);
+        MapKeyValue *item = HashMapGet(hashmap, key);
+        assert_true(item != NULL);
+        assert_string_equal(item->value, key);
+        assert_true(HashMapRemove(hashmap, key));
+        free(key);
+    }
+
+    assert_int_equal(hashmap->load, 0);
+
+    HashMapDestroy(hashmap);
+}
+
+static void test_hashmap_remove_in_probe_run(void)
+{
+    /* All keys collide, removals have to keep the rest of the run reachable */
+    HashMap *hashmap = HashMapNew(ConstHash, (MapKeyEqualFn)StringSafeEqual, free, free);
+
+    for (int i = 0; i < 100; i++)
+    {
+        HashMapInsert(hashmap, StringFromLong(i), StringFromLong(i));
+    }
+
+    for (int i = 0; i < 100; i += 3)
+    {
+        char *key = StringFromLong(i);
+        assert_true(HashMapRemove(hashmap, key));
+        assert_false(HashMapRemove(hashmap, key));
+        free(key);
+    }
+
+    for (int i = 0; i < 100; i++)
+    {
+        char *key = StringFromLong(i);
+        MapKeyValue *item = HashMapGet(hashmap, key);
+        if (i % 3 == 0)
+        {
+            assert_true(item == NULL);
+        }
+        else
+        {
+            assert_true(item != NULL);
+            assert_string_equal(item->value, key);
+        }
+        free(key);
+    }
+
+    size_t count = 0;
+    HashMapIterator it = HashMapIteratorInit(hashmap);
+    while (HashMapIteratorNext(&it))
+    {
+        count++;
+    }
+    assert_int_equal(count, 66);
+    assert_int_equal(hashmap->load, 66);
+
+    HashMapDestroy(hashmap);
+}
+
+static void test_hashmap_pointer_keys(void)
+{
+    /* Aligned pointers only differ in their high bits */
+    Map *map = MapNew(NULL, NULL, NULL, NULL);
+    char *block = xcalloc(1000, 64);
+
+    for (int i = 0; i < 1000; i++)
+    {
+        MapInsert(map, block + i * 64, block + i * 64);
+    }
+    assert_int_equal(MapSize(map), 1000);
+
+    for (int i = 0; i < 1000; i++)
+    {
+        assert_true(MapGet(map, block + i * 64) == block + i * 64);
+    }
+    assert_false(MapHasKey(map, block + 1));
+
+    MapDestroy(map);
+    free(block);
+}
+
 int main()
 {
     PRINT_TEST_BANNER();
@@ -201,6 +298,9 @@ int main()
         unit_test(test_iterate),
         unit_test(test_hashmap_new_destroy),
         unit_test(test_hashmap_degenerate_hash_fn),
+        unit_test(test_hashmap_grow),
+        unit_test(test_hashmap_remove_in_probe_run),
+        unit_test(test_hashmap_pointer_keys),
     };
 
     return run_tests(tests);
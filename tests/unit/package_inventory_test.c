@@ -0,0 +1,164 @@
+#include <cf3.defs.h>
+
+#include <verify_packages.h>
+#include <files_names.h>
+
+#include <test.h>
+
+static char DATABASE[CF_BUFSIZE];
+
+static void setup(void)
+{
+    char path[CF_BUFSIZE];
+
+    snprintf(CFWORKDIR, CF_BUFSIZE, "/tmp/package_inventory_test.XXXXXX");
+    mkdtemp(CFWORKDIR);
+    snprintf(path, sizeof(path), "%s/state", CFWORKDIR);
+    mkdir(path, 0700);
+
+    snprintf(DATABASE, sizeof(DATABASE), "%s/Packages", CFWORKDIR);
+    close(open(DATABASE, O_WRONLY | O_CREAT, 0600));
+}
+
+static void teardown(void)
+{
+    char cmd[CF_BUFSIZE];
+    snprintf(cmd, CF_BUFSIZE, "rm -rf '%s'", CFWORKDIR);
+    system(cmd);
+}
+
+static PackageManager *ListedManager(const char *command, time_t list_time, time_t database_mtime)
+{
+    PackageManager *manager = xcalloc(1, sizeof(PackageManager));
+    manager->manager = xstrdup(command);
+    manager->list_time = list_time;
+    manager->database_mtime = database_mtime;
+    return manager;
+}
+
+static void DestroyManager(PackageManager *manager)
+{
+    for (PackageItem *pi = manager->pack_list, *next; pi != NULL; pi = next)
+    {
+        next = pi->next;
+        free(pi->name);
+        free(pi->version);
+        free(pi->arch);
+        free(pi);
+    }
+    free(manager->manager);
+    free(manager);
+}
+
+static void test_write_and_load(void)
+{
+    Attributes a = { .packages = { .package_list_update_ifelapsed = CF_NOINT } };
+
+    PackageManager *rpm = ListedManager("/bin/rpm -qa", time(NULL), 0);
+    PrependPackageItem(NULL, &rpm->pack_list, "bash", "4.2-1", "x86_64", NULL);
+    PrependPackageItem(NULL, &rpm->pack_list, "glibc", "2.17-2", "i686", NULL);
+    PrependPackageItem(NULL, &rpm->pack_list, "glibc", "2.17-1", "x86_64", NULL);
+    WriteSoftwareInventory(rpm);
+
+    PackageManager *pip = ListedManager("/usr/bin/pip list", time(NULL), 0);
+    PrependPackageItem(NULL, &pip->pack_list, "requests", "2.0", "default", NULL);
+    WriteSoftwareInventory(pip);
+
+    /* Writing the pip list kept the rpm one */
+    PackageManager *loaded = ListedManager("/bin/rpm -qa", 0, 0);
+    assert_true(LoadSoftwareInventory(loaded, "x86_64", a));
+    assert_int_equal(loaded->list_time, rpm->list_time);
+
+    PackageItem *expected = rpm->pack_list, *pi = loaded->pack_list;
+    for (; (expected != NULL) && (pi != NULL); expected = expected->next, pi = pi->next)
+    {
+        assert_string_equal(pi->name, expected->name);
+        assert_string_equal(pi->version, expected->version);
+        assert_string_equal(pi->arch, expected->arch);
+    }
+    assert_true(expected == NULL && pi == NULL);
+    DestroyManager(loaded);
+
+    /* A cached "default" architecture is the one the package method detects */
+    loaded = ListedManager("/usr/bin/pip list", 0, 0);
+    assert_true(LoadSoftwareInventory(loaded, "x86_64", a));
+    assert_string_equal(loaded->pack_list->name, "requests");
+    assert_string_equal(loaded->pack_list->arch, "x86_64");
+    assert_true(loaded->pack_list->next == NULL);
+    DestroyManager(loaded);
+
+    loaded = ListedManager("/usr/bin/dpkg -l", 0, 0);
+    assert_false(LoadSoftwareInventory(loaded, "x86_64", a));
+    assert_true(loaded->pack_list == NULL);
+    DestroyManager(loaded);
+
+    DestroyManager(rpm);
+    DestroyManager(pip);
+}
+
+static void test_expiry(void)
+{
+    Attributes a = { .packages = { .package_list_update_ifelapsed = 60 } };
+
+    PackageManager *rpm = ListedManager("/bin/rpm -qa", time(NULL) - 2 * 3600, 0);
+    PrependPackageItem(NULL, &rpm->pack_list, "bash", "4.2-1", "x86_64", NULL);
+    WriteSoftwareInventory(rpm);
+
+    PackageManager *loaded = ListedManager("/bin/rpm -qa", 0, 0);
+    assert_false(LoadSoftwareInventory(loaded, "x86_64", a));
+
+    a.packages.package_list_update_ifelapsed = 3 * 60;
+    assert_true(LoadSoftwareInventory(loaded, "x86_64", a));
+
+    DestroyManager(loaded);
+    DestroyManager(rpm);
+}
+
+static void test_database_mtime(void)
+{
+    struct stat sb;
+    struct utimbuf times;
+    stat(DATABASE, &sb);
+
+    /* Old enough for package_list_update_ifelapsed, but the database decides */
+    Attributes a = { .packages = { .package_list_update_ifelapsed = 1, .package_list_database = DATABASE } };
+    PackageManager *rpm = ListedManager("/bin/rpm -qa", time(NULL) - 2 * 3600, sb.st_mtime);
+    PrependPackageItem(NULL, &rpm->pack_list, "bash", "4.2-1", "x86_64", NULL);
+    WriteSoftwareInventory(rpm);
+
+    PackageManager *loaded = ListedManager("/bin/rpm -qa", 0, 0);
+    assert_true(LoadSoftwareInventory(loaded, "x86_64", a));
+    DestroyManager(loaded);
+
+    times.actime = times.modtime = sb.st_mtime + 10;
+    utime(DATABASE, &times);
+
+    loaded = ListedManager("/bin/rpm -qa", 0, 0);
+    assert_false(LoadSoftwareInventory(loaded, "x86_64", a));
+    DestroyManager(loaded);
+
+    unlink(DATABASE);
+    loaded = ListedManager("/bin/rpm -qa", 0, 0);
+    assert_false(LoadSoftwareInventory(loaded, "x86_64", a));
+    DestroyManager(loaded);
+
+    DestroyManager(rpm);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    setup();
+
+    const UnitTest tests[] =
+    {
+        unit_test(test_write_and_load),
+        unit_test(test_expiry),
+        unit_test(test_database_mtime),
+    };
+
+    int ret = run_tests(tests);
+
+    teardown();
+    return ret;
+}
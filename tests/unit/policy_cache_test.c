@@ -0,0 +1,142 @@
+#include <test.h>
+
+#include <policy_cache.h>
+#include <parser.h>
+#include <crypto.h>
+
+static char TEST_DIR[] = "/tmp/policy_cache_test.XXXXXX";
+static char POLICY_FILE[CF_BUFSIZE];
+
+static char *PolicyToJsonString(const Policy *policy)
+{
+    JsonElement *json = PolicyToJson(policy);
+    Writer *writer = StringWriter();
+    JsonWrite(writer, json, 0);
+    JsonDestroy(json);
+    return StringWriterClose(writer);
+}
+
+static void WritePolicyFile(const char *content)
+{
+    FILE *fp = fopen(POLICY_FILE, "w");
+    assert_true(fp != NULL);
+    assert_true(fputs(content, fp) >= 0);
+    assert_int_equal(fclose(fp), 0);
+}
+
+static void test_serialize_roundtrip(void)
+{
+    const char *path = TESTDATADIR "/benchmark.cf";
+    Policy *original = ParserParseFile(AGENT_TYPE_COMMON, path, 0, 0);
+    assert_true(original != NULL);
+
+    size_t size = 0;
+    char *data = PolicySerialize(original, &size);
+    assert_true(data != NULL);
+
+    Policy *copy = PolicyDeserialize(data, size, path);
+    assert_true(copy != NULL);
+
+    char *original_json = PolicyToJsonString(original);
+    char *copy_json = PolicyToJsonString(copy);
+    assert_string_equal(original_json, copy_json);
+    free(original_json);
+    free(copy_json);
+
+    /* The index is rebuilt as well */
+    assert_true(PolicyGetBody(copy, NULL, "common", "control") != NULL);
+
+    /* Truncated or trailing data is rejected */
+    assert_true(PolicyDeserialize(data, size - 1, path) == NULL);
+    assert_true(PolicyDeserialize(data, size / 2, path) == NULL);
+    char *longer = xcalloc(1, size + 1);
+    memcpy(longer, data, size);
+    assert_true(PolicyDeserialize(longer, size + 1, path) == NULL);
+
+    free(longer);
+    free(data);
+    PolicyDestroy(copy);
+    PolicyDestroy(original);
+}
+
+static void test_cache_load_store(void)
+{
+    WritePolicyFile("bundle agent main { reports: \"one\"; }\n");
+
+    PolicyCacheKey key;
+    assert_true(PolicyCacheLoad(AGENT_TYPE_AGENT, POLICY_FILE, &key) == NULL);
+    assert_true(key.valid);
+
+    Policy *parsed = ParserParseFile(AGENT_TYPE_AGENT, POLICY_FILE, 0, 0);
+    assert_true(parsed != NULL);
+    PolicyCacheStore(&key, parsed);
+
+    Policy *cached = PolicyCacheLoad(AGENT_TYPE_AGENT, POLICY_FILE, &key);
+    assert_true(cached != NULL);
+
+    char *parsed_json = PolicyToJsonString(parsed);
+    char *cached_json = PolicyToJsonString(cached);
+    assert_string_equal(parsed_json, cached_json);
+    free(parsed_json);
+    free(cached_json);
+    PolicyDestroy(cached);
+    PolicyDestroy(parsed);
+
+    /* Another agent type has its own entry */
+    assert_true(PolicyCacheLoad(AGENT_TYPE_SERVER, POLICY_FILE, &key) == NULL);
+
+    /* So does another content */
+    WritePolicyFile("bundle agent main { reports: \"two\"; }\n");
+    assert_true(PolicyCacheLoad(AGENT_TYPE_AGENT, POLICY_FILE, &key) == NULL);
+    assert_true(key.valid);
+}
+
+static void test_include_not_cached(void)
+{
+    WritePolicyFile("@include other.cf\n");
+
+    PolicyCacheKey key;
+    assert_true(PolicyCacheLoad(AGENT_TYPE_AGENT, POLICY_FILE, &key) == NULL);
+    assert_false(key.valid);
+}
+
+static void test_long_path_not_cached(void)
+{
+    WritePolicyFile("bundle agent main { reports: \"one\"; }\n");
+
+    /* The cache file name would not fit */
+    memset(CFWORKDIR, 'x', CF_BUFSIZE - 10);
+    CFWORKDIR[CF_BUFSIZE - 10] = '\0';
+
+    PolicyCacheKey key;
+    assert_true(PolicyCacheLoad(AGENT_TYPE_AGENT, POLICY_FILE, &key) == NULL);
+    assert_false(key.valid);
+
+    snprintf(CFWORKDIR, CF_BUFSIZE, "%s", TEST_DIR);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    CryptoInitialize();
+
+    assert_true(mkdtemp(TEST_DIR) != NULL);
+    snprintf(CFWORKDIR, CF_BUFSIZE, "%s", TEST_DIR);
+    snprintf(POLICY_FILE, sizeof(POLICY_FILE), "%s/promises.cf", TEST_DIR);
+
+    const UnitTest tests[] =
+    {
+        unit_test(test_serialize_roundtrip),
+        unit_test(test_cache_load_store),
+        unit_test(test_include_not_cached),
+        unit_test(test_long_path_not_cached),
+    };
+
+    int ret = run_tests(tests);
+
+    char cmd[CF_BUFSIZE];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", TEST_DIR);
+    system(cmd);
+
+    return ret;
+}
@@ -321,6 +321,45 @@ static void test_policy_json_offsets(void)
     JsonDestroy(json);
 }
 
+static void test_policy_lookup(void)
+{
+    Policy *a = PolicyNew();
+    Bundle *main_bundle = PolicyAppendBundle(a, "default", "main", "agent", NULL, NULL);
+    Bundle *common_main = PolicyAppendBundle(a, "default", "main", "common", NULL, NULL);
+    Bundle *ns_main = PolicyAppendBundle(a, "ns", "main", "agent", NULL, NULL);
+    Bundle *prefixed = PolicyAppendBundle(a, "other", "other:lib", "agent", NULL, NULL);
+    Body *perms = PolicyAppendBody(a, "default", "p", "perms", NULL, NULL);
+
+    assert_true(PolicyGetBundle(a, NULL, "agent", "main") == main_bundle);
+    assert_true(PolicyGetBundle(a, NULL, NULL, "main") == main_bundle);
+    assert_true(PolicyGetBundle(a, NULL, "common", "main") == common_main);
+    assert_true(PolicyGetBundle(a, "ns", NULL, "main") == ns_main);
+    assert_true(PolicyGetBundle(a, "ns", "common", "main") == NULL);
+    assert_true(PolicyGetBundle(a, NULL, "agent", "missing") == NULL);
+
+    /* Found both with and without the namespace prefix */
+    assert_true(PolicyGetBundle(a, NULL, "agent", "lib") == prefixed);
+    assert_true(PolicyGetBundle(a, "other", "agent", "other:lib") == prefixed);
+
+    assert_true(PolicyGetBody(a, NULL, "perms", "p") == perms);
+    assert_true(PolicyGetBody(a, "default", NULL, "p") == perms);
+    assert_true(PolicyGetBody(a, NULL, "action", "p") == NULL);
+
+    Policy *b = PolicyNew();
+    Body *ns_perms = PolicyAppendBody(b, "ns", "p", "perms", NULL, NULL);
+    Body *action = PolicyAppendBody(b, "default", "p", "action", NULL, NULL);
+
+    Policy *merged = PolicyMerge(a, b);
+    assert_true(PolicyGetBundle(merged, NULL, "agent", "main") == main_bundle);
+    assert_true(PolicyGetBody(merged, NULL, "perms", "p") == perms);
+    assert_true(PolicyGetBody(merged, "ns", "perms", "p") == ns_perms);
+    assert_true(PolicyGetBody(merged, NULL, "action", "p") == action);
+
+    Body *later = PolicyAppendBody(merged, "default", "q", "perms", NULL, NULL);
+    assert_true(PolicyGetBody(merged, NULL, "perms", "q") == later);
+
+    PolicyDestroy(merged);
+}
 
 static void test_util_bundle_qualified_name(void)
 {
@@ -457,6 +496,7 @@ int main()
 
         unit_test(test_policy_json_to_from),
         unit_test(test_policy_json_offsets),
+        unit_test(test_policy_lookup),
 
         unit_test(test_util_bundle_qualified_name),
         unit_test(test_util_qualified_name_components),
@@ -0,0 +1,121 @@
+#include <test.h>
+
+#include <profiler.h>
+#include <json.h>
+#include <file_lib.h>
+#include <writer.h>
+
+static char PREFIX[] = "/tmp/profiler_test.XXXXXX";
+
+static JsonElement *ReadProfile(void)
+{
+    char path[CF_BUFSIZE];
+    snprintf(path, sizeof(path), "%s.json", PREFIX);
+
+    JsonElement *json = NULL;
+    assert_int_equal(JsonParseFile(path, SIZE_MAX, &json), JSON_PARSE_OK);
+    return json;
+}
+
+static double Number(JsonElement *object, const char *key)
+{
+    return JsonPrimitiveGetAsReal(JsonObjectGet(object, key));
+}
+
+static void test_disabled(void)
+{
+    ProfilerReset();
+
+    ProfilerEnter(PROFILE_FRAME_BUNDLE, "default:main");
+    ProfilerLeave();
+
+    assert_false(ProfilerIsEnabled());
+    assert_false(ProfilerWrite(PREFIX));
+}
+
+static void test_tree(void)
+{
+    ProfilerEnable();
+
+    ProfilerEnter(PROFILE_FRAME_BUNDLE, "default:main");
+    ProfilerEnter(PROFILE_FRAME_PROMISE_TYPE, "files");
+    for (int i = 0; i < 2; i++)
+    {
+        ProfilerEnter(PROFILE_FRAME_PROMISE, "/etc/motd");
+        ProfilerEnter(PROFILE_FRAME_EXPANSION, NULL);
+        ProfilerEnter(PROFILE_FRAME_FUNCTION, "readfile");
+        usleep(2000);
+        ProfilerLeave();
+        ProfilerLeave();
+        ProfilerLeave();
+    }
+    ProfilerEnter(PROFILE_FRAME_PROMISE, "a;b");
+    usleep(2000);
+    ProfilerLeave();
+    ProfilerLeave();
+    ProfilerLeave();
+
+    /* More leaves than enters are ignored */
+    ProfilerLeave();
+
+    assert_true(ProfilerWrite(PREFIX));
+    ProfilerReset();
+
+    JsonElement *root = ReadProfile();
+    assert_true(Number(root, "wall_ms") >= 6);
+
+    JsonElement *bundle = JsonArrayGetAsObject(JsonObjectGetAsArray(root, "children"), 0);
+    assert_string_equal(JsonObjectGetAsString(bundle, "type"), "bundle");
+    assert_string_equal(JsonObjectGetAsString(bundle, "name"), "default:main");
+    assert_int_equal((int) Number(bundle, "count"), 1);
+    assert_true(Number(bundle, "function_ms") >= 4);
+    assert_true(Number(bundle, "expansion_ms") >= Number(bundle, "function_ms"));
+    assert_true(Number(bundle, "wall_ms") >= Number(bundle, "expansion_ms") + 2);
+
+    JsonElement *type = JsonArrayGetAsObject(JsonObjectGetAsArray(bundle, "children"), 0);
+    JsonElement *promises = JsonObjectGetAsArray(type, "children");
+    assert_int_equal(JsonLength(promises), 2);
+
+    JsonElement *promise = JsonArrayGetAsObject(promises, 0);
+    assert_string_equal(JsonObjectGetAsString(promise, "name"), "/etc/motd");
+    assert_int_equal((int) Number(promise, "count"), 2);
+
+    JsonElement *expansion = JsonArrayGetAsObject(JsonObjectGetAsArray(promise, "children"), 0);
+    assert_string_equal(JsonObjectGetAsString(expansion, "type"), "expansion");
+    assert_true(JsonObjectGet(expansion, "name") == NULL);
+
+    JsonDestroy(root);
+
+    char path[CF_BUFSIZE];
+    snprintf(path, sizeof(path), "%s.folded", PREFIX);
+    Writer *folded = FileRead(path, SIZE_MAX, NULL);
+    const char *data = StringWriterData(folded);
+
+    assert_true(strstr(data, "default:main;files;/etc/motd;(expansion);readfile() ") != NULL);
+    assert_true(strstr(data, "default:main;files;a_b ") != NULL);
+
+    WriterClose(folded);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    close(mkstemp(PREFIX));
+
+    const UnitTest tests[] =
+    {
+        unit_test(test_disabled),
+        unit_test(test_tree),
+    };
+
+    int ret = run_tests(tests);
+
+    char path[CF_BUFSIZE];
+    unlink(PREFIX);
+    snprintf(path, sizeof(path), "%s.json", PREFIX);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s.folded", PREFIX);
+    unlink(path);
+
+    return ret;
+}
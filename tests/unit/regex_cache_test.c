@@ -0,0 +1,106 @@
+#include <test.h>
+
+#include <regex_cache.h>
+#include <string_lib.h>
+
+static void test_hit_and_miss(void)
+{
+    RegexCacheClear();
+
+    CachedRegex *rx = RegexCacheGet("^a+b$", 0);
+    assert_true(rx != NULL);
+    RegexCacheRelease(rx);
+
+    rx = RegexCacheGet("^a+b$", 0);
+    assert_true(rx != NULL);
+
+    int ovector[30];
+    assert_true(RegexCacheExec(rx, "aaab", ovector, 30) >= 0);
+    assert_true(RegexCacheExec(rx, "aaac", ovector, 30) < 0);
+    RegexCacheRelease(rx);
+
+    RegexCacheStats stats = RegexCacheGetStats();
+    assert_int_equal(1, stats.misses);
+    assert_int_equal(1, stats.hits);
+    assert_int_equal(1, stats.entries);
+}
+
+static void test_options_are_part_of_key(void)
+{
+    RegexCacheClear();
+
+    CachedRegex *rx1 = RegexCacheGet("abc", 0);
+    CachedRegex *rx2 = RegexCacheGet("abc", PCRE_CASELESS);
+    assert_true(rx1 != rx2);
+
+    int ovector[30];
+    assert_true(RegexCacheExec(rx1, "ABC", ovector, 30) < 0);
+    assert_true(RegexCacheExec(rx2, "ABC", ovector, 30) >= 0);
+
+    RegexCacheRelease(rx1);
+    RegexCacheRelease(rx2);
+
+    assert_int_equal(2, RegexCacheGetStats().misses);
+}
+
+static void test_invalid_pattern(void)
+{
+    RegexCacheClear();
+
+    assert_true(RegexCacheGet("(unclosed", 0) == NULL);
+    assert_int_equal(0, RegexCacheGetStats().entries);
+
+    /* Releasing the NULL a failed lookup returned is harmless. */
+    RegexCacheRelease(NULL);
+}
+
+static void test_eviction_keeps_held_entries(void)
+{
+    RegexCacheClear();
+
+    CachedRegex *held = RegexCacheGet("^held$", 0);
+
+    char pattern[64];
+    for (int i = 0; i < 1000; i++)
+    {
+        snprintf(pattern, sizeof(pattern), "^pattern%d$", i);
+        RegexCacheRelease(RegexCacheGet(pattern, 0));
+    }
+
+    RegexCacheStats stats = RegexCacheGetStats();
+    assert_true(stats.evictions > 0);
+    assert_true(stats.entries < 1000);
+
+    int ovector[30];
+    assert_true(RegexCacheExec(held, "held", ovector, 30) >= 0);
+    RegexCacheRelease(held);
+}
+
+static void test_string_match_uses_cache(void)
+{
+    RegexCacheClear();
+
+    for (int i = 0; i < 10; i++)
+    {
+        assert_true(StringMatchFull("[0-9]+", "12345"));
+    }
+
+    RegexCacheStats stats = RegexCacheGetStats();
+    assert_int_equal(1, stats.misses);
+    assert_int_equal(9, stats.hits);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    const UnitTest tests[] =
+    {
+        unit_test(test_hit_and_miss),
+        unit_test(test_options_are_part_of_key),
+        unit_test(test_invalid_pattern),
+        unit_test(test_eviction_keeps_held_entries),
+        unit_test(test_string_match_uses_cache),
+    };
+
+    return run_tests(tests);
+}
@@ -0,0 +1,191 @@
+#include <test.h>
+
+#include <server.h>
+#include <server_common.h>
+#include <client_code.h>
+#include <communication.h>
+#include <net.h>
+
+#define N_FILES 50
+
+static char TEST_DIR[] = "/tmp/remote_stat_test.XXXXXX";
+static int SOCKETS[2];
+
+/* Answers the given number of SYNCH STAT requests, like cf-serverd does */
+static void *ServeStat(void *arg)
+{
+    int requests = *(int *) arg;
+
+    ServerConnectionState *conn = xcalloc(1, sizeof(ServerConnectionState));
+    conn->conn_info.type = CF_PROTOCOL_CLASSIC;
+    conn->conn_info.sd = SOCKETS[1];
+
+    char recvbuffer[CF_BUFSIZE], sendbuffer[CF_BUFSIZE], filename[CF_BUFSIZE];
+    long time_sent;
+
+    for (int i = 0; i < requests; i++)
+    {
+        memset(recvbuffer, 0, sizeof(recvbuffer));
+        assert_true(ReceiveTransaction(&conn->conn_info, recvbuffer, NULL) > 0);
+        assert_int_equal(sscanf(recvbuffer, "SYNCH %ld STAT %[^\n]", &time_sent, filename), 2);
+        StatFile(conn, sendbuffer, filename);
+    }
+
+    free(conn);
+    return NULL;
+}
+
+/* Answers the given number of requests, then hangs up */
+static void *ServeStatAndClose(void *arg)
+{
+    ServeStat(arg);
+    close(SOCKETS[1]);
+    return NULL;
+}
+
+static Seq *TestFiles(void)
+{
+    Seq *files = SeqNew(N_FILES + 2, free);
+    char path[CF_BUFSIZE];
+
+    for (int i = 0; i < N_FILES; i++)
+    {
+        snprintf(path, sizeof(path), "%s/file%02d", TEST_DIR, i);
+        SeqAppend(files, xstrdup(path));
+    }
+
+    snprintf(path, sizeof(path), "%s/link", TEST_DIR);
+    SeqAppend(files, xstrdup(path));
+    snprintf(path, sizeof(path), "%s/missing", TEST_DIR);
+    SeqAppend(files, xstrdup(path));
+
+    return files;
+}
+
+static int Prefetch(AgentConnection *conn, Seq *files, int requests)
+{
+    pthread_t thread;
+    assert_int_equal(pthread_create(&thread, NULL, ServeStat, &requests), 0);
+    int ret = RemoteStatPrefetch(files, false, conn);
+    assert_int_equal(pthread_join(thread, NULL), 0);
+
+    return ret;
+}
+
+static void test_prefetch(void)
+{
+    assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, SOCKETS), 0);
+
+    AgentConnection *conn = NewAgentConn("localhost");
+    conn->conn_info.type = CF_PROTOCOL_CLASSIC;
+    conn->conn_info.sd = SOCKETS[0];
+
+    Seq *files = TestFiles();
+    ConnectionStats before = ConnectionsGetStats();
+
+    assert_int_equal(Prefetch(conn, files, SeqLength(files)), N_FILES + 1);
+
+    ConnectionStats after = ConnectionsGetStats();
+    assert_int_equal(after.pipelined - before.pipelined, N_FILES + 2);
+    assert_int_equal(after.round_trips_saved - before.round_trips_saved, N_FILES);
+
+    /* Everything is cached now, a request would find the server gone */
+    assert_int_equal(Prefetch(conn, files, 0), 0);
+    close(SOCKETS[1]);
+
+    for (int i = 0; i < N_FILES; i++)
+    {
+        struct stat expected, actual;
+        assert_int_equal(stat(SeqAt(files, i), &expected), 0);
+        assert_int_equal(cf_remote_stat(SeqAt(files, i), &actual, "file", false, conn), 0);
+
+        assert_true(S_ISREG(actual.st_mode));
+        assert_int_equal(actual.st_size, i);
+        assert_int_equal(actual.st_mtime, expected.st_mtime);
+        assert_int_equal(actual.st_ino, expected.st_ino);
+    }
+
+    struct stat sb;
+    assert_int_equal(cf_remote_stat(SeqAt(files, N_FILES), &sb, "link", false, conn), 0);
+    assert_true(S_ISLNK(sb.st_mode));
+    assert_int_equal(cf_remote_stat(SeqAt(files, N_FILES), &sb, "file", false, conn), 0);
+    assert_true(S_ISREG(sb.st_mode));
+
+    const Stat *link = ClientCacheLookup(conn, "localhost", SeqAt(files, N_FILES));
+    assert_true(link != NULL);
+    assert_string_equal(link->cf_readlink, "file01");
+
+    errno = 0;
+    assert_int_equal(cf_remote_stat(SeqAt(files, N_FILES + 1), &sb, "file", false, conn), -1);
+    assert_int_equal(errno, EPERM);
+
+    SeqDestroy(files);
+    DisconnectServer(conn);
+}
+
+static void test_prefetch_connection_lost(void)
+{
+    assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, SOCKETS), 0);
+
+    AgentConnection *conn = NewAgentConn("localhost");
+    conn->conn_info.type = CF_PROTOCOL_CLASSIC;
+    conn->conn_info.sd = SOCKETS[0];
+
+    /* The server goes away with most of the first batch unanswered */
+    Seq *files = TestFiles();
+    int requests = 5;
+    pthread_t thread;
+    assert_int_equal(pthread_create(&thread, NULL, ServeStatAndClose, &requests), 0);
+    assert_int_equal(RemoteStatPrefetch(files, false, conn), -1);
+    assert_int_equal(pthread_join(thread, NULL), 0);
+
+    /* The unread replies make the connection unusable */
+    assert_int_equal(conn->conn_info.sd, SOCKET_INVALID);
+
+    SeqDestroy(files);
+    DisconnectServer(conn);
+}
+
+static void setup(void)
+{
+    char path[CF_BUFSIZE];
+
+    assert_true(mkdtemp(TEST_DIR) != NULL);
+
+    for (int i = 0; i < N_FILES; i++)
+    {
+        snprintf(path, sizeof(path), "%s/file%02d", TEST_DIR, i);
+        FILE *fp = fopen(path, "w");
+        assert_true(fp != NULL);
+        fprintf(fp, "%*s", i, "");
+        fclose(fp);
+    }
+
+    snprintf(path, sizeof(path), "%s/link", TEST_DIR);
+    assert_int_equal(symlink("file01", path), 0);
+}
+
+static void teardown(void)
+{
+    char cmd[CF_BUFSIZE];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", TEST_DIR);
+    system(cmd);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    signal(SIGPIPE, SIG_IGN);
+    setup();
+
+    const UnitTest tests[] =
+    {
+        unit_test(test_prefetch),
+        unit_test(test_prefetch_connection_lost),
+    };
+
+    int ret = run_tests(tests);
+
+    teardown();
+    return ret;
+}
@@ -0,0 +1,231 @@
+#include <test.h>
+
+#include <server.h>
+#include <server_access.h>
+#include <item_lib.h>
+#include <env_context.h>
+
+static char TEST_DIR[] = "/tmp/server_access_test.XXXXXX";
+
+static char *TestPath(const char *path)
+{
+    static char buffers[4][CF_BUFSIZE];
+    static int next = 0;
+
+    char *buffer = buffers[next++ % 4];
+    snprintf(buffer, CF_BUFSIZE, "%s/%s", TEST_DIR, path);
+    return buffer;
+}
+
+static Auth *NewRule(Auth **list, const char *path, const char *host)
+{
+    Auth *rule = xcalloc(1, sizeof(Auth));
+    rule->path = xstrdup(path);
+    PrependItem(&rule->accesslist, host, NULL);
+
+    Auth **last = list;
+    while (*last != NULL)
+    {
+        last = &(*last)->next;
+    }
+    *last = rule;
+
+    return rule;
+}
+
+static void DestroyRules(Auth *list)
+{
+    for (Auth *next; list != NULL; list = next)
+    {
+        next = list->next;
+        free(list->path);
+        DeleteItemList(list->accesslist);
+        DeleteItemList(list->maproot);
+        free(list);
+    }
+}
+
+static const char *Decide(AccessCache *cache, const PathAcl *acl, EvalContext *ctx, const char *path)
+{
+    AccessDecision decision = AccessCacheDecide(cache, acl, ctx, TestPath(path), "10.0.0.1", "host1.example.com");
+    return (decision.rule == NULL) ? NULL : decision.rule->path;
+}
+
+static void test_first_rule_wins(void)
+{
+    EvalContext *ctx = EvalContextNew();
+    Auth *admit = NULL;
+
+    NewRule(&admit, TestPath("a/sub"), "other.example.com");
+    Auth *a = NewRule(&admit, TestPath("a"), "host1.*");
+    NewRule(&admit, TestPath("missing"), "host1.*");
+    NewRule(&admit, "/", "10.0.0.1");
+
+    PathAcl *acl = PathAclCompile(admit, NULL);
+    AccessCache *cache = AccessCacheNew();
+
+    assert_string_equal(Decide(cache, acl, ctx, "a/f1"), TestPath("a"));
+    assert_string_equal(Decide(cache, acl, ctx, "a/sub/g"), TestPath("a/sub"));
+    assert_string_equal(Decide(cache, acl, ctx, "a"), TestPath("a"));
+
+    /* Only a whole directory name covers a path */
+    assert_string_equal(Decide(cache, acl, ctx, "ab/f"), "/");
+
+    /* Rules for paths which do not exist are skipped */
+    assert_string_equal(Decide(cache, acl, ctx, "missing/f"), "/");
+
+    AccessDecision decision = AccessCacheDecide(cache, acl, ctx, TestPath("a/f2"), "10.0.0.1", "host1.example.com");
+    assert_true(decision.rule == a);
+    assert_true(decision.access);
+    assert_false(decision.maproot);
+
+    decision = AccessCacheDecide(cache, acl, ctx, TestPath("a/sub/g"), "10.0.0.1", "host1.example.com");
+    assert_false(decision.access);
+
+    decision = AccessCacheDecide(cache, acl, ctx, TestPath("b/f"), "10.0.0.1", "host1.example.com");
+    assert_true(decision.access);
+
+    AccessCacheDestroy(cache);
+    PathAclDestroy(acl);
+
+    DestroyRules(admit);
+
+    /* A rule for "/" given first covers everything */
+    admit = NULL;
+    NewRule(&admit, "/", "10.0.0.1");
+    NewRule(&admit, TestPath("a/sub"), "host1.*");
+
+    acl = PathAclCompile(admit, NULL);
+    cache = AccessCacheNew();
+    assert_string_equal(Decide(cache, acl, ctx, "a/sub/g"), "/");
+    AccessCacheDestroy(cache);
+    PathAclDestroy(acl);
+
+    DestroyRules(admit);
+    EvalContextDestroy(ctx);
+}
+
+static void test_recompiled(void)
+{
+    EvalContext *ctx = EvalContextNew();
+    Auth *admit = NULL;
+
+    NewRule(&admit, TestPath("a"), "host1.*");
+
+    PathAcl *acl = PathAclCompile(admit, NULL);
+    AccessCache *cache = AccessCacheNew();
+    assert_string_equal(Decide(cache, acl, ctx, "a/f1"), TestPath("a"));
+    assert_string_equal(Decide(cache, acl, ctx, "a/f2"), TestPath("a"));
+    assert_true(Decide(cache, acl, ctx, "b/f") == NULL);
+    PathAclDestroy(acl);
+
+    /* What the connection learnt from the old rules is forgotten */
+    NewRule(&admit, TestPath("b"), "host1.*");
+    NewRule(&admit, TestPath("a/f2"), "host1.*");
+    acl = PathAclCompile(admit, NULL);
+    assert_string_equal(Decide(cache, acl, ctx, "b/f"), TestPath("b"));
+    assert_string_equal(Decide(cache, acl, ctx, "a/f2"), TestPath("a"));
+
+    AccessCacheDestroy(cache);
+    PathAclDestroy(acl);
+    DestroyRules(admit);
+
+    /* A rule below a directory takes its files out of the directory's rule */
+    admit = NULL;
+    NewRule(&admit, TestPath("a/f2"), "host1.*");
+    NewRule(&admit, TestPath("a"), "host1.*");
+
+    acl = PathAclCompile(admit, NULL);
+    cache = AccessCacheNew();
+    assert_string_equal(Decide(cache, acl, ctx, "a/f1"), TestPath("a"));
+    assert_string_equal(Decide(cache, acl, ctx, "a/f2"), TestPath("a/f2"));
+    assert_string_equal(Decide(cache, acl, ctx, "a/f1"), TestPath("a"));
+
+    AccessCacheDestroy(cache);
+    PathAclDestroy(acl);
+    DestroyRules(admit);
+    EvalContextDestroy(ctx);
+}
+
+/* Rule paths are checked on every request, not once per connection */
+static void test_rule_path_changes(void)
+{
+    EvalContext *ctx = EvalContextNew();
+    Auth *admit = NULL;
+
+    NewRule(&admit, TestPath("d"), "host1.*");
+    NewRule(&admit, "/", "10.0.0.1");
+
+    PathAcl *acl = PathAclCompile(admit, NULL);
+    AccessCache *cache = AccessCacheNew();
+
+    assert_string_equal(Decide(cache, acl, ctx, "d/f"), "/");
+    mkdir(TestPath("d"), 0700);
+    assert_string_equal(Decide(cache, acl, ctx, "d/f"), TestPath("d"));
+    rmdir(TestPath("d"));
+    assert_string_equal(Decide(cache, acl, ctx, "d/f"), "/");
+
+    AccessCacheDestroy(cache);
+    PathAclDestroy(acl);
+    DestroyRules(admit);
+    EvalContextDestroy(ctx);
+}
+
+static void test_denied(void)
+{
+    EvalContext *ctx = EvalContextNew();
+    Auth *deny = NULL;
+
+    NewRule(&deny, "/nowhere", "other.*");
+    PathAcl *acl = PathAclCompile(NULL, deny);
+    AccessCache *cache = AccessCacheNew();
+    assert_false(AccessCacheDenied(cache, acl, ctx, "host1.example.com"));
+    AccessCacheDestroy(cache);
+    PathAclDestroy(acl);
+
+    /* Whatever the path of the deny rule */
+    NewRule(&deny, "/nowhere/else", "host1.*");
+    acl = PathAclCompile(NULL, deny);
+    cache = AccessCacheNew();
+    assert_true(AccessCacheDenied(cache, acl, ctx, "host1.example.com"));
+    assert_true(Decide(cache, acl, ctx, "a/f1") == NULL);
+    AccessCacheDestroy(cache);
+    PathAclDestroy(acl);
+
+    DestroyRules(deny);
+    EvalContextDestroy(ctx);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    mkdtemp(TEST_DIR);
+
+    const char *dirs[] = { "a", "a/sub", "ab", "b" };
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++)
+    {
+        mkdir(TestPath(dirs[i]), 0700);
+    }
+
+    const char *files[] = { "a/f1", "a/f2", "a/sub/g", "ab/f", "b/f" };
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+    {
+        close(open(TestPath(files[i]), O_WRONLY | O_CREAT, 0600));
+    }
+
+    const UnitTest tests[] =
+    {
+        unit_test(test_first_rule_wins),
+        unit_test(test_recompiled),
+        unit_test(test_rule_path_changes),
+        unit_test(test_denied),
+    };
+
+    int ret = run_tests(tests);
+
+    char cmd[CF_BUFSIZE];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", TEST_DIR);
+    system(cmd);
+
+    return ret;
+}
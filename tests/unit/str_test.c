@@ -527,6 +527,33 @@ static void test_stringscanfcapped(void)
     assert_string_equal(buf, "123456789012345");
 }
 
+static void test_mem_span(void)
+{
+    char buf[100];
+
+    /* Every length and position around the word and four-word steps */
+    for (size_t len = 0; len < 80; len++)
+    {
+        for (size_t offset = 0; offset < 8; offset++)
+        {
+            memset(buf, 0, sizeof(buf));
+            assert_true(MemSpan(buf + offset, 0, len) == buf + offset + len);
+
+            for (size_t i = 0; i < len; i++)
+            {
+                buf[offset + i] = 'x';
+                assert_true(MemSpan(buf + offset, 0, len) == buf + offset + i);
+                assert_true(MemSpanInverse(buf + offset, 0, len) == buf + offset + ((i == 0) ? 1 : 0));
+                buf[offset + i] = 0;
+            }
+        }
+    }
+
+    memset(buf, 'a', sizeof(buf));
+    buf[70] = 'b';
+    assert_true(MemSpan(buf, 'a', sizeof(buf)) == buf + 70);
+}
+
 int main()
 {
     PRINT_TEST_BANNER();
@@ -592,6 +619,8 @@ int main()
         unit_test(test_stringvformat),
 
         unit_test(test_stringscanfcapped),
+
+        unit_test(test_mem_span),
     };
 
     return run_tests(tests);
@@ -1,6 +1,9 @@
 #include <test.h>
 
 #include <sysinfo.h>
+#include <env_context.h>
+#include <json.h>
+#include <writer.h>
 
 static void test_uptime(void)
 {
@@ -13,12 +16,74 @@ static void test_uptime(void)
     assert_in_range(uptime, 5, 60*24*365*2);
 }
 
+/* Hard classes OSClasses() defines in a fresh context */
+static StringSet *OSHardClasses(void)
+{
+    EvalContext *ctx = EvalContextNew();
+    OSClasses(ctx);
+
+    StringSet *classes = StringSetNew();
+    ClassTableIterator *iter = EvalContextClassTableIteratorNewGlobal(ctx, NULL, true, false);
+    Class *cls;
+    while ((cls = ClassTableIteratorNext(iter)))
+    {
+        StringSetAdd(classes, xstrdup(cls->name));
+    }
+    ClassTableIteratorDestroy(iter);
+
+    EvalContextDestroy(ctx);
+    return classes;
+}
+
+static void test_os_facts_cache(void)
+{
+    char path[CF_BUFSIZE];
+    snprintf(CFWORKDIR, CF_BUFSIZE, "/tmp/sysinfo_test.XXXXXX");
+    mkdtemp(CFWORKDIR);
+    snprintf(path, sizeof(path), "%s/state", CFWORKDIR);
+    mkdir(path, 0700);
+    uname(&VSYSNAME);
+
+    StringSet *expected = OSHardClasses();
+
+    snprintf(path, sizeof(path), "%s/state/os_facts.json", CFWORKDIR);
+    struct stat sb;
+    assert_int_equal(stat(path, &sb), 0);
+
+    /* Discovered again from the cache */
+    StringSet *actual = OSHardClasses();
+    assert_true(StringSetIsEqual(expected, actual));
+    StringSetDestroy(actual);
+
+    /* Not used for another kernel */
+    JsonElement *cache = NULL;
+    assert_int_equal(JsonParseFile(path, SIZE_MAX, &cache), JSON_PARSE_OK);
+    JsonObjectAppendString(cache, "uname", "plan9 4 x y");
+    JsonObjectAppendArray(cache, "classes", JsonArrayCreate(1));
+    JsonArrayAppendString(JsonObjectGetAsArray(cache, "classes"), "from_the_cache");
+
+    Writer *w = FileWriter(fopen(path, "w"));
+    JsonWrite(w, cache, 0);
+    WriterClose(w);
+    JsonDestroy(cache);
+
+    actual = OSHardClasses();
+    assert_true(StringSetIsEqual(expected, actual));
+    StringSetDestroy(actual);
+    StringSetDestroy(expected);
+
+    char cmd[CF_BUFSIZE];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", CFWORKDIR);
+    system(cmd);
+}
+
 int main()
 {
     PRINT_TEST_BANNER();
     const UnitTest tests[] =
     {
-        unit_test(test_uptime)
+        unit_test(test_uptime),
+        unit_test(test_os_facts_cache),
     };
 
     return run_tests(tests);
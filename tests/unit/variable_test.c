@@ -225,68 +225,84 @@ static void test_counting(void)
     VariableTableDestroy(t);
 }
 
+/* iteration order is unspecified, so check that each expected value is seen once */
+static void AssertIterates(VariableTable *t, const char *ref_str, const char **expected, size_t num_expected)
+{
+    VarRef *ref = VarRefParse(ref_str);
+    VariableTableIterator *iter = VariableTableIteratorNewFromVarRef(t, ref);
+
+    bool seen[num_expected];
+    memset(seen, 0, sizeof(seen));
+
+    size_t count = 0;
+    for (Variable *v = VariableTableIteratorNext(iter); v; v = VariableTableIteratorNext(iter))
+    {
+        bool found = false;
+        for (size_t i = 0; i < num_expected; i++)
+        {
+            if (strcmp(expected[i], RvalScalarValue(v->rval)) == 0)
+            {
+                assert_false(seen[i]);
+                seen[i] = true;
+                found = true;
+            }
+        }
+        assert_true(found);
+        count++;
+    }
+    assert_int_equal(num_expected, count);
+
+    VariableTableIteratorDestroy(iter);
+    VarRefDestroy(ref);
+}
+
 static void test_iterate_indices(void)
 {
     VariableTable *t = ReferenceTable();
 
     {
-        VarRef *ref = VarRefParse("default:scope1.array");
-        VariableTableIterator *iter = VariableTableIteratorNewFromVarRef(t, ref);
-
-        Variable *v = VariableTableIteratorNext(iter);
-        assert_true(v != NULL);
-        assert_int_equal(2, v->ref->num_indices);
-        assert_string_equal("two", v->ref->indices[0]);
-        assert_string_equal("three", v->ref->indices[1]);
-
-        v = VariableTableIteratorNext(iter);
-        assert_true(v != NULL);
-        assert_int_equal(1, v->ref->num_indices);
-        assert_string_equal("one", v->ref->indices[0]);
-
-        v = VariableTableIteratorNext(iter);
-        assert_true(v != NULL);
-        assert_int_equal(1, v->ref->num_indices);
-        assert_string_equal("two", v->ref->indices[0]);
-
-        v = VariableTableIteratorNext(iter);
-        assert_true(v != NULL);
-        assert_int_equal(2, v->ref->num_indices);
-        assert_string_equal("two", v->ref->indices[0]);
-        assert_string_equal("four", v->ref->indices[1]);
-
-        assert_false(VariableTableIteratorNext(iter) != NULL);
-
-        VariableTableIteratorDestroy(iter);
-        VarRefDestroy(ref);
+        const char *expected[] =
+        {
+            "scope1.array[one]",
+            "scope1.array[two]",
+            "scope1.array[two][three]",
+            "scope1.array[two][four]",
+        };
+        AssertIterates(t, "default:scope1.array", expected, 4);
     }
 
     {
-        VarRef *ref = VarRefParse("default:scope1.array[two]");
-        VariableTableIterator *iter = VariableTableIteratorNewFromVarRef(t, ref);
+        const char *expected[] =
+        {
+            "scope1.array[two]",
+            "scope1.array[two][three]",
+            "scope1.array[two][four]",
+        };
+        AssertIterates(t, "default:scope1.array[two]", expected, 3);
+    }
 
-        Variable *v = VariableTableIteratorNext(iter);
-        assert_true(v != NULL);
-        assert_int_equal(2, v->ref->num_indices);
-        assert_string_equal("two", v->ref->indices[0]);
-        assert_string_equal("three", v->ref->indices[1]);
+    VariableTableDestroy(t);
+}
 
-        v = VariableTableIteratorNext(iter);
-        assert_true(v != NULL);
-        assert_int_equal(1, v->ref->num_indices);
-        assert_string_equal("two", v->ref->indices[0]);
+static void test_hash_collision(void)
+{
+    VariableTable *t = VariableTableNew();
 
-        v = VariableTableIteratorNext(iter);
-        assert_true(v != NULL);
-        assert_int_equal(2, v->ref->num_indices);
-        assert_string_equal("two", v->ref->indices[0]);
-        assert_string_equal("four", v->ref->indices[1]);
+    /* scope and lval are hashed back to back, so these share a hash */
+    assert_false(PutVar(t, "ab.c"));
+    assert_false(PutVar(t, "a.bc"));
 
-        assert_false(VariableTableIteratorNext(iter) != NULL);
+    assert_int_equal(2, VariableTableCount(t, NULL, NULL, NULL));
+    TestGet(t, "ab.c");
+    TestGet(t, "a.bc");
 
-        VariableTableIteratorDestroy(iter);
+    {
+        VarRef *ref = VarRefParse("ab.c");
+        assert_true(VariableTableRemove(t, ref));
+        assert_true(VariableTableGet(t, ref) == NULL);
         VarRefDestroy(ref);
     }
+    TestGet(t, "a.bc");
 
     VariableTableDestroy(t);
 }
@@ -304,6 +320,7 @@ int main()
         unit_test(test_clear),
         unit_test(test_counting),
         unit_test(test_iterate_indices),
+        unit_test(test_hash_collision),
     };
 
     return run_tests(tests);
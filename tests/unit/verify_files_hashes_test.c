@@ -0,0 +1,206 @@
+#include <test.h>
+
+#include <verify_files_hashes.h>
+#include <files_hashes.h>
+#include <env_context.h>
+#include <policy.h>
+#include <crypto.h>
+
+static char TEST_DIR[] = "/tmp/verify_files_hashes_test.XXXXXX";
+static char TEST_FILE[CF_BUFSIZE];
+
+static EvalContext *CTX;
+static Policy *POLICY;
+static Promise *PROMISE;
+
+static void WriteTestFile(const char *content)
+{
+    FILE *fp = fopen(TEST_FILE, "w");
+    assert_true(fp != NULL);
+    assert_true(fputs(content, fp) >= 0);
+    assert_int_equal(fclose(fp), 0);
+}
+
+/* Stat of the test file as it would be seen a while after it was written,
+   so that FileHashChanged may record it */
+static struct stat SettledStat(void)
+{
+    struct stat sb;
+    assert_int_equal(stat(TEST_FILE, &sb), 0);
+    sb.st_mtime -= 10;
+    sb.st_ctime -= 10;
+    return sb;
+}
+
+static int HashChanged(const struct stat *sb, HashMethod type, bool rehash_always)
+{
+    Attributes attr = { { 0 } };
+    attr.change.hash = type;
+    attr.change.update = false;
+    attr.change.rehash_always = rehash_always;
+
+    PromiseResult result = PROMISE_RESULT_NOOP;
+    return FileHashChanged(CTX, TEST_FILE, sb, type, attr, PROMISE, &result);
+}
+
+static void test_hash_file_multi(void)
+{
+    WriteTestFile("snookie");
+
+    HashMethod types[] = { HASH_METHOD_MD5, HASH_METHOD_SHA1, HASH_METHOD_SHA256 };
+    unsigned char digests[3][EVP_MAX_MD_SIZE + 1];
+    memset(digests, 0, sizeof(digests));
+
+    assert_true(HashFileMulti(TEST_FILE, 3, types, digests));
+
+    for (int i = 0; i < 3; i++)
+    {
+        unsigned char digest[EVP_MAX_MD_SIZE + 1] = { 0 };
+        HashFile(TEST_FILE, digest, types[i]);
+        assert_memory_equal(digests[i], digest, FileHashSize(types[i]));
+    }
+
+    char missing[CF_BUFSIZE];
+    snprintf(missing, sizeof(missing), "%s/missing", TEST_DIR);
+    assert_false(HashFileMulti(missing, 3, types, digests));
+}
+
+static void test_unchanged_stat_skips_hashing(void)
+{
+    WriteTestFile("one");
+    struct stat sb = SettledStat();
+
+    /* New file */
+    assert_false(HashChanged(&sb, HASH_METHOD_MD5, false));
+
+    /* Same stat: the recorded digest is trusted, the file is not read */
+    WriteTestFile("two");
+    assert_false(HashChanged(&sb, HASH_METHOD_MD5, false));
+
+    /* ... unless told to rehash every time */
+    assert_true(HashChanged(&sb, HASH_METHOD_MD5, true));
+
+    /* A new stat always means reading the file */
+    sb.st_ctime++;
+    assert_true(HashChanged(&sb, HASH_METHOD_MD5, false));
+    assert_true(HashChanged(NULL, HASH_METHOD_MD5, false));
+}
+
+static void test_recent_stat_not_recorded(void)
+{
+    WriteTestFile("one");
+    struct stat sb;
+    assert_int_equal(stat(TEST_FILE, &sb), 0);
+    sb.st_ctime = sb.st_mtime = time(NULL) + 1;
+
+    assert_false(HashChanged(&sb, HASH_METHOD_SHA256, false));
+
+    /* The file may have been written again in the same second */
+    WriteTestFile("two");
+    assert_true(HashChanged(&sb, HASH_METHOD_SHA256, false));
+}
+
+static void test_best_hashes_both(void)
+{
+    WriteTestFile("one");
+    struct stat sb = SettledStat();
+
+    assert_false(HashChanged(&sb, HASH_METHOD_BEST, false));
+    assert_false(HashChanged(&sb, HASH_METHOD_BEST, false));
+
+    WriteTestFile("three");
+    sb = SettledStat();
+    assert_true(HashChanged(&sb, HASH_METHOD_MD5, false));
+    assert_true(HashChanged(&sb, HASH_METHOD_SHA1, false));
+}
+
+static void test_prehashed_files(void)
+{
+    Attributes attr = { { 0 } };
+    attr.change.hash = HASH_METHOD_MD5;
+    PromiseResult result = PROMISE_RESULT_NOOP;
+
+    Seq *files = SeqNew(4, free);
+    for (int i = 0; i < 4; i++)
+    {
+        char path[CF_BUFSIZE];
+        snprintf(path, sizeof(path), "%s/prehashed%d", TEST_DIR, i);
+        FILE *fp = fopen(path, "w");
+        assert_true(fp != NULL);
+        fprintf(fp, "one %d", i);
+        fclose(fp);
+        SeqAppend(files, xstrdup(path));
+    }
+
+    const char *file = SeqAt(files, 0);
+    struct stat sb;
+    assert_int_equal(stat(file, &sb), 0);
+
+    PrehashFiles(files, HASH_METHOD_MD5, attr);
+
+    FILE *fp = fopen(file, "w");
+    assert_true(fp != NULL);
+    fputs("three", fp);
+    fclose(fp);
+
+    /* The digest taken ahead is used for the stat it was taken with... */
+    assert_false(FileHashChanged(CTX, file, &sb, HASH_METHOD_MD5, attr, PROMISE, &result));
+
+    /* ... and only once: the file is read for its new stat */
+    assert_int_equal(stat(file, &sb), 0);
+    assert_true(FileHashChanged(CTX, file, &sb, HASH_METHOD_MD5, attr, PROMISE, &result));
+
+    ForgetPrehashedFiles(files);
+    SeqDestroy(files);
+}
+
+static void setup(void)
+{
+    CryptoInitialize();
+
+    assert_true(mkdtemp(TEST_DIR) != NULL);
+    snprintf(CFWORKDIR, CF_BUFSIZE, "%s", TEST_DIR);
+
+    char path[CF_BUFSIZE];
+    snprintf(path, sizeof(path), "%s/state", TEST_DIR);
+    assert_int_equal(mkdir(path, 0700), 0);
+    snprintf(TEST_FILE, sizeof(TEST_FILE), "%s/file", TEST_DIR);
+
+    CTX = EvalContextNew();
+    POLICY = PolicyNew();
+    Bundle *bundle = PolicyAppendBundle(POLICY, NamespaceDefault(), "bundle", "agent", NULL, NULL);
+    PromiseType *promise_type = BundleAppendPromiseType(bundle, "files");
+    PROMISE = PromiseTypeAppendPromise(promise_type, TEST_FILE, (Rval) { NULL, RVAL_TYPE_NOPROMISEE }, "any");
+    EvalContextStackPushBundleFrame(CTX, bundle, NULL, false);
+}
+
+static void teardown(void)
+{
+    EvalContextStackPopFrame(CTX);
+    PolicyDestroy(POLICY);
+    EvalContextDestroy(CTX);
+
+    char cmd[CF_BUFSIZE];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", TEST_DIR);
+    system(cmd);
+}
+
+int main()
+{
+    PRINT_TEST_BANNER();
+    setup();
+
+    const UnitTest tests[] =
+    {
+        unit_test(test_hash_file_multi),
+        unit_test(test_unchanged_stat_skips_hashing),
+        unit_test(test_recent_stat_not_recorded),
+        unit_test(test_best_hashes_both),
+        unit_test(test_prehashed_files),
+    };
+
+    int ret = run_tests(tests);
+
+    teardown();
+    return ret;
+}